@@ -0,0 +1,324 @@
+#include "aot.h"
+#include "cfg.h"
+#include "ops.h"
+#include "optable.h"
+
+/**
+ * Return the C++ expression for reading a register, rip reads as the address of the next instruction.
+ * @param[in] reg
+ * @param[in] next
+ */
+static std::string reg_expr(uint32_t reg, uint32_t next) {
+    if (reg >= RegisterCount) {
+        throw std::runtime_error("No such register.");
+    }
+    if (reg == RIP) {
+        return std::to_string(next) + "u";
+    }
+    return "r" + std::to_string(reg);
+}
+
+/**
+ * Return a C++ string literal holding the text.
+ * @param[in] text
+ */
+static std::string string_literal(const std::string &text) {
+    std::string literal = "\"";
+    for(unsigned char c: text) {
+        if (c == '"' || c == '\\') {
+            literal += '\\';
+            literal += c;
+        } else if (c < 0x20 || c >= 0x7f) {
+            char escaped[5];
+            snprintf(escaped, sizeof(escaped), "\\%03o", c);
+            literal += escaped;
+        } else {
+            literal += c;
+        }
+    }
+    return literal + "\"";
+}
+
+/* the operations as C++ expressions, by operation */
+static const char *const BinaryExpressions[] = {
+#define X(name, mnemonic, expr) #expr,
+    BINARY_OPERATIONS(X)
+#undef X
+};
+static const char *const UnaryExpressions[] = {
+#define X(name, mnemonic, expr) #expr,
+    UNARY_OPERATIONS(X)
+#undef X
+};
+static const char *const JumpConditions[] = {
+#define X(name, expr) #expr,
+    JUMP_CONDITIONS(X)
+#undef X
+};
+
+/**
+ * Return the C++ expression for an operand read as a value.
+ * @param[in] arg
+ * @param[in] next
+ */
+static std::string value_expr(const OpcodeArg &arg, uint32_t next) {
+    return arg.kind() == ArgKind::Reg ? reg_expr(arg.get_raw_value(), next) : std::to_string(arg.get_raw_value()) + "u";
+}
+
+/**
+ * Write the C++ statements for a single instruction.
+ * @param[in] out
+ * @param[in] number - of the opcode.
+ * @param[in] opcode
+ * @param[in] next - address of the following instruction.
+ */
+static void write_instruction(std::ostream &out, uint8_t number, const Opcode &opcode, uint32_t next) {
+    auto &args = opcode.get_args();
+    out << "    /* " << opcode.write_asm() << " */" << std::endl;
+    if (number == ExitOpcodeNumber) {
+        out << "    return 0;" << std::endl;
+        return;
+    }
+    if (number >= OpcodeSpecCount || OpcodeSpecs[number].width != 4) {
+        throw std::runtime_error("Can't translate " + opcode.write_asm() + " to C++.");
+    }
+    const OpcodeSpec &spec = OpcodeSpecs[number];
+
+    if (spec.family == OpcodeFamily::Jump) {
+        uint32_t target = args[0]->get_raw_value();
+        if ((JumpCondition)spec.operation == JumpCondition::Always) {
+            out << "    goto L" << target << ";" << std::endl;
+            return;
+        }
+        /* a missing second operand of the condition is 0 */
+        std::string b = value_expr(*args[1], next);
+        std::string c = args.size() < 3 ? "0u" : value_expr(*args[2], next);
+        out << "    { uint32_t b = " << b << ", c = " << c << "; if (" << JumpConditions[spec.operation] << ") goto L"
+            << target << "; }" << std::endl;
+        out << "    goto L" << next << ";" << std::endl;
+        return;
+    }
+
+    std::string statement;
+    std::string dst = args.size() > 0 && args[0]->kind() == ArgKind::Reg ? reg_expr(args[0]->get_raw_value(), next) : "";
+    if (dst != "" && args[0]->get_raw_value() == RIP) {
+        dst = "r" + std::to_string(RIP);
+    }
+    switch (spec.family) {
+        case OpcodeFamily::Binary:
+            if (spec.args[1] == ArgKind::Address) {
+                statement = dst + " = load(" + std::to_string(args[1]->get_raw_value()) + "u);";
+            } else if (spec.args[0] == ArgKind::Address) {
+                statement = "store(" + std::to_string(args[0]->get_raw_value()) + "u, " + reg_expr(args[1]->get_raw_value(), next) + ");";
+            } else {
+                statement = "{ uint32_t a = " + reg_expr(args[0]->get_raw_value(), next) + ", b = " + value_expr(*args[1], next) + "; "
+                    + dst + " = " + BinaryExpressions[spec.operation] + "; }";
+            }
+            break;
+        case OpcodeFamily::ThreeOperand:
+            /* the three-operand forms read their operands after the destination */
+            statement = "{ uint32_t a = " + reg_expr(args[1]->get_raw_value(), next) + ", b = " + value_expr(*args[2], next) + "; "
+                + dst + " = " + BinaryExpressions[spec.operation] + "; }";
+            break;
+        case OpcodeFamily::Unary:
+            statement = "{ uint32_t a = " + reg_expr(args[0]->get_raw_value(), next) + "; " + dst + " = " + UnaryExpressions[spec.operation] + "; }";
+            break;
+        case OpcodeFamily::Io:
+            switch ((IoOperation)spec.operation) {
+                case IoOperation::Print:
+                    statement = "std::cout << " + reg_expr(args[0]->get_raw_value(), next) + ";";
+                    break;
+                case IoOperation::PrintChar:
+                    statement = "std::cout << (char)" + reg_expr(args[0]->get_raw_value(), next) + ";";
+                    break;
+                case IoOperation::ReadChar:
+                    /* the end of input reads as -1, like GuestIO::read_char */
+                    statement = "{ int c = -1; char ch; if (std::cin >> ch) c = ch; " + dst + " = (uint32_t)c; }";
+                    break;
+                case IoOperation::Read:
+                    statement = "{ uint32_t a = " + reg_expr(args[0]->get_raw_value(), next) + "; std::cin >> a; " + dst + " = a; }";
+                    break;
+            }
+            break;
+        default:
+            throw std::runtime_error("Can't translate " + opcode.write_asm() + " to C++.");
+    }
+    out << "    " << statement << std::endl;
+    if (writes_rip(opcode)) {
+        out << "    goto dispatch;" << std::endl;
+    }
+}
+
+/**
+ * Write the code reachable from rip as a standalone C++ translation unit.
+ * Every basic block becomes a label, registers become locals and writes to rip go through a dispatch table
+ * of all blocks. Memory is a flat table of 4 KiB pages starting from a copy of the pages of the image, code written
+ * at runtime is not executed.
+ * @param[in] out
+ * @param[in] icache
+ * @param[in] m
+ * @param[in] regs - the initial registers.
+ */
+void write_cpp(std::ostream &out, InstructionCache &icache, const Memory &m, const Registers &regs) {
+    uint32_t entry = regs.get(RIP);
+    std::set<uint32_t> entries = {entry};
+    auto blocks = find_basic_blocks(icache, m, entries);
+
+    /* writes to rip may go anywhere, so also translate the code following every block */
+    bool grown = true;
+    while (grown) {
+        grown = false;
+        bool indirect = false;
+        for(auto &block: blocks) {
+            indirect = indirect || block.second.indirect;
+        }
+        if (!indirect) {
+            break;
+        }
+        for(auto &block: blocks) {
+            uint32_t end = block.second.end;
+            if (blocks.find(end) == blocks.end() && entries.find(end) == entries.end() && end < m.size()) {
+                entries.insert(end);
+                grown = true;
+            }
+        }
+        blocks = find_basic_blocks(icache, m, entries);
+    }
+
+    out << "/* generated by processor aot */" << std::endl;
+    out << "#include <cstdint>" << std::endl;
+    out << "#include <cstdlib>" << std::endl;
+    out << "#include <cstring>" << std::endl;
+    out << "#include <iostream>" << std::endl;
+    out << std::endl;
+    out << "#pragma GCC diagnostic ignored \"-Wunused-variable\"" << std::endl;
+    out << "#pragma GCC diagnostic ignored \"-Wunused-function\"" << std::endl;
+    out << "#pragma GCC diagnostic ignored \"-Wunused-label\"" << std::endl;
+    out << std::endl;
+    /* only pages with data, the others read as zero and are allocated by the first store */
+    out << "static const size_t PageBits = " << PageBits << ";" << std::endl;
+    out << "static const size_t PageSize = (size_t)1 << PageBits;" << std::endl;
+    std::vector<uint32_t> data_pages;
+    for(auto address: m.page_addresses()) {
+        const uint8_t *page = m.get_page(address);
+        if (std::all_of(page, page + PageSize, [](uint8_t byte) { return byte == 0; })) {
+            continue;
+        }
+        data_pages.push_back(address >> PageBits);
+        out << "static uint8_t page" << data_pages.back() << "[PageSize] = {";
+        for(size_t i = 0; i < PageSize; i++) {
+            if (i % 16 == 0) {
+                out << std::endl << "   ";
+            }
+            out << " " << (unsigned)page[i] << ",";
+        }
+        out << std::endl << "};" << std::endl;
+    }
+    out << "static uint8_t *pages[(size_t)1 << (32 - PageBits)];" << std::endl;
+    out << std::endl;
+    out << "static uint8_t *touch_page(uint32_t address) {" << std::endl;
+    out << "    uint8_t *&page = pages[address >> PageBits];" << std::endl;
+    out << "    if (page == nullptr) {" << std::endl;
+    out << "        page = (uint8_t *)calloc(1, PageSize);" << std::endl;
+    out << "    }" << std::endl;
+    out << "    return page;" << std::endl;
+    out << "}" << std::endl;
+    out << std::endl;
+    /* like Memory::read_type and Memory::write_type: one memcpy within a page, bytewise across pages */
+    out << "static uint32_t load(uint32_t address) {" << std::endl;
+    out << "    uint32_t value = 0;" << std::endl;
+    out << "    size_t offset = address & (PageSize - 1);" << std::endl;
+    out << "    if (offset + sizeof(value) <= PageSize) {" << std::endl;
+    out << "        const uint8_t *page = pages[address >> PageBits];" << std::endl;
+    out << "        if (page != nullptr) {" << std::endl;
+    out << "            memcpy(&value, page + offset, sizeof(value));" << std::endl;
+    out << "        }" << std::endl;
+    out << "        return value;" << std::endl;
+    out << "    }" << std::endl;
+    out << "    for(uint32_t i = 0; i < sizeof(value); i++) {" << std::endl;
+    out << "        uint32_t byte = address + i;" << std::endl;
+    out << "        const uint8_t *page = pages[byte >> PageBits];" << std::endl;
+    out << "        if (page != nullptr) {" << std::endl;
+    out << "            ((uint8_t *)&value)[i] = page[byte & (PageSize - 1)];" << std::endl;
+    out << "        }" << std::endl;
+    out << "    }" << std::endl;
+    out << "    return value;" << std::endl;
+    out << "}" << std::endl;
+    out << std::endl;
+    out << "static void store(uint32_t address, uint32_t value) {" << std::endl;
+    out << "    size_t offset = address & (PageSize - 1);" << std::endl;
+    out << "    if (offset + sizeof(value) <= PageSize) {" << std::endl;
+    out << "        memcpy(touch_page(address) + offset, &value, sizeof(value));" << std::endl;
+    out << "        return;" << std::endl;
+    out << "    }" << std::endl;
+    out << "    for(uint32_t i = 0; i < sizeof(value); i++) {" << std::endl;
+    out << "        uint32_t byte = address + i;" << std::endl;
+    out << "        touch_page(byte)[byte & (PageSize - 1)] = ((uint8_t *)&value)[i];" << std::endl;
+    out << "    }" << std::endl;
+    out << "}" << std::endl;
+    out << std::endl;
+    out << "int main() {" << std::endl;
+    for(auto number: data_pages) {
+        out << "    pages[" << number << "] = page" << number << ";" << std::endl;
+    }
+    for(size_t i = 0; i < RegisterCount; i++) {
+        out << "    uint32_t r" << i << " = " << regs.get(i) << "u;" << std::endl;
+    }
+    out << "    goto L" << entry << ";" << std::endl;
+    out << std::endl;
+    out << "dispatch:" << std::endl;
+    out << "    switch (r" << (unsigned)RIP << ") {" << std::endl;
+    for(auto &block: blocks) {
+        out << "        case " << block.first << "u: goto L" << block.first << ";" << std::endl;
+    }
+    out << "        default:" << std::endl;
+    out << "            std::cerr << \"No translated block at \" << r" << (unsigned)RIP << " << \".\" << std::endl;" << std::endl;
+    out << "            return 1;" << std::endl;
+    out << "    }" << std::endl;
+
+    std::set<uint32_t> missing = {entry};
+    for(auto &leader: blocks) {
+        BasicBlock &block = leader.second;
+        out << std::endl;
+        out << "L" << block.start << ":" << std::endl;
+        uint32_t address = block.start;
+        const Opcode *last = NULL;
+        bool failed = false;
+        while (address < block.end && !failed) {
+            const DecodedInstruction &instr = icache.fetch(m, address);
+            std::stringstream statement;
+            try {
+                write_instruction(statement, instr.opcode_no, icache.opcode(address), address + instr.length);
+            } catch (const std::runtime_error &e) {
+                /* fail like the interpreter would, once the instruction is reached */
+                statement.str("");
+                statement << "    std::cerr << " << string_literal(e.what()) << " << std::endl;" << std::endl;
+                statement << "    return 1;" << std::endl;
+                failed = true;
+            }
+            out << statement.str();
+            last = &icache.opcode(address);
+            address += instr.length;
+        }
+        if (failed) {
+            continue;
+        }
+        if (last == NULL || !ends_basic_block(*last)) {
+            out << "    goto L" << block.end << ";" << std::endl;
+            missing.insert(block.end);
+        }
+        missing.insert(block.successors.begin(), block.successors.end());
+    }
+
+    /* targets which could not be decoded */
+    for(auto address: missing) {
+        if (blocks.find(address) != blocks.end()) {
+            continue;
+        }
+        out << std::endl;
+        out << "L" << address << ":" << std::endl;
+        out << "    std::cerr << \"Undecodable instruction at " << address << ".\" << std::endl;" << std::endl;
+        out << "    return 1;" << std::endl;
+    }
+    out << "}" << std::endl;
+}
@@ -0,0 +1,6 @@
+#pragma once
+#include "opcode.h"
+#include "memory.h"
+#include "icache.h"
+
+void write_cpp(std::ostream &out, InstructionCache &icache, const Memory &m, const Registers &regs);
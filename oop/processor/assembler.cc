@@ -0,0 +1,200 @@
+#include "assembler.h"
+#include "error.h"
+
+/**
+ * Assembler constructor
+ * @param[in] table - opcodes the mnemonics are looked up in, must outlive the assembler.
+ * @param[in] relocatable - make an object instead of writing to memory.
+ */
+Assembler::Assembler(const OpcodeTable &table, bool relocatable)
+    : table {table}
+    , relocatable {relocatable}
+{
+    for(auto &opcode: table.opcodes_by_name) {
+        names.push_back(opcode.first);
+        Forms &mnemonic = forms[names.back()];
+        std::fill(std::begin(mnemonic.by_count), std::end(mnemonic.by_count), -1);
+        mnemonic.first = opcode.second;
+    }
+    for(auto &form: table.opcodes_by_form) {
+        if (form.first.second > MaxOperands) {
+            throw std::logic_error("Opcode " + form.first.first + " has too many operands.");
+        }
+        forms.at(form.first.first).by_count[form.first.second] = form.second;
+    }
+    std::fill(std::begin(lengths), std::end(lengths), 0);
+    for(auto &opcode: table.opcodes) {
+        lengths[opcode.first] = 1 + opcode.second->len();
+    }
+}
+
+/**
+ * Return the opcode of an instruction line, picking the form by the number of operands.
+ * @param[in] line
+ * @param[out] number
+ * @param[out] opcode
+ */
+const Opcode &Assembler::find(const LexedLine &line, uint8_t &number) const {
+    auto mnemonic = forms.find(line.mnemonic);
+    if (mnemonic == forms.end()) {
+        throw AsmException("No such opcode %s.", std::string(line.mnemonic).c_str());
+    }
+    if (line.operand_count <= MaxOperands && mnemonic->second.by_count[line.operand_count] >= 0) {
+        number = mnemonic->second.by_count[line.operand_count];
+    } else {
+        number = mnemonic->second.first;
+    }
+    const Opcode &opcode = *table.opcodes.at(number);
+    if (opcode.get_args().size() != line.operand_count) {
+        throw AsmException("Wrong number of arguments %zu to %s.", line.operand_count, opcode.get_name().c_str());
+    }
+    return opcode;
+}
+
+/**
+ * Return the address of a label of the program, or of one the memory already knows.
+ * @param[in] label
+ * @param[in] m
+ */
+uint32_t Assembler::resolve(std::string_view label, const Memory &m) const {
+    auto res = labels.find(label);
+    if (res != labels.end()) {
+        return res->second;
+    }
+    return m.resolve_label(std::string(label));
+}
+
+/**
+ * Return the number of the object symbol of a label, adding it on first use.
+ * @param[in] label
+ */
+uint32_t Assembler::symbol_number(std::string_view label) {
+    auto number = symbol_numbers.find(label);
+    if (number != symbol_numbers.end()) {
+        return number->second;
+    }
+    ObjectSymbol symbol;
+    symbol.name = label;
+    auto defined = labels.find(label);
+    if (defined != labels.end()) {
+        symbol.address = defined->second;
+        symbol.defined = true;
+    }
+    symbols.push_back(symbol);
+    symbol_numbers.emplace(label, symbols.size() - 1);
+    return symbols.size() - 1;
+}
+
+/**
+ * First pass, assign the line its address.
+ * @param[in] line
+ */
+void Assembler::layout(const LexedLine &line) {
+    if (line.mnemonic.empty()) {
+        if (!line.label.empty()) {
+            if (!labels.emplace(line.label, address).second) {
+                throw AsmException("Label %s already exists.", std::string(line.label).c_str());
+            }
+            label_order.push_back(line.label);
+        }
+        address += line.label_length;
+        size = address;
+        return;
+    }
+    uint8_t number;
+    find(line, number);
+    address += lengths[number];
+    code_end = address;
+    size = address;
+}
+
+/**
+ * Second pass, encode the line into the code buffer. It must get the same lines in the same order as layout.
+ * @param[in] line
+ * @param[in] m - resolves labels defined before this program.
+ */
+void Assembler::encode(const LexedLine &line, const Memory &m) {
+    if (!encoding) {
+        code.resize(code_end);
+        address = 0;
+        encoding = true;
+    }
+    if (line.mnemonic.empty()) {
+        address += line.label_length;
+        return;
+    }
+    uint8_t number;
+    const Opcode &opcode = find(line, number);
+    if (runs.empty() || runs.back().end != address) {
+        runs.push_back({address, address});
+    }
+
+    uint8_t *out = &code[address];
+    *out++ = number;
+    auto &args = opcode.get_args();
+    for(size_t i = 0; i < args.size(); i++) {
+        std::string_view operand = line.operands[i];
+        switch (args[i]->kind()) {
+            case ArgKind::Reg:
+                *out++ = parse_register(operand);
+                break;
+            case ArgKind::Vec:
+                *out++ = parse_vector_register(operand);
+                break;
+            case ArgKind::Int:
+            case ArgKind::Address:
+                {
+                    auto number_parse_res = string_to_int(operand);
+                    uint32_t value = number_parse_res.first;
+                    if (!number_parse_res.second && relocatable) {
+                        relocations.push_back({(uint32_t)(out - code.data()), symbol_number(operand)});
+                        value = labels.count(operand) ? labels.at(operand) : 0;
+                    } else if (!number_parse_res.second) {
+                        value = resolve(operand, m);
+                    }
+                    memcpy(out, &value, sizeof(value));
+                    out += sizeof(value);
+                }
+                break;
+        }
+    }
+    address += lengths[number];
+    runs.back().end = address;
+}
+
+/**
+ * Add the labels to the memory and write the encoded instructions into it.
+ * @param[in] m
+ */
+void Assembler::write(Memory &m) {
+    for(auto &label: labels) {
+        m.add_label(std::string(label.first), label.second);
+    }
+    for(auto &run: runs) {
+        m.write_bytes(run.begin, code.data() + run.begin, run.end - run.begin);
+    }
+}
+
+/**
+ * Return the encoded lines as an object, all labels are exported.
+ * @param[out] object
+ */
+ObjectFile Assembler::make_object() {
+    for(auto label: label_order) {
+        symbol_number(label);
+    }
+    ObjectFile object;
+    object.size = size;
+    object.code = code;
+    object.runs = runs;
+    object.symbols = symbols;
+    object.relocations = relocations;
+    return object;
+}
+
+/**
+ * Return the address after the last instruction.
+ */
+uint32_t Assembler::get_code_end() const {
+    return code_end;
+}
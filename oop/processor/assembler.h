@@ -0,0 +1,59 @@
+#pragma once
+#include "lexer.h"
+#include "memory.h"
+#include "object.h"
+
+/* bumped whenever the same source is encoded differently, compiled images cached before are not used then */
+const uint32_t AssemblerVersion = 1;
+
+/**
+ * Two pass assembler working on lexed lines, without creating an Opcode per instruction.
+ * The first pass looks up every mnemonic and lays out labels and instructions, the second pass
+ * gets the same lines again and encodes them straight into a code buffer, which is written to memory
+ * at the end. Mnemonics and labels are interned in hash maps keyed by views, labels by views of the
+ * source, so the source must stay alive until the code is written.
+ * A relocatable assembler makes an ObjectFile instead, labels it doesn't define become imported symbols
+ * and every label operand gets a relocation.
+ */
+class Assembler {
+    /* opcode numbers of a mnemonic by operand count, -1 if there is no such form */
+    struct Forms {
+        int by_count[MaxOperands + 1];
+        /* the form used to report a wrong operand count */
+        uint8_t first;
+    };
+
+    const OpcodeTable &table;
+    /* owns the mnemonics the keys of forms point to */
+    std::deque<std::string> names;
+    std::unordered_map<std::string_view, Forms> forms;
+    std::unordered_map<std::string_view, uint32_t> labels;
+    std::vector<std::string_view> label_order;
+    bool relocatable;
+    /* symbols of the object by name, and their numbers */
+    std::vector<ObjectSymbol> symbols;
+    std::unordered_map<std::string_view, uint32_t> symbol_numbers;
+    std::vector<ObjectRelocation> relocations;
+    /* encoded length of every opcode, including its number */
+    uint32_t lengths[256];
+    std::vector<uint8_t> code;
+    /* ranges of code holding instructions, reserved label bytes are not written */
+    std::vector<ObjectRun> runs;
+    uint32_t address = 0;
+    uint32_t code_end = 0;
+    uint32_t size = 0;
+    bool encoding = false;
+
+    const Opcode &find(const LexedLine &line, uint8_t &number) const;
+    uint32_t resolve(std::string_view label, const Memory &m) const;
+    uint32_t symbol_number(std::string_view label);
+
+    public:
+    Assembler(const OpcodeTable &table, bool relocatable=false);
+
+    void layout(const LexedLine &line);
+    void encode(const LexedLine &line, const Memory &m);
+    void write(Memory &m);
+    ObjectFile make_object();
+    uint32_t get_code_end() const;
+};
@@ -0,0 +1,116 @@
+#include "batch.h"
+#include <atomic>
+#include <thread>
+
+/**
+ * Run job(0) to job(jobs - 1) on a pool of threads, the calling thread is one of them.
+ * Errors thrown by a job are returned at its index, they don't stop the other jobs.
+ * @param[in] jobs
+ * @param[in] threads - 0 for one per core.
+ * @param[in] job
+ * @param[out] errors - empty for the jobs which succeeded.
+ */
+std::vector<std::string> parallel_for(size_t jobs, size_t threads, std::function<void (size_t)> job) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::vector<std::string> errors(jobs);
+    std::atomic<size_t> next {0};
+
+    auto worker = [&]() {
+        for(size_t i; (i = next.fetch_add(1)) < jobs;) {
+            try {
+                job(i);
+            } catch (const std::exception &e) {
+                errors[i] = e.what();
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for(size_t i = 1; i < std::min(threads, jobs); i++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for(auto &thread: pool) {
+        thread.join();
+    }
+    return errors;
+}
+
+/**
+ * BatchRunner constructor
+ * @param[in] threads - number of worker threads, 0 for one per core.
+ * @param[in] engine - interp, threaded or jit.
+ */
+BatchRunner::BatchRunner(size_t threads, std::string engine)
+    : threads {threads}
+    , engine {engine}
+{
+    if (this->threads == 0) {
+        this->threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (engine != "interp" && engine != "threaded" && engine != "jit") {
+        throw std::logic_error("No such engine " + engine + ".");
+    }
+}
+
+/**
+ * Run jobs on the pool and return their results in job order.
+ * Errors thrown by a job are stored in its result and don't stop the other jobs.
+ * @param[in] jobs
+ * @param[in] setup - prepares the processor of a job, e.g. by compiling or loading a program.
+ * @param[in] finish - inspects the processor after the job ran, may be empty.
+ */
+std::vector<BatchResult> BatchRunner::run(size_t jobs,
+        std::function<void (size_t, Processor &)> setup,
+        std::function<void (size_t, Processor &)> finish) {
+    std::vector<BatchResult> results(jobs);
+    parallel_for(jobs, threads, [&](size_t job) {
+        BatchResult &result = results[job];
+        Processor p;
+        try {
+            setup(job, p);
+            if (engine == "threaded") {
+                p.run_threaded();
+            } else if (engine == "jit") {
+                p.run_jit();
+            } else {
+                p.run();
+            }
+            if (finish) {
+                finish(job, p);
+            }
+            result.ok = true;
+        } catch (const std::exception &e) {
+            result.error = e.what();
+        }
+        result.regs = p.get_regs();
+        result.executed = p.instructions_executed();
+    });
+    return results;
+}
+
+/**
+ * Load and run every image as a job.
+ * With a suffix, a job's input or output is bound to the file named by its image name followed by the suffix.
+ * @param[in] fnames
+ * @param[in] input_suffix
+ * @param[in] output_suffix
+ */
+std::vector<BatchResult> BatchRunner::run_images(const std::vector<std::string> &fnames,
+        std::string input_suffix, std::string output_suffix) {
+    return run(fnames.size(), [&](size_t job, Processor &p) {
+        p.load(fnames[job].c_str());
+        if (input_suffix != "") {
+            p.get_io().bind_input((fnames[job] + input_suffix).c_str());
+        }
+        if (output_suffix != "") {
+            p.get_io().bind_output((fnames[job] + output_suffix).c_str());
+        }
+    });
+}
+
+size_t BatchRunner::get_threads() const {
+    return threads;
+}
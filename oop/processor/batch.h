@@ -0,0 +1,34 @@
+#pragma once
+#include "proc.h"
+#include <functional>
+
+/**
+ * Outcome of one job of a batch.
+ */
+struct BatchResult {
+    Registers regs;
+    uint64_t executed = 0;
+    bool ok = false;
+    std::string error;
+};
+
+std::vector<std::string> parallel_for(size_t jobs, size_t threads, std::function<void (size_t)> job);
+
+/**
+ * Runs many independent programs on a pool of threads.
+ * Every job gets a fresh Processor, so jobs share nothing but the opcode table.
+ */
+class BatchRunner {
+    size_t threads;
+    std::string engine;
+
+    public:
+    BatchRunner(size_t threads=0, std::string engine="interp");
+
+    std::vector<BatchResult> run(size_t jobs,
+            std::function<void (size_t, Processor &)> setup,
+            std::function<void (size_t, Processor &)> finish=nullptr);
+    std::vector<BatchResult> run_images(const std::vector<std::string> &fnames,
+            std::string input_suffix="", std::string output_suffix="");
+    size_t get_threads() const;
+};
@@ -0,0 +1,94 @@
+#include <chrono>
+#include <unistd.h>
+#include "../proc.h"
+
+/**
+ * Write a generated source of the given number of lines, blocks of arithmetic and jumps under a label each.
+ * @param[in] fname
+ * @param[in] lines
+ */
+void write_source(const std::string &fname, size_t lines) {
+    static const std::vector<std::string> block = {
+        "movi r1, 1000",
+        "addi r2, r1, -7",
+        "mul r3, r1, r2",
+        "ldr r4, 4096",
+        "xor r5, r4",
+        "jlt block%, r3, r4",
+        "jnz block%, r5",
+    };
+    std::ofstream out(fname);
+    for(size_t i = 0; i < lines; i += block.size() + 1) {
+        out << "block" << i << ":\n";
+        for(auto &line: block) {
+            size_t mark = line.find('%');
+            if (mark == std::string::npos) {
+                out << "    " << line << "\n";
+            } else {
+                out << "    " << line.substr(0, mark) << i << line.substr(mark + 1) << "\n";
+            }
+        }
+    }
+    out << "exit\n";
+}
+
+/**
+ * Return the seconds the function took.
+ * @param[in] f
+ */
+template<class F>
+double measure(F f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+int main(int argc, char *argv[]) {
+    size_t lines = 1000000;
+    if (argc > 1) {
+        lines = std::stoul(argv[1]);
+    }
+    char fname[] = "/tmp/assembler_benchXXXXXX";
+    int fd = mkstemp(fname);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+    write_source(fname, lines);
+
+    printf("%-28s %9s %12s\n", "assemble", "time", "lines/s");
+    auto report = [&](const char *name, double seconds) {
+        printf("%-28s %7.3f s %12.0f\n", name, seconds, lines / seconds);
+    };
+
+    report("mapped file, two passes", measure([&]() {
+        Processor p;
+        p.set_fusion(false);
+        p.compile_file(fname);
+    }));
+    report("getline, list of lines", measure([&]() {
+        std::ifstream in(fname);
+        std::vector<std::string> instructions;
+        std::string s;
+        while (std::getline(in, s)) {
+            instructions.push_back(s);
+        }
+        Processor p;
+        p.set_fusion(false);
+        p.compile(instructions);
+    }));
+    report("getline, Opcode per line", measure([&]() {
+        std::ifstream in(fname);
+        std::vector<std::string> instructions;
+        std::string s;
+        while (std::getline(in, s)) {
+            instructions.push_back(s);
+        }
+        Processor p;
+        p.parse(instructions);
+    }));
+    unlink(fname);
+    return 0;
+}
@@ -0,0 +1,48 @@
+#include <chrono>
+#include "../batch.h"
+
+/**
+ * Return a small program summing 1..n.
+ * @param[in] n
+ */
+std::vector<std::string> sum_program(uint32_t n) {
+    return {
+        "movi r1, 0",
+        "movi r2, " + std::to_string(n),
+        "loop:",
+        "jz end, r2",
+        "add r1, r2",
+        "subi r2, 1",
+        "jmp loop",
+        "end:",
+        "exit",
+    };
+}
+
+/**
+ * Run the jobs on the given number of threads and report the programs per second.
+ * @param[in] threads
+ * @param[in] jobs
+ * @param[in] engine
+ */
+void bench(size_t threads, size_t jobs, std::string engine) {
+    BatchRunner runner(threads, engine);
+    auto start = std::chrono::steady_clock::now();
+    auto results = runner.run(jobs, [](size_t job, Processor &p) { p.compile(sum_program(100 + job % 100)); });
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    size_t failed = std::count_if(results.begin(), results.end(), [](const BatchResult &r) { return !r.ok; });
+    printf("%-10s %3zu threads %8zu programs %8.3f s %12.0f programs/s %zu failed\n",
+            engine.c_str(), runner.get_threads(), jobs, elapsed.count(), jobs / elapsed.count(), failed);
+}
+
+int main(int argc, char *argv[]) {
+    size_t jobs = 10000;
+    if (argc > 1) {
+        jobs = std::stoul(argv[1]);
+    }
+    for(std::string engine: {"interp", "threaded", "jit"}) {
+        bench(1, jobs, engine);
+        bench(0, jobs, engine);
+    }
+}
@@ -0,0 +1,70 @@
+#include <chrono>
+#include "../proc.h"
+
+/**
+ * Run the program and return the run time.
+ * @param[in] program
+ */
+double run(const std::vector<std::string> &program) {
+    Processor p;
+    p.compile(program);
+    auto start = std::chrono::steady_clock::now();
+    p.run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+/**
+ * Return a program copying a buffer of the given size a number of times, with a word loop or with mcpy.
+ * Guest code has no indexed loads and stores, the loop reads with a fetchadd of zero and writes with xchg.
+ * @param[in] bytes - a multiple of 4.
+ * @param[in] times
+ * @param[in] bulk
+ */
+std::vector<std::string> copy_program(uint32_t bytes, uint32_t times, bool bulk) {
+    std::vector<std::string> program = {
+        "movi r10, " + std::to_string(times),
+        "movi r6, 255",
+        "movi r7, 1048576",
+        "movi r8, " + std::to_string(bytes),
+        "mset r7, r6, r8",
+        "repeat:",
+        "movi r1, 1048576",
+        "movi r2, 134217728",
+        "movi r3, " + std::to_string(bytes),
+    };
+    if (bulk) {
+        program.push_back("mcpy r2, r1, r3");
+    } else {
+        std::vector<std::string> loop = {
+            "rshifti r3, 2",
+            "loop:",
+            "movi r5, 0",
+            "fetchadd r1, r5",
+            "xchg r2, r5",
+            "addi r1, 4",
+            "addi r2, 4",
+            "subi r3, 1",
+            "jnz loop, r3",
+        };
+        program.insert(program.end(), loop.begin(), loop.end());
+    }
+    program.push_back("subi r10, 1");
+    program.push_back("jnz repeat, r10");
+    program.push_back("exit");
+    return program;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t bytes = 1 << 20;
+    if (argc > 1) {
+        bytes = std::stoul(argv[1]) & ~3u;
+    }
+    printf("%6s %10s %9s %10s\n", "copy", "bytes", "time", "MB/s");
+    for(bool bulk: {false, true}) {
+        uint32_t times = bulk ? 256 : 4;
+        double seconds = run(copy_program(bytes, times, bulk));
+        printf("%6s %10u %7.3f s %10.1f\n", bulk ? "mcpy" : "words", bytes, seconds, (double)bytes * times / seconds / 1e6);
+    }
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include <chrono>
+#include "../proc.h"
+
+/**
+ * Return a gcd.kekasm-style program computing the same gcd in a loop.
+ * @param[in] iterations
+ */
+std::vector<std::string> gcd_loop(uint32_t iterations) {
+    return {
+        "movi r3, " + std::to_string((uint32_t)-iterations),
+        "loop:",
+        "movi r0, 57827924",
+        "movi r1, 1038849",
+        "gcd:",
+        "jz fin, r1",
+        "mod r0, r1",
+        "mov r2, r0",
+        "mov r0, r1",
+        "mov r1, r2",
+        "jmp gcd",
+        "fin:",
+        "addi r3, 1",
+        "jnz loop, r3",
+        "print r0",
+        "exit",
+    };
+}
+
+/**
+ * Run the program with the given engine and report the instructions per second.
+ * @param[in] name
+ * @param[in] program
+ * @param[in] run
+ */
+void bench(std::string name, std::vector<std::string> program, std::function<void (Processor &)> run) {
+    Processor p;
+    p.compile(program);
+
+    auto start = std::chrono::steady_clock::now();
+    run(p);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << std::endl;
+    printf("%-10s %12" PRIu64 " instructions %8.3f s %14.0f instructions/s\n",
+            name.c_str(), p.instructions_executed(), elapsed.count(),
+            p.instructions_executed() / elapsed.count());
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t iterations = 20000;
+    if (argc > 1) {
+        iterations = std::stoul(argv[1]);
+    }
+    auto program = gcd_loop(iterations);
+    bench("interp", program, [](Processor &p) { p.run(); });
+    bench("threaded", program, [](Processor &p) { p.run_threaded(); });
+    bench("jit", program, [](Processor &p) { p.run_jit(); });
+}
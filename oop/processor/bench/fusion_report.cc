@@ -0,0 +1,81 @@
+#include <chrono>
+#include "../proc.h"
+
+/**
+ * Return the lines of a sample program.
+ * @param[in] fname - relative to the source directory.
+ */
+std::vector<std::string> read_program(std::string fname) {
+    std::ifstream in(std::string(SAMPLES_DIR) + "/" + fname);
+    if (!in) {
+        throw std::runtime_error("Could not open " + fname + ".");
+    }
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(in, line)) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+/**
+ * Run the program on the interpreter without and with fusion and print the dispatch counts.
+ * @param[in] name
+ * @param[in] program
+ */
+void report(std::string name, std::vector<std::string> program) {
+    uint64_t dispatched[2];
+    uint64_t executed = 0;
+    double seconds[2];
+    for(int fused = 0; fused < 2; fused++) {
+        Processor p;
+        p.set_fusion(fused);
+        p.compile(program);
+        p.get_io().bind_output("/dev/null");
+        auto start = std::chrono::steady_clock::now();
+        p.run();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        dispatched[fused] = p.instructions_dispatched();
+        executed = p.instructions_executed();
+        seconds[fused] = elapsed.count();
+    }
+    printf("%-14s %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %7.1f%% %9.3f s %9.3f s\n",
+            name.c_str(), executed, dispatched[0], dispatched[1],
+            100.0 * (dispatched[0] - dispatched[1]) / dispatched[0], seconds[0], seconds[1]);
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t iterations = 20000;
+    if (argc > 1) {
+        iterations = std::stoul(argv[1]);
+    }
+    printf("%-14s %12s %12s %12s %8s %11s %11s\n",
+            "program", "executed", "dispatched", "fused", "saved", "unfused", "fused");
+    report("gcd.kekasm", read_program("gcd.kekasm"));
+    report("lol.kekasm", read_program("lol.kekasm"));
+    report("gcd loop", {
+        "movi r3, " + std::to_string((uint32_t)-iterations),
+        "loop:",
+        "movi r0, 57827924",
+        "movi r1, 1038849",
+        "gcd:",
+        "jz fin, r1",
+        "mod r0, r1",
+        "mov r2, r0",
+        "mov r0, r1",
+        "mov r1, r2",
+        "jmp gcd",
+        "fin:",
+        "addi r3, 1",
+        "jnz loop, r3",
+        "print r0",
+        "exit",
+    });
+    report("countdown", {
+        "movi r1, " + std::to_string(iterations * 100),
+        "loop:",
+        "subi r1, 1",
+        "jnz loop, r1",
+        "exit",
+    });
+}
@@ -0,0 +1,97 @@
+#include <chrono>
+#include "../scheduler.h"
+
+/**
+ * Return a program summing 1..n.
+ * @param[in] n
+ */
+std::vector<std::string> sum_program(uint32_t n) {
+    return {
+        "movi r1, 0",
+        "movi r2, " + std::to_string(n),
+        "loop:",
+        "jz end, r2",
+        "add r1, r2",
+        "subi r2, 1",
+        "jmp loop",
+        "end:",
+        "exit",
+    };
+}
+
+/**
+ * Compare a run without fuel to runs sliced with the given fuel.
+ * @param[in] n
+ * @param[in] fuel
+ */
+void metering(uint32_t n, uint64_t fuel) {
+    double seconds[2];
+    for(int sliced = 0; sliced < 2; sliced++) {
+        Processor p;
+        p.compile(sum_program(n));
+        auto start = std::chrono::steady_clock::now();
+        if (sliced) {
+            while (!p.run_for(fuel));
+        } else {
+            p.run();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        seconds[sliced] = elapsed.count();
+    }
+    printf("fuel %8" PRIu64 ": %.3f s unsliced, %.3f s sliced\n", fuel, seconds[0], seconds[1]);
+}
+
+/**
+ * Schedule jobs of mixed lengths, report throughput and latency and return the instructions per second.
+ * @param[in] threads
+ * @param[in] jobs
+ * @param[in] quantum
+ * @param[in] policy
+ */
+double bench(size_t threads, size_t jobs, uint64_t quantum, SchedulingPolicy policy) {
+    Scheduler scheduler(threads, quantum, policy);
+    for(size_t job = 0; job < jobs; job++) {
+        auto p = std::unique_ptr<Processor>(new Processor());
+        /* mostly short jobs and a few long ones */
+        p->compile(sum_program(job % 100 == 0 ? 200000 : 100 + job % 1000));
+        scheduler.add(std::move(p), job % 4);
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto reports = scheduler.run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    uint64_t executed = 0;
+    std::vector<double> latencies;
+    for(auto &report: reports) {
+        executed += report.executed;
+        latencies.push_back(report.wall_seconds);
+    }
+    std::sort(latencies.begin(), latencies.end());
+    printf("%-11s %3zu threads %6zu jobs quantum %7" PRIu64 " %8.3f s %6.1f M instr/s latency p50 %.4f s p99 %.4f s\n",
+            policy == SchedulingPolicy::Priority ? "priority" : "round-robin", scheduler.get_threads(), jobs, quantum,
+            elapsed.count(), executed / elapsed.count() / 1e6,
+            latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100]);
+    return executed / elapsed.count();
+}
+
+int main(int argc, char *argv[]) {
+    size_t jobs = 5000;
+    if (argc > 1) {
+        jobs = std::stoul(argv[1]);
+    }
+    for(uint64_t fuel: {100, 10000, 1000000}) {
+        metering(5000000, fuel);
+    }
+    for(uint64_t quantum: {1000, 100000}) {
+        bench(0, jobs, quantum, SchedulingPolicy::RoundRobin);
+    }
+    bench(0, jobs, 10000, SchedulingPolicy::Priority);
+
+    /* a slice should cost little more than the instructions in it, even when it is short */
+    double sliced = bench(1, jobs, 100, SchedulingPolicy::RoundRobin);
+    double whole = bench(1, jobs, 1000000, SchedulingPolicy::RoundRobin);
+    if (sliced < whole / 2) {
+        printf("quantum 100 runs at %.1f%% of the throughput of quantum 1000000\n", sliced / whole * 100);
+        return 1;
+    }
+}
@@ -0,0 +1,72 @@
+#include <chrono>
+#include "../proc.h"
+
+/**
+ * Return a program filling an array of words with mset and adding them up, a word or four lanes at a time.
+ * The scalar loop reads with a fetchadd of zero, guest code has no indexed loads.
+ * @param[in] words - a multiple of 4.
+ * @param[in] times
+ * @param[in] vector
+ */
+std::vector<std::string> checksum_program(uint32_t words, uint32_t times, bool vector) {
+    std::vector<std::string> program = {
+        "movi r10, " + std::to_string(times),
+        "movi r6, 1",
+        "movi r7, 1048576",
+        "movi r8, " + std::to_string(4 * words),
+        "mset r7, r6, r8",
+        "repeat:",
+        "movi r1, 1048576",
+        "movi r3, " + std::to_string(words),
+    };
+    std::vector<std::string> loop;
+    if (vector) {
+        loop = {
+            "vxor v1, v1",
+            "rshifti r3, 2",
+            "loop:",
+            "vld v0, r1",
+            "vadd v1, v0",
+            "addi r1, 16",
+            "subi r3, 1",
+            "jnz loop, r3",
+            "vsum r4, v1",
+        };
+    } else {
+        loop = {
+            "movi r4, 0",
+            "loop:",
+            "movi r5, 0",
+            "fetchadd r1, r5",
+            "add r4, r5",
+            "addi r1, 4",
+            "subi r3, 1",
+            "jnz loop, r3",
+        };
+    }
+    program.insert(program.end(), loop.begin(), loop.end());
+    program.push_back("subi r10, 1");
+    program.push_back("jnz repeat, r10");
+    program.push_back("exit");
+    return program;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t words = 1 << 18;
+    if (argc > 1) {
+        words = std::stoul(argv[1]) & ~3u;
+    }
+    uint32_t times = 8;
+    printf("%7s %12s %9s %12s %10s\n", "loop", "executed", "time", "M instr/s", "checksum");
+    for(bool vector: {false, true}) {
+        Processor p;
+        p.compile(checksum_program(words, times, vector));
+        auto start = std::chrono::steady_clock::now();
+        p.run();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        double seconds = elapsed.count();
+        printf("%7s %12" PRIu64 " %7.3f s %12.1f %10u\n", vector ? "vector" : "scalar", p.instructions_executed(),
+                seconds, p.instructions_executed() / seconds / 1e6, p.get_regs().get(4));
+    }
+    return 0;
+}
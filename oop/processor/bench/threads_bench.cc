@@ -0,0 +1,69 @@
+#include <chrono>
+#include <unistd.h>
+#include "../proc.h"
+
+/**
+ * Return the lines of a sample program.
+ * @param[in] fname - relative to the source directory.
+ */
+std::vector<std::string> read_program(std::string fname) {
+    std::ifstream in(std::string(SAMPLES_DIR) + "/" + fname);
+    if (!in) {
+        throw std::runtime_error("Could not open " + fname + ".");
+    }
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(in, line)) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+/**
+ * Run the parallel gcd demo with the given number of guest threads and return the run time.
+ * @param[in] program
+ * @param[in] threads
+ * @param[out] executed
+ */
+double run(const std::vector<std::string> &program, uint32_t threads, uint64_t &executed) {
+    char input[] = "/tmp/threads_bench_XXXXXX";
+    int fd = mkstemp(input);
+    if (fd < 0) {
+        throw std::runtime_error("Could not create the input file.");
+    }
+    std::string count = std::to_string(threads) + "\n";
+    if (write(fd, count.data(), count.size()) != (ssize_t)count.size()) {
+        throw std::runtime_error("Could not write the input file.");
+    }
+    close(fd);
+
+    Processor p;
+    p.compile(program);
+    p.get_io().bind_input(input);
+    p.get_io().bind_output("/dev/null");
+    auto start = std::chrono::steady_clock::now();
+    p.run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    unlink(input);
+    executed = p.instructions_executed();
+    return elapsed.count();
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t max_threads = std::max(4u, std::thread::hardware_concurrency());
+    if (argc > 1) {
+        max_threads = std::stoul(argv[1]);
+    }
+    auto program = read_program("pgcd.kekasm");
+    printf("%7s %12s %9s %12s %8s\n", "threads", "executed", "time", "M instr/s", "speedup");
+    double base = 0;
+    for(uint32_t threads = 1; threads <= max_threads; threads *= 2) {
+        uint64_t executed;
+        double seconds = run(program, threads, executed);
+        if (threads == 1) {
+            base = seconds;
+        }
+        printf("%7u %12" PRIu64 " %7.3f s %12.1f %7.2fx\n", threads, executed, seconds, executed / seconds / 1e6, base / seconds);
+    }
+    return 0;
+}
@@ -0,0 +1,166 @@
+#include "cache.h"
+#include "assembler.h"
+#include "lexer.h"
+#include "proc.h"
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* extension of the cached images, other files in the directory are left alone */
+static const char *ImageExtension = ".img";
+/* prefix of the files images are written to before they are renamed into place */
+static const char *TempPrefix = "tmp.";
+/* age after which a temporary file is taken to be left over by a compile which died */
+static const auto StaleTempAge = std::chrono::hours(1);
+
+/**
+ * Return the file mode creation mask of the process, it is read once.
+ */
+static mode_t creation_mask() {
+    static const mode_t mask = [] {
+        mode_t mask = umask(0);
+        umask(mask);
+        return mask;
+    }();
+    return mask;
+}
+
+/**
+ * Return the name of the cache entry of a source.
+ * The hash is 64 bit FNV-1a over the assembler version, the options and the source, the source length
+ * is part of the name as well.
+ * @param[in] source
+ * @param[in] optimize
+ * @param[out] key
+ */
+std::string compile_cache_key(std::string_view source, bool optimize) {
+    uint64_t hash = 0xcbf29ce484222325;
+    auto mix = [&](const void *data, size_t length) {
+        for(size_t i = 0; i < length; i++) {
+            hash ^= ((const uint8_t *)data)[i];
+            hash *= 0x100000001b3;
+        }
+    };
+    uint32_t prefix[2] = {AssemblerVersion, optimize};
+    mix(prefix, sizeof(prefix));
+    mix(source.data(), source.size());
+
+    char key[64];
+    snprintf(key, sizeof(key), "%016" PRIx64 "-%zx", hash, source.size());
+    return key;
+}
+
+/**
+ * CompileCache constructor, the directory is created if it doesn't exist.
+ * @param[in] dir
+ * @param[in] max_size - bytes the images may take in total.
+ */
+CompileCache::CompileCache(const std::string &dir, uint64_t max_size)
+    : dir {dir}
+    , max_size {max_size}
+{
+    std::error_code error;
+    std::filesystem::create_directories(this->dir, error);
+    if (!std::filesystem::is_directory(this->dir)) {
+        throw std::runtime_error("Could not create cache directory " + dir + ".");
+    }
+}
+
+/**
+ * Return the path of the image of a source file, compiling it on a miss.
+ * @param[in] fname
+ * @param[in] optimize
+ * @param[out] path
+ */
+std::string CompileCache::get(const char *fname, bool optimize) {
+    SourceFile source(fname);
+    std::filesystem::path path = dir / (compile_cache_key(source.text(), optimize) + ImageExtension);
+    std::error_code error;
+    if (std::filesystem::is_regular_file(path, error)) {
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+        hits++;
+        return path.string();
+    }
+    misses++;
+
+    Processor p;
+    p.set_optimization(optimize);
+    p.compile_source(source.text());
+    std::string temp = (dir / (std::string(TempPrefix) + "XXXXXX")).string();
+    int fd = mkstemp(&temp[0]);
+    if (fd < 0) {
+        throw std::runtime_error("Could not write to cache directory.");
+    }
+    /* mkstemp creates the file private, the image is for everyone sharing the directory */
+    if (fchmod(fd, 0666 & ~creation_mask()) != 0) {
+        close(fd);
+        unlink(temp.c_str());
+        throw std::runtime_error("Could not write to cache directory.");
+    }
+    FILE *f = fdopen(fd, "wb");
+    if (f == NULL) {
+        close(fd);
+        unlink(temp.c_str());
+        throw std::runtime_error("Could not write to cache directory.");
+    }
+    p.dump_image(f);
+    if (fclose(f) != 0 || rename(temp.c_str(), path.c_str()) != 0) {
+        unlink(temp.c_str());
+        throw std::runtime_error("Could not write to cache directory.");
+    }
+    evict(path);
+    return path.string();
+}
+
+/**
+ * Remove the least recently used images until the rest fit into the size limit,
+ * and the temporary files of compiles which didn't finish.
+ * @param[in] keep - the image just returned, never removed.
+ */
+void CompileCache::evict(const std::filesystem::path &keep) {
+    struct Entry {
+        std::filesystem::file_time_type used;
+        uint64_t size;
+        std::filesystem::path path;
+    };
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    std::error_code error;
+    auto stale = std::filesystem::file_time_type::clock::now() - StaleTempAge;
+    for(auto &file: std::filesystem::directory_iterator(dir, error)) {
+        if (file.path().filename().string().rfind(TempPrefix, 0) == 0 && file.is_regular_file(error)) {
+            /* the files of running compiles are younger */
+            auto written = file.last_write_time(error);
+            if (!error && written < stale) {
+                std::filesystem::remove(file.path(), error);
+            }
+            continue;
+        }
+        if (file.path().extension() != ImageExtension || !file.is_regular_file(error)) {
+            continue;
+        }
+        Entry entry = {file.last_write_time(error), file.file_size(error), file.path()};
+        if (error) {
+            /* removed by another compile meanwhile */
+            continue;
+        }
+        total += entry.size;
+        entries.push_back(entry);
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.used < b.used; });
+    for(auto &entry: entries) {
+        if (total <= max_size) {
+            break;
+        }
+        if (entry.path != keep && std::filesystem::remove(entry.path, error)) {
+            total -= entry.size;
+        }
+    }
+}
+
+size_t CompileCache::get_hits() const {
+    return hits;
+}
+
+size_t CompileCache::get_misses() const {
+    return misses;
+}
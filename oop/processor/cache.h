@@ -0,0 +1,30 @@
+#pragma once
+#include <bits/stdc++.h>
+#include <filesystem>
+
+/**
+ * Content addressed cache of compiled images. An entry is named after a hash of the source bytes,
+ * the assembler version and the compile options, so a hit needs neither parsing nor comparing timestamps,
+ * and the image it returns is loaded like any other, by mapping it.
+ * Images are written to a temporary file and renamed into place, so compiles sharing the directory
+ * never see a partial image, and are readable by everyone the umask allows, so the directory may be shared
+ * between users. Temporary files left behind by a compile which died are removed an hour later.
+ * When the images take more than the size limit the least recently used ones are removed, a hit counts as a use.
+ */
+class CompileCache {
+    std::filesystem::path dir;
+    uint64_t max_size;
+    size_t hits = 0;
+    size_t misses = 0;
+
+    void evict(const std::filesystem::path &keep);
+
+    public:
+    CompileCache(const std::string &dir, uint64_t max_size);
+
+    std::string get(const char *fname, bool optimize);
+    size_t get_hits() const;
+    size_t get_misses() const;
+};
+
+std::string compile_cache_key(std::string_view source, bool optimize);
@@ -0,0 +1,136 @@
+#include "cfg.h"
+#include "simd.h"
+
+/**
+ * Return whether the opcode is a jump and the address it jumps to.
+ * @param[in] opcode
+ * @param[out] target
+ * @param[out] conditional - whether execution may also fall through.
+ */
+bool is_jump(const Opcode &opcode, uint32_t &target, bool &conditional) {
+    if (dynamic_cast<const JumpOpcode *>(&opcode) == NULL) {
+        return false;
+    }
+    auto &args = opcode.get_args();
+    target = args[0]->get_raw_value();
+    conditional = args.size() > 1;
+    return true;
+}
+
+/**
+ * Return whether the opcode stores its result into rip.
+ * @param[in] opcode
+ */
+bool writes_rip(const Opcode &opcode) {
+    auto vector = dynamic_cast<const VectorOpcode *>(&opcode);
+    if (vector != NULL && vector->get_operation() != VectorOperation::Sum) {
+        return false;
+    }
+    if (vector == NULL && dynamic_cast<const BinaryOperationOpcode *>(&opcode) == NULL && dynamic_cast<const UnaryOperationOpcode *>(&opcode) == NULL
+            && dynamic_cast<const ThreeOperandOpcode *>(&opcode) == NULL
+            && dynamic_cast<const IoOpcode *>(&opcode) == NULL && dynamic_cast<const BulkOpcode *>(&opcode) == NULL) {
+        return false;
+    }
+    auto &args = opcode.get_args();
+    return args[0]->kind() == ArgKind::Reg && args[0]->get_raw_value() == RIP;
+}
+
+bool ends_basic_block(const Opcode &opcode) {
+    uint32_t target;
+    bool conditional;
+    return is_jump(opcode, target, conditional) || dynamic_cast<const ExitOpcode *>(&opcode) != NULL || writes_rip(opcode);
+}
+
+/**
+ * Find the basic blocks reachable from the entries by following jumps.
+ * Decoding stops at the first undecodable instruction of a path, and at never written memory,
+ * which would otherwise decode as an endless run of add r0, r0.
+ * @param[in] icache
+ * @param[in] m
+ * @param[in] entries
+ * @param[out] blocks - by their start address.
+ */
+std::map<uint32_t, BasicBlock> find_basic_blocks(InstructionCache &icache, const Memory &m, std::set<uint32_t> entries) {
+    std::set<uint32_t> leaders = entries;
+    std::set<uint32_t> visited;
+    std::vector<uint32_t> worklist(entries.begin(), entries.end());
+
+    while (!worklist.empty()) {
+        uint32_t address = worklist.back();
+        worklist.pop_back();
+        while (visited.find(address) == visited.end() && m.get_page(address) != nullptr) {
+            visited.insert(address);
+            const DecodedInstruction *instr;
+            try {
+                instr = &icache.fetch(m, address);
+            } catch (const std::runtime_error &e) {
+                break;
+            }
+            const Opcode &opcode = icache.opcode(address);
+            uint32_t next = address + instr->length;
+            uint32_t target;
+            bool conditional;
+            if (is_jump(opcode, target, conditional)) {
+                leaders.insert(target);
+                worklist.push_back(target);
+                if (conditional) {
+                    leaders.insert(next);
+                    worklist.push_back(next);
+                }
+                break;
+            }
+            if (ends_basic_block(opcode)) {
+                break;
+            }
+            address = next;
+        }
+    }
+
+    std::map<uint32_t, BasicBlock> blocks;
+    for(auto leader: leaders) {
+        if (visited.find(leader) == visited.end()) {
+            continue;
+        }
+        BasicBlock block;
+        block.start = leader;
+        uint32_t address = leader;
+        while (m.get_page(address) != nullptr) {
+            const DecodedInstruction *instr;
+            try {
+                instr = &icache.fetch(m, address);
+            } catch (const std::runtime_error &e) {
+                break;
+            }
+            const Opcode &opcode = icache.opcode(address);
+            uint32_t next = address + instr->length;
+            address = next;
+            uint32_t target;
+            bool conditional;
+            if (is_jump(opcode, target, conditional)) {
+                block.successors.push_back(target);
+                if (conditional) {
+                    block.successors.push_back(next);
+                }
+                break;
+            }
+            if (writes_rip(opcode)) {
+                block.indirect = true;
+                break;
+            }
+            if (ends_basic_block(opcode)) {
+                break;
+            }
+            if (leaders.find(next) != leaders.end()) {
+                block.successors.push_back(next);
+                break;
+            }
+        }
+        block.end = address;
+        blocks[leader] = block;
+    }
+    return blocks;
+}
+
+std::map<uint32_t, BasicBlock> find_basic_blocks(InstructionCache &icache, const Memory &m, uint32_t entry) {
+    return find_basic_blocks(icache, m, std::set<uint32_t>{entry});
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "opcode.h"
+#include "memory.h"
+#include "icache.h"
+
+/**
+ * A run of instructions entered only at its start and left only after its last instruction.
+ */
+struct BasicBlock {
+    uint32_t start;
+    uint32_t end;
+    std::vector<uint32_t> successors;
+    /* the block ends in a write to rip, its successors are unknown */
+    bool indirect = false;
+};
+
+bool is_jump(const Opcode &opcode, uint32_t &target, bool &conditional);
+bool writes_rip(const Opcode &opcode);
+bool ends_basic_block(const Opcode &opcode);
+std::map<uint32_t, BasicBlock> find_basic_blocks(InstructionCache &icache, const Memory &m, std::set<uint32_t> entries);
+std::map<uint32_t, BasicBlock> find_basic_blocks(InstructionCache &icache, const Memory &m, uint32_t entry);
@@ -0,0 +1,154 @@
+#include "debugger.h"
+
+/**
+ * Copy the contents of the memory range into value, page by page, and return whether they differed.
+ * @param[in] m
+ * @param[in] address
+ * @param[in,out] value - as long as the range.
+ */
+static bool update_range(const Memory &m, uint32_t address, std::vector<uint8_t> &value) {
+    bool changed = false;
+    for(size_t done = 0; done < value.size();) {
+        uint32_t at = address + done;
+        size_t offset = at & (PageSize - 1);
+        size_t chunk = std::min(value.size() - done, PageSize - offset);
+        uint8_t *old = value.data() + done;
+        const uint8_t *page = m.get_page(at);
+        if (page == nullptr) {
+            /* never written memory reads as zero */
+            if (std::any_of(old, old + chunk, [](uint8_t byte) { return byte != 0; })) {
+                std::fill(old, old + chunk, 0);
+                changed = true;
+            }
+        } else if (memcmp(old, page + offset, chunk) != 0) {
+            memcpy(old, page + offset, chunk);
+            changed = true;
+        }
+        done += chunk;
+    }
+    return changed;
+}
+
+static std::string describe_kinds(int kinds) {
+    std::string res;
+    if (kinds & WatchRead) {
+        res += "r";
+    }
+    if (kinds & WatchWrite) {
+        res += "w";
+    }
+    if (kinds & WatchChange) {
+        res += "c";
+    }
+    return res;
+}
+
+/**
+ * Stop before executing the instruction at the address.
+ * @param[in] address
+ * @param[out] id - used to delete the breakpoint.
+ */
+uint32_t DebugState::add_breakpoint(uint32_t address) {
+    bitmap.touch(address).set(address & (PageSize - 1));
+    breakpoints[next_id] = address;
+    return next_id++;
+}
+
+/**
+ * Stop after an instruction reads, writes or changes the memory range.
+ * @param[in] address
+ * @param[in] length - at most MaxWatchLength.
+ * @param[in] kinds - WatchRead, WatchWrite and WatchChange or-ed together.
+ * @param[in] m - the current contents are remembered for WatchChange.
+ * @param[out] id - used to delete the watchpoint.
+ */
+uint32_t DebugState::add_watchpoint(uint32_t address, uint32_t length, int kinds, const Memory &m) {
+    if (length == 0 || kinds == 0) {
+        throw std::logic_error("Watchpoints need a length and a kind.");
+    }
+    if (length > MaxWatchLength) {
+        throw std::logic_error("Watchpoints cover at most " + std::to_string(MaxWatchLength) + " bytes.");
+    }
+    Watchpoint watchpoint = {next_id, address, length, kinds, {}};
+    if (kinds & WatchChange) {
+        watchpoint.value.resize(length);
+        update_range(m, address, watchpoint.value);
+    }
+    watchpoints.push_back(watchpoint);
+    return next_id++;
+}
+
+/**
+ * Delete a breakpoint or watchpoint, return whether it existed.
+ * @param[in] id
+ */
+bool DebugState::remove(uint32_t id) {
+    auto breakpoint = breakpoints.find(id);
+    if (breakpoint != breakpoints.end()) {
+        uint32_t address = breakpoint->second;
+        breakpoints.erase(breakpoint);
+        bool still_set = false;
+        for(auto &other: breakpoints) {
+            still_set |= other.second == address;
+        }
+        if (!still_set) {
+            bitmap.find(address)->reset(address & (PageSize - 1));
+        }
+        return true;
+    }
+    auto watchpoint = std::find_if(watchpoints.begin(), watchpoints.end(), [&](const Watchpoint &w) { return w.id == id; });
+    if (watchpoint != watchpoints.end()) {
+        watchpoints.erase(watchpoint);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Return a description of the watchpoint hit by an access, or an empty string.
+ * @param[in] address
+ * @param[in] length
+ * @param[in] kind - WatchRead or WatchWrite.
+ */
+std::string DebugState::check_access(uint32_t address, uint32_t length, int kind) const {
+    for(auto &watchpoint: watchpoints) {
+        if (!(watchpoint.kinds & kind)) {
+            continue;
+        }
+        if ((uint64_t)address < (uint64_t)watchpoint.address + watchpoint.length && (uint64_t)watchpoint.address < (uint64_t)address + length) {
+            return "watchpoint " + std::to_string(watchpoint.id) + ": " + (kind == WatchRead ? "read" : "write")
+                + " of " + std::to_string(address);
+        }
+    }
+    return "";
+}
+
+/**
+ * Return a description of the watchpoints whose ranges changed since the last check, or an empty string.
+ * @param[in] m
+ */
+std::string DebugState::check_changes(const Memory &m) {
+    std::string res;
+    for(auto &watchpoint: watchpoints) {
+        if (!(watchpoint.kinds & WatchChange)) {
+            continue;
+        }
+        if (update_range(m, watchpoint.address, watchpoint.value)) {
+            if (res != "") {
+                res += ", ";
+            }
+            res += "watchpoint " + std::to_string(watchpoint.id) + ": " + std::to_string(watchpoint.address) + " changed";
+        }
+    }
+    return res;
+}
+
+void DebugState::list(std::ostream &out) const {
+    for(auto &breakpoint: breakpoints) {
+        out << breakpoint.first << " breakpoint " << breakpoint.second << std::endl;
+    }
+    for(auto &watchpoint: watchpoints) {
+        out << watchpoint.id << " watchpoint " << watchpoint.address << " " << watchpoint.length << " "
+            << describe_kinds(watchpoint.kinds) << std::endl;
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "memory.h"
+#include <ostream>
+#include <algorithm>
+#include <bitset>
+
+const int WatchRead = 1;
+const int WatchWrite = 2;
+const int WatchChange = 4;
+/* longest watched range, changes are looked for after every instruction which touches memory */
+const uint32_t MaxWatchLength = 1 << 16;
+
+/**
+ * A watched memory range, along with its contents when they were last checked if changes are watched.
+ */
+struct Watchpoint {
+    uint32_t id;
+    uint32_t address;
+    uint32_t length;
+    int kinds;
+    std::vector<uint8_t> value;
+};
+
+/**
+ * Breakpoints and watchpoints of a debugging session, and whether it is single-stepping.
+ * Breakpoints are kept in bitmaps indexed by address, one per page with a breakpoint.
+ * Checking an address without breakpoints around it is a single load.
+ */
+class DebugState {
+    PagedTable<std::bitset<PageSize>> bitmap;
+    std::map<uint32_t, uint32_t> breakpoints;
+    std::vector<Watchpoint> watchpoints;
+    uint32_t next_id = 1;
+
+    public:
+    bool stepping = true;
+
+    bool is_breakpoint(uint32_t address) const {
+        const std::bitset<PageSize> *page = bitmap.find(address);
+        return page != nullptr && page->test(address & (PageSize - 1));
+    }
+    bool has_watchpoints() const {
+        return !watchpoints.empty();
+    }
+
+    uint32_t add_breakpoint(uint32_t address);
+    uint32_t add_watchpoint(uint32_t address, uint32_t length, int kinds, const Memory &m);
+    bool remove(uint32_t id);
+    std::string check_access(uint32_t address, uint32_t length, int kind) const;
+    std::string check_changes(const Memory &m);
+    void list(std::ostream &out) const;
+};
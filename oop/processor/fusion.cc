@@ -0,0 +1,231 @@
+#include "fusion.h"
+#include "cfg.h"
+
+/**
+ * FusedOpcode constructor
+ * @param[in] kind
+ * @param[in] a, b, c - registers, in the order of the comment on the kind.
+ * @param[in] value - the constant of addi.
+ * @param[in] target - the jump target.
+ * @param[in] parts - the fused instructions, used for disassembly.
+ */
+FusedOpcode::FusedOpcode(FusedKind kind, uint8_t a, uint8_t b, uint8_t c, uint32_t value, uint32_t target,
+        std::vector<std::shared_ptr<const Opcode>> parts)
+    : Opcode("fused", {})
+    , kind_ {kind}
+    , a_ {a}
+    , b_ {b}
+    , c_ {c}
+    , value_ {value}
+    , target_ {target}
+    , parts_ {parts}
+{}
+
+FusedKind FusedOpcode::get_kind() const {
+    return kind_;
+}
+
+std::shared_ptr<Opcode> FusedOpcode::clone() const {
+    return std::shared_ptr<Opcode>(new FusedOpcode(kind_, a_, b_, c_, value_, target_, parts_));
+}
+
+/**
+ * Return the length of the fused instructions, without the opcode number of the first one.
+ */
+size_t FusedOpcode::len() const {
+    size_t length = 0;
+    for(auto &part: parts_) {
+        length += 1 + part->len();
+    }
+    return length - 1;
+}
+
+std::string FusedOpcode::write_asm() const {
+    std::string asm_string;
+    for(auto &part: parts_) {
+        if (asm_string.length()) {
+            asm_string += "; ";
+        }
+        asm_string += part->write_asm();
+    }
+    return asm_string;
+}
+
+/**
+ * Execute the whole sequence, rip already points past it.
+ * @param[in] r
+ * @param[in] m
+ * @param[in] stack
+ */
+bool FusedOpcode::execute(Registers &r, Memory &m, Memory &stack) const {
+    uint32_t *regs = r.data();
+    switch (kind_) {
+        case FusedKind::ModSwap:
+            {
+                uint32_t rest = regs[a_] % regs[b_];
+                regs[a_] = regs[b_];
+                regs[b_] = rest;
+                regs[c_] = rest;
+                break;
+            }
+        case FusedKind::Swap:
+            {
+                uint32_t t = regs[a_];
+                regs[a_] = regs[b_];
+                regs[b_] = t;
+                regs[c_] = t;
+                break;
+            }
+        case FusedKind::AddiJnz:
+            regs[a_] += value_;
+            if (regs[a_] != 0) {
+                regs[RIP] = target_;
+            }
+            break;
+        case FusedKind::AddiJz:
+            regs[a_] += value_;
+            if (regs[a_] == 0) {
+                regs[RIP] = target_;
+            }
+            break;
+        case FusedKind::SubJnz:
+            regs[a_] -= regs[b_];
+            if (regs[a_] != 0) {
+                regs[RIP] = target_;
+            }
+            break;
+        case FusedKind::SubJz:
+            regs[a_] -= regs[b_];
+            if (regs[a_] == 0) {
+                regs[RIP] = target_;
+            }
+            break;
+    }
+    return false;
+}
+
+/**
+ * Return the register operand, or -1 if the argument is not a register usable by fused code.
+ */
+static int reg_operand(const Opcode &opcode, size_t i) {
+    auto &args = opcode.get_args();
+    if (i >= args.size() || args[i]->kind() != ArgKind::Reg) {
+        return -1;
+    }
+    uint32_t reg = args[i]->get_raw_value();
+    if (reg >= RegisterCount || reg == RIP) {
+        return -1;
+    }
+    return reg;
+}
+
+static bool is_op(const Opcode &opcode, const char *name, ArgKind second) {
+    auto &args = opcode.get_args();
+    return opcode.get_name() == name && args.size() == 2 && reg_operand(opcode, 0) >= 0
+        && args[1]->kind() == second && (second != ArgKind::Reg || reg_operand(opcode, 1) >= 0);
+}
+
+/**
+ * Try to match a fusable sequence against the instructions starting at the address.
+ * @param[in] parts - up to four decoded instructions following each other, shorter if decoding failed
+ *                    or an earlier instruction ends a basic block.
+ * @param[out] fused
+ * @param[out] count - number of fused instructions.
+ */
+static bool match(const std::vector<std::shared_ptr<const Opcode>> &parts, std::shared_ptr<Opcode> &fused, size_t &count) {
+    auto arg = [&](size_t i, size_t j) -> uint32_t { return parts[i]->get_args()[j]->get_raw_value(); };
+
+    /* mod a, b; mov c, a; mov a, b; mov b, c */
+    if (parts.size() >= 4 && is_op(*parts[0], "mod", ArgKind::Reg) && is_op(*parts[1], "mov", ArgKind::Reg)
+            && is_op(*parts[2], "mov", ArgKind::Reg) && is_op(*parts[3], "mov", ArgKind::Reg)) {
+        uint32_t a = arg(0, 0), b = arg(0, 1), c = arg(1, 0);
+        if (a != b && b != c && a != c && arg(1, 1) == a && arg(2, 0) == a && arg(2, 1) == b && arg(3, 0) == b && arg(3, 1) == c) {
+            count = 4;
+            fused.reset(new FusedOpcode(FusedKind::ModSwap, a, b, c, 0, 0, {parts.begin(), parts.begin() + 4}));
+            return true;
+        }
+    }
+    /* mov c, a; mov a, b; mov b, c */
+    if (parts.size() >= 3 && is_op(*parts[0], "mov", ArgKind::Reg) && is_op(*parts[1], "mov", ArgKind::Reg)
+            && is_op(*parts[2], "mov", ArgKind::Reg)) {
+        uint32_t c = arg(0, 0), a = arg(0, 1), b = arg(1, 1);
+        if (a != b && b != c && a != c && arg(1, 0) == a && arg(2, 0) == b && arg(2, 1) == c) {
+            count = 3;
+            fused.reset(new FusedOpcode(FusedKind::Swap, a, b, c, 0, 0, {parts.begin(), parts.begin() + 3}));
+            return true;
+        }
+    }
+    if (parts.size() >= 2 && (parts[1]->get_name() == "jz" || parts[1]->get_name() == "jnz")
+            && reg_operand(*parts[1], 1) >= 0) {
+        bool nonzero = parts[1]->get_name() == "jnz";
+        uint32_t target = arg(1, 0);
+        uint32_t tested = arg(1, 1);
+        /* addi a, n or subi a, n; jnz/jz target, a */
+        if ((is_op(*parts[0], "addi", ArgKind::Int) || is_op(*parts[0], "subi", ArgKind::Int)) && arg(0, 0) == tested) {
+            uint32_t value = parts[0]->get_name() == "addi" ? arg(0, 1) : -arg(0, 1);
+            count = 2;
+            fused.reset(new FusedOpcode(nonzero ? FusedKind::AddiJnz : FusedKind::AddiJz,
+                        tested, 0, 0, value, target, {parts[0], parts[1]}));
+            return true;
+        }
+        /* sub a, b; jnz/jz target, a */
+        if (is_op(*parts[0], "sub", ArgKind::Reg) && arg(0, 0) == tested) {
+            count = 2;
+            fused.reset(new FusedOpcode(nonzero ? FusedKind::SubJnz : FusedKind::SubJz,
+                        tested, arg(0, 1), 0, 0, target, {parts[0], parts[1]}));
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Attach superinstructions to the cached instructions of every fusable sequence reachable from the entries.
+ * Only the sequence start gets the fused instruction, so jumps into the middle of it run the original
+ * instructions, and writing to any of them drops the fused instruction along with the decoded ones.
+ * @param[in] icache
+ * @param[in] m
+ * @param[in] entries
+ * @param[out] fused - number of fused sequences.
+ */
+size_t fuse_instructions(InstructionCache &icache, const Memory &m, std::set<uint32_t> entries) {
+    const size_t MaxParts = 4;
+    size_t fused_count = 0;
+    for(auto &block: find_basic_blocks(icache, m, entries)) {
+        for(uint32_t address = block.second.start; address < block.second.end;) {
+            std::vector<std::shared_ptr<const Opcode>> parts;
+            std::vector<uint32_t> lengths;
+            uint32_t next = address;
+            while (parts.size() < MaxParts) {
+                try {
+                    const DecodedInstruction &instr = icache.fetch(m, next);
+                    parts.push_back(icache.objects(next).opcode);
+                    lengths.push_back(instr.length);
+                    next += instr.length;
+                } catch (const std::runtime_error &e) {
+                    break;
+                }
+                /* a jump may only end a fused sequence */
+                if (ends_basic_block(*parts.back())) {
+                    break;
+                }
+            }
+            if (parts.empty()) {
+                break;
+            }
+
+            std::shared_ptr<Opcode> fused;
+            size_t count;
+            if (match(parts, fused, count)) {
+                size_t length = 0;
+                for(size_t i = 0; i < count; i++) {
+                    length += lengths[i];
+                }
+                icache.fuse(address, fused, length, count);
+                fused_count++;
+            }
+            address += lengths[0];
+        }
+    }
+    return fused_count;
+}
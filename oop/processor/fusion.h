@@ -0,0 +1,45 @@
+#pragma once
+#include "opcode.h"
+#include "memory.h"
+#include "icache.h"
+
+enum class FusedKind {
+    /* mod a, b; mov c, a; mov a, b; mov b, c */
+    ModSwap,
+    /* mov c, a; mov a, b; mov b, c */
+    Swap,
+    /* addi a, n; jnz target, a (subi is addi of -n) */
+    AddiJnz,
+    /* addi a, n; jz target, a */
+    AddiJz,
+    /* sub a, b; jnz target, a */
+    SubJnz,
+    /* sub a, b; jz target, a */
+    SubJz,
+};
+
+/**
+ * A superinstruction replacing a sequence of register only instructions, which may end in a jump.
+ * It is executed by a single handler and never writes memory.
+ */
+class FusedOpcode : public Opcode {
+    FusedKind kind_;
+    uint8_t a_ = 0;
+    uint8_t b_ = 0;
+    uint8_t c_ = 0;
+    uint32_t value_ = 0;
+    uint32_t target_ = 0;
+    std::vector<std::shared_ptr<const Opcode>> parts_;
+
+    public:
+    FusedOpcode(FusedKind kind, uint8_t a, uint8_t b, uint8_t c, uint32_t value, uint32_t target,
+            std::vector<std::shared_ptr<const Opcode>> parts);
+
+    FusedKind get_kind() const;
+    std::shared_ptr<Opcode> clone() const;
+    size_t len() const;
+    std::string write_asm() const;
+    bool execute(Registers &r, Memory &m, Memory &stack) const;
+};
+
+size_t fuse_instructions(InstructionCache &icache, const Memory &m, std::set<uint32_t> entries);
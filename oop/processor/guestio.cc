@@ -0,0 +1,418 @@
+#include "guestio.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <cerrno>
+#include <cctype>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <cinttypes>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+/* log names of the input kinds, in their order */
+static const char *const input_kind_names[] = {"read", "readc", "ready"};
+
+/**
+ * GuestIO constructor, the guest starts out bound to the process' stdin and stdout.
+ */
+GuestIO::GuestIO()
+    : out_file {stdout}
+    , out_buffer {new char[GuestOutputBufferSize]}
+    , in_buffer {new char[GuestInputBufferSize]}
+    , in_fd {STDIN_FILENO}
+{}
+
+GuestIO::~GuestIO() {
+    try {
+        flush();
+    } catch (const std::runtime_error &e) {
+    }
+    if (own_out) {
+        fclose(out_file);
+    }
+    if (record_file != nullptr) {
+        fclose(record_file);
+    }
+}
+
+/**
+ * Read guest input from a file, which is mapped rather than read.
+ * @param[in] fname
+ */
+void GuestIO::bind_input(const char *fname) {
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open input file.");
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        throw std::runtime_error("Could not open input file.");
+    }
+    size_t size = st.st_size;
+    in_mapping.reset();
+    in_pos = in_end = nullptr;
+    if (size) {
+        void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Could not map input file.");
+        }
+        madvise(addr, size, MADV_SEQUENTIAL);
+        in_mapping.reset((char *)addr, [size](char *p) { munmap(p, size); });
+        in_pos = in_mapping.get();
+        in_end = in_pos + size;
+    }
+    close(fd);
+    in_fd = -1;
+    in_file = nullptr;
+}
+
+/**
+ * Read guest input from the descriptor of a stream, like stdin, for pipes and terminals which can't be mapped.
+ * The stream stays open, input stdio already buffered from it is not seen.
+ * @param[in] f
+ */
+void GuestIO::bind_input(FILE *f) {
+    in_mapping.reset();
+    in_pos = in_end = nullptr;
+    in_fd = fileno(f);
+    in_file = nullptr;
+}
+
+/**
+ * Read guest input bound to stdin through stdio from now on, so it shares one buffer with std::cin.
+ * Input already read ahead is consumed first.
+ */
+void GuestIO::share_stdin() {
+    if (in_fd == STDIN_FILENO) {
+        in_file = stdin;
+    }
+}
+
+/**
+ * Write guest output to a file instead of stdout.
+ * @param[in] fname
+ */
+void GuestIO::bind_output(const char *fname) {
+    FILE *f = fopen(fname, "wb");
+    if (f == NULL) {
+        throw std::runtime_error("Could not open output file.");
+    }
+    flush();
+    if (own_out) {
+        fclose(out_file);
+    }
+    out_file = f;
+    own_out = true;
+}
+
+void GuestIO::flush() {
+    if (out_used == 0) {
+        return;
+    }
+    size_t used = out_used;
+    out_used = 0;
+    if (fwrite(out_buffer.get(), 1, used, out_file) != used || fflush(out_file) != 0) {
+        throw std::runtime_error("Could not write guest output.");
+    }
+}
+
+/**
+ * Count instructions for the input log with the counter of a processor.
+ * @param[in] executed - instructions executed so far, must outlive the I/O.
+ */
+void GuestIO::set_clock(const uint64_t *executed) {
+    clock = executed;
+}
+
+/**
+ * Log every input event to a file, a line with the instruction count, read, readc or ready, and the value.
+ * @param[in] fname
+ */
+void GuestIO::record_input(const char *fname) {
+    FILE *f = fopen(fname, "w");
+    if (f == NULL) {
+        throw std::runtime_error("Could not open record file.");
+    }
+    if (record_file != nullptr) {
+        fclose(record_file);
+    }
+    record_file = f;
+}
+
+/**
+ * Return the values and readiness of a recorded log instead of reading input.
+ * @param[in] fname
+ */
+void GuestIO::replay_input(const char *fname) {
+    std::ifstream in(fname);
+    if (!in) {
+        throw std::runtime_error("Could not open replay file.");
+    }
+    std::vector<InputEvent> events;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        InputEvent event;
+        std::string kind;
+        if (!(fields >> event.executed >> kind >> event.value)) {
+            throw std::runtime_error("Invalid replay line " + line + ".");
+        }
+        auto name = std::find(std::begin(input_kind_names), std::end(input_kind_names), kind);
+        if (name == std::end(input_kind_names)) {
+            throw std::runtime_error("Invalid replay line " + line + ".");
+        }
+        event.kind = (InputKind)(name - std::begin(input_kind_names));
+        events.push_back(event);
+    }
+    replay = std::move(events);
+    replay_pos = 0;
+    replaying = true;
+}
+
+/**
+ * Return whether input is recorded or replayed.
+ */
+bool GuestIO::logging() const {
+    return record_file != nullptr || replaying;
+}
+
+uint32_t GuestIO::record(InputKind kind, uint32_t value) {
+    if (record_file != nullptr) {
+        fprintf(record_file, "%" PRIu64 " %s %" PRIu32 "\n", clock ? *clock : 0, input_kind_names[(int)kind], value);
+        fflush(record_file);
+    }
+    return value;
+}
+
+/**
+ * Return the next replayed event, or nullptr at the end of the log.
+ */
+const GuestIO::InputEvent *GuestIO::replay_peek() {
+    uint64_t now = clock ? *clock : 0;
+    /* events before a snapshot the run continues from */
+    while (replay_pos < replay.size() && replay[replay_pos].executed < now) {
+        replay_pos++;
+    }
+    return replay_pos == replay.size() ? nullptr : &replay[replay_pos];
+}
+
+uint32_t GuestIO::replay_next(InputKind kind) {
+    uint64_t now = clock ? *clock : 0;
+    if (replay_peek() == nullptr) {
+        throw std::runtime_error("Replay log ended at instruction " + std::to_string(now) + ".");
+    }
+    const InputEvent &event = replay[replay_pos++];
+    if (event.executed != now || event.kind != kind) {
+        throw std::runtime_error("Replay diverged at instruction " + std::to_string(now) + ", the log has "
+                + input_kind_names[(int)event.kind] + " at " + std::to_string(event.executed) + ".");
+    }
+    return record(kind, event.value);
+}
+
+/**
+ * Make accesses lock while guest threads share the I/O.
+ * Must only be switched while a single thread uses it.
+ * @param[in] enabled
+ */
+void GuestIO::set_shared(bool enabled) {
+    shared = enabled;
+}
+
+/**
+ * Return a lock to hold during an access, it only owns the mutex while the I/O is shared.
+ */
+std::unique_lock<std::mutex> GuestIO::acquire() {
+    if (!shared) {
+        return std::unique_lock<std::mutex>();
+    }
+    return std::unique_lock<std::mutex>(mutex);
+}
+
+/**
+ * Print a number in decimal, like std::cout << value did.
+ * @param[in] value
+ */
+void GuestIO::put_uint(uint32_t value) {
+    char digits[10];
+    size_t n = 0;
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    if (out_used + n > GuestOutputBufferSize) {
+        flush();
+    }
+    while (n) {
+        out_buffer[out_used++] = digits[--n];
+    }
+}
+
+/**
+ * Refill the empty input buffer from the stream, return false at the end of input.
+ */
+bool GuestIO::fill_input() {
+    if (in_fd < 0) {
+        return false;
+    }
+    ssize_t n;
+    while ((n = read(in_fd, in_buffer.get(), GuestInputBufferSize)) < 0 && errno == EINTR) {
+    }
+    if (n <= 0) {
+        return false;
+    }
+    in_pos = in_buffer.get();
+    in_end = in_pos + n;
+    return true;
+}
+
+int GuestIO::peek_input() {
+    if (in_pos == in_end) {
+        if (in_file != nullptr) {
+            int c = getc(in_file);
+            if (c != EOF) {
+                ungetc(c, in_file);
+            }
+            return c;
+        }
+        if (!fill_input()) {
+            return EOF;
+        }
+    }
+    return (unsigned char)*in_pos;
+}
+
+int GuestIO::next_input() {
+    if (in_pos == in_end) {
+        if (in_file != nullptr) {
+            return getc(in_file);
+        }
+        if (!fill_input()) {
+            return EOF;
+        }
+    }
+    return (unsigned char)*in_pos++;
+}
+
+/**
+ * Read the next non whitespace character, like std::cin >> c into a char did.
+ * Characters are sign extended, the end of input reads as -1.
+ */
+uint32_t GuestIO::get_char() {
+    if (replaying) {
+        return replay_next(InputKind::ReadChar);
+    }
+    return record(InputKind::ReadChar, read_char());
+}
+
+/**
+ * Read a decimal number, like std::cin >> value into a uint32_t did.
+ * Leading whitespace is skipped, negative numbers wrap, too large ones saturate and anything else reads as 0.
+ */
+uint32_t GuestIO::get_uint() {
+    if (replaying) {
+        return replay_next(InputKind::Read);
+    }
+    return record(InputKind::Read, read_uint());
+}
+
+uint32_t GuestIO::read_char() {
+    if (in_fd >= 0) {
+        flush();
+    }
+    int c;
+    while ((c = next_input()) != EOF && isspace(c)) {
+    }
+    if (c == EOF) {
+        return (uint32_t)-1;
+    }
+    return (uint32_t)(int32_t)(char)c;
+}
+
+uint32_t GuestIO::read_uint() {
+    if (in_fd >= 0) {
+        flush();
+    }
+    int c;
+    while ((c = peek_input()) != EOF && isspace(c)) {
+        next_input();
+    }
+    bool negative = false;
+    if (c == '-' || c == '+') {
+        negative = c == '-';
+        next_input();
+        c = peek_input();
+    }
+    uint64_t value = 0;
+    bool overflow = false;
+    while (c != EOF && isdigit(c)) {
+        value = value * 10 + (c - '0');
+        overflow |= value > UINT32_MAX;
+        next_input();
+        c = peek_input();
+    }
+    if (overflow) {
+        return UINT32_MAX;
+    }
+    return negative ? -(uint32_t)value : (uint32_t)value;
+}
+
+/**
+ * Return whether reading input would not block, at the end of input it doesn't either.
+ * Ready input is logged like a value read, a replay answers whether the log has it ready at the clock.
+ * Unready answers are not logged, tasks spinning on them would fill the log.
+ */
+bool GuestIO::input_ready() {
+    if (replaying) {
+        const InputEvent *event = replay_peek();
+        if (event == nullptr || event->executed != (clock ? *clock : 0) || event->kind != InputKind::Ready) {
+            return false;
+        }
+        replay_pos++;
+    } else if (!poll_input()) {
+        return false;
+    }
+    record(InputKind::Ready, 1);
+    return true;
+}
+
+/**
+ * Mapped input is always ready, a stream is when the input buffer holds some of it or its descriptor is readable.
+ * Buffered whitespace is dropped first, both input opcodes skip it anyway. Input shared through stdio,
+ * whose buffer can't be seen, is always ready too: reading it blocks instead of parking.
+ */
+bool GuestIO::poll_input() {
+    if (in_fd < 0) {
+        return true;
+    }
+    for(; in_pos < in_end; in_pos++) {
+        if (!isspace((unsigned char)*in_pos)) {
+            return true;
+        }
+    }
+    if (in_file != nullptr) {
+        return true;
+    }
+    struct pollfd fd = {in_fd, POLLIN, 0};
+    return poll(&fd, 1, 0) != 0;
+}
+
+/**
+ * Block until reading input would not block, replayed input never waits.
+ */
+void GuestIO::wait_input() {
+    if (input_ready() || replaying) {
+        return;
+    }
+    flush();
+    struct pollfd fd = {in_fd, POLLIN, 0};
+    while (poll(&fd, 1, -1) < 0 && errno == EINTR) {
+    }
+}
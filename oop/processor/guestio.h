@@ -0,0 +1,100 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+const size_t GuestOutputBufferSize = 1 << 16;
+const size_t GuestInputBufferSize = 1 << 16;
+
+/**
+ * Buffered input and output of one processor.
+ * Output is collected in a large buffer which is flushed when it is full, when the program exits
+ * and before input is read from stdin, so prompts show up. Input bound to a file is mapped and parsed
+ * in place, streams like stdin are read ahead with read(2) into an input buffer, which also answers whether
+ * input is ready. While the debugger reads its commands from std::cin, stdin is read through stdio instead,
+ * so both share its buffer.
+ * While it is shared by guest threads, every access has to hold the lock returned by acquire.
+ * The values read can be recorded into a log, with the instruction count of the clock at which they were read,
+ * and replayed from it instead of reading input. Replay checks the counts, so a run which diverges stops
+ * there, and skips the values read before the clock, so it can continue a snapshot of a recorded run.
+ * Whether input was ready decides when guest tasks park and wake, so ready input is logged and replayed too.
+ * Guest threads read at times no single clock orders, they can't be recorded or replayed.
+ */
+class GuestIO {
+    FILE *out_file;
+    bool own_out = false;
+    std::unique_ptr<char[]> out_buffer;
+    size_t out_used = 0;
+
+    std::shared_ptr<char> in_mapping;
+    std::unique_ptr<char[]> in_buffer;
+    const char *in_pos = nullptr;
+    const char *in_end = nullptr;
+    /* descriptor the input buffer is filled from, -1 for mapped input */
+    int in_fd;
+    /* stream read through stdio instead of the input buffer, shared with other readers of it */
+    FILE *in_file = nullptr;
+
+    std::mutex mutex;
+    bool shared = false;
+
+    /* what an input event logs: a value read by read or readc, or whether input was ready */
+    enum class InputKind {
+        Read,
+        ReadChar,
+        Ready,
+    };
+    /* an input event and the instruction count it happened at */
+    struct InputEvent {
+        uint64_t executed;
+        InputKind kind;
+        uint32_t value;
+    };
+    const uint64_t *clock = nullptr;
+    FILE *record_file = nullptr;
+    std::vector<InputEvent> replay;
+    size_t replay_pos = 0;
+    bool replaying = false;
+
+    bool fill_input();
+    int peek_input();
+    int next_input();
+    uint32_t read_char();
+    uint32_t read_uint();
+    bool poll_input();
+    uint32_t record(InputKind kind, uint32_t value);
+    const InputEvent *replay_peek();
+    uint32_t replay_next(InputKind kind);
+
+    public:
+    GuestIO();
+    GuestIO(const GuestIO &) = delete;
+    GuestIO &operator=(const GuestIO &) = delete;
+    ~GuestIO();
+
+    void bind_input(const char *fname);
+    void bind_input(FILE *f);
+    void share_stdin();
+    void bind_output(const char *fname);
+    void flush();
+    void set_shared(bool enabled);
+    void set_clock(const uint64_t *executed);
+    void record_input(const char *fname);
+    void replay_input(const char *fname);
+    bool logging() const;
+    std::unique_lock<std::mutex> acquire();
+
+    void put_char(char c) {
+        if (out_used == GuestOutputBufferSize) {
+            flush();
+        }
+        out_buffer[out_used++] = c;
+    }
+    void put_uint(uint32_t value);
+    uint32_t get_char();
+    uint32_t get_uint();
+    bool input_ready();
+    void wait_input();
+};
@@ -0,0 +1,276 @@
+#include "guestthreads.h"
+#include "proc.h"
+#include "fusion.h"
+
+ThreadOpcode::ThreadOpcode(std::string name, std::vector<std::shared_ptr<OpcodeArg>> args, ThreadOperation op)
+    : Opcode(name, args)
+    , op_ {op}
+{}
+
+ThreadOperation ThreadOpcode::get_operation() const {
+    return op_;
+}
+
+std::shared_ptr<Opcode> ThreadOpcode::clone() const {
+    auto args = args_;
+    for(auto &arg: args) {
+        arg = arg->clone();
+    }
+    return std::shared_ptr<Opcode>(new ThreadOpcode(name_, args, op_));
+}
+
+bool ThreadOpcode::execute(Registers &r, Memory &m, Memory &stack) const {
+    throw std::logic_error("Thread opcodes need the interpreter.");
+}
+
+/**
+ * Execute with access to the guest threads of the processor.
+ * @param[in] r
+ * @param[in] m
+ * @param[in] stack
+ * @param[in] threads
+ */
+bool ThreadOpcode::execute(Registers &r, Memory &m, Memory &stack, GuestThreads &threads) const {
+    switch (op_) {
+        case ThreadOperation::Spawn:
+            args_[0]->set_value(r, m, threads.spawn(r, args_[1]->get_value(r, m)));
+            break;
+        case ThreadOperation::Join:
+            args_[0]->set_value(r, m, threads.join(args_[0]->get_value(r, m)));
+            break;
+    }
+    return false;
+}
+
+void CodeGuard::set_code_end(uint32_t end) {
+    code_end = end;
+}
+
+void CodeGuard::memory_written(size_t address, size_t length) {
+    if (address < code_end) {
+        throw std::runtime_error("Guest threads can't write into the code at " + std::to_string(address) + ".");
+    }
+}
+
+/**
+ * GuestThreads constructor
+ * @param[in] processor - whose memory, I/O and code the threads share.
+ */
+GuestThreads::GuestThreads(Processor &processor)
+    : processor {processor}
+{}
+
+/**
+ * Stop the threads still running at the end of their current basic block and wait for them.
+ */
+GuestThreads::~GuestThreads() {
+    stopping = true;
+    try {
+        join_all();
+    } catch (const std::exception &e) {
+    }
+}
+
+/**
+ * Switch the shared state of the processor over to concurrent use, before the first thread is started.
+ * The code becomes read only, so the instruction cache of the processor doesn't have to observe the memory.
+ */
+void GuestThreads::start() {
+    guard.set_code_end(processor.code_end);
+    processor.mem.remove_observer(&processor.icache);
+    processor.mem.add_observer(&guard);
+    processor.io.set_shared(true);
+    stopping = false;
+}
+
+/**
+ * Switch back after the last thread was joined.
+ * The threads may have written code past the end of the compiled code, which the instruction cache of the
+ * processor didn't see, so all of it is decoded again. Its entries stay allocated, the join is one of them.
+ */
+void GuestThreads::finish() {
+    processor.io.set_shared(false);
+    processor.mem.remove_observer(&guard);
+    processor.mem.add_observer(&processor.icache);
+    processor.icache.invalidate(0, SIZE_MAX);
+}
+
+/**
+ * Interpret a thread until it exits, fails or the threads are stopped.
+ * Stopping is only checked at the end of basic blocks.
+ * @param[in] thread
+ */
+void GuestThreads::run(Thread &thread) {
+    InstructionCache icache(processor.opcodes);
+    Memory stack;
+    Memory &mem = processor.mem;
+    GuestIO &io = processor.io;
+    Registers &regs = thread.regs;
+    bool thread_opcode[256] = {};
+    for(auto &opcode: processor.opcodes) {
+        thread_opcode[opcode.first] = dynamic_cast<const ThreadOpcode *>(opcode.second.get()) != NULL;
+    }
+
+    uint64_t count = 0;
+    try {
+        if (processor.fusion) {
+            fuse_instructions(icache, mem, {regs.get(RIP)});
+        }
+        while (true) {
+            uint32_t rip = regs.get(RIP);
+            const DecodedInstruction &instr = icache.fetch(mem, rip);
+            if (instr.fused) {
+                const DecodedObjects &objects = icache.objects(rip);
+                regs.set(RIP, rip + objects.fused_length);
+                count += objects.fused_count;
+                objects.fused->execute(regs, mem, stack);
+                if (stopping.load(std::memory_order_relaxed)) {
+                    break;
+                }
+                continue;
+            }
+            regs.set(RIP, rip + instr.length);
+            count++;
+            bool exited;
+            if (thread_opcode[instr.opcode_no]) {
+                exited = static_cast<const ThreadOpcode &>(icache.opcode(rip)).execute(regs, mem, stack, *this);
+            } else if (instr.handler != NULL) {
+                exited = instr.handler(instr.operands, regs, mem);
+            } else {
+                exited = icache.opcode(rip).execute(regs, mem, stack, io);
+            }
+            if (exited || (instr.ends_block && stopping.load(std::memory_order_relaxed))) {
+                break;
+            }
+        }
+    } catch (...) {
+        thread.error = std::current_exception();
+    }
+    thread.executed = count;
+    executed += count;
+}
+
+/**
+ * Start a thread at the entry with a copy of the registers, return its id.
+ * Threads can't be spawned while input is recorded or replayed, their reads happen in no replayable order.
+ * @param[in] regs
+ * @param[in] entry
+ */
+uint32_t GuestThreads::spawn(const Registers &regs, uint32_t entry) {
+    if (processor.io.logging()) {
+        throw std::runtime_error("Guest threads can't be recorded or replayed.");
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (running == 0) {
+        start();
+    }
+    std::unique_ptr<Thread> thread(new Thread());
+    thread->regs = regs;
+    thread->regs.set(RIP, entry);
+    thread->regs.set(RSP, 0);
+    try {
+        thread->host = std::thread(&GuestThreads::run, this, std::ref(*thread));
+    } catch (const std::system_error &e) {
+        if (running == 0) {
+            finish();
+        }
+        throw std::runtime_error("Could not start a guest thread.");
+    }
+    threads.push_back(std::move(thread));
+    running++;
+    return threads.size();
+}
+
+/**
+ * Mark a thread as joined by the calling thread, must be called with the mutex held.
+ * @param[in] id
+ */
+GuestThreads::Thread *GuestThreads::claim(uint32_t id) {
+    if (id == 0 || id > threads.size()) {
+        throw std::runtime_error("No guest thread " + std::to_string(id) + ".");
+    }
+    Thread *thread = threads[id - 1].get();
+    if (thread->joined) {
+        throw std::runtime_error("Guest thread " + std::to_string(id) + " was already joined.");
+    }
+    if (thread->host.get_id() == std::this_thread::get_id()) {
+        throw std::runtime_error("Guest thread " + std::to_string(id) + " can't join itself.");
+    }
+    thread->joined = true;
+    return thread;
+}
+
+/**
+ * Wait for a claimed thread to end.
+ * @param[in] thread
+ */
+void GuestThreads::wait(Thread &thread) {
+    thread.host.join();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--running == 0) {
+        finish();
+    }
+}
+
+/**
+ * Wait for a thread and return its r1, rethrowing the error it failed with.
+ * @param[in] id
+ */
+uint32_t GuestThreads::join(uint32_t id) {
+    Thread *thread;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        thread = claim(id);
+    }
+    wait(*thread);
+    if (thread->error) {
+        std::rethrow_exception(thread->error);
+    }
+    return thread->regs.get(1);
+}
+
+/**
+ * Wait for all threads not joined yet, including the ones they spawn meanwhile.
+ * The first error of any of them is rethrown after all ended.
+ */
+void GuestThreads::join_all() {
+    std::exception_ptr error;
+    while (true) {
+        std::vector<Thread *> claimed;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for(size_t i = 0; i < threads.size(); i++) {
+                if (!threads[i]->joined) {
+                    claimed.push_back(claim(i + 1));
+                }
+            }
+        }
+        if (claimed.empty()) {
+            break;
+        }
+        for(auto thread: claimed) {
+            wait(*thread);
+            if (thread->error && !error) {
+                error = thread->error;
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+/**
+ * Return whether threads were spawned and not joined yet.
+ */
+bool GuestThreads::active() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return running > 0;
+}
+
+/**
+ * Return the number of instructions executed by the threads which ended.
+ */
+uint64_t GuestThreads::instructions_executed() const {
+    return executed;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "opcode.h"
+#include "memory.h"
+#include "icache.h"
+#include <thread>
+
+class Processor;
+class GuestThreads;
+
+enum class ThreadOperation {
+    /* spawn id, label */
+    Spawn,
+    /* join id */
+    Join,
+};
+
+/**
+ * Starts or waits for a guest thread, only the interpreter can execute it.
+ */
+class ThreadOpcode : public Opcode {
+    ThreadOperation op_;
+
+    public:
+    ThreadOpcode(std::string name, std::vector<std::shared_ptr<OpcodeArg>> args, ThreadOperation op);
+
+    ThreadOperation get_operation() const;
+    std::shared_ptr<Opcode> clone() const;
+    bool execute(Registers &r, Memory &m, Memory &stack) const;
+    bool execute(Registers &r, Memory &m, Memory &stack, GuestThreads &threads) const;
+};
+
+/**
+ * Rejects writes into the code while guest threads run, their instruction caches are not invalidated.
+ */
+class CodeGuard : public MemoryObserver {
+    uint32_t code_end = 0;
+
+    public:
+    void set_code_end(uint32_t end);
+    void memory_written(size_t address, size_t length);
+};
+
+/**
+ * The guest threads of a processor, each runs on its own host thread with its own registers, stack and
+ * instruction cache, sharing the memory and I/O of the processor.
+ * A new thread starts with a copy of the registers of the spawning thread and an empty stack.
+ * Spawning happens before the first instruction of the new thread, the exit of a thread happens before
+ * the join returning it. Atomic opcodes are sequentially consistent, plain loads and stores are not ordered.
+ */
+class GuestThreads {
+    struct Thread {
+        std::thread host;
+        Registers regs;
+        std::exception_ptr error;
+        uint64_t executed = 0;
+        bool joined = false;
+    };
+
+    Processor &processor;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Thread>> threads;
+    /* spawned and not joined yet */
+    size_t running = 0;
+    std::atomic<bool> stopping {false};
+    std::atomic<uint64_t> executed {0};
+    CodeGuard guard;
+
+    void run(Thread &thread);
+    void start();
+    void finish();
+    Thread *claim(uint32_t id);
+    void wait(Thread &thread);
+
+    public:
+    GuestThreads(Processor &processor);
+    GuestThreads(const GuestThreads &) = delete;
+    GuestThreads &operator=(const GuestThreads &) = delete;
+    ~GuestThreads();
+
+    uint32_t spawn(const Registers &regs, uint32_t entry);
+    uint32_t join(uint32_t id);
+    void join_all();
+    bool active();
+    uint64_t instructions_executed() const;
+};
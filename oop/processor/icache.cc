@@ -0,0 +1,93 @@
+#include "icache.h"
+#include "cfg.h"
+
+static const size_t AddressSpaceSize = (size_t)1 << 32;
+
+/**
+ * InstructionCache constructor
+ * @param[in] opcodes - the table instructions are decoded with.
+ */
+InstructionCache::InstructionCache(const std::map<uint8_t, std::shared_ptr<const Opcode>> &opcodes)
+    : opcodes {opcodes}
+{}
+
+void InstructionCache::decode(const Memory &m, uint32_t address, Page &page) {
+    uint8_t opcode_no = m.read_type<uint8_t>(address);
+    auto opcode = opcodes.find(opcode_no);
+    if (opcode == opcodes.end()) {
+        throw std::runtime_error("No such opcode " + std::to_string(opcode_no) + ".");
+    }
+    size_t length;
+    DecodedObjects objects;
+    objects.opcode = opcode->second->decode(m, (size_t)address + 1, length);
+
+    DecodedInstruction &entry = page.entries[address & (PageSize - 1)];
+    if (entry.slot == 0) {
+        page.objects.emplace_back();
+        entry.slot = page.objects.size();
+    }
+    entry.opcode_no = opcode_no;
+    entry.length = 1 + length;
+    entry.valid = true;
+    entry.ends_block = ends_basic_block(*objects.opcode);
+    entry.fused = false;
+    entry.handler = opcode->second->get_handler();
+    auto &args = objects.opcode->get_args();
+    for(size_t i = 0; i < 3; i++) {
+        entry.operands[i] = i < args.size() ? args[i]->get_raw_value() : 0;
+    }
+    page.objects[entry.slot - 1] = std::move(objects);
+    max_instruction_length = std::max(max_instruction_length, (size_t)entry.length);
+}
+
+/**
+ * Attach a superinstruction to the cached instruction at the address.
+ * @param[in] address - must be cached.
+ * @param[in] fused
+ * @param[in] length - of the whole sequence.
+ * @param[in] count - number of instructions in the sequence.
+ */
+void InstructionCache::fuse(uint32_t address, std::shared_ptr<const Opcode> fused, size_t length, size_t count) {
+    Page *page = pages.find(address);
+    if (page == nullptr || !page->entries[address & (PageSize - 1)].valid) {
+        throw std::logic_error("Fusing an instruction which is not cached.");
+    }
+    DecodedInstruction &entry = page->entries[address & (PageSize - 1)];
+    DecodedObjects &objects = page->objects[entry.slot - 1];
+    objects.fused = fused;
+    objects.fused_length = length;
+    objects.fused_count = count;
+    entry.fused = true;
+    /* a write anywhere into the sequence has to reach back to its start */
+    max_instruction_length = std::max(max_instruction_length, length);
+}
+
+/**
+ * Drop every cached instruction overlapping the given memory range.
+ * The opcode objects are kept alive, since one of them may be executing the write.
+ * @param[in] address
+ * @param[in] length
+ */
+void InstructionCache::invalidate(size_t address, size_t length) {
+    size_t start = address >= max_instruction_length ? address - max_instruction_length + 1 : 0;
+    /* lengths past the end of the address space, like SIZE_MAX, cover all of it */
+    size_t end = length > AddressSpaceSize - std::min(address, AddressSpaceSize) ? AddressSpaceSize : address + length;
+    for(size_t i = start; i < end; i = (i | (PageSize - 1)) + 1) {
+        Page *page = pages.find(i);
+        if (page == nullptr) {
+            continue;
+        }
+        size_t page_end = std::min(end, (i | (PageSize - 1)) + 1);
+        for(size_t j = i; j < page_end; j++) {
+            page->entries[j & (PageSize - 1)].valid = false;
+        }
+    }
+}
+
+void InstructionCache::clear() {
+    pages.clear();
+}
+
+void InstructionCache::memory_written(size_t address, size_t length) {
+    invalidate(address, length);
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include "opcode.h"
+#include "memory.h"
+
+/**
+ * An instruction decoded once from memory, ready to be executed.
+ * Only what the interpreter needs on every dispatch is kept here, the opcode objects are in a side table of
+ * the page, see DecodedObjects.
+ */
+struct DecodedInstruction {
+    /* run by the interpreter instead of the opcode, if the opcode has one */
+    InstructionHandler handler;
+    /* raw values of the first three operands, for the handler and traced runs */
+    uint32_t operands[3];
+    uint8_t opcode_no;
+    uint8_t length;
+    /* one past the index of the objects in the side table of the page, 0 before the first decode */
+    uint16_t slot : 13;
+    bool valid : 1;
+    /* a jump, exit or write to rip */
+    bool ends_block : 1;
+    /* a superinstruction starts here */
+    bool fused : 1;
+};
+static_assert(sizeof(DecodedInstruction) == 24, "decoded instructions should stay compact");
+
+/**
+ * The opcode objects of a decoded instruction.
+ */
+struct DecodedObjects {
+    std::shared_ptr<const Opcode> opcode;
+    /* superinstruction for the sequence starting here, run instead of opcode by the interpreter */
+    std::shared_ptr<const Opcode> fused;
+    uint8_t fused_length = 0;
+    uint8_t fused_count = 0;
+};
+
+/**
+ * Decoded instructions indexed by their address, in pages allocated on the first fetch from them.
+ * Entries are decoded on first execution and invalidated when the code they were decoded from is overwritten.
+ * They keep their address until the cache is cleared, so an instruction may be executed from its entry.
+ * An entry keeps its slot in the side table when it is decoded again, so a page never has more than PageSize
+ * objects.
+ */
+class InstructionCache : public MemoryObserver {
+    struct Page {
+        DecodedInstruction entries[PageSize];
+        std::vector<DecodedObjects> objects;
+    };
+
+    const std::map<uint8_t, std::shared_ptr<const Opcode>> &opcodes;
+    PagedTable<Page> pages;
+    size_t max_instruction_length = 1;
+
+    void decode(const Memory &m, uint32_t address, Page &page);
+
+    public:
+    InstructionCache(const std::map<uint8_t, std::shared_ptr<const Opcode>> &opcodes);
+
+    /**
+     * Return the instruction at the address, decoding it if it is not cached.
+     * @param[in] m
+     * @param[in] address
+     */
+    const DecodedInstruction &fetch(const Memory &m, uint32_t address) {
+        Page *page = pages.find(address);
+        if (page != nullptr && page->entries[address & (PageSize - 1)].valid) {
+            return page->entries[address & (PageSize - 1)];
+        }
+        Page &fresh = pages.touch(address);
+        decode(m, address, fresh);
+        return fresh.entries[address & (PageSize - 1)];
+    }
+    /**
+     * Return the opcode objects of the instruction at the address.
+     * @param[in] address - must have been fetched since it was last invalidated.
+     */
+    const DecodedObjects &objects(uint32_t address) const {
+        const Page *page = pages.find(address);
+        return page->objects[page->entries[address & (PageSize - 1)].slot - 1];
+    }
+    /**
+     * Return the opcode of the instruction at the address.
+     * @param[in] address - must have been fetched since it was last invalidated.
+     */
+    const Opcode &opcode(uint32_t address) const {
+        return *objects(address).opcode;
+    }
+
+    void fuse(uint32_t address, std::shared_ptr<const Opcode> fused, size_t length, size_t count);
+    void invalidate(size_t address, size_t length);
+    void clear();
+    void memory_written(size_t address, size_t length);
+};
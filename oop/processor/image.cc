@@ -0,0 +1,215 @@
+#include "image.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdexcept>
+#include <algorithm>
+
+static uint64_t align_page(uint64_t offset) {
+    return (offset + PageSize - 1) & ~(uint64_t)(PageSize - 1);
+}
+
+static void write_bytes(FILE *f, const void *data, size_t length) {
+    if (length && fwrite(data, 1, length, f) != length) {
+        throw std::runtime_error("Could not write image.");
+    }
+}
+
+/**
+ * Check whether a file starts with the image magic, otherwise it is a raw regs and memory dump.
+ * @param[in] fname
+ */
+bool is_image(const char *fname) {
+    FILE *f = fopen(fname, "rb");
+    if (f == NULL) {
+        throw std::runtime_error("Could not open file.");
+    }
+    char magic[sizeof(ImageMagic)];
+    bool res = fread(magic, 1, sizeof(magic), f) == sizeof(magic) && memcmp(magic, ImageMagic, sizeof(magic)) == 0;
+    fclose(f);
+    return res;
+}
+
+/**
+ * Write registers, every run of allocated pages as a section and the labels as symbols.
+ * The file is written sequentially, so it can go to a pipe.
+ * @param[in] f
+ * @param[in] regs
+ * @param[in] m
+ * @param[in] code_end - sections below it are marked as code.
+ */
+void write_image(FILE *f, Registers &regs, const Memory &m, uint32_t code_end) {
+    std::vector<ImageSection> sections;
+    for(auto address: m.page_addresses()) {
+        if (!sections.empty() && (uint64_t)sections.back().address + sections.back().size == address) {
+            sections.back().size += PageSize;
+            continue;
+        }
+        ImageSection section = {};
+        section.address = address;
+        section.size = PageSize;
+        sections.push_back(section);
+    }
+    /* split the run the code ends in, so the code sections end exactly at code_end */
+    for(size_t i = 0; i < sections.size(); i++) {
+        uint64_t end = (uint64_t)sections[i].address + sections[i].size;
+        if (sections[i].address < code_end && code_end < end) {
+            ImageSection data = {};
+            data.address = code_end;
+            data.size = end - code_end;
+            sections[i].size = code_end - sections[i].address;
+            sections.insert(sections.begin() + i + 1, data);
+            break;
+        }
+    }
+
+    std::vector<std::pair<std::string, uint32_t>> symbols(m.get_labels().begin(), m.get_labels().end());
+    uint64_t symbols_size = 0;
+    for(auto &symbol: symbols) {
+        symbols_size += 2 * sizeof(uint32_t) + symbol.first.size();
+    }
+
+    ImageHeader header = {};
+    memcpy(header.magic, ImageMagic, sizeof(ImageMagic));
+    header.version = ImageVersion;
+    header.section_count = sections.size();
+    header.symbol_count = symbols.size();
+    header.symbols_offset = sizeof(header) + sections.size() * sizeof(ImageSection);
+    memcpy(header.regs, regs.data(), sizeof(header.regs));
+
+    uint64_t offset = align_page(header.symbols_offset + symbols_size);
+    for(auto &section: sections) {
+        /* the trailing unwritten part of the last page is not part of the image */
+        uint64_t end = std::min<uint64_t>((uint64_t)section.address + section.size, std::max<uint64_t>(m.size(), (uint64_t)section.address + 1));
+        section.size = end - section.address;
+        section.offset = offset;
+        section.flags = section.address < code_end ? ImageSectionCode : ImageSectionData;
+        offset += align_page(section.size);
+    }
+
+    write_bytes(f, &header, sizeof(header));
+    write_bytes(f, sections.data(), sections.size() * sizeof(ImageSection));
+    for(auto &symbol: symbols) {
+        uint32_t fields[2] = {symbol.second, (uint32_t)symbol.first.size()};
+        write_bytes(f, fields, sizeof(fields));
+        write_bytes(f, symbol.first.data(), symbol.first.size());
+    }
+    static const uint8_t zero_page[PageSize] = {};
+    uint64_t position = header.symbols_offset + symbols_size;
+    for(auto &section: sections) {
+        write_bytes(f, zero_page, section.offset - position);
+        /* a section split off at the end of the code starts within a page */
+        for(uint64_t done = 0; done < section.size; ) {
+            uint64_t address = (uint64_t)section.address + done;
+            uint64_t in_page = address & (PageSize - 1);
+            uint64_t length = std::min<uint64_t>(PageSize - in_page, section.size - done);
+            const uint8_t *page = m.get_page(address);
+            write_bytes(f, page ? page + in_page : zero_page, length);
+            done += length;
+        }
+        write_bytes(f, zero_page, align_page(section.size) - section.size);
+        position = section.offset + align_page(section.size);
+    }
+}
+
+/**
+ * Load an image by mapping the whole file privately, page aligned sections become guest pages without a copy.
+ * @param[in] fname
+ * @param[out] regs
+ * @param[out] m
+ * @param[out] code_end - end of the last code section.
+ */
+uint32_t load_image(const char *fname, Registers &regs, Memory &m) {
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open file.");
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ImageHeader)) {
+        close(fd);
+        throw std::runtime_error("Image is truncated.");
+    }
+    size_t file_size = st.st_size;
+    void *addr = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        throw std::runtime_error("Could not map image.");
+    }
+    std::shared_ptr<uint8_t> mapping((uint8_t *)addr, [file_size](uint8_t *p) { munmap(p, file_size); });
+    uint8_t *base = mapping.get();
+
+    ImageHeader header;
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, ImageMagic, sizeof(ImageMagic)) != 0) {
+        throw std::runtime_error("Not an image.");
+    }
+    if (header.version != ImageVersion) {
+        throw std::runtime_error("Unsupported image version " + std::to_string(header.version) + ".");
+    }
+    if (sizeof(header) + (uint64_t)header.section_count * sizeof(ImageSection) > file_size) {
+        throw std::runtime_error("Image is truncated.");
+    }
+    for(size_t i = 0; i < RegisterCount; i++) {
+        regs.set(i, header.regs[i]);
+    }
+
+    const ImageSection *sections = (const ImageSection *)(base + sizeof(header));
+    uint32_t code_end = 0;
+    for(size_t i = 0; i < header.section_count; i++) {
+        ImageSection section = sections[i];
+        if (section.offset > file_size || section.size > file_size - section.offset) {
+            throw std::runtime_error("Image section is out of the file.");
+        }
+        bool mappable = (section.address & (PageSize - 1)) == 0
+            && (section.offset & (PageSize - 1)) == 0
+            && section.offset + align_page(section.size) <= file_size;
+        if (mappable) {
+            m.map_pages(section.address, base + section.offset, section.size, mapping);
+        } else {
+            m.write_bytes(section.address, base + section.offset, section.size);
+        }
+        if (section.flags & ImageSectionCode) {
+            code_end = std::max<uint32_t>(code_end, section.address + section.size);
+        }
+    }
+
+    uint64_t offset = header.symbols_offset;
+    for(size_t i = 0; i < header.symbol_count; i++) {
+        uint32_t fields[2];
+        if (offset + sizeof(fields) > file_size) {
+            throw std::runtime_error("Image symbol table is truncated.");
+        }
+        memcpy(fields, base + offset, sizeof(fields));
+        offset += sizeof(fields);
+        if (fields[1] > file_size - offset) {
+            throw std::runtime_error("Image symbol table is truncated.");
+        }
+        m.add_label(std::string((const char *)base + offset, fields[1]), fields[0]);
+        offset += fields[1];
+    }
+    return code_end;
+}
+
+/**
+ * Load the headerless format: the registers followed by memory from address zero.
+ * @param[in] f
+ * @param[out] regs
+ * @param[out] m
+ */
+void load_raw_image(FILE *f, Registers &regs, Memory &m) {
+    uint32_t raw_regs[RegisterCount] = {};
+    if (fread(raw_regs, sizeof(uint32_t), RegisterCount, f) != RegisterCount) {
+        throw std::runtime_error("Raw image is truncated.");
+    }
+    for(size_t i = 0; i < RegisterCount; i++) {
+        regs.set(i, raw_regs[i]);
+    }
+    std::vector<uint8_t> buffer(PageSize);
+    size_t address = 0;
+    size_t n;
+    while ((n = fread(buffer.data(), 1, buffer.size(), f)) > 0) {
+        m.write_bytes(address, buffer.data(), n);
+        address += n;
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "memory.h"
+#include "register.h"
+#include <cstdio>
+
+/*
+ * Image layout, all integers little endian:
+ *   ImageHeader
+ *   ImageSection[section_count]
+ *   symbols at symbols_offset: { uint32_t address; uint32_t name_length; char name[name_length]; }[symbol_count]
+ *   section data, each section starts at a page aligned file offset and is padded to a whole page
+ * Page aligned sections are mapped into guest memory straight from the file, copy on write.
+ */
+const char ImageMagic[4] = {'K', 'E', 'K', 'I'};
+const uint32_t ImageVersion = 1;
+
+const uint32_t ImageSectionCode = 1;
+const uint32_t ImageSectionData = 2;
+
+struct ImageHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t section_count;
+    uint32_t symbol_count;
+    uint64_t symbols_offset;
+    uint32_t regs[RegisterCount];
+};
+
+struct ImageSection {
+    uint32_t address;
+    uint32_t size;
+    uint64_t offset;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+bool is_image(const char *fname);
+void write_image(FILE *f, Registers &regs, const Memory &m, uint32_t code_end);
+uint32_t load_image(const char *fname, Registers &regs, Memory &m);
+void load_raw_image(FILE *f, Registers &regs, Memory &m);
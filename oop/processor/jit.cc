@@ -0,0 +1,594 @@
+#include <sys/mman.h>
+#include "jit.h"
+#include "cfg.h"
+#include "optable.h"
+
+static const size_t JitBufferSize = 16 << 20;
+static const size_t MaxBlockInstructions = 256;
+static const size_t MaxBlockCodeSize = MaxBlockInstructions * 64;
+
+enum class JitOp {
+#define X(name, mnemonic, expr) name,
+    BINARY_OPERATIONS(X)
+    UNARY_OPERATIONS(X)
+#undef X
+    Ldr,
+    Str,
+};
+
+/**
+ * Return the operation the compiler emits for an opcode of the instruction set, false if it has none.
+ * ldr and str are the moves between a register and memory, three-operand forms emit the operation of their
+ * two-operand form.
+ * @param[in] spec
+ * @param[out] op
+ */
+static constexpr bool spec_jit_op(const OpcodeSpec &spec, JitOp &op) {
+    if (spec.width != 4) {
+        return false;
+    }
+    if (spec.family == OpcodeFamily::Binary || spec.family == OpcodeFamily::ThreeOperand) {
+        if (spec.args[1] == ArgKind::Address) {
+            op = JitOp::Ldr;
+            return (BinaryOperation)spec.operation == BinaryOperation::Mov;
+        }
+        if (spec.args[0] == ArgKind::Address) {
+            op = JitOp::Str;
+            return (BinaryOperation)spec.operation == BinaryOperation::Mov;
+        }
+        switch ((BinaryOperation)spec.operation) {
+#define X(name, mnemonic, expr) case BinaryOperation::name: op = JitOp::name; return true;
+            BINARY_OPERATIONS(X)
+#undef X
+        }
+    } else if (spec.family == OpcodeFamily::Unary) {
+        switch ((UnaryOperation)spec.operation) {
+#define X(name, mnemonic, expr) case UnaryOperation::name: op = JitOp::name; return true;
+            UNARY_OPERATIONS(X)
+#undef X
+        }
+    }
+    return false;
+}
+
+/**
+ * Return the second opcode byte of the jcc to the fallthrough, taken when a jump on the condition isn't.
+ * @param[in] condition
+ */
+static constexpr uint8_t fallthrough_jcc(JumpCondition condition) {
+    switch (condition) {
+        case JumpCondition::Zero:
+        case JumpCondition::Equal:
+            return 0x85;    /* jne */
+        case JumpCondition::NonZero:
+        case JumpCondition::NotEqual:
+            return 0x84;    /* je */
+        case JumpCondition::Less:
+            return 0x8d;    /* jge */
+        case JumpCondition::GreaterEqual:
+            return 0x8c;    /* jl */
+        case JumpCondition::Always:
+            break;
+    }
+    return 0;
+}
+
+/* how the compiler handles an opcode number */
+struct JitSpec {
+    bool compilable = false;
+    JitOp op = JitOp::Add;
+    /* of conditional jumps, see fallthrough_jcc */
+    uint8_t jcc = 0;
+};
+
+/**
+ * Return how the compiler handles every opcode number, jumps are compiled and exit is not.
+ */
+static constexpr std::array<JitSpec, 256> make_jit_specs() {
+    std::array<JitSpec, 256> specs {};
+    for(size_t i = 0; i < OpcodeSpecCount; i++) {
+        const OpcodeSpec &spec = OpcodeSpecs[i];
+        if (spec.family == OpcodeFamily::Jump) {
+            specs[i].compilable = true;
+            specs[i].jcc = fallthrough_jcc((JumpCondition)spec.operation);
+        } else {
+            specs[i].compilable = spec_jit_op(spec, specs[i].op);
+        }
+    }
+    return specs;
+}
+
+static constexpr std::array<JitSpec, 256> JitSpecs = make_jit_specs();
+
+/**
+ * Writes x86-64 machine code at a position in the code buffer.
+ */
+class X86Emitter {
+    uint8_t *p;
+
+    public:
+    X86Emitter(uint8_t *p)
+        : p {p}
+    {}
+
+    uint8_t *pos() {
+        return p;
+    }
+
+    void bytes(std::initializer_list<uint8_t> bs) {
+        for(auto b: bs) {
+            *p++ = b;
+        }
+    }
+
+    void dword(uint32_t value) {
+        memcpy(p, &value, sizeof(value));
+        p += sizeof(value);
+    }
+
+    void qword(uint64_t value) {
+        memcpy(p, &value, sizeof(value));
+        p += sizeof(value);
+    }
+
+    /**
+     * Emit a zero rel32 and return its position for patching.
+     */
+    uint8_t *rel32() {
+        uint8_t *site = p;
+        dword(0);
+        return site;
+    }
+};
+
+static void set_rel32(uint8_t *site, uint8_t *target) {
+    int32_t rel = target - (site + 4);
+    memcpy(site, &rel, sizeof(rel));
+}
+
+/* displacement of a guest register from the pinned register array in rbx */
+static uint8_t reg_disp(uint32_t reg) {
+    return reg * sizeof(uint32_t);
+}
+
+uint32_t jit_load(JitState *state, uint32_t address) {
+    return state->engine->mem.read_type<uint32_t>(address);
+}
+
+/**
+ * Store from compiled code, returning whether compiled code was overwritten and the block has to be left.
+ */
+uint32_t jit_store(JitState *state, uint32_t address, uint32_t value) {
+    state->engine->mem.write_type<uint32_t>(address, value);
+    return state->code_dirty;
+}
+
+/**
+ * Return whether the compiler handles the opcode, which must not touch rip or invalid registers.
+ * @param[in] number - of the opcode.
+ * @param[in] opcode
+ */
+static bool is_compilable(uint8_t number, const Opcode &opcode) {
+    if (!JitSpecs[number].compilable) {
+        return false;
+    }
+    for(auto &arg: opcode.get_args()) {
+        if (arg->kind() == ArgKind::Reg && (arg->get_raw_value() >= RegisterCount || arg->get_raw_value() == RIP)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * JitEngine constructor
+ * @param[in] regs
+ * @param[in] mem
+ * @param[in] stack
+ * @param[in] icache - used to decode the instructions being compiled or interpreted.
+ * @param[in] io - guest input and output.
+ */
+JitEngine::JitEngine(Registers &regs, Memory &mem, Memory &stack, InstructionCache &icache, GuestIO &io)
+    : regs {regs}
+    , mem {mem}
+    , stack {stack}
+    , icache {icache}
+    , io {io}
+{
+#if !defined(__x86_64__)
+    throw std::runtime_error("The JIT only supports x86-64 hosts.");
+#endif
+    void *p = mmap(NULL, JitBufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        throw std::runtime_error("Could not allocate executable memory.");
+    }
+    buffer = (uint8_t *)p;
+    buffer_size = JitBufferSize;
+    state.engine = this;
+    {
+        WriteScope scope(*this);
+        emit_trampoline();
+    }
+    mem.add_observer(this);
+}
+
+JitEngine::~JitEngine() {
+    mem.remove_observer(this);
+    munmap(buffer, buffer_size);
+}
+
+/**
+ * Make the code buffer writable if it is not already.
+ * @param[in] engine
+ */
+JitEngine::WriteScope::WriteScope(JitEngine &engine)
+    : engine {engine}
+{
+    if (engine.writers++ == 0 && mprotect(engine.buffer, engine.buffer_size, PROT_READ | PROT_WRITE) != 0) {
+        engine.writers--;
+        throw std::runtime_error("Could not make the compiled code writable.");
+    }
+}
+
+JitEngine::WriteScope::~WriteScope() {
+    if (--engine.writers == 0 && mprotect(engine.buffer, engine.buffer_size, PROT_READ | PROT_EXEC) != 0) {
+        std::cerr << "Could not make the compiled code executable." << std::endl;
+        std::abort();
+    }
+}
+
+/**
+ * Emit the entry sequence pinning the registers and state, and the exit sequence compiled blocks jump to.
+ */
+void JitEngine::emit_trampoline() {
+    X86Emitter e(buffer);
+    enter = (void (*)(uint32_t *, JitState *, uint8_t *))e.pos();
+    e.bytes({0x53});                /* push rbx */
+    e.bytes({0x41, 0x54});          /* push r12 */
+    e.bytes({0x55});                /* push rbp */
+    e.bytes({0x48, 0x89, 0xfb});    /* mov rbx, rdi */
+    e.bytes({0x49, 0x89, 0xf4});    /* mov r12, rsi */
+    e.bytes({0xff, 0xe2});          /* jmp rdx */
+    exit_stub = e.pos();
+    e.bytes({0x5d});                /* pop rbp */
+    e.bytes({0x41, 0x5c});          /* pop r12 */
+    e.bytes({0x5b});                /* pop rbx */
+    e.bytes({0xc3});                /* ret */
+    buffer_used = e.pos() - buffer;
+}
+
+/**
+ * Point a block exit at the compiled target, or remember it until the target gets compiled.
+ * @param[in] site - rel32 of the exit's jump.
+ * @param[in] target
+ */
+void JitEngine::link(uint8_t *site, uint32_t target) {
+    if (!chaining) {
+        return;
+    }
+    auto block = blocks.find(target);
+    if (block != blocks.end()) {
+        if (block->second != nullptr) {
+            set_rel32(site, block->second);
+        }
+        return;
+    }
+    pending_links[target].push_back(site);
+}
+
+/**
+ * Drop all compiled code.
+ */
+void JitEngine::flush() {
+    WriteScope scope(*this);
+    blocks.clear();
+    pending_links.clear();
+    code_pages.for_each([](CodePage &page) { page.compiled.reset(); });
+    state.code_dirty = false;
+    emit_trampoline();
+}
+
+/**
+ * Compile the block starting at the address.
+ * @param[in] address
+ * @param[out] code - nullptr if the first instruction has to be interpreted.
+ */
+uint8_t *JitEngine::compile_block(uint32_t address) {
+    WriteScope scope(*this);
+    if (buffer_size - buffer_used < MaxBlockCodeSize) {
+        flush();
+    }
+    X86Emitter e(buffer + buffer_used);
+    uint8_t *entry = e.pos();
+    uint32_t pc = address;
+    uint32_t count = 0;
+
+    /* leave the block for the given rip, linkable exits may later be chained directly to the target */
+    auto emit_exit = [&](uint32_t target, bool linkable) {
+        e.bytes({0x49, 0x81, 0x04, 0x24});      /* add qword [r12], count */
+        e.dword(count);
+        if (linkable) {
+            e.bytes({0xe9});                    /* jmp target block, falls through until linked */
+            uint8_t *site = e.rel32();
+            link(site, target);
+        }
+        e.bytes({0xc7, 0x43, reg_disp(RIP)});   /* mov dword [rbx + rip], target */
+        e.dword(target);
+        e.bytes({0xe9});                        /* jmp exit */
+        set_rel32(e.rel32(), exit_stub);
+    };
+
+    for(;;) {
+        if (count == MaxBlockInstructions || (count > 0 && leaders.find(pc) != leaders.end())) {
+            emit_exit(pc, true);
+            break;
+        }
+
+        const DecodedInstruction *instr = NULL;
+        try {
+            instr = &icache.fetch(mem, pc);
+        } catch (const std::runtime_error &e) {
+        }
+        bool compilable = instr != NULL && is_compilable(instr->opcode_no, icache.opcode(pc));
+        for(size_t i = pc; compilable && i < (size_t)pc + instr->length; i++) {
+            CodePage *page = code_pages.find(i);
+            if (page != nullptr && page->modified[i & (PageSize - 1)]) {
+                compilable = false;
+            }
+        }
+        if (!compilable) {
+            if (count == 0) {
+                blocks[address] = nullptr;
+                return nullptr;
+            }
+            emit_exit(pc, false);
+            break;
+        }
+
+        const Opcode &opcode = icache.opcode(pc);
+        auto &args = opcode.get_args();
+        uint32_t next = pc + instr->length;
+        count++;
+
+        uint32_t target;
+        bool conditional;
+        if (is_jump(opcode, target, conditional)) {
+            pc = next;
+            if (conditional) {
+                if (args.size() == 2) {
+                    e.bytes({0x83, 0x7b, reg_disp(args[1]->get_raw_value()), 0x00});   /* cmp dword [rbx + reg], 0 */
+                } else {
+                    e.bytes({0x8b, 0x43, reg_disp(args[1]->get_raw_value())});         /* mov eax, [rbx + a] */
+                    if (args[2]->kind() == ArgKind::Int) {
+                        e.bytes({0x3d});                                                /* cmp eax, b */
+                        e.dword(args[2]->get_raw_value());
+                    } else {
+                        e.bytes({0x3b, 0x43, reg_disp(args[2]->get_raw_value())});     /* cmp eax, [rbx + b] */
+                    }
+                }
+                e.bytes({0x0f, JitSpecs[instr->opcode_no].jcc});   /* jcc fallthrough */
+                uint8_t *fallthrough = e.rel32();
+                emit_exit(target, true);
+                set_rel32(fallthrough, e.pos());
+                emit_exit(next, true);
+            } else {
+                emit_exit(target, true);
+            }
+            break;
+        }
+
+        JitOp op = JitSpecs[instr->opcode_no].op;
+        uint8_t a = reg_disp(args[0]->get_raw_value());
+        /* the first operand, it is the destination unless the opcode has three operands */
+        uint8_t src = reg_disp(args[args.size() == 3 ? 1 : 0]->get_raw_value());
+        uint32_t b = args.size() > 1 ? args.back()->get_raw_value() : 0;
+        bool immediate = args.size() > 1 && args.back()->kind() == ArgKind::Int;
+        switch (op) {
+            case JitOp::Bitflip:
+                e.bytes({0xf7, 0x53, a});                       /* not dword [rbx + a] */
+                break;
+            case JitOp::Neg:
+                e.bytes({0xf7, 0x5b, a});                       /* neg dword [rbx + a] */
+                break;
+            case JitOp::Ldr:
+                e.bytes({0x4c, 0x89, 0xe7});                    /* mov rdi, r12 */
+                e.bytes({0xbe});                                /* mov esi, address */
+                e.dword(b);
+                e.bytes({0x48, 0xb8});                          /* mov rax, jit_load */
+                e.qword((uint64_t)&jit_load);
+                e.bytes({0xff, 0xd0});                          /* call rax */
+                e.bytes({0x89, 0x43, a});                       /* mov [rbx + a], eax */
+                break;
+            case JitOp::Str:
+                {
+                    e.bytes({0x4c, 0x89, 0xe7});                /* mov rdi, r12 */
+                    e.bytes({0xbe});                            /* mov esi, address */
+                    e.dword(args[0]->get_raw_value());
+                    e.bytes({0x8b, 0x53, reg_disp(b)});         /* mov edx, [rbx + b] */
+                    e.bytes({0x48, 0xb8});                      /* mov rax, jit_store */
+                    e.qword((uint64_t)&jit_store);
+                    e.bytes({0xff, 0xd0});                      /* call rax */
+                    e.bytes({0x84, 0xc0});                      /* test al, al */
+                    e.bytes({0x0f, 0x84});                      /* je continue */
+                    uint8_t *skip = e.rel32();
+                    emit_exit(next, false);
+                    set_rel32(skip, e.pos());
+                }
+                break;
+            default:
+                if (op != JitOp::Mov) {
+                    e.bytes({0x8b, 0x43, src});                 /* mov eax, [rbx + src] */
+                }
+                switch (op) {
+                    case JitOp::Add:
+                    case JitOp::Sub:
+                    case JitOp::Xor:
+                    case JitOp::And:
+                    case JitOp::Or:
+                        {
+                            /* register and immediate forms of op eax, src */
+                            static const std::map<JitOp, std::pair<uint8_t, uint8_t>> encodings = {
+                                {JitOp::Add, {0x03, 0x05}},
+                                {JitOp::Sub, {0x2b, 0x2d}},
+                                {JitOp::Xor, {0x33, 0x35}},
+                                {JitOp::And, {0x23, 0x25}},
+                                {JitOp::Or, {0x0b, 0x0d}},
+                            };
+                            if (immediate) {
+                                e.bytes({encodings.at(op).second});
+                                e.dword(b);
+                            } else {
+                                e.bytes({encodings.at(op).first, 0x43, reg_disp(b)});
+                            }
+                        }
+                        break;
+                    case JitOp::Mov:
+                        if (immediate) {
+                            e.bytes({0xb8});                    /* mov eax, imm */
+                            e.dword(b);
+                        } else {
+                            e.bytes({0x8b, 0x43, reg_disp(b)}); /* mov eax, [rbx + b] */
+                        }
+                        break;
+                    case JitOp::Lshift:
+                    case JitOp::Rshift:
+                        if (immediate) {
+                            e.bytes({0xb9});                    /* mov ecx, imm */
+                            e.dword(b);
+                        } else {
+                            e.bytes({0x8b, 0x4b, reg_disp(b)}); /* mov ecx, [rbx + b] */
+                        }
+                        e.bytes({0xd3, (uint8_t)(op == JitOp::Lshift ? 0xe0 : 0xe8)}); /* shl/shr eax, cl */
+                        break;
+                    case JitOp::Mul:
+                        if (immediate) {
+                            e.bytes({0x69, 0xc0});              /* imul eax, eax, imm */
+                            e.dword(b);
+                        } else {
+                            e.bytes({0x0f, 0xaf, 0x43, reg_disp(b)}); /* imul eax, [rbx + b] */
+                        }
+                        break;
+                    case JitOp::Div:
+                    case JitOp::Mod:
+                        e.bytes({0x31, 0xd2});                  /* xor edx, edx */
+                        if (immediate) {
+                            e.bytes({0xb9});                    /* mov ecx, imm */
+                            e.dword(b);
+                            e.bytes({0xf7, 0xf1});              /* div ecx */
+                        } else {
+                            e.bytes({0xf7, 0x73, reg_disp(b)}); /* div dword [rbx + b] */
+                        }
+                        break;
+                    default:
+                        throw std::logic_error("Unhandled JIT operation.");
+                }
+                if (op == JitOp::Mod) {
+                    e.bytes({0x89, 0x53, a});                   /* mov [rbx + a], edx */
+                } else {
+                    e.bytes({0x89, 0x43, a});                   /* mov [rbx + a], eax */
+                }
+        }
+        pc = next;
+    }
+
+    for(size_t i = address; i < pc; i++) {
+        code_pages.touch(i).compiled[i & (PageSize - 1)] = true;
+    }
+    buffer_used = e.pos() - buffer;
+    blocks[address] = entry;
+
+    auto links = pending_links.find(address);
+    if (links != pending_links.end()) {
+        for(auto site: links->second) {
+            set_rel32(site, entry);
+        }
+        pending_links.erase(links);
+    }
+    return entry;
+}
+
+/**
+ * Enable or disable chaining blocks directly to each other.
+ * Without it every step executes exactly one block.
+ * @param[in] enabled
+ */
+void JitEngine::set_chaining(bool enabled) {
+    chaining = enabled;
+}
+
+/**
+ * Find and compile the basic blocks reachable from the entry.
+ * @param[in] entry
+ */
+void JitEngine::compile_reachable(uint32_t entry) {
+    /* one protection change for all the blocks */
+    WriteScope scope(*this);
+    for(auto &block: find_basic_blocks(icache, mem, entry)) {
+        leaders.insert(block.first);
+    }
+    for(auto leader: leaders) {
+        if (blocks.find(leader) == blocks.end()) {
+            compile_block(leader);
+        }
+    }
+}
+
+/**
+ * Execute compiled code from rip until it leaves to the dispatcher, or interpret a single instruction.
+ * @param[out] executed - instructions executed by this step.
+ * @param[out] stop - the program exited.
+ */
+bool JitEngine::step(uint64_t &executed) {
+    if (state.code_dirty) {
+        flush();
+    }
+    uint32_t rip = regs.get(RIP);
+    auto block = blocks.find(rip);
+    uint8_t *code = block == blocks.end() ? compile_block(rip) : block->second;
+    if (code != nullptr) {
+        uint64_t before = state.executed;
+        enter(regs.data(), &state, code);
+        executed = state.executed - before;
+        return false;
+    }
+
+    const DecodedInstruction &instr = icache.fetch(mem, rip);
+    regs.set(RIP, rip + instr.length);
+    state.executed++;
+    executed = 1;
+    return icache.opcode(rip).execute(regs, mem, stack, io);
+}
+
+/**
+ * Run from the current rip until an exit opcode.
+ * @param[out] executed - number of executed instructions.
+ */
+uint64_t JitEngine::run() {
+    compile_reachable(regs.get(RIP));
+    uint64_t executed;
+    while (!step(executed)) {
+    }
+    return state.executed;
+}
+
+/**
+ * Remember overwritten compiled code, it is dropped before the next step and interpreted from then on.
+ * @param[in] address
+ * @param[in] length
+ */
+void JitEngine::memory_written(size_t address, size_t length) {
+    size_t end = std::min(address + length, (size_t)1 << 32);
+    for(size_t i = address; i < end; i = (i | (PageSize - 1)) + 1) {
+        CodePage *page = code_pages.find(i);
+        if (page == nullptr) {
+            continue;
+        }
+        size_t page_end = std::min(end, (i | (PageSize - 1)) + 1);
+        for(size_t j = i; j < page_end; j++) {
+            if (page->compiled[j & (PageSize - 1)]) {
+                state.code_dirty = true;
+                page->modified[j & (PageSize - 1)] = true;
+            }
+        }
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include "opcode.h"
+#include "memory.h"
+#include "icache.h"
+
+class JitEngine;
+
+/**
+ * State reachable from compiled code, pinned in r12 while it runs.
+ */
+struct JitState {
+    uint64_t executed = 0;
+    JitEngine *engine = nullptr;
+    bool code_dirty = false;
+};
+
+/**
+ * Basic block compiler from raw code to x86-64.
+ * Guest registers stay in the pinned Registers array, blocks are chained with direct jumps
+ * and anything the compiler does not handle, including I/O and code written at runtime, is interpreted.
+ * The code buffer is never writable and executable at once: it is mapped read-write, and flipped to read-execute
+ * with mprotect whenever no block is being emitted or chained, so hosts enforcing W^X can run it.
+ */
+class JitEngine : public MemoryObserver {
+    /**
+     * Flags of the guest code bytes of one page.
+     */
+    struct CodePage {
+        /* part of a compiled block */
+        std::bitset<PageSize> compiled;
+        /* written after it was compiled, interpreted from then on */
+        std::bitset<PageSize> modified;
+    };
+    /**
+     * Keeps the code buffer writable while it lives, the outermost one makes it executable again.
+     */
+    class WriteScope {
+        JitEngine &engine;
+        public:
+        WriteScope(JitEngine &engine);
+        ~WriteScope();
+    };
+
+    Registers &regs;
+    Memory &mem;
+    Memory &stack;
+    InstructionCache &icache;
+    GuestIO &io;
+    JitState state;
+
+    uint8_t *buffer = nullptr;
+    size_t buffer_size = 0;
+    size_t buffer_used = 0;
+    size_t writers = 0;
+    uint8_t *exit_stub = nullptr;
+    void (*enter)(uint32_t *regs, JitState *state, uint8_t *block) = nullptr;
+
+    std::unordered_map<uint32_t, uint8_t *> blocks;
+    std::unordered_map<uint32_t, std::vector<uint8_t *>> pending_links;
+    std::set<uint32_t> leaders;
+    PagedTable<CodePage> code_pages;
+    bool chaining = true;
+
+    void emit_trampoline();
+    uint8_t *compile_block(uint32_t address);
+    void link(uint8_t *site, uint32_t target);
+    void flush();
+
+    friend uint32_t jit_load(JitState *state, uint32_t address);
+    friend uint32_t jit_store(JitState *state, uint32_t address, uint32_t value);
+
+    public:
+    JitEngine(Registers &regs, Memory &mem, Memory &stack, InstructionCache &icache, GuestIO &io);
+    JitEngine(const JitEngine &) = delete;
+    JitEngine &operator=(const JitEngine &) = delete;
+    ~JitEngine();
+
+    void set_chaining(bool enabled);
+    void compile_reachable(uint32_t entry);
+    bool step(uint64_t &executed);
+    uint64_t run();
+    void memory_written(size_t address, size_t length);
+};
@@ -0,0 +1,146 @@
+#include "lexer.h"
+#include "error.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+/**
+ * Return the view without blanks on both sides.
+ * @param[in] s
+ */
+static std::string_view strip_view(std::string_view s) {
+    size_t begin = 0;
+    while (begin < s.size() && is_blank(s[begin])) {
+        begin++;
+    }
+    size_t end = s.size();
+    while (end > begin && is_blank(s[end - 1])) {
+        end--;
+    }
+    return s.substr(begin, end - begin);
+}
+
+/**
+ * Split a line of assembly into a label or a mnemonic and its operands.
+ * A label line is "name:" or "name:length:", where length bytes are reserved after the label.
+ * @param[in] text - a single line without its line break.
+ * @param[out] line - views into text.
+ * @param[out] nonempty - false for blank lines.
+ */
+bool lex_line(std::string_view text, LexedLine &line) {
+    text = strip_view(text);
+    line = LexedLine();
+    if (text.empty()) {
+        return false;
+    }
+
+    if (text.back() == ':') {
+        /* label */
+        size_t first = text.find(':');
+        size_t second = text.find(':', first + 1);
+        if (second != std::string_view::npos && second != text.size() - 1) {
+            throw AsmException("Ill formated label %s.", std::string(text).c_str());
+        }
+        line.label = strip_view(text.substr(0, first));
+        if (second != std::string_view::npos) {
+            std::string_view length = text.substr(first + 1, second - first - 1);
+            auto length_parse_res = string_to_int(length);
+            if (!length_parse_res.second) {
+                throw AsmException("Couldn't parse number %s.", std::string(length).c_str());
+            }
+            line.label_length = length_parse_res.first;
+        }
+        return true;
+    }
+
+    /* instruction */
+    size_t mnemonic_end = 0;
+    while (mnemonic_end < text.size() && !is_blank(text[mnemonic_end])) {
+        mnemonic_end++;
+    }
+    line.mnemonic = text.substr(0, mnemonic_end);
+    if (mnemonic_end == text.size()) {
+        return true;
+    }
+    std::string_view rest = text.substr(mnemonic_end);
+    while (true) {
+        size_t comma = rest.find(',');
+        if (line.operand_count < MaxOperands) {
+            line.operands[line.operand_count] = strip_view(rest.substr(0, comma));
+        }
+        line.operand_count++;
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        rest = rest.substr(comma + 1);
+    }
+    return true;
+}
+
+/**
+ * Lexer constructor
+ * @param[in] source - must outlive the lexer and the lines it returns.
+ */
+Lexer::Lexer(std::string_view source) : source {source} {}
+
+/**
+ * Lex the next nonblank line, line breaks may be \n or \r\n.
+ * @param[out] line
+ * @param[out] found - false at the end of the source.
+ */
+bool Lexer::next(LexedLine &line) {
+    while (pos < source.size()) {
+        size_t end = source.find('\n', pos);
+        if (end == std::string_view::npos) {
+            end = source.size();
+        }
+        std::string_view text = source.substr(pos, end - pos);
+        pos = end + 1;
+        if (!text.empty() && text.back() == '\r') {
+            text.remove_suffix(1);
+        }
+        if (lex_line(text, line)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * SourceFile constructor
+ * @param[in] fname
+ */
+SourceFile::SourceFile(const char *fname) {
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open file.");
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        throw std::runtime_error("Could not open file.");
+    }
+    size = st.st_size;
+    if (size == 0) {
+        close(fd);
+        return;
+    }
+    void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        throw std::runtime_error("Could not map file.");
+    }
+    madvise(addr, size, MADV_SEQUENTIAL);
+    data = (const char *)addr;
+}
+
+SourceFile::~SourceFile() {
+    if (data != NULL) {
+        munmap((void *)data, size);
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <string_view>
+#include "opcode.h"
+
+/* most operands an instruction can have */
+const size_t MaxOperands = 3;
+
+/**
+ * A line of assembly split into views of the source text, nothing is copied.
+ * Labels have an empty mnemonic, instructions an empty label.
+ */
+struct LexedLine {
+    std::string_view label;
+    uint32_t label_length = 0;
+    std::string_view mnemonic;
+    std::string_view operands[MaxOperands];
+    /* may exceed MaxOperands, only the first ones are kept */
+    size_t operand_count = 0;
+};
+
+bool lex_line(std::string_view text, LexedLine &line);
+
+/**
+ * Splits a source buffer into lines and lexes them one after another.
+ */
+class Lexer {
+    std::string_view source;
+    size_t pos = 0;
+
+    public:
+    Lexer(std::string_view source);
+
+    bool next(LexedLine &line);
+};
+
+/**
+ * A source file mapped read only into memory, the views of its lexed lines stay valid while it exists.
+ */
+class SourceFile {
+    const char *data = NULL;
+    size_t size = 0;
+
+    public:
+    SourceFile(const char *fname);
+    SourceFile(const SourceFile &) = delete;
+    SourceFile &operator=(const SourceFile &) = delete;
+    ~SourceFile();
+
+    std::string_view text() const {
+        return std::string_view(data, size);
+    }
+};
@@ -0,0 +1,146 @@
+#include "linker.h"
+#include "error.h"
+
+/**
+ * Return the capacity of a new slot for an object of the given size, an eighth of it is slack.
+ * @param[in] size
+ * @param[in] jump_length - of the jump to the next slot.
+ */
+static uint64_t slot_capacity(uint32_t size, uint32_t jump_length) {
+    return (uint64_t)size + size / 8 + jump_length;
+}
+
+/**
+ * Linker constructor
+ * @param[in] table - to encode the jumps between slots.
+ */
+Linker::Linker(const OpcodeTable &table)
+    : table {table}, jump_length {(uint32_t)(1 + table.opcodes.at(table.lookup("jmp", 1))->len())} {}
+
+/**
+ * Replace the objects to link, they keep their slots as long as the objects in front of them do.
+ * @param[in] objects - names and objects in link order.
+ * @param[out] laid_out - number of objects which got a new slot.
+ */
+size_t Linker::update(const std::vector<std::pair<std::string, std::shared_ptr<const ObjectFile>>> &objects) {
+    size_t kept = 0;
+    while (kept < slots.size() && kept < objects.size() && slots[kept].name == objects[kept].first
+            && (uint64_t)objects[kept].second->size + jump_length <= slots[kept].capacity) {
+        slots[kept].object = objects[kept].second;
+        kept++;
+    }
+    slots.resize(kept);
+
+    uint64_t base = kept ? (uint64_t)slots.back().base + slots.back().capacity : 0;
+    for(size_t i = kept; i < objects.size(); i++) {
+        uint64_t capacity = slot_capacity(objects[i].second->size, jump_length);
+        if (base + capacity > UINT32_MAX) {
+            throw std::runtime_error("Linked program doesn't fit into memory.");
+        }
+        slots.push_back({objects[i].first, objects[i].second, (uint32_t)base, (uint32_t)capacity});
+        base += capacity;
+    }
+    return objects.size() - kept;
+}
+
+/**
+ * Write the objects into memory at their slots, resolve their relocations and add all labels.
+ * @param[in] m
+ * @param[in,out] code_end - raised to the end of the last instruction.
+ */
+void Linker::link(Memory &m, uint32_t &code_end) const {
+    std::unordered_map<std::string, uint32_t> addresses;
+    for(auto &slot: slots) {
+        if (slot.object == nullptr) {
+            throw std::logic_error("Object " + slot.name + " of the loaded layout was not updated.");
+        }
+        for(auto &symbol: slot.object->symbols) {
+            if (symbol.defined && !addresses.emplace(symbol.name, slot.base + symbol.address).second) {
+                throw AsmException("Label %s already exists.", symbol.name.c_str());
+            }
+        }
+    }
+
+    uint8_t jump = table.lookup("jmp", 1);
+    for(size_t i = 0; i < slots.size(); i++) {
+        const Slot &slot = slots[i];
+        const ObjectFile &object = *slot.object;
+        std::vector<uint8_t> code = object.code;
+        for(auto &relocation: object.relocations) {
+            const ObjectSymbol &symbol = object.symbols[relocation.symbol];
+            uint32_t value;
+            if (symbol.defined) {
+                value = slot.base + symbol.address;
+            } else {
+                auto address = addresses.find(symbol.name);
+                if (address == addresses.end()) {
+                    throw AsmException("No such label %s.", symbol.name.c_str());
+                }
+                value = address->second;
+            }
+            memcpy(&code[relocation.offset], &value, sizeof(value));
+        }
+        for(auto &run: object.runs) {
+            m.write_bytes(slot.base + run.begin, code.data() + run.begin, run.end - run.begin);
+        }
+        if (!object.runs.empty()) {
+            code_end = std::max<uint32_t>(code_end, slot.base + object.runs.back().end);
+        }
+
+        if (i + 1 < slots.size()) {
+            std::vector<uint8_t> bytes(jump_length);
+            bytes[0] = jump;
+            memcpy(bytes.data() + 1, &slots[i + 1].base, sizeof(uint32_t));
+            m.write_bytes(slot.base + object.size, bytes.data(), jump_length);
+            code_end = std::max<uint32_t>(code_end, slot.base + object.size + jump_length);
+        }
+    }
+
+    for(auto &address: addresses) {
+        m.add_label(address.first, address.second);
+    }
+}
+
+/**
+ * Return the start address of an object.
+ * @param[in] name
+ */
+uint32_t Linker::get_base(const std::string &name) const {
+    for(auto &slot: slots) {
+        if (slot.name == name) {
+            return slot.base;
+        }
+    }
+    throw std::runtime_error("No such object " + name + ".");
+}
+
+/**
+ * Write the layout, a line with base, capacity and name per slot.
+ * @param[in] out
+ */
+void Linker::save(std::ostream &out) const {
+    for(auto &slot: slots) {
+        out << slot.base << " " << slot.capacity << " " << slot.name << "\n";
+    }
+}
+
+/**
+ * Load a saved layout, the objects must be given by update before linking.
+ * @param[in] in
+ */
+void Linker::load(std::istream &in) {
+    slots.clear();
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        Slot slot;
+        if (!(fields >> slot.base >> slot.capacity) || fields.get() != ' ' || !std::getline(fields, slot.name)) {
+            throw std::runtime_error("Invalid link layout.");
+        }
+        uint64_t base = slots.empty() ? 0 : (uint64_t)slots.back().base + slots.back().capacity;
+        if (slot.base != base || slot.capacity < jump_length) {
+            throw std::runtime_error("Invalid link layout.");
+        }
+        slots.push_back(slot);
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "object.h"
+#include "opcode.h"
+#include "memory.h"
+
+/**
+ * Combines object files into one program, the first object starts at address 0.
+ * Every object gets a slot with some slack after it, so a relink keeps the slots of all objects in front
+ * of the first one that changed its name or outgrew its slot, only that one and the ones after it are
+ * laid out again. A slot with slack ends with a jump to the next slot, so falling off the end of an
+ * object continues in the next one like it would in a single source.
+ * The layout can be saved next to the linked image and loaded for the next link.
+ */
+class Linker {
+    struct Slot {
+        std::string name;
+        std::shared_ptr<const ObjectFile> object;
+        uint32_t base;
+        uint32_t capacity;
+    };
+
+    const OpcodeTable &table;
+    /* length of the jump from the end of a slot to the next one */
+    const uint32_t jump_length;
+    std::vector<Slot> slots;
+
+    public:
+    Linker(const OpcodeTable &table);
+
+    size_t update(const std::vector<std::pair<std::string, std::shared_ptr<const ObjectFile>>> &objects);
+    void link(Memory &m, uint32_t &code_end) const;
+    uint32_t get_base(const std::string &name) const;
+    void save(std::ostream &out) const;
+    void load(std::istream &in);
+};
@@ -1,59 +1,505 @@
 #include "opcode.h"
 #include "proc.h"
+#include "image.h"
+#include "batch.h"
+#include "scheduler.h"
+#include "linker.h"
+#include "cache.h"
+#include "trace.h"
+#include <fcntl.h>
+#include <unistd.h>
 
 std::map<int, std::shared_ptr<Opcode>> opcodes;
 std::map<std::string, std::shared_ptr<Opcode>> opcodes_by_name;
 
+struct Options {
+    std::string engine = "interp";
+    bool diff = false;
+    bool fuse = true;
+    bool stats = false;
+    bool optimize = false;
+    bool object = false;
+    bool priority = false;
+    uint64_t fuel = 10000;
+    uint64_t cache_size = 256 << 20;
+    size_t trace_size = 1 << 20;
+    TraceFilter filter;
+    char *output = NULL;
+    size_t threads = 0;
+    std::string input;
+    std::string output_file;
+    std::string cache_dir;
+    std::string trace;
+    std::string record;
+    std::string replay;
+    std::vector<char *> files;
+};
 
 void usage(char *argv[]) {
-    fprintf(stderr, "usage: %s <compile|run|debug> <fname>", argv[0]);
+    fprintf(stderr, "usage: %s compile [-O] [--cache-dir=dir] [--cache-size=bytes] <fname>\n", argv[0]);
+    fprintf(stderr, "       %s asm -c [-O] [-j threads] [-o <object>] <fname>...\n", argv[0]);
+    fprintf(stderr, "       %s link [--stats] [-o <image>] <object>...\n", argv[0]);
+    fprintf(stderr, "       %s <run|debug> [--engine=interp|threaded|jit] [--diff] [--no-fuse] [--stats] [--stdin=file] [--stdout=file] [--cache-dir=dir [-O]] [--trace=file [--trace-size=records]] [--record=file] [--replay=file] <fname>\n", argv[0]);
+    fprintf(stderr, "       %s trace-view [--from=address] [--to=address] [--reg=rN] <trace>\n", argv[0]);
+    fprintf(stderr, "       %s aot <fname> -o <out.cc>\n", argv[0]);
+    fprintf(stderr, "       %s convert <raw image> -o <image>\n", argv[0]);
+    fprintf(stderr, "       %s snapshot [--fuel=n] [--replay=file] <fname> -o <snapshot>\n", argv[0]);
+    fprintf(stderr, "       %s profile <fname> [-o <folded stacks>]\n", argv[0]);
+    fprintf(stderr, "       %s batch [--engine=interp|threaded|jit] [-j threads] [--stdin=suffix] [--stdout=suffix] <fname>...\n", argv[0]);
+    fprintf(stderr, "       %s schedule [-j threads] [--fuel=n] [--priority] [--stdin=suffix] [--stdout=suffix] <fname[@priority]>...\n", argv[0]);
     exit(1);
 }
 
-void compile(char *fname) {
+Options parse_options(int argc, char *argv[]) {
+    Options options;
+    for(int i = 2; i < argc; i++) {
+        if (strncmp(argv[i], "--engine=", strlen("--engine=")) == 0) {
+            options.engine = argv[i] + strlen("--engine=");
+            if (options.engine != "interp" && options.engine != "threaded" && options.engine != "jit") {
+                usage(argv);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            options.output = argv[++i];
+            continue;
+        }
+        if (strncmp(argv[i], "--stdin=", strlen("--stdin=")) == 0) {
+            options.input = argv[i] + strlen("--stdin=");
+            continue;
+        }
+        if (strncmp(argv[i], "--stdout=", strlen("--stdout=")) == 0) {
+            options.output_file = argv[i] + strlen("--stdout=");
+            continue;
+        }
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            options.threads = std::stoul(argv[++i]);
+            continue;
+        }
+        if (strncmp(argv[i], "--fuel=", strlen("--fuel=")) == 0) {
+            options.fuel = std::stoull(argv[i] + strlen("--fuel="));
+            continue;
+        }
+        if (strcmp(argv[i], "--priority") == 0) {
+            options.priority = true;
+            continue;
+        }
+        if (strncmp(argv[i], "--cache-dir=", strlen("--cache-dir=")) == 0) {
+            options.cache_dir = argv[i] + strlen("--cache-dir=");
+            continue;
+        }
+        if (strncmp(argv[i], "--cache-size=", strlen("--cache-size=")) == 0) {
+            options.cache_size = std::stoull(argv[i] + strlen("--cache-size="));
+            continue;
+        }
+        if (strncmp(argv[i], "--record=", strlen("--record=")) == 0) {
+            options.record = argv[i] + strlen("--record=");
+            continue;
+        }
+        if (strncmp(argv[i], "--replay=", strlen("--replay=")) == 0) {
+            options.replay = argv[i] + strlen("--replay=");
+            continue;
+        }
+        if (strncmp(argv[i], "--trace=", strlen("--trace=")) == 0) {
+            options.trace = argv[i] + strlen("--trace=");
+            continue;
+        }
+        if (strncmp(argv[i], "--trace-size=", strlen("--trace-size=")) == 0) {
+            options.trace_size = std::stoull(argv[i] + strlen("--trace-size="));
+            continue;
+        }
+        if (strncmp(argv[i], "--from=", strlen("--from=")) == 0) {
+            options.filter.from = std::stoul(argv[i] + strlen("--from="));
+            continue;
+        }
+        if (strncmp(argv[i], "--to=", strlen("--to=")) == 0) {
+            options.filter.to = std::stoul(argv[i] + strlen("--to="));
+            continue;
+        }
+        if (strncmp(argv[i], "--reg=", strlen("--reg=")) == 0) {
+            options.filter.reg = parse_register(argv[i] + strlen("--reg="));
+            continue;
+        }
+        if (strcmp(argv[i], "-c") == 0) {
+            options.object = true;
+            continue;
+        }
+        if (strcmp(argv[i], "-O") == 0) {
+            options.optimize = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--no-fuse") == 0) {
+            options.fuse = false;
+            continue;
+        }
+        if (strcmp(argv[i], "--stats") == 0) {
+            options.stats = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--diff") == 0) {
+            options.diff = true;
+            continue;
+        }
+        if (argv[i][0] == '-') {
+            usage(argv);
+        }
+        options.files.push_back(argv[i]);
+    }
+    return options;
+}
+
+void compile(char *fname, Options &options) {
+    if (options.cache_dir != "") {
+        /* a hit copies the stored image without parsing the source */
+        CompileCache cache(options.cache_dir, options.cache_size);
+        FILE *f = fopen(cache.get(fname, options.optimize).c_str(), "rb");
+        if (f == NULL) {
+            throw std::runtime_error("Could not open cached image.");
+        }
+        char buffer[1 << 16];
+        for(size_t read; (read = fread(buffer, 1, sizeof(buffer), f)) > 0;) {
+            fwrite(buffer, 1, read, stdout);
+        }
+        fclose(f);
+        return;
+    }
     Processor p;
+    p.set_optimization(options.optimize);
+    p.compile_file(fname);
+    p.dump_image(stdout);
+}
 
-    std::fstream fs(fname);
+std::string object_name(const std::string &fname) {
+    size_t dot = fname.rfind('.');
+    size_t slash = fname.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return fname + ".o";
+    }
+    return fname.substr(0, dot) + ".o";
+}
+
+bool assemble_objects(const Options &options) {
+    if (options.output != NULL && options.files.size() != 1) {
+        throw std::runtime_error("-o needs a single source.");
+    }
+    std::vector<std::string> errors = parallel_for(options.files.size(), options.threads, [&](size_t job) {
+        Processor p;
+        p.set_optimization(options.optimize);
+        ObjectFile object = p.compile_object(SourceFile(options.files[job]).text());
+        std::string out = options.output != NULL ? options.output : object_name(options.files[job]);
+        FILE *f = fopen(out.c_str(), "wb");
+        if (f == NULL) {
+            throw std::runtime_error("Could not open output file.");
+        }
+        std::unique_ptr<FILE, int (*)(FILE *)> closer(f, fclose);
+        object.write(f);
+    });
+    bool ok = true;
+    for(size_t i = 0; i < errors.size(); i++) {
+        if (!errors[i].empty()) {
+            fprintf(stderr, "%s: %s\n", options.files[i], errors[i].c_str());
+            ok = false;
+        }
+    }
+    return ok;
+}
 
-    std::vector<std::string> instructions;
-    std::string s;
-    while (std::getline(fs, s)) {
-        instructions.push_back(s);
+void link_objects(const Options &options) {
+    std::vector<std::pair<std::string, std::shared_ptr<const ObjectFile>>> objects;
+    for(auto file: options.files) {
+        objects.emplace_back(file, std::make_shared<const ObjectFile>(ObjectFile::read(file)));
     }
+    Processor p;
+    Linker linker(*Processor::get_opcode_table());
+    /* the layout is kept next to the image, so a relink only lays out the objects from the first changed one on */
+    std::string layout = options.output != NULL ? std::string(options.output) + ".layout" : "";
+    if (layout != "") {
+        std::ifstream in(layout);
+        if (in) {
+            linker.load(in);
+        }
+    }
+    size_t laid_out = linker.update(objects);
+    p.link(linker);
+    if (options.stats) {
+        fprintf(stderr, "%zu of %zu objects laid out\n", laid_out, objects.size());
+    }
+    if (options.output == NULL) {
+        p.dump_image(stdout);
+        return;
+    }
+    FILE *f = fopen(options.output, "wb");
+    if (f == NULL) {
+        throw std::runtime_error("Could not open output file.");
+    }
+    p.dump_image(f);
+    fclose(f);
+    std::ofstream out(layout);
+    if (!out) {
+        throw std::runtime_error("Could not open layout file.");
+    }
+    linker.save(out);
+}
 
-    p.compile(instructions);
-    p.dump_regs(stdout);
-    p.dump_mem(stdout);
+void load(Processor &p, char *fname, const Options &options) {
+    if (options.cache_dir != "") {
+        /* the file is a source, its cached image is mapped */
+        CompileCache cache(options.cache_dir, options.cache_size);
+        p.load(cache.get(fname, options.optimize).c_str());
+        return;
+    }
+    p.load(fname);
 }
 
-void run(char *fname, bool debug=false) {
+void bind_io(Processor &p, const Options &options) {
+    if (options.input != "") {
+        p.get_io().bind_input(options.input.c_str());
+    }
+    if (options.output_file != "") {
+        p.get_io().bind_output(options.output_file.c_str());
+    }
+    if (options.replay != "") {
+        p.get_io().replay_input(options.replay.c_str());
+    }
+    if (options.record != "") {
+        p.get_io().record_input(options.record.c_str());
+    }
+}
+
+void convert(char *fname, const Options &options) {
     Processor p;
-    FILE *f;
-    f = fopen(fname, "rb");
+    p.load_raw_image(fname);
+    FILE *f = fopen(options.output, "wb");
     if (f == NULL) {
-        throw std::runtime_error("Could not open file.");
+        throw std::runtime_error("Could not open output file.");
     }
-    p.load_regs(f);
-    p.load_mem(f);
-    p.run(debug);
+    p.dump_image(f);
     fclose(f);
 }
 
+void snapshot(char *fname, const Options &options) {
+    Processor p;
+    load(p, fname, options);
+    bind_io(p, options);
+    /* rip of an exited program points past its exit, running the snapshot would go on from there */
+    if (p.run_for(options.fuel)) {
+        throw std::runtime_error("Program exited after " + std::to_string(p.instructions_executed())
+                + " instructions, there is nothing to snapshot.");
+    }
+    FILE *f = fopen(options.output, "wb");
+    if (f == NULL) {
+        throw std::runtime_error("Could not open output file.");
+    }
+    p.write_snapshot(f, *p.snapshot(), false);
+    fclose(f);
+    fprintf(stderr, "suspended after %" PRIu64 " instructions\n", p.instructions_executed());
+}
+
+void aot(char *fname, const Options &options) {
+    Processor p;
+    load(p, fname, options);
+    std::ofstream out(options.output);
+    if (!out) {
+        throw std::runtime_error("Could not open output file.");
+    }
+    p.translate_cpp(out);
+}
+
+void run_traced(Processor &p, const Options &options) {
+    int fd = open(options.trace.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open trace file.");
+    }
+    /* the trace is dumped when the run ends, by an error or a crash too */
+    std::exception_ptr error;
+    {
+        TraceBuffer trace(options.trace_size);
+        trace.dump_on_crash(fd);
+        try {
+            p.run_traced(trace);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        trace.dump(fd);
+    }
+    close(fd);
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void run(char *fname, const Options &options, bool debug=false) {
+    Processor p;
+    /* a traced run executes the instructions one by one, superinstructions would only widen code invalidations */
+    p.set_fusion(options.fuse && options.trace == "");
+    load(p, fname, options);
+    bind_io(p, options);
+    if (options.engine != "interp" && debug) {
+        throw std::runtime_error("Only the interpreter can debug.");
+    }
+    if (options.diff && options.engine != "jit") {
+        throw std::runtime_error("Differential runs need the JIT.");
+    }
+    if ((options.record != "" || options.replay != "") && options.engine != "interp") {
+        throw std::runtime_error("Only the interpreter can record or replay input.");
+    }
+    if (options.trace != "" && (options.engine != "interp" || debug)) {
+        throw std::runtime_error("Only the interpreter can trace.");
+    }
+    if (options.trace != "") {
+        run_traced(p, options);
+    } else if (options.engine == "threaded") {
+        p.run_threaded();
+    } else if (options.engine == "jit" && options.diff) {
+        p.run_differential();
+    } else if (options.engine == "jit") {
+        p.run_jit();
+    } else {
+        p.run(debug);
+    }
+    if (options.stats) {
+        fprintf(stderr, "\n%" PRIu64 " instructions executed, %" PRIu64 " dispatched by the interpreter\n",
+                p.instructions_executed(), p.instructions_dispatched());
+    }
+}
+
+void trace_view(char *fname, const Options &options) {
+    uint64_t total;
+    auto records = read_trace(fname, total);
+    write_trace(std::cout, records, *Processor::get_opcode_table(), options.filter);
+    fprintf(stderr, "%zu of %" PRIu64 " instructions kept\n", records.size(), total);
+}
+
+void profile(char *fname, const Options &options) {
+    Processor p;
+    load(p, fname, options);
+    bind_io(p, options);
+    Profile profile;
+    p.run_profiled(profile);
+    std::cout.flush();
+    std::cerr << std::endl;
+    if (options.output == NULL) {
+        p.write_profile(profile, std::cerr, NULL);
+        return;
+    }
+    std::ofstream folded(options.output);
+    if (!folded) {
+        throw std::runtime_error("Could not open output file.");
+    }
+    p.write_profile(profile, std::cerr, &folded);
+}
+
+void batch(const Options &options) {
+    BatchRunner runner(options.threads, options.engine);
+    std::vector<std::string> fnames(options.files.begin(), options.files.end());
+    auto results = runner.run_images(fnames, options.input, options.output_file);
+    for(size_t i = 0; i < results.size(); i++) {
+        if (results[i].ok) {
+            fprintf(stderr, "%s: %" PRIu64 " instructions\n", fnames[i].c_str(), results[i].executed);
+        } else {
+            fprintf(stderr, "%s: %s\n", fnames[i].c_str(), results[i].error.c_str());
+        }
+    }
+}
+
+void schedule(const Options &options) {
+    Scheduler scheduler(options.threads, options.fuel,
+            options.priority ? SchedulingPolicy::Priority : SchedulingPolicy::RoundRobin);
+    std::vector<std::string> fnames;
+    for(auto file: options.files) {
+        std::string fname = file;
+        int priority = 0;
+        size_t at = fname.rfind('@');
+        if (at != std::string::npos) {
+            priority = std::stoi(fname.substr(at + 1));
+            fname = fname.substr(0, at);
+        }
+        auto p = std::unique_ptr<Processor>(new Processor());
+        p->load(fname.c_str());
+        if (options.input != "") {
+            p->get_io().bind_input((fname + options.input).c_str());
+        }
+        if (options.output_file != "") {
+            p->get_io().bind_output((fname + options.output_file).c_str());
+        }
+        scheduler.add(std::move(p), priority);
+        fnames.push_back(fname);
+    }
+    auto reports = scheduler.run();
+    for(size_t i = 0; i < reports.size(); i++) {
+        if (reports[i].ok) {
+            fprintf(stderr, "%s: %" PRIu64 " instructions, %zu slices, %.3f s running, %.3f s wall\n", fnames[i].c_str(),
+                    reports[i].executed, reports[i].slices, reports[i].run_seconds, reports[i].wall_seconds);
+        } else {
+            fprintf(stderr, "%s: %s\n", fnames[i].c_str(), reports[i].error.c_str());
+        }
+    }
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
+    if (argc < 3) {
+        usage(argv);
+    }
+    Options options = parse_options(argc, argv);
+    if (strcmp(argv[1], "batch") == 0 && !options.files.empty()) {
+        batch(options);
+        return 0;
+    }
+    if (strcmp(argv[1], "schedule") == 0 && !options.files.empty()) {
+        schedule(options);
+        return 0;
+    }
+    if (strcmp(argv[1], "asm") == 0 && options.object && !options.files.empty()) {
+        return assemble_objects(options) ? 0 : 1;
+    }
+    if (strcmp(argv[1], "link") == 0 && !options.files.empty()) {
+        link_objects(options);
+        return 0;
+    }
+    if (options.files.size() != 1) {
         usage(argv);
     }
 
     if (strcmp(argv[1], "compile") == 0) {
-        compile(argv[2]);
+        compile(options.files[0], options);
         return 0;
     }
     if (strcmp(argv[1], "run") == 0) {
-        run(argv[2]);
+        run(options.files[0], options);
+        return 0;
+    }
+    if (strcmp(argv[1], "aot") == 0) {
+        if (options.output == NULL) {
+            usage(argv);
+        }
+        aot(options.files[0], options);
+        return 0;
+    }
+    if (strcmp(argv[1], "trace-view") == 0) {
+        trace_view(options.files[0], options);
+        return 0;
+    }
+    if (strcmp(argv[1], "profile") == 0) {
+        profile(options.files[0], options);
+        return 0;
+    }
+    if (strcmp(argv[1], "snapshot") == 0) {
+        if (options.output == NULL) {
+            usage(argv);
+        }
+        snapshot(options.files[0], options);
+        return 0;
+    }
+    if (strcmp(argv[1], "convert") == 0) {
+        if (options.output == NULL) {
+            usage(argv);
+        }
+        convert(options.files[0], options);
         return 0;
     }
     if (strcmp(argv[1], "debug") == 0) {
-        run(argv[2], true);
+        run(options.files[0], options, true);
         return 0;
     }
+    usage(argv);
 }
@@ -20,20 +20,499 @@ void Memory::add_label(std::string label, uint32_t value) {
     label_map[label] = value;
 }
 
-uint8_t Memory::read_byte(size_t addr) const {
-    if (addr >= memory.size()) {
-        return 0;
+const std::map<std::string, uint32_t> &Memory::get_labels() const {
+    return label_map;
+}
+
+Memory::PageTable::PageTable(const PageTable &other) {
+    for(size_t i = 0; i < PageTableSize; i++) {
+        pages[i] = other.pages[i].load();
+        owned[i] = other.owned[i];
+        writable[i] = other.writable[i].load();
+    }
+}
+
+/**
+ * Replace a page table of the directory, publishing it to readers on other threads.
+ * @param[in] dir
+ * @param[in] table
+ */
+void Memory::set_table(size_t dir, std::shared_ptr<PageTable> table) {
+    directory[dir] = table;
+    tables[dir].store(table.get(), std::memory_order_release);
+}
+
+/**
+ * Return the page table holding the address, allocating it or copying it away from the snapshots sharing it.
+ * @param[in] addr
+ */
+Memory::PageTable &Memory::private_table(uint32_t addr) {
+    size_t dir = addr >> (PageBits + PageTableBits);
+    auto &table = directory[dir];
+    if (table == nullptr) {
+        set_table(dir, std::make_shared<PageTable>());
+    } else if (table_shared[dir] && table.use_count() != 1) {
+        set_table(dir, std::make_shared<PageTable>(*table));
+    }
+    table_shared[dir] = false;
+    return *table;
+}
+
+/**
+ * Make the page holding the address writable and return it.
+ * A page still referenced by a snapshot or a file mapping is copied first, unless nothing else uses it anymore.
+ * Another thread may have made the page writable while this one waited for the lock.
+ * @param[in] addr
+ */
+uint8_t *Memory::make_writable(uint32_t addr) {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    PageTable &table = private_table(addr);
+    size_t index = (addr >> PageBits) & (PageTableSize - 1);
+    uint8_t *page = table.writable[index].load(std::memory_order_relaxed);
+    if (page != nullptr) {
+        return page;
+    }
+    auto &owned = table.owned[index];
+    if (table.pages[index] == nullptr) {
+        owned.reset(new uint8_t[PageSize](), std::default_delete<uint8_t[]>());
+        page_count++;
+    } else if (owned == nullptr || owned.use_count() != 1) {
+        std::shared_ptr<uint8_t> copy(new uint8_t[PageSize], std::default_delete<uint8_t[]>());
+        memcpy(copy.get(), table.pages[index].load(std::memory_order_relaxed), PageSize);
+        owned = copy;
+    }
+    table.pages[index].store(owned.get(), std::memory_order_release);
+    table.writable[index].store(owned.get(), std::memory_order_release);
+    dirty.push_back(addr & ~(uint32_t)(PageSize - 1));
+    return owned.get();
+}
+
+/**
+ * Write a buffer into memory a page at a time.
+ * @param[in] address
+ * @param[in] bytes
+ * @param[in] length
+ */
+void Memory::write_bytes(size_t address, const uint8_t *bytes, size_t length) {
+    uint32_t addr = address;
+    size_t done = 0;
+    while (done < length) {
+        size_t offset = (uint32_t)(addr + done) & (PageSize - 1);
+        size_t chunk = std::min(PageSize - offset, length - done);
+        memcpy(touch_page(addr + done) + offset, bytes + done, chunk);
+        extend((size_t)(uint32_t)(addr + done) + chunk);
+        done += chunk;
+    }
+    if (!observers.empty() && length) {
+        notify_write(addr, length);
+    }
+}
+
+/**
+ * Copy a range which lies in one source and one destination page, never written source pages read as zero.
+ * The destination page is touched first, it may be a copy of the source page afterwards.
+ * @param[in] dst
+ * @param[in] src
+ * @param[in] length
+ */
+void Memory::copy_chunk(uint32_t dst, uint32_t src, size_t length) {
+    size_t dst_offset = dst & (PageSize - 1);
+    if (find_page(src) == nullptr) {
+        if (find_page(dst) == nullptr) {
+            return;
+        }
+        memset(touch_page(dst) + dst_offset, 0, length);
+    } else {
+        uint8_t *to = touch_page(dst) + dst_offset;
+        memmove(to, find_page(src) + (src & (PageSize - 1)), length);
+    }
+    extend((size_t)dst + length);
+}
+
+/**
+ * Copy a range like memmove, split into chunks which don't cross a page of the source or the destination.
+ * Copying zeros over never written pages doesn't allocate them or grow the size.
+ * @param[in] dst
+ * @param[in] src
+ * @param[in] length
+ */
+void Memory::copy(uint32_t dst, uint32_t src, uint32_t length) {
+    if (length == 0 || dst == src) {
+        return;
+    }
+    /* the destination starts inside the source, copy from the end */
+    bool backwards = (uint32_t)(dst - src) < length;
+    size_t done = 0;
+    while (done < length) {
+        size_t left = length - done;
+        size_t chunk;
+        if (backwards) {
+            uint32_t src_end = src + left;
+            uint32_t dst_end = dst + left;
+            chunk = std::min({((src_end - 1) & (PageSize - 1)) + 1, ((dst_end - 1) & (PageSize - 1)) + 1, left});
+            copy_chunk(dst_end - chunk, src_end - chunk, chunk);
+        } else {
+            uint32_t from = src + done;
+            uint32_t to = dst + done;
+            chunk = std::min({PageSize - (from & (PageSize - 1)), PageSize - (to & (PageSize - 1)), left});
+            copy_chunk(to, from, chunk);
+        }
+        done += chunk;
+    }
+    if (!observers.empty()) {
+        notify_write(dst, length);
+    }
+}
+
+/**
+ * Set a range to a byte a page at a time, clearing never written pages doesn't allocate them or grow the size.
+ * @param[in] dst
+ * @param[in] value
+ * @param[in] length
+ */
+void Memory::fill(uint32_t dst, uint8_t value, uint32_t length) {
+    size_t done = 0;
+    while (done < length) {
+        uint32_t addr = dst + done;
+        size_t offset = addr & (PageSize - 1);
+        size_t chunk = std::min(PageSize - offset, length - done);
+        if (value != 0 || find_page(addr) != nullptr) {
+            memset(touch_page(addr) + offset, value, chunk);
+            extend((size_t)addr + chunk);
+        }
+        done += chunk;
+    }
+    if (!observers.empty() && length) {
+        notify_write(dst, length);
+    }
+}
+
+/**
+ * Compare two ranges like memcmp, split into chunks which don't cross a page of either.
+ * @param[in] a
+ * @param[in] b
+ * @param[in] length
+ * @param[out] order - -1, 0 or 1.
+ */
+int Memory::compare(uint32_t a, uint32_t b, uint32_t length) const {
+    static const uint8_t zeros[PageSize] = {};
+    size_t done = 0;
+    while (done < length) {
+        uint32_t x = a + done;
+        uint32_t y = b + done;
+        size_t x_offset = x & (PageSize - 1);
+        size_t y_offset = y & (PageSize - 1);
+        size_t chunk = std::min({PageSize - x_offset, PageSize - y_offset, length - done});
+        const uint8_t *x_page = find_page(x);
+        const uint8_t *y_page = find_page(y);
+        done += chunk;
+        if (x_page == y_page && x_offset == y_offset) {
+            continue;
+        }
+        int order = memcmp((x_page ? x_page : zeros) + x_offset, (y_page ? y_page : zeros) + y_offset, chunk);
+        if (order != 0) {
+            return order < 0 ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Return the aligned word at the address for an atomic access, observers are notified before the access.
+ * @param[in] addr
+ */
+uint32_t *Memory::atomic_word(uint32_t addr) {
+    if ((addr & (sizeof(uint32_t) - 1)) != 0) {
+        throw std::runtime_error("Unaligned atomic access at " + std::to_string(addr) + ".");
+    }
+    uint32_t *word = (uint32_t *)(touch_page(addr) + (addr & (PageSize - 1)));
+    extend((size_t)addr + sizeof(uint32_t));
+    if (!observers.empty()) {
+        notify_write(addr, sizeof(uint32_t));
+    }
+    return word;
+}
+
+/**
+ * Atomically replace the word at the address and return the previous value.
+ * All atomic operations are sequentially consistent.
+ * @param[in] address - 4 byte aligned.
+ * @param[in] value
+ */
+uint32_t Memory::atomic_exchange(uint32_t address, uint32_t value) {
+    return __atomic_exchange_n(atomic_word(address), value, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Atomically replace the word at the address by desired if it equals expected, return the previous value.
+ * @param[in] address - 4 byte aligned.
+ * @param[in] expected
+ * @param[in] desired
+ */
+uint32_t Memory::atomic_compare_exchange(uint32_t address, uint32_t expected, uint32_t desired) {
+    __atomic_compare_exchange_n(atomic_word(address), &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return expected;
+}
+
+/**
+ * Atomically add to the word at the address and return the previous value.
+ * @param[in] address - 4 byte aligned.
+ * @param[in] value
+ */
+uint32_t Memory::atomic_fetch_add(uint32_t address, uint32_t value) {
+    return __atomic_fetch_add(atomic_word(address), value, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Use pages of a private, writable file mapping as memory without copying them.
+ * Writes go to the mapping, which the kernel copies on write.
+ * @param[in] address - page aligned.
+ * @param[in] data - page aligned, readable and writable up to length rounded up to a page.
+ * @param[in] length
+ * @param[in] mapping - kept alive as long as the memory.
+ */
+void Memory::map_pages(size_t address, uint8_t *data, size_t length, std::shared_ptr<uint8_t> mapping) {
+    uint32_t addr = address;
+    if ((addr & (PageSize - 1)) != 0 || ((uintptr_t)data & (PageSize - 1)) != 0) {
+        throw std::logic_error("Can't map pages at unaligned addresses.");
+    }
+    for(size_t done = 0; done < length; done += PageSize) {
+        uint32_t page_addr = addr + done;
+        PageTable &table = private_table(page_addr);
+        size_t index = (page_addr >> PageBits) & (PageTableSize - 1);
+        if (table.pages[index] == nullptr) {
+            page_count++;
+        }
+        if (table.writable[index] == nullptr) {
+            dirty.push_back(page_addr);
+        }
+        table.owned[index].reset();
+        table.pages[index] = data + done;
+        table.writable[index] = data + done;
+    }
+    extend((size_t)addr + length);
+    mappings.push_back(mapping);
+    if (!observers.empty() && length) {
+        notify_write(addr, length);
+    }
+}
+
+/**
+ * Return the page holding the address, or NULL if it was never written.
+ * @param[in] address
+ */
+const uint8_t *Memory::get_page(size_t address) const {
+    return find_page(address);
+}
+
+/**
+ * Return the addresses of all allocated pages in ascending order.
+ * @param[in] directory
+ */
+std::vector<uint32_t> Memory::page_addresses(const std::shared_ptr<PageTable> *directory) {
+    std::vector<uint32_t> addresses;
+    for(size_t i = 0; i < PageTableSize; i++) {
+        if (directory[i] == nullptr) {
+            continue;
+        }
+        for(size_t j = 0; j < PageTableSize; j++) {
+            if (directory[i]->pages[j] != nullptr) {
+                addresses.push_back((i << (PageBits + PageTableBits)) | (j << PageBits));
+            }
+        }
+    }
+    return addresses;
+}
+
+std::vector<uint32_t> Memory::page_addresses() const {
+    return page_addresses(directory);
+}
+
+/**
+ * Freeze the current contents and labels into a snapshot sharing all pages with the memory.
+ * Only the pages written since the last snapshot are touched, they become copy on write again.
+ */
+std::shared_ptr<const Memory::Snapshot> Memory::snapshot() {
+    for(auto addr: dirty) {
+        directory[addr >> (PageBits + PageTableBits)]->writable[(addr >> PageBits) & (PageTableSize - 1)] = nullptr;
+    }
+    auto snapshot = std::make_shared<Snapshot>();
+    for(size_t i = 0; i < PageTableSize; i++) {
+        snapshot->directory[i] = directory[i];
+        table_shared[i] = directory[i] != nullptr;
+    }
+    snapshot->label_map = label_map;
+    snapshot->mappings = mappings;
+    snapshot->size_ = size_;
+    snapshot->page_count = page_count;
+    snapshot->dirty.swap(dirty);
+    return snapshot;
+}
+
+/**
+ * Go back to the contents and labels of a snapshot, sharing its pages copy on write.
+ * Observers are not notified.
+ * @param[in] snapshot
+ */
+void Memory::restore(const Snapshot &snapshot) {
+    for(size_t i = 0; i < PageTableSize; i++) {
+        set_table(i, snapshot.directory[i]);
+        table_shared[i] = directory[i] != nullptr;
     }
-    return memory[addr];
+    label_map = snapshot.label_map;
+    mappings = snapshot.mappings;
+    size_ = snapshot.size_;
+    page_count = snapshot.page_count;
+    dirty.clear();
 }
 
-void Memory::write_byte(size_t addr, uint8_t byte) {
-    if (addr >= memory.size()) {
-        memory.resize(addr + 1);
+const uint8_t *Memory::Snapshot::get_page(size_t address) const {
+    return find_page(directory, address);
+}
+
+std::vector<uint32_t> Memory::Snapshot::page_addresses() const {
+    return Memory::page_addresses(directory);
+}
+
+/**
+ * Return the addresses of the pages written between the snapshot before this one and this one.
+ */
+const std::vector<uint32_t> &Memory::Snapshot::dirty_pages() const {
+    return dirty;
+}
+
+const std::map<std::string, uint32_t> &Memory::Snapshot::get_labels() const {
+    return label_map;
+}
+
+size_t Memory::Snapshot::size() const {
+    return size_;
+}
+
+uint8_t Memory::read_byte(uint32_t addr) const {
+    const uint8_t *page = find_page(addr);
+    if (page == nullptr) {
+        return 0;
     }
-    memory[addr] = byte;
+    return page[addr & (PageSize - 1)];
+}
+
+void Memory::write_byte(uint32_t addr, uint8_t byte) {
+    touch_page(addr)[addr & (PageSize - 1)] = byte;
+    extend((size_t)addr + 1);
 }
 
+/**
+ * Return a contiguous copy of the memory up to the highest written address.
+ */
 std::vector<uint8_t> Memory::get_memory() {
+    size_t size = size_;
+    std::vector<uint8_t> memory(size);
+    for(size_t addr = 0; addr < size; addr += PageSize) {
+        const uint8_t *page = find_page(addr);
+        if (page != nullptr) {
+            memcpy(memory.data() + addr, page, std::min(PageSize, size - addr));
+        }
+    }
     return memory;
 }
+
+/**
+ * Return the address after the highest written byte.
+ */
+size_t Memory::size() const {
+    return size_;
+}
+
+/**
+ * Return the number of allocated pages.
+ */
+size_t Memory::pages() const {
+    return page_count;
+}
+
+/**
+ * Copy the contents and labels of the memory, observers stay with the original.
+ * @param[in] other
+ */
+Memory::Memory(const Memory &other) {
+    *this = other;
+}
+
+Memory &Memory::operator=(const Memory &other) {
+    if (this == &other) {
+        return *this;
+    }
+    label_map = other.label_map;
+    size_ = other.size_.load();
+    page_count = other.page_count;
+    mappings.clear();
+    dirty.clear();
+    for(size_t i = 0; i < PageTableSize; i++) {
+        set_table(i, nullptr);
+        table_shared[i] = false;
+        if (other.directory[i] == nullptr) {
+            continue;
+        }
+        set_table(i, std::make_shared<PageTable>());
+        for(size_t j = 0; j < PageTableSize; j++) {
+            const uint8_t *page = other.directory[i]->pages[j].load();
+            if (page != nullptr) {
+                auto &owned = directory[i]->owned[j];
+                owned.reset(new uint8_t[PageSize], std::default_delete<uint8_t[]>());
+                memcpy(owned.get(), page, PageSize);
+                directory[i]->pages[j] = owned.get();
+                directory[i]->writable[j] = owned.get();
+                dirty.push_back((i << (PageBits + PageTableBits)) | (j << PageBits));
+            }
+        }
+    }
+    return *this;
+}
+
+/**
+ * Compare the contents of two memories, unallocated pages compare equal to zeroed ones.
+ * @param[in] other
+ */
+bool Memory::operator==(const Memory &other) const {
+    static const uint8_t zero_page[PageSize] = {};
+    for(size_t i = 0; i < PageTableSize; i++) {
+        if (directory[i] == nullptr && other.directory[i] == nullptr) {
+            continue;
+        }
+        for(size_t j = 0; j < PageTableSize; j++) {
+            uint32_t addr = (i << (PageBits + PageTableBits)) | (j << PageBits);
+            const uint8_t *page = find_page(addr);
+            const uint8_t *other_page = other.find_page(addr);
+            if (page == other_page) {
+                continue;
+            }
+            if (memcmp(page ? page : zero_page, other_page ? other_page : zero_page, PageSize) != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool Memory::operator!=(const Memory &other) const {
+    return !(*this == other);
+}
+
+/**
+ * Register an observer, which will be notified about every following write.
+ * @param[in] observer
+ */
+void Memory::add_observer(MemoryObserver *observer) {
+    observers.push_back(observer);
+}
+
+void Memory::remove_observer(MemoryObserver *observer) {
+    observers.erase(std::remove(observers.begin(), observers.end(), observer), observers.end());
+}
+
+void Memory::notify_write(size_t address, size_t length) {
+    for(auto observer: observers) {
+        observer->memory_written(address, length);
+    }
+}
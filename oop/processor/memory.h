@@ -1,31 +1,258 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
 #include <string>
 #include <map>
+#include <memory>
 #include <vector>
+#include <atomic>
+#include <mutex>
 
+const size_t PageBits = 12;
+const size_t PageSize = (size_t)1 << PageBits;
+const size_t PageTableBits = 10;
+const size_t PageTableSize = (size_t)1 << PageTableBits;
+
+/**
+ * Gets notified about every write into the memory it is attached to.
+ */
+class MemoryObserver {
+    public:
+    virtual void memory_written(size_t address, size_t length) = 0;
+    virtual ~MemoryObserver() = default;
+};
+
+/**
+ * Sparse 32-bit address space, 4 KiB pages are allocated on first write through a two-level page table.
+ * Untouched memory reads as zero. Pages may also be mapped from private file mappings.
+ * Snapshots share pages and page tables with the memory, both are copied on the first write after a snapshot.
+ * Several threads may read and write concurrently: pages and page tables are published through atomic pointers
+ * and only allocating or copying a page takes a lock. Snapshots, restores, copies, labels and observers
+ * must not race with writes.
+ */
 class Memory {
+    /**
+     * Page pointers are atomic, so other threads may read them while a page is allocated or copied.
+     */
+    struct PageTable {
+        std::atomic<uint8_t *> pages[PageTableSize] = {};
+        std::shared_ptr<uint8_t> owned[PageTableSize];
+        /* pages which may be written in place, the others are shared or not allocated yet */
+        std::atomic<uint8_t *> writable[PageTableSize] = {};
+
+        PageTable() = default;
+        PageTable(const PageTable &other);
+    };
+
+    public:
+    /**
+     * Immutable contents and labels of a memory at one point.
+     */
+    class Snapshot {
+        friend class Memory;
+        std::shared_ptr<PageTable> directory[PageTableSize];
+        std::map<std::string, uint32_t> label_map;
+        std::vector<std::shared_ptr<uint8_t>> mappings;
+        size_t size_ = 0;
+        size_t page_count = 0;
+        std::vector<uint32_t> dirty;
+
+        public:
+        const uint8_t *get_page(size_t address) const;
+        std::vector<uint32_t> page_addresses() const;
+        const std::vector<uint32_t> &dirty_pages() const;
+        const std::map<std::string, uint32_t> &get_labels() const;
+        size_t size() const;
+    };
+
+    private:
     std::map<std::string, uint32_t> label_map;
-    std::vector<uint8_t> memory;
-    uint8_t read_byte(size_t addr) const;
-    void write_byte(size_t addr, uint8_t byte);
+    std::shared_ptr<PageTable> directory[PageTableSize];
+    /* the page tables of the directory, read without the lock */
+    std::atomic<PageTable *> tables[PageTableSize] = {};
+    /* page tables which are also referenced by a snapshot */
+    bool table_shared[PageTableSize] = {};
+    std::vector<std::shared_ptr<uint8_t>> mappings;
+    std::atomic<size_t> size_ {0};
+    size_t page_count = 0;
+    /* addresses of the pages made writable since the last snapshot */
+    std::vector<uint32_t> dirty;
+    std::vector<MemoryObserver *> observers;
+    /* held while pages and page tables are allocated or copied */
+    std::mutex write_mutex;
+
+    /**
+     * Return the page holding the address, or NULL if it was never written.
+     * @param[in] directory
+     * @param[in] addr
+     */
+    static const uint8_t *find_page(const std::shared_ptr<PageTable> *directory, uint32_t addr) {
+        const PageTable *table = directory[addr >> (PageBits + PageTableBits)].get();
+        if (table == nullptr) {
+            return nullptr;
+        }
+        return table->pages[(addr >> PageBits) & (PageTableSize - 1)].load(std::memory_order_acquire);
+    }
+    const uint8_t *find_page(uint32_t addr) const {
+        const PageTable *table = tables[addr >> (PageBits + PageTableBits)].load(std::memory_order_acquire);
+        if (table == nullptr) {
+            return nullptr;
+        }
+        return table->pages[(addr >> PageBits) & (PageTableSize - 1)].load(std::memory_order_acquire);
+    }
+    static std::vector<uint32_t> page_addresses(const std::shared_ptr<PageTable> *directory);
+    PageTable &private_table(uint32_t addr);
+    uint8_t *make_writable(uint32_t addr);
+    /**
+     * Return the page holding the address for writing, allocating or copying it if needed.
+     * @param[in] addr
+     */
+    uint8_t *touch_page(uint32_t addr) {
+        PageTable *table = tables[addr >> (PageBits + PageTableBits)].load(std::memory_order_acquire);
+        if (table != nullptr) {
+            uint8_t *page = table->writable[(addr >> PageBits) & (PageTableSize - 1)].load(std::memory_order_acquire);
+            if (page != nullptr) {
+                return page;
+            }
+        }
+        return make_writable(addr);
+    }
+    /**
+     * Grow the size to cover the address before end.
+     * @param[in] end
+     */
+    void extend(size_t end) {
+        size_t size = size_.load(std::memory_order_relaxed);
+        while (end > size && !size_.compare_exchange_weak(size, end, std::memory_order_relaxed));
+    }
+    void set_table(size_t dir, std::shared_ptr<PageTable> table);
+    uint32_t *atomic_word(uint32_t addr);
+    uint8_t read_byte(uint32_t addr) const;
+    void write_byte(uint32_t addr, uint8_t byte);
+    void copy_chunk(uint32_t dst, uint32_t src, size_t length);
+    void notify_write(size_t address, size_t length);
     public:
+        Memory() = default;
+        Memory(const Memory &other);
+        Memory &operator=(const Memory &other);
+        bool operator==(const Memory &other) const;
+        bool operator!=(const Memory &other) const;
         template<class T>
             T read_type(size_t address) const {
                 T res;
+                uint32_t addr = address;
+                size_t offset = addr & (PageSize - 1);
+                if (offset + sizeof(T) <= PageSize) {
+                    const uint8_t *page = find_page(addr);
+                    if (page == nullptr) {
+                        memset(&res, 0, sizeof(T));
+                    } else {
+                        memcpy(&res, page + offset, sizeof(T));
+                    }
+                    return res;
+                }
                 for(size_t i = 0; i < sizeof(T); i++) {
-                    ((uint8_t *)&res)[i] = read_byte(address + i);
+                    ((uint8_t *)&res)[i] = read_byte(addr + i);
                 }
                 return res;
             }
         template<class T>
             void write_type(size_t address, T val) {
-                for(size_t i = 0; i < sizeof(T); i++) {
-                    write_byte(address + i, ((uint8_t *)&val)[i]);
+                uint32_t addr = address;
+                size_t offset = addr & (PageSize - 1);
+                if (offset + sizeof(T) <= PageSize) {
+                    memcpy(touch_page(addr) + offset, &val, sizeof(T));
+                    extend((size_t)addr + sizeof(T));
+                } else {
+                    for(size_t i = 0; i < sizeof(T); i++) {
+                        write_byte(addr + i, ((uint8_t *)&val)[i]);
+                    }
+                }
+                if (!observers.empty()) {
+                    notify_write(addr, sizeof(T));
                 }
             }
+        void write_bytes(size_t address, const uint8_t *bytes, size_t length);
+        void copy(uint32_t dst, uint32_t src, uint32_t length);
+        void fill(uint32_t dst, uint8_t value, uint32_t length);
+        int compare(uint32_t a, uint32_t b, uint32_t length) const;
+        uint32_t atomic_exchange(uint32_t address, uint32_t value);
+        uint32_t atomic_compare_exchange(uint32_t address, uint32_t expected, uint32_t desired);
+        uint32_t atomic_fetch_add(uint32_t address, uint32_t value);
+        void map_pages(size_t address, uint8_t *data, size_t length, std::shared_ptr<uint8_t> mapping);
+        const uint8_t *get_page(size_t address) const;
+        std::vector<uint32_t> page_addresses() const;
+        std::shared_ptr<const Snapshot> snapshot();
+        void restore(const Snapshot &snapshot);
         uint32_t resolve_label(std::string label) const;
         void add_label(std::string label, uint32_t value);
+        const std::map<std::string, uint32_t> &get_labels() const;
         std::vector<uint8_t> get_memory();
+        size_t size() const;
+        size_t pages() const;
+        void add_observer(MemoryObserver *observer);
+        void remove_observer(MemoryObserver *observer);
+};
+
+/**
+ * One T per page of the 32-bit address space, allocated on first use and found through a two-level page table
+ * like the one of Memory. Keeps the per-page state of the engines and the debugger.
+ */
+template<class T>
+class PagedTable {
+    struct Table {
+        std::unique_ptr<T> pages[PageTableSize];
+    };
+    std::unique_ptr<Table> directory[PageTableSize];
+
+    public:
+    /**
+     * Return the T of the page holding the address, or NULL if it was never touched.
+     * @param[in] address
+     */
+    T *find(uint32_t address) const {
+        const Table *table = directory[address >> (PageBits + PageTableBits)].get();
+        if (table == nullptr) {
+            return nullptr;
+        }
+        return table->pages[(address >> PageBits) & (PageTableSize - 1)].get();
+    }
+    /**
+     * Return the T of the page holding the address, value-initializing it if needed.
+     * @param[in] address
+     */
+    T &touch(uint32_t address) {
+        std::unique_ptr<Table> &table = directory[address >> (PageBits + PageTableBits)];
+        if (table == nullptr) {
+            table.reset(new Table());
+        }
+        std::unique_ptr<T> &page = table->pages[(address >> PageBits) & (PageTableSize - 1)];
+        if (page == nullptr) {
+            page.reset(new T());
+        }
+        return *page;
+    }
+    /**
+     * Call f on the T of every touched page.
+     * @param[in] f
+     */
+    template<class F>
+        void for_each(F f) {
+            for(auto &table: directory) {
+                if (table == nullptr) {
+                    continue;
+                }
+                for(auto &page: table->pages) {
+                    if (page != nullptr) {
+                        f(*page);
+                    }
+                }
+            }
+        }
+    void clear() {
+        for(auto &table: directory) {
+            table.reset();
+        }
+    }
 };
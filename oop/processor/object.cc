@@ -0,0 +1,93 @@
+#include "object.h"
+
+static void write_bytes(FILE *f, const void *data, size_t length) {
+    if (length && fwrite(data, 1, length, f) != length) {
+        throw std::runtime_error("Could not write object.");
+    }
+}
+
+static void read_bytes(FILE *f, void *data, size_t length) {
+    if (length && fread(data, 1, length, f) != length) {
+        throw std::runtime_error("Object is truncated.");
+    }
+}
+
+/**
+ * Write the object, sequentially so it can go to a pipe.
+ * @param[in] f
+ */
+void ObjectFile::write(FILE *f) const {
+    ObjectHeader header = {};
+    memcpy(header.magic, ObjectMagic, sizeof(ObjectMagic));
+    header.version = ObjectVersion;
+    header.size = size;
+    header.code_end = code.size();
+    header.run_count = runs.size();
+    header.symbol_count = symbols.size();
+    header.relocation_count = relocations.size();
+
+    write_bytes(f, &header, sizeof(header));
+    write_bytes(f, runs.data(), runs.size() * sizeof(ObjectRun));
+    write_bytes(f, code.data(), code.size());
+    for(auto &symbol: symbols) {
+        uint32_t fields[3] = {symbol.address, symbol.defined ? ObjectSymbolDefined : 0, (uint32_t)symbol.name.size()};
+        write_bytes(f, fields, sizeof(fields));
+        write_bytes(f, symbol.name.data(), symbol.name.size());
+    }
+    write_bytes(f, relocations.data(), relocations.size() * sizeof(ObjectRelocation));
+}
+
+/**
+ * Read an object file.
+ * @param[in] fname
+ * @param[out] object
+ */
+ObjectFile ObjectFile::read(const char *fname) {
+    FILE *f = fopen(fname, "rb");
+    if (f == NULL) {
+        throw std::runtime_error("Could not open file.");
+    }
+    std::unique_ptr<FILE, int (*)(FILE *)> closer(f, fclose);
+
+    ObjectHeader header;
+    read_bytes(f, &header, sizeof(header));
+    if (memcmp(header.magic, ObjectMagic, sizeof(ObjectMagic)) != 0) {
+        throw std::runtime_error("Not an object.");
+    }
+    if (header.version != ObjectVersion) {
+        throw std::runtime_error("Unsupported object version " + std::to_string(header.version) + ".");
+    }
+    if (header.code_end > header.size) {
+        throw std::runtime_error("Object is corrupt.");
+    }
+
+    ObjectFile object;
+    object.size = header.size;
+    object.runs.resize(header.run_count);
+    read_bytes(f, object.runs.data(), object.runs.size() * sizeof(ObjectRun));
+    object.code.resize(header.code_end);
+    read_bytes(f, object.code.data(), object.code.size());
+    object.symbols.resize(header.symbol_count);
+    for(auto &symbol: object.symbols) {
+        uint32_t fields[3];
+        read_bytes(f, fields, sizeof(fields));
+        symbol.address = fields[0];
+        symbol.defined = fields[1] & ObjectSymbolDefined;
+        symbol.name.resize(fields[2]);
+        read_bytes(f, &symbol.name[0], symbol.name.size());
+    }
+    object.relocations.resize(header.relocation_count);
+    read_bytes(f, object.relocations.data(), object.relocations.size() * sizeof(ObjectRelocation));
+
+    for(auto &run: object.runs) {
+        if (run.begin > run.end || run.end > object.code.size()) {
+            throw std::runtime_error("Object is corrupt.");
+        }
+    }
+    for(auto &relocation: object.relocations) {
+        if (relocation.symbol >= object.symbols.size() || (uint64_t)relocation.offset + sizeof(uint32_t) > object.code.size()) {
+            throw std::runtime_error("Object is corrupt.");
+        }
+    }
+    return object;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <bits/stdc++.h>
+#include <cstdio>
+
+/*
+ * Object file layout, all integers little endian:
+ *   ObjectHeader
+ *   ObjectRun[run_count]
+ *   code[code_end]
+ *   symbols { uint32_t address; uint32_t flags; uint32_t name_length; char name[name_length]; }[symbol_count]
+ *   ObjectRelocation[relocation_count]
+ * Addresses are relative to the start of the object. Every label of the unit is a defined symbol,
+ * labels it uses without defining them are imported symbols.
+ */
+const char ObjectMagic[4] = {'K', 'E', 'K', 'O'};
+const uint32_t ObjectVersion = 1;
+
+const uint32_t ObjectSymbolDefined = 1;
+
+struct ObjectHeader {
+    char magic[4];
+    uint32_t version;
+    /* bytes the object takes, including labels reserving bytes after the last instruction */
+    uint32_t size;
+    uint32_t code_end;
+    uint32_t run_count;
+    uint32_t symbol_count;
+    uint32_t relocation_count;
+};
+
+/* a range of the code holding instructions, the bytes between runs are reserved by labels */
+struct ObjectRun {
+    uint32_t begin;
+    uint32_t end;
+};
+
+/* a 4 byte operand holding the address of a symbol */
+struct ObjectRelocation {
+    uint32_t offset;
+    uint32_t symbol;
+};
+
+struct ObjectSymbol {
+    std::string name;
+    uint32_t address = 0;
+    bool defined = false;
+};
+
+/**
+ * A separately assembled unit of code, relocatable to any address by the Linker.
+ */
+struct ObjectFile {
+    uint32_t size = 0;
+    std::vector<uint8_t> code;
+    std::vector<ObjectRun> runs;
+    std::vector<ObjectSymbol> symbols;
+    std::vector<ObjectRelocation> relocations;
+
+    void write(FILE *f) const;
+    static ObjectFile read(const char *fname);
+};
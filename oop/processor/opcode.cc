@@ -1,6 +1,17 @@
 #include "opcode.h"
 
-size_t IntArg::len() {
+ArgKind IntArg::kind() const {
+    return ArgKind::Int;
+}
+
+/**
+ * Return the constant as stored in raw code, labels are only resolved when writing raw code.
+ */
+uint32_t IntArg::get_raw_value() const {
+    return value;
+}
+
+size_t IntArg::len() const {
     return 4;
 }
 
@@ -9,7 +20,7 @@ size_t IntArg::parse_raw(const Memory& m, size_t addr) {
     return sizeof(uint32_t);
 }
 
-size_t IntArg::write_raw(Memory &m, size_t addr) {
+size_t IntArg::write_raw(Memory &m, size_t addr) const {
     m.write_type<uint32_t>(addr, resolve(m));
     return 4;
 }
@@ -24,7 +35,7 @@ void IntArg::parse_asm(std::string asm_string) {
     }
 }
 
-std::string IntArg::write_asm() {
+std::string IntArg::write_asm() const {
     if (is_label) {
         return label;
     }
@@ -38,19 +49,31 @@ uint32_t IntArg::resolve(const Memory &m) const {
     return m.resolve_label(label);
 }
 
+bool IntArg::has_label() const {
+    return is_label;
+}
+
+std::string IntArg::get_label() const {
+    return label;
+}
+
 uint32_t IntArg::get_value(const Registers &r, const Memory& m) const {
     return resolve(m);
 }
 
-void IntArg::set_value(Registers &r, Memory& m, uint32_t value, uint8_t value_length) {
+void IntArg::set_value(Registers &r, Memory& m, uint32_t value, uint8_t value_length) const {
     throw std::logic_error("Trying to set consant value.");
 }
 
+ArgKind AddressArg::kind() const {
+    return ArgKind::Address;
+}
+
 uint32_t AddressArg::get_value(const Registers &r, const Memory& m) const {
     return m.read_type<uint32_t>(resolve(m));
 }
 
-void AddressArg::set_value(Registers &r, Memory& m, uint32_t value, uint8_t value_length) {
+void AddressArg::set_value(Registers &r, Memory& m, uint32_t value, uint8_t value_length) const {
     if (value_length > 4) {
         throw std::logic_error("Can't write more than 4 bytes at a time.");
     }
@@ -71,47 +94,77 @@ void AddressArg::set_value(Registers &r, Memory& m, uint32_t value, uint8_t valu
     }
 }
 
+ArgKind RegArg::kind() const {
+    return ArgKind::Reg;
+}
+
+uint32_t RegArg::get_raw_value() const {
+    return register_number;
+}
+
 size_t RegArg::parse_raw(const Memory& m, size_t addr) {
     register_number = m.read_type<int8_t>(addr);
     return sizeof(uint8_t);
 }
 
-size_t RegArg::write_raw(Memory &m, size_t addr) {
+size_t RegArg::write_raw(Memory &m, size_t addr) const {
     m.write_type<uint8_t>(addr, register_number);
     return 1;
 }
 
-void RegArg::parse_asm(std::string asm_string) { 
-    asm_string = to_lower(asm_string);
-    if (asm_string == "rip") {
-        register_number = RIP;
-        return;
+/**
+ * Return whether the operand equals the lowercase name, ignoring case.
+ * @param[in] asm_string
+ * @param[in] name
+ */
+static bool equals_lower(std::string_view asm_string, std::string_view name) {
+    if (asm_string.size() != name.size()) {
+        return false;
     }
-    if (asm_string == "rsp") {
-        register_number = RSP;
-        return;
+    for(size_t i = 0; i < name.size(); i++) {
+        if (tolower((unsigned char)asm_string[i]) != name[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Return the number of the register named by the operand, rN, rip or rsp in any case.
+ * @param[in] asm_string
+ */
+uint8_t parse_register(std::string_view asm_string) {
+    if (equals_lower(asm_string, "rip")) {
+        return RIP;
+    }
+    if (equals_lower(asm_string, "rsp")) {
+        return RSP;
     }
 
-    if (asm_string[0] != 'r') {
-        throw AsmException("Invalid register '%s'.", asm_string.c_str());
+    if (asm_string.empty() || tolower((unsigned char)asm_string[0]) != 'r') {
+        throw AsmException("Invalid register '%s'.", to_lower(std::string(asm_string)).c_str());
     }
-    std::string number_string = asm_string.substr(1);
+    std::string_view number_string = asm_string.substr(1);
 
     std::pair<uint32_t, bool> number_conversion_res = string_to_int(number_string);
     if (!number_conversion_res.second) {
-        throw AsmException("Could not parse number '%s'.", number_string.c_str());
+        throw AsmException("Could not parse number '%s'.", std::string(number_string).c_str());
     }
-    register_number = number_conversion_res.first;
+    return number_conversion_res.first;
+}
+
+void RegArg::parse_asm(std::string asm_string) { 
+    register_number = parse_register(asm_string);
 }
 
-std::string RegArg::write_asm() {
+std::string RegArg::write_asm() const {
     return "r" + std::to_string(register_number);
 }
 
 uint32_t RegArg::get_value(const Registers &r, const Memory& m) const {
     return r.get(register_number);
 }
-void RegArg::set_value(Registers &r, Memory& m, uint32_t value, uint8_t value_length) {
+void RegArg::set_value(Registers &r, Memory& m, uint32_t value, uint8_t value_length) const {
     if (value_length > 4) {
         throw std::logic_error("Can't write more than 4 bytes at a time.");
     }
@@ -124,29 +177,101 @@ void RegArg::set_value(Registers &r, Memory& m, uint32_t value, uint8_t value_le
     r.set(register_number, value & ((uint32_t)((uint64_t)1 << (value_length * 8)) - 1));
 }
 
-size_t RegArg::len() {
+size_t RegArg::len() const {
+    return 1;
+}
+
+ArgKind VecArg::kind() const {
+    return ArgKind::Vec;
+}
+
+uint32_t VecArg::get_raw_value() const {
+    return register_number;
+}
+
+size_t VecArg::parse_raw(const Memory& m, size_t addr) {
+    register_number = m.read_type<uint8_t>(addr);
+    return sizeof(uint8_t);
+}
+
+size_t VecArg::write_raw(Memory &m, size_t addr) const {
+    m.write_type<uint8_t>(addr, register_number);
     return 1;
 }
 
-size_t Opcode::len() {
-    opcode_length = 0;
+/**
+ * Return the number of the vector register named by the operand, vN in any case.
+ * @param[in] asm_string
+ */
+uint8_t parse_vector_register(std::string_view asm_string) {
+    if (asm_string.empty() || tolower((unsigned char)asm_string[0]) != 'v') {
+        throw AsmException("Invalid vector register '%s'.", to_lower(std::string(asm_string)).c_str());
+    }
+    std::string_view number_string = asm_string.substr(1);
+
+    std::pair<uint32_t, bool> number_conversion_res = string_to_int(number_string);
+    if (!number_conversion_res.second) {
+        throw AsmException("Could not parse number '%s'.", std::string(number_string).c_str());
+    }
+    return number_conversion_res.first;
+}
+
+void VecArg::parse_asm(std::string asm_string) {
+    register_number = parse_vector_register(asm_string);
+}
+
+std::string VecArg::write_asm() const {
+    return "v" + std::to_string(register_number);
+}
+
+uint32_t VecArg::get_value(const Registers &r, const Memory& m) const {
+    throw std::logic_error("Vector registers have no scalar value.");
+}
+
+void VecArg::set_value(Registers &r, Memory& m, uint32_t value, uint8_t value_length) const {
+    throw std::logic_error("Vector registers have no scalar value.");
+}
+
+size_t VecArg::len() const {
+    return 1;
+}
+
+size_t Opcode::len() const {
+    size_t opcode_length = 0;
     for(auto arg: args_) {
         opcode_length += arg->len();
     }
     return opcode_length;
 }
 
-std::string Opcode::get_name() {
+std::string Opcode::get_name() const {
     return name_;
 }
 
+const std::vector<std::shared_ptr<OpcodeArg>> &Opcode::get_args() const {
+    return args_;
+}
+
+InstructionHandler Opcode::get_handler() const {
+    return handler_;
+}
+
+/**
+ * Attach the handler the interpreter runs instead of execute, for definitions in the opcode table.
+ * Decoded instances don't carry it, it is looked up in the definition.
+ * @param[in] handler
+ */
+void Opcode::set_handler(InstructionHandler handler) {
+    handler_ = handler;
+}
+
 Opcode::Opcode(std::string name, std::vector<std::shared_ptr<OpcodeArg>> args)
     : args_ {args}
     , name_ {name}
 {}
 
-size_t Opcode::write_raw(Memory &m, size_t addr) {
-    opcode_length = 0;
+size_t Opcode::write_raw(Memory &m, size_t addr) const {
+    size_t opcode_length = 0;
     for(auto arg: args_) {
         opcode_length += arg->write_raw(m, addr + opcode_length);
     }
@@ -154,14 +279,54 @@ size_t Opcode::write_raw(Memory &m, size_t addr) {
 }
 
 size_t Opcode::parse_raw(const Memory& m, size_t addr) {
-    opcode_length = 0;
+    size_t opcode_length = 0;
     for(auto arg: args_) {
         opcode_length += arg->parse_raw(m, addr + opcode_length);
     }
     return opcode_length;
 }
 
-std::string Opcode::write_asm() {
+/**
+ * Decode the operands following the opcode number into a new instance.
+ * @param[in] m
+ * @param[in] addr - address of the first operand.
+ * @param[out] length - length of the operands.
+ */
+std::shared_ptr<Opcode> Opcode::decode(const Memory &m, size_t addr, size_t &length) const {
+    auto opcode = clone();
+    length = opcode->parse_raw(m, addr);
+    return opcode;
+}
+
+/**
+ * Parse assembly operands into a new instance.
+ * @param[in] asm_strings
+ */
+std::shared_ptr<Opcode> Opcode::assemble(std::vector<std::string> asm_strings) const {
+    auto opcode = clone();
+    opcode->parse_asm(asm_strings);
+    return opcode;
+}
+
+/**
+ * Return the number of the form of the mnemonic taking the number of operands.
+ * Without such a form it is the first one, assembling it reports the wrong operands.
+ * @param[in] name
+ * @param[in] operands
+ */
+uint8_t OpcodeTable::lookup(const std::string &name, size_t operands) const {
+    auto form = opcodes_by_form.find({name, operands});
+    if (form != opcodes_by_form.end()) {
+        return form->second;
+    }
+    auto opcode = opcodes_by_name.find(name);
+    if (opcode == opcodes_by_name.end()) {
+        throw AsmException("No such opcode %s.", name.c_str());
+    }
+    return opcode->second;
+}
+
+std::string Opcode::write_asm() const {
     std::string asm_string = get_name();
 
     std::string args_string = "";
@@ -180,7 +345,7 @@ std::string Opcode::write_asm() {
 
 void Opcode::parse_asm(std::vector<std::string> asm_strings) {
     if (asm_strings.size() != args_.size()) {
-        throw AsmException("Wrong name of arguments %zu to %s.", asm_strings.size(), get_name().c_str());
+        throw AsmException("Wrong number of arguments %zu to %s.", asm_strings.size(), get_name().c_str());
     }
     for(size_t i = 0; i < args_.size(); i++) {
         args_[i]->parse_asm(asm_strings[i]);
@@ -190,7 +355,7 @@ void Opcode::parse_asm(std::vector<std::string> asm_strings) {
 BinaryOperationOpcode::BinaryOperationOpcode(std::string name, 
         std::shared_ptr<OpcodeArg> arg1,
         std::shared_ptr<OpcodeArg> arg2,
-        std::function<uint32_t (uint32_t, uint32_t)>op, uint8_t value_length)
+        BinaryFunction op, uint8_t value_length)
     : value_length_ {value_length}
     , op_ {op}
 , Opcode(name,  std::vector<std::shared_ptr<OpcodeArg>>{arg1, arg2})
@@ -206,7 +371,7 @@ BinaryOperationOpcode::BinaryOperationOpcode(std::string name,
     }
 }
 
-bool BinaryOperationOpcode::execute(Registers &r, Memory &m, Memory &stack)  {
+bool BinaryOperationOpcode::execute(Registers &r, Memory &m, Memory &stack) const {
 
     uint32_t a = args_[0]->get_value(r, m) & ((uint32_t)((uint64_t)1 << ((value_length_) * 8)) - 1);
     uint32_t b = args_[1]->get_value(r, m) & ((uint32_t)((uint64_t)1 << ((value_length_) * 8)) - 1);
@@ -214,38 +379,160 @@ bool BinaryOperationOpcode::execute(Registers &r, Memory &m, Memory &stack)  {
     return false;
 }
 
+ThreeOperandOpcode::ThreeOperandOpcode(std::string name,
+        std::shared_ptr<OpcodeArg> dest,
+        std::shared_ptr<OpcodeArg> arg1,
+        std::shared_ptr<OpcodeArg> arg2,
+        BinaryFunction op, uint8_t value_length)
+    : Opcode(name, std::vector<std::shared_ptr<OpcodeArg>>{dest, arg1, arg2})
+    , value_length_ {value_length}
+    , op_ {op}
+{}
+
+bool ThreeOperandOpcode::execute(Registers &r, Memory &m, Memory &stack) const {
+    uint32_t a = args_[1]->get_value(r, m) & ((uint32_t)((uint64_t)1 << ((value_length_) * 8)) - 1);
+    uint32_t b = args_[2]->get_value(r, m) & ((uint32_t)((uint64_t)1 << ((value_length_) * 8)) - 1);
+    args_[0]->set_value(r, m, op_(a, b), value_length_);
+    return false;
+}
+
 UnaryOperationOpcode::UnaryOperationOpcode(
         std::string name, std::shared_ptr<OpcodeArg> arg,
-        std::function<uint32_t (uint32_t)> op, uint8_t value_length
+        UnaryFunction op, uint8_t value_length
         ) 
 : op_ {op}
 , value_length_ {value_length}
 , Opcode(name,  std::vector<std::shared_ptr<OpcodeArg>>{arg})
 {}
 
-bool UnaryOperationOpcode::execute(Registers &r, Memory &m, Memory &stack) {
+bool UnaryOperationOpcode::execute(Registers &r, Memory &m, Memory &stack) const {
     uint32_t a = args_[0]->get_value(r, m) & ((uint32_t)((uint64_t)1 << ((value_length_) * 8)) - 1);
     args_[0]->set_value(r, m, op_(a), value_length_);
     return false;
 }
 
-JumpOpcode::JumpOpcode(std::string name, std::vector<std::shared_ptr<OpcodeArg>> args,
-        std::function<bool (std::vector<uint32_t>)> holds
-        )
-: holds_ {holds}
+/**
+ * Execute with access to the guest I/O, only I/O opcodes make use of it.
+ * @param[in] r
+ * @param[in] m
+ * @param[in] stack
+ * @param[in] io
+ */
+bool Opcode::execute(Registers &r, Memory &m, Memory &stack, GuestIO &io) const {
+    return execute(r, m, stack);
+}
+
+IoOpcode::IoOpcode(std::string name, std::shared_ptr<OpcodeArg> arg, IoOperation op)
+    : Opcode(name, {arg})
+    , op_ {op}
+{}
+
+IoOperation IoOpcode::get_operation() const {
+    return op_;
+}
+
+bool IoOpcode::execute(Registers &r, Memory &m, Memory &stack) const {
+    throw std::logic_error("I/O opcodes need a GuestIO.");
+}
+
+bool IoOpcode::execute(Registers &r, Memory &m, Memory &stack, GuestIO &io) const {
+    auto lock = io.acquire();
+    switch (op_) {
+        case IoOperation::PrintChar:
+            io.put_char(args_[0]->get_value(r, m));
+            break;
+        case IoOperation::Print:
+            io.put_uint(args_[0]->get_value(r, m));
+            break;
+        case IoOperation::ReadChar:
+            args_[0]->set_value(r, m, io.get_char());
+            break;
+        case IoOperation::Read:
+            args_[0]->set_value(r, m, io.get_uint());
+            break;
+    }
+    return false;
+}
+
+AtomicOpcode::AtomicOpcode(std::string name, std::vector<std::shared_ptr<OpcodeArg>> args, AtomicOperation op)
+    : Opcode(name, args)
+    , op_ {op}
+{}
+
+AtomicOperation AtomicOpcode::get_operation() const {
+    return op_;
+}
+
+bool AtomicOpcode::execute(Registers &r, Memory &m, Memory &stack) const {
+    uint32_t address = args_[0]->get_value(r, m);
+    uint32_t value = args_[1]->get_value(r, m);
+    switch (op_) {
+        case AtomicOperation::Exchange:
+            value = m.atomic_exchange(address, value);
+            break;
+        case AtomicOperation::CompareExchange:
+            value = m.atomic_compare_exchange(address, value, args_[2]->get_value(r, m));
+            break;
+        case AtomicOperation::FetchAdd:
+            value = m.atomic_fetch_add(address, value);
+            break;
+    }
+    args_[1]->set_value(r, m, value);
+    return false;
+}
+
+BulkOpcode::BulkOpcode(std::string name, std::vector<std::shared_ptr<OpcodeArg>> args, BulkOperation op)
+    : Opcode(name, args)
+    , op_ {op}
+{}
+
+BulkOperation BulkOpcode::get_operation() const {
+    return op_;
+}
+
+bool BulkOpcode::execute(Registers &r, Memory &m, Memory &stack) const {
+    uint32_t a = args_[0]->get_value(r, m);
+    uint32_t b = args_[1]->get_value(r, m);
+    uint32_t length = args_[2]->get_value(r, m);
+    switch (op_) {
+        case BulkOperation::Copy:
+            m.copy(a, b, length);
+            break;
+        case BulkOperation::Fill:
+            m.fill(a, b, length);
+            break;
+        case BulkOperation::Compare:
+            args_[0]->set_value(r, m, m.compare(a, b, length));
+            break;
+    }
+    return false;
+}
+
+JumpOpcode::JumpOpcode(std::string name, std::vector<std::shared_ptr<OpcodeArg>> args, JumpCondition condition)
+: condition_ {condition}
 , Opcode(name, args)
 { }
 
-bool JumpOpcode::execute(Registers &r, Memory &m, Memory &stack)  {
-    uint32_t jump_addr = args_[0]->get_value(r, m);
+JumpCondition JumpOpcode::get_condition() const {
+    return condition_;
+}
 
-    std::vector<uint32_t> values;
-    for(auto arg: args_) {
-        values.push_back(arg->get_value(r, m));
+/**
+ * Return whether the jump is taken for the values of its operands, the target first.
+ * @param[in] values
+ */
+bool JumpOpcode::holds(const std::vector<uint32_t> &values) const {
+    return jump_holds(condition_, values.size() > 1 ? values[1] : 0, values.size() > 2 ? values[2] : 0);
+}
+
+bool JumpOpcode::execute(Registers &r, Memory &m, Memory &stack) const {
+    uint32_t values[3] = {};
+    for(size_t i = 0; i < args_.size(); i++) {
+        values[i] = args_[i]->get_value(r, m);
     }
 
-    if (holds_(values)) {
-        r.set(RIP, jump_addr);
+    if (jump_holds(condition_, values[1], values[2])) {
+        r.set(RIP, values[0]);
     }
     return false;
 }
@@ -254,7 +541,7 @@ ExitOpcode::ExitOpcode(std::string name)
     : Opcode(name, {})
 {}
 
-bool ExitOpcode::execute(Registers &r, Memory &m, Memory &stack) {
+bool ExitOpcode::execute(Registers &r, Memory &m, Memory &stack) const {
     return true;
 }
 
@@ -263,7 +550,7 @@ PushOpcode::PushOpcode(std::string name, std::shared_ptr<OpcodeArg> arg, uint8_t
     , value_length_ {value_length}
 {}
 
-bool PushOpcode::execute(Registers &r, Memory &m, Memory &stack) {
+bool PushOpcode::execute(Registers &r, Memory &m, Memory &stack) const {
     uint32_t rsp = r.get(RSP);
     uint32_t value = args_[1]->get_value(r, m);
     if (value_length_ > 4) {
@@ -294,7 +581,7 @@ PopOpcode::PopOpcode(std::string name, std::shared_ptr<OpcodeArg> arg, uint8_t v
     , value_length_ {value_length}
 {}
 
-bool PopOpcode::execute(Registers &r, Memory &m, Memory &stack) {
+bool PopOpcode::execute(Registers &r, Memory &m, Memory &stack) const {
     uint32_t rsp = r.get(RSP);
     if (rsp < value_length_) {
         throw std::runtime_error("Callstack analysis failed, positive sp found.");
@@ -308,7 +595,7 @@ CallOpcode::CallOpcode(std::string name)
     : Opcode(name, {std::shared_ptr<OpcodeArg>(new IntArg())})
 {}
 
-bool CallOpcode::execute(Registers &r, Memory &m, Memory &stack) {
+bool CallOpcode::execute(Registers &r, Memory &m, Memory &stack) const {
     uint32_t rsp = r.get(RSP);
     uint32_t rip = r.get(RIP);
     stack.write_type<uint32_t>(rsp, rip);
@@ -321,7 +608,7 @@ RetOpcode::RetOpcode(std::string name)
     : Opcode(name, {})
 {}
 
-bool RetOpcode::execute(Registers &r, Memory &m, Memory &stack) {
+bool RetOpcode::execute(Registers &r, Memory &m, Memory &stack) const {
     uint32_t rsp = r.get(RSP);
     if (rsp < 4) {
         throw std::runtime_error("Callstack analysis failed, positive sp found.");
@@ -335,40 +622,63 @@ bool RetOpcode::execute(Registers &r, Memory &m, Memory &stack) {
     return false;
 }
 
-std::shared_ptr<OpcodeArg> IntArg::clone() {
+std::shared_ptr<OpcodeArg> IntArg::clone() const {
     return std::shared_ptr<OpcodeArg>(new IntArg(*this));
 }
-std::shared_ptr<OpcodeArg> AddressArg::clone() {
+std::shared_ptr<OpcodeArg> AddressArg::clone() const {
     return std::shared_ptr<OpcodeArg>(new AddressArg(*this));
 }
-std::shared_ptr<OpcodeArg> RegArg::clone() {
+std::shared_ptr<OpcodeArg> RegArg::clone() const {
     return std::shared_ptr<OpcodeArg>(new RegArg(*this));
 }
-std::shared_ptr<Opcode> BinaryOperationOpcode::clone() {
+std::shared_ptr<OpcodeArg> VecArg::clone() const {
+    return std::shared_ptr<OpcodeArg>(new VecArg(*this));
+}
+std::shared_ptr<Opcode> BinaryOperationOpcode::clone() const {
     return std::shared_ptr<Opcode>(new BinaryOperationOpcode(name_, args_[0]->clone(), args_[1]->clone(), op_, value_length_));
 }
-std::shared_ptr<Opcode> UnaryOperationOpcode::clone() {
+std::shared_ptr<Opcode> ThreeOperandOpcode::clone() const {
+    return std::shared_ptr<Opcode>(new ThreeOperandOpcode(name_, args_[0]->clone(), args_[1]->clone(), args_[2]->clone(), op_, value_length_));
+}
+std::shared_ptr<Opcode> UnaryOperationOpcode::clone() const {
     return std::shared_ptr<Opcode>(new UnaryOperationOpcode(name_, args_[0]->clone(), op_, value_length_));
 }
-std::shared_ptr<Opcode> JumpOpcode::clone() {
+std::shared_ptr<Opcode> JumpOpcode::clone() const {
+    auto args = args_;
+    for(auto &arg: args) {
+        arg = arg->clone();
+    }
+    return std::shared_ptr<Opcode>(new JumpOpcode(name_, args, condition_));
+}
+std::shared_ptr<Opcode> IoOpcode::clone() const {
+    return std::shared_ptr<Opcode>(new IoOpcode(name_, args_[0]->clone(), op_));
+}
+std::shared_ptr<Opcode> AtomicOpcode::clone() const {
+    auto args = args_;
+    for(auto &arg: args) {
+        arg = arg->clone();
+    }
+    return std::shared_ptr<Opcode>(new AtomicOpcode(name_, args, op_));
+}
+std::shared_ptr<Opcode> BulkOpcode::clone() const {
     auto args = args_;
     for(auto &arg: args) {
         arg = arg->clone();
     }
-    return std::shared_ptr<Opcode>(new JumpOpcode(name_, args, holds_));
+    return std::shared_ptr<Opcode>(new BulkOpcode(name_, args, op_));
 }
-std::shared_ptr<Opcode> CallOpcode::clone() {
+std::shared_ptr<Opcode> CallOpcode::clone() const {
     return std::shared_ptr<Opcode>(new CallOpcode(name_));
 }
-std::shared_ptr<Opcode> RetOpcode::clone() {
+std::shared_ptr<Opcode> RetOpcode::clone() const {
     return std::shared_ptr<Opcode>(new RetOpcode(name_));
 }
-std::shared_ptr<Opcode> PushOpcode::clone() {
+std::shared_ptr<Opcode> PushOpcode::clone() const {
     return std::shared_ptr<Opcode>(new PushOpcode(name_, args_[0]->clone(), value_length_));
 }
-std::shared_ptr<Opcode> PopOpcode::clone() {
+std::shared_ptr<Opcode> PopOpcode::clone() const {
     return std::shared_ptr<Opcode>(new PopOpcode(name_, args_[0]->clone(), value_length_));
 }
-std::shared_ptr<Opcode> ExitOpcode::clone() {
+std::shared_ptr<Opcode> ExitOpcode::clone() const {
     return std::shared_ptr<Opcode>(new ExitOpcode(name_));
 }
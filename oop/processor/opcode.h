@@ -4,125 +4,292 @@
 #include "memory.h"
 #include "util.h"
 #include "error.h"
+#include "guestio.h"
+#include "ops.h"
+
+enum class ArgKind {
+    Reg,
+    Int,
+    Address,
+    Vec,
+};
 
 class OpcodeArg {
     public:
-    virtual size_t len() = 0;
-    virtual std::shared_ptr<OpcodeArg> clone() = 0;
+    virtual ArgKind kind() const = 0;
+    virtual uint32_t get_raw_value() const = 0;
+    virtual size_t len() const = 0;
+    virtual std::shared_ptr<OpcodeArg> clone() const = 0;
     virtual size_t parse_raw(const Memory& m, size_t address) = 0;
-    virtual size_t write_raw(Memory &m, size_t address) = 0;
+    virtual size_t write_raw(Memory &m, size_t address) const = 0;
     virtual void parse_asm(std::string asm_string) = 0;
-    virtual std::string write_asm() = 0;
+    virtual std::string write_asm() const = 0;
     virtual uint32_t get_value(const Registers &r, const Memory& m) const = 0;
-    virtual void set_value(Registers &r, Memory& m, uint32_t value, uint8_t value_length=4) = 0;
+    virtual void set_value(Registers &r, Memory& m, uint32_t value, uint8_t value_length=4) const = 0;
+    virtual ~OpcodeArg() = default;
 };
 
 class IntArg : public OpcodeArg {
 
     protected:
     bool is_label = false;
-    uint32_t value;
+    uint32_t value = 0;
     std::string label;
 
     public:
     size_t parse_raw(const Memory& m, size_t addr);
 
-    size_t len();
-    std::shared_ptr<OpcodeArg> clone() ;
-    size_t write_raw(Memory &m, size_t addr);
+    ArgKind kind() const;
+    uint32_t get_raw_value() const;
+    size_t len() const;
+    std::shared_ptr<OpcodeArg> clone() const;
+    size_t write_raw(Memory &m, size_t addr) const;
     void parse_asm(std::string asm_string);
-    std::string write_asm();
+    std::string write_asm() const;
     uint32_t resolve(const Memory &m) const;
+    bool has_label() const;
+    std::string get_label() const;
     virtual uint32_t get_value(const Registers &r, const Memory& m) const;
-    virtual void set_value(Registers &r, Memory& m, uint32_t value, uint8_t value_length=4);
+    virtual void set_value(Registers &r, Memory& m, uint32_t value, uint8_t value_length=4) const;
 };
 
 class AddressArg : public IntArg {
-    std::shared_ptr<OpcodeArg> clone() ;
+    ArgKind kind() const;
+    std::shared_ptr<OpcodeArg> clone() const;
     uint32_t get_value(const Registers &r, const Memory& m) const;
-    void set_value(Registers &r, Memory& m, uint32_t value, uint8_t value_length=4);
+    void set_value(Registers &r, Memory& m, uint32_t value, uint8_t value_length=4) const;
 };
 
 class RegArg : public OpcodeArg {
-    uint8_t register_number;
+    uint8_t register_number = 0;
     public:
-    std::shared_ptr<OpcodeArg> clone() ;
-    size_t len();
+    ArgKind kind() const;
+    uint32_t get_raw_value() const;
+    std::shared_ptr<OpcodeArg> clone() const;
+    size_t len() const;
     size_t parse_raw(const Memory& m, size_t addr);
-    size_t write_raw(Memory &m, size_t addr);
+    size_t write_raw(Memory &m, size_t addr) const;
     void parse_asm(std::string asm_string);
-    std::string write_asm();
+    std::string write_asm() const;
     uint32_t get_value(const Registers &r, const Memory& m) const;
-    void set_value(Registers &r, Memory& m, uint32_t value, uint8_t value_length=4);
+    void set_value(Registers &r, Memory& m, uint32_t value, uint8_t value_length=4) const;
+
+};
+
+uint8_t parse_register(std::string_view asm_string);
+uint8_t parse_vector_register(std::string_view asm_string);
 
+/**
+ * A vector register, it has no scalar value. Opcodes using it access the registers directly.
+ */
+class VecArg : public OpcodeArg {
+    uint8_t register_number = 0;
+    public:
+    ArgKind kind() const;
+    uint32_t get_raw_value() const;
+    std::shared_ptr<OpcodeArg> clone() const;
+    size_t len() const;
+    size_t parse_raw(const Memory& m, size_t addr);
+    size_t write_raw(Memory &m, size_t addr) const;
+    void parse_asm(std::string asm_string);
+    std::string write_asm() const;
+    uint32_t get_value(const Registers &r, const Memory& m) const;
+    void set_value(Registers &r, Memory& m, uint32_t value, uint8_t value_length=4) const;
 };
 
+typedef uint32_t (*UnaryFunction)(uint32_t a);
+typedef uint32_t (*BinaryFunction)(uint32_t a, uint32_t b);
+
+/*
+ * Executes a decoded instruction from the raw values of its first three operands, missing ones are zero.
+ * Returns whether the program exited.
+ */
+typedef bool (*InstructionHandler)(const uint32_t *operands, Registers &r, Memory &m);
+
+/**
+ * An opcode with its operands. Definitions in an OpcodeTable are never parsed into,
+ * decode and assemble return new instances holding the operands of one instruction.
+ * Executing doesn't modify the opcode, so decoded instructions may be shared between threads.
+ */
 class Opcode {
     protected:
     std::vector<std::shared_ptr<OpcodeArg>> args_;
     std::string name_;
-    size_t opcode_length = 0;
+    InstructionHandler handler_ = NULL;
 
     public:
-    virtual bool execute(Registers &r, Memory &m, Memory &stack) = 0;
+    virtual bool execute(Registers &r, Memory &m, Memory &stack) const = 0;
+    virtual bool execute(Registers &r, Memory &m, Memory &stack, GuestIO &io) const;
 
-    std::string get_name();
+    std::string get_name() const;
+    const std::vector<std::shared_ptr<OpcodeArg>> &get_args() const;
+    InstructionHandler get_handler() const;
+    void set_handler(InstructionHandler handler);
     Opcode(std::string name, std::vector<std::shared_ptr<OpcodeArg>> args);
 
-    virtual std::shared_ptr<Opcode> clone() = 0;
-    virtual size_t len();
-    virtual size_t write_raw(Memory &m, size_t addr);
+    virtual std::shared_ptr<Opcode> clone() const = 0;
+    std::shared_ptr<Opcode> decode(const Memory &m, size_t addr, size_t &length) const;
+    std::shared_ptr<Opcode> assemble(std::vector<std::string> asm_strings) const;
+    virtual size_t len() const;
+    virtual size_t write_raw(Memory &m, size_t addr) const;
     virtual size_t parse_raw(const Memory& m, size_t addr);
-    virtual std::string write_asm();
+    virtual std::string write_asm() const;
     virtual void parse_asm(std::vector<std::string> asm_strings);
     virtual ~Opcode() = default;
 };
 
+/**
+ * Immutable opcode definitions by number and mnemonic.
+ * A mnemonic may have forms with different numbers of operands, opcodes_by_name holds the first one.
+ */
+struct OpcodeTable {
+    std::map<uint8_t, std::shared_ptr<const Opcode>> opcodes;
+    std::map<std::string, uint8_t> opcodes_by_name;
+    std::map<std::pair<std::string, size_t>, uint8_t> opcodes_by_form;
+
+    uint8_t lookup(const std::string &name, size_t operands) const;
+};
+
 class UnaryOperationOpcode : public Opcode {
     uint8_t value_length_ = 0;
-    std::function<uint32_t (uint32_t)> op_;
+    UnaryFunction op_;
 
     public:
     UnaryOperationOpcode(
             std::string name, std::shared_ptr<OpcodeArg> arg,
-            std::function<uint32_t (uint32_t)> op, uint8_t value_length
+            UnaryFunction op, uint8_t value_length
             );
 
-    std::shared_ptr<Opcode> clone() ;
-     bool execute(Registers &r, Memory &m, Memory &stack);
+    std::shared_ptr<Opcode> clone() const;
+     bool execute(Registers &r, Memory &m, Memory &stack) const;
 };
 
 class BinaryOperationOpcode : public Opcode {
     uint8_t value_length_ = 0;
-    std::function<uint32_t (uint32_t, uint32_t)> op_;
+    BinaryFunction op_;
 
     public:
     BinaryOperationOpcode(
             std::string name, 
             std::shared_ptr<OpcodeArg> arg1,
             std::shared_ptr<OpcodeArg> arg2,
-            std::function<uint32_t (uint32_t, uint32_t)> op, uint8_t value_length
+            BinaryFunction op, uint8_t value_length
             );
 
-    std::shared_ptr<Opcode> clone() ;
-     bool execute(Registers &r, Memory &m, Memory &stack);
+    std::shared_ptr<Opcode> clone() const;
+     bool execute(Registers &r, Memory &m, Memory &stack) const;
 };
 
-class JumpOpcode : public Opcode {
+/**
+ * A binary operation on its second and third operand, storing the result into the first one.
+ */
+class ThreeOperandOpcode : public Opcode {
+    uint8_t value_length_ = 0;
+    BinaryFunction op_;
+
     public:
-    std::function<bool (std::vector<uint32_t>)> holds_;
-    JumpOpcode(std::string name, std::vector<std::shared_ptr<OpcodeArg>> args,
-            std::function<bool (std::vector<uint32_t>)> holds
+    ThreeOperandOpcode(
+            std::string name,
+            std::shared_ptr<OpcodeArg> dest,
+            std::shared_ptr<OpcodeArg> arg1,
+            std::shared_ptr<OpcodeArg> arg2,
+            BinaryFunction op, uint8_t value_length
             );
-    std::shared_ptr<Opcode> clone() ;
-    bool execute(Registers &r, Memory &m, Memory &stack);
+
+    std::shared_ptr<Opcode> clone() const;
+    bool execute(Registers &r, Memory &m, Memory &stack) const;
+};
+
+enum class IoOperation {
+    PrintChar,
+    Print,
+    ReadChar,
+    Read,
+};
+
+/**
+ * Reads or prints a register through the GuestIO of the processor.
+ */
+class IoOpcode : public Opcode {
+    IoOperation op_;
+
+    public:
+    IoOpcode(std::string name, std::shared_ptr<OpcodeArg> arg, IoOperation op);
+
+    IoOperation get_operation() const;
+    std::shared_ptr<Opcode> clone() const;
+    bool execute(Registers &r, Memory &m, Memory &stack) const;
+    bool execute(Registers &r, Memory &m, Memory &stack, GuestIO &io) const;
+};
+
+enum class AtomicOperation {
+    /* xchg addr, value */
+    Exchange,
+    /* cas addr, expected, desired */
+    CompareExchange,
+    /* fetchadd addr, value */
+    FetchAdd,
+};
+
+/**
+ * A sequentially consistent read-modify-write of the aligned word at the address held by the first register.
+ * The previous value of the word is returned in the second register.
+ */
+class AtomicOpcode : public Opcode {
+    AtomicOperation op_;
+
+    public:
+    AtomicOpcode(std::string name, std::vector<std::shared_ptr<OpcodeArg>> args, AtomicOperation op);
+
+    AtomicOperation get_operation() const;
+    std::shared_ptr<Opcode> clone() const;
+    bool execute(Registers &r, Memory &m, Memory &stack) const;
+};
+
+enum class BulkOperation {
+    /* mcpy dst, src, len */
+    Copy,
+    /* mset dst, value, len */
+    Fill,
+    /* mcmp a, b, len */
+    Compare,
+};
+
+/**
+ * Copies, fills or compares a range of memory at once, the addresses and the length are held by registers.
+ * Ranges may overlap, mset uses the low byte of the value and mcmp stores -1, 0 or 1 into its first register.
+ */
+class BulkOpcode : public Opcode {
+    BulkOperation op_;
+
+    public:
+    BulkOpcode(std::string name, std::vector<std::shared_ptr<OpcodeArg>> args, BulkOperation op);
+
+    BulkOperation get_operation() const;
+    std::shared_ptr<Opcode> clone() const;
+    bool execute(Registers &r, Memory &m, Memory &stack) const;
+};
+
+/**
+ * Jumps to the address of its first operand when the condition holds for the values of the others.
+ */
+class JumpOpcode : public Opcode {
+    JumpCondition condition_;
+
+    public:
+    JumpOpcode(std::string name, std::vector<std::shared_ptr<OpcodeArg>> args, JumpCondition condition);
+
+    JumpCondition get_condition() const;
+    bool holds(const std::vector<uint32_t> &values) const;
+    std::shared_ptr<Opcode> clone() const;
+    bool execute(Registers &r, Memory &m, Memory &stack) const;
 };
 
 class ExitOpcode : public Opcode {
     public:
     ExitOpcode(std::string name);
-    std::shared_ptr<Opcode> clone() ;
-    bool execute(Registers &r, Memory &m, Memory &stack);
+    std::shared_ptr<Opcode> clone() const;
+    bool execute(Registers &r, Memory &m, Memory &stack) const;
 };
 
 class PushOpcode : public Opcode {
@@ -134,9 +301,9 @@ class PushOpcode : public Opcode {
             std::shared_ptr<OpcodeArg> arg,
             uint8_t value_length
             );
-    std::shared_ptr<Opcode> clone() ;
+    std::shared_ptr<Opcode> clone() const;
 
-     bool execute(Registers &r, Memory &m, Memory &stack);
+     bool execute(Registers &r, Memory &m, Memory &stack) const;
 };
 
 class PopOpcode : public Opcode {
@@ -149,22 +316,22 @@ class PopOpcode : public Opcode {
             uint8_t value_length
             );
 
-    std::shared_ptr<Opcode> clone() ;
-     bool execute(Registers &r, Memory &m, Memory &stack);
+    std::shared_ptr<Opcode> clone() const;
+     bool execute(Registers &r, Memory &m, Memory &stack) const;
 };
 
 class CallOpcode : public Opcode {
     public:
     CallOpcode(std::string name);
 
-    std::shared_ptr<Opcode> clone() ;
-    bool execute(Registers &r, Memory &m, Memory &stack);
+    std::shared_ptr<Opcode> clone() const;
+    bool execute(Registers &r, Memory &m, Memory &stack) const;
 };
 
 class RetOpcode : public Opcode {
     public:
     RetOpcode(std::string name);
 
-    std::shared_ptr<Opcode> clone() ;
-    bool execute(Registers &r, Memory &m, Memory &stack);
+    std::shared_ptr<Opcode> clone() const;
+    bool execute(Registers &r, Memory &m, Memory &stack) const;
 };
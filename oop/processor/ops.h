@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+
+/*
+ * Operations of the arithmetic opcodes on uint32_t a and b, shared by the engines and translators.
+ * name, mnemonic of the register form (the constant form has an "i" appended), operation
+ */
+#define BINARY_OPERATIONS(X) \
+    X(Add, "add", a + b) \
+    X(Sub, "sub", a - b) \
+    X(Mov, "mov", b) \
+    X(Xor, "xor", a ^ b) \
+    X(And, "and", a & b) \
+    X(Or, "or", a | b) \
+    X(Lshift, "lshift", a << (b & 31)) \
+    X(Rshift, "rshift", a >> (b & 31)) \
+    X(Mul, "mul", a * b) \
+    X(Div, "div", a / b) \
+    X(Mod, "mod", a % b)
+
+/* name, mnemonic, operation on uint32_t a */
+#define UNARY_OPERATIONS(X) \
+    X(Bitflip, "bitflip", a ^ 0xffffffff) \
+    X(Neg, "neg", -a)
+
+/* name, condition on the uint32_t operands b and c following the jump target */
+#define JUMP_CONDITIONS(X) \
+    X(Always, true) \
+    X(Zero, b == 0) \
+    X(NonZero, b != 0) \
+    X(Less, (int32_t)b < (int32_t)c) \
+    X(GreaterEqual, (int32_t)b >= (int32_t)c) \
+    X(Equal, b == c) \
+    X(NotEqual, b != c)
+
+enum class BinaryOperation : uint8_t {
+#define X(name, mnemonic, expr) name,
+    BINARY_OPERATIONS(X)
+#undef X
+};
+
+enum class UnaryOperation : uint8_t {
+#define X(name, mnemonic, expr) name,
+    UNARY_OPERATIONS(X)
+#undef X
+};
+
+enum class JumpCondition : uint8_t {
+#define X(name, expr) name,
+    JUMP_CONDITIONS(X)
+#undef X
+};
+
+/* the operations as functions, for handlers instantiated per operation */
+template<BinaryOperation Op> constexpr uint32_t binary_operation(uint32_t a, uint32_t b);
+template<UnaryOperation Op> constexpr uint32_t unary_operation(uint32_t a);
+template<JumpCondition Condition> constexpr bool jump_holds(uint32_t b, uint32_t c);
+
+#define X(name, mnemonic, expr) \
+    template<> constexpr uint32_t binary_operation<BinaryOperation::name>([[maybe_unused]] uint32_t a, uint32_t b) { return expr; }
+BINARY_OPERATIONS(X)
+#undef X
+
+#define X(name, mnemonic, expr) \
+    template<> constexpr uint32_t unary_operation<UnaryOperation::name>(uint32_t a) { return expr; }
+UNARY_OPERATIONS(X)
+#undef X
+
+#define X(name, expr) \
+    template<> constexpr bool jump_holds<JumpCondition::name>([[maybe_unused]] uint32_t b, [[maybe_unused]] uint32_t c) { return expr; }
+JUMP_CONDITIONS(X)
+#undef X
+
+constexpr bool jump_holds(JumpCondition condition, uint32_t b, uint32_t c) {
+    switch (condition) {
+#define X(name, expr) case JumpCondition::name: return jump_holds<JumpCondition::name>(b, c);
+        JUMP_CONDITIONS(X)
+#undef X
+    }
+    return false;
+}
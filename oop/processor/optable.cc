@@ -0,0 +1,198 @@
+#include "optable.h"
+
+/*
+ * Handlers execute one decoded instruction from its raw operands, with the operation and the operand kinds
+ * fixed at compile time, instead of going through the virtual operands of the opcode.
+ * They do exactly what execute of the opcode does, the registers are still range checked.
+ */
+
+template<uint8_t Width>
+static constexpr uint32_t width_mask() {
+    return (uint32_t)((uint64_t)1 << (Width * 8)) - 1;
+}
+
+template<ArgKind Kind>
+static inline uint32_t load_operand(uint32_t operand, const Registers &r, const Memory &m) {
+    if constexpr (Kind == ArgKind::Reg) {
+        return r.get(operand);
+    } else if constexpr (Kind == ArgKind::Address) {
+        return m.read_type<uint32_t>(operand);
+    } else {
+        return operand;
+    }
+}
+
+template<ArgKind Kind, uint8_t Width>
+static inline void store_operand(uint32_t operand, Registers &r, Memory &m, uint32_t value) {
+    static_assert(Width == 1 || Width == 2 || Width == 4, "Can only write 1, 2 or 4 bytes.");
+    if constexpr (Kind == ArgKind::Reg) {
+        r.set(operand, value & width_mask<Width>());
+    } else {
+        static_assert(Kind == ArgKind::Address, "Only registers and memory can be written.");
+        if constexpr (Width == 1) {
+            m.write_type<uint8_t>(operand, value);
+        } else if constexpr (Width == 2) {
+            m.write_type<uint16_t>(operand, value);
+        } else {
+            m.write_type<uint32_t>(operand, value);
+        }
+    }
+}
+
+template<BinaryOperation Op, ArgKind A, ArgKind B, uint8_t Width>
+static bool binary_handler(const uint32_t *operands, Registers &r, Memory &m) {
+    uint32_t a = load_operand<A>(operands[0], r, m) & width_mask<Width>();
+    uint32_t b = load_operand<B>(operands[1], r, m) & width_mask<Width>();
+    store_operand<A, Width>(operands[0], r, m, binary_operation<Op>(a, b));
+    return false;
+}
+
+template<UnaryOperation Op, ArgKind A, uint8_t Width>
+static bool unary_handler(const uint32_t *operands, Registers &r, Memory &m) {
+    uint32_t a = load_operand<A>(operands[0], r, m) & width_mask<Width>();
+    store_operand<A, Width>(operands[0], r, m, unary_operation<Op>(a));
+    return false;
+}
+
+template<BinaryOperation Op, ArgKind Dest, ArgKind A, ArgKind B, uint8_t Width>
+static bool three_operand_handler(const uint32_t *operands, Registers &r, Memory &m) {
+    uint32_t a = load_operand<A>(operands[1], r, m) & width_mask<Width>();
+    uint32_t b = load_operand<B>(operands[2], r, m) & width_mask<Width>();
+    store_operand<Dest, Width>(operands[0], r, m, binary_operation<Op>(a, b));
+    return false;
+}
+
+/* missing operands are zero, their kind is Int */
+template<JumpCondition Condition, ArgKind B, ArgKind C>
+static bool jump_handler(const uint32_t *operands, Registers &r, Memory &m) {
+    uint32_t b = load_operand<B>(operands[1], r, m);
+    uint32_t c = load_operand<C>(operands[2], r, m);
+    if (jump_holds<Condition>(b, c)) {
+        r.set(RIP, operands[0]);
+    }
+    return false;
+}
+
+static constexpr ArgKind operand_kind(const OpcodeSpec &spec, size_t i) {
+    return i < spec.arg_count ? spec.args[i] : ArgKind::Int;
+}
+
+/**
+ * Return the handler of the opcode numbered N, NULL for the families which are executed by the opcode.
+ */
+template<size_t N>
+static constexpr InstructionHandler spec_handler() {
+    constexpr const OpcodeSpec &spec = OpcodeSpecs[N];
+    constexpr ArgKind a = operand_kind(spec, 0);
+    constexpr ArgKind b = operand_kind(spec, 1);
+    constexpr ArgKind c = operand_kind(spec, 2);
+    if constexpr (spec.family == OpcodeFamily::Binary) {
+        return &binary_handler<(BinaryOperation)spec.operation, a, b, spec.width>;
+    } else if constexpr (spec.family == OpcodeFamily::Unary) {
+        return &unary_handler<(UnaryOperation)spec.operation, a, spec.width>;
+    } else if constexpr (spec.family == OpcodeFamily::ThreeOperand) {
+        return &three_operand_handler<(BinaryOperation)spec.operation, a, b, c, spec.width>;
+    } else if constexpr (spec.family == OpcodeFamily::Jump) {
+        return &jump_handler<(JumpCondition)spec.operation, b, c>;
+    } else {
+        return NULL;
+    }
+}
+
+template<size_t... N>
+static constexpr std::array<InstructionHandler, sizeof...(N)> spec_handlers(std::index_sequence<N...>) {
+    return {spec_handler<N>()...};
+}
+
+static constexpr std::array<InstructionHandler, OpcodeSpecCount> Handlers = spec_handlers(std::make_index_sequence<OpcodeSpecCount>());
+
+static BinaryFunction binary_function(BinaryOperation op) {
+    switch (op) {
+#define X(name, mnemonic, expr) case BinaryOperation::name: return &binary_operation<BinaryOperation::name>;
+        BINARY_OPERATIONS(X)
+#undef X
+    }
+    throw std::logic_error("No such binary operation.");
+}
+
+static UnaryFunction unary_function(UnaryOperation op) {
+    switch (op) {
+#define X(name, mnemonic, expr) case UnaryOperation::name: return &unary_operation<UnaryOperation::name>;
+        UNARY_OPERATIONS(X)
+#undef X
+    }
+    throw std::logic_error("No such unary operation.");
+}
+
+static std::shared_ptr<OpcodeArg> make_arg(ArgKind kind) {
+    switch (kind) {
+        case ArgKind::Reg:
+            return std::shared_ptr<OpcodeArg>(new RegArg());
+        case ArgKind::Int:
+            return std::shared_ptr<OpcodeArg>(new IntArg());
+        case ArgKind::Address:
+            return std::shared_ptr<OpcodeArg>(new AddressArg());
+        case ArgKind::Vec:
+            return std::shared_ptr<OpcodeArg>(new VecArg());
+    }
+    throw std::logic_error("No such operand kind.");
+}
+
+/**
+ * Return the definition of an opcode as described by its spec, with its handler attached.
+ * @param[in] number - index into OpcodeSpecs.
+ */
+std::shared_ptr<Opcode> make_opcode(size_t number) {
+    const OpcodeSpec &spec = OpcodeSpecs[number];
+    std::vector<std::shared_ptr<OpcodeArg>> args;
+    for(size_t i = 0; i < spec.arg_count; i++) {
+        args.push_back(make_arg(spec.args[i]));
+    }
+
+    std::shared_ptr<Opcode> opcode;
+    switch (spec.family) {
+        case OpcodeFamily::Binary:
+            opcode.reset(new BinaryOperationOpcode(spec.mnemonic, args[0], args[1],
+                        binary_function((BinaryOperation)spec.operation), spec.width));
+            break;
+        case OpcodeFamily::Unary:
+            opcode.reset(new UnaryOperationOpcode(spec.mnemonic, args[0],
+                        unary_function((UnaryOperation)spec.operation), spec.width));
+            break;
+        case OpcodeFamily::ThreeOperand:
+            opcode.reset(new ThreeOperandOpcode(spec.mnemonic, args[0], args[1], args[2],
+                        binary_function((BinaryOperation)spec.operation), spec.width));
+            break;
+        case OpcodeFamily::Io:
+            opcode.reset(new IoOpcode(spec.mnemonic, args[0], (IoOperation)spec.operation));
+            break;
+        case OpcodeFamily::Jump:
+            opcode.reset(new JumpOpcode(spec.mnemonic, args, (JumpCondition)spec.operation));
+            break;
+        case OpcodeFamily::Thread:
+            opcode.reset(new ThreadOpcode(spec.mnemonic, args, (ThreadOperation)spec.operation));
+            break;
+        case OpcodeFamily::Atomic:
+            opcode.reset(new AtomicOpcode(spec.mnemonic, args, (AtomicOperation)spec.operation));
+            break;
+        case OpcodeFamily::Task:
+            opcode.reset(new TaskOpcode(spec.mnemonic, args, (TaskOperation)spec.operation));
+            break;
+        case OpcodeFamily::Bulk:
+            opcode.reset(new BulkOpcode(spec.mnemonic, args, (BulkOperation)spec.operation));
+            break;
+        case OpcodeFamily::Vector:
+            opcode.reset(new VectorOpcode(spec.mnemonic, args, (VectorOperation)spec.operation));
+            break;
+    }
+    opcode->set_handler(Handlers[number]);
+    return opcode;
+}
+
+/**
+ * Return the handler generated for an opcode, NULL if it has none or isn't in OpcodeSpecs.
+ * @param[in] number
+ */
+InstructionHandler opcode_handler(size_t number) {
+    return number < OpcodeSpecCount ? Handlers[number] : NULL;
+}
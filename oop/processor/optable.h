@@ -0,0 +1,138 @@
+#pragma once
+#include "opcode.h"
+#include "ops.h"
+#include "guestthreads.h"
+#include "simd.h"
+#include "tasks.h"
+
+enum class OpcodeFamily : uint8_t {
+    Binary,
+    Unary,
+    ThreeOperand,
+    Io,
+    Jump,
+    Thread,
+    Atomic,
+    Task,
+    Bulk,
+    Vector,
+};
+
+/*
+ * One opcode of the instruction set, numbered by its index in OpcodeSpecs.
+ * operation holds a value of the operation enum of the family, args beyond arg_count are unused.
+ */
+struct OpcodeSpec {
+    const char *mnemonic;
+    OpcodeFamily family;
+    uint8_t operation;
+    uint8_t arg_count;
+    ArgKind args[3];
+    /* bytes read and written by the arithmetic families */
+    uint8_t width = 4;
+};
+
+/*
+ * The instruction set. The opcode table, and with it the assembler, the decoder and the disassembler, is built
+ * from it, and so are the interpreter's handlers, at compile time. New opcodes go to the end, the numbers are
+ * part of the image format. exit is numbered 255 and not listed.
+ */
+inline constexpr OpcodeSpec OpcodeSpecs[] = {
+    /* arithmetic opcodes */
+#define X(name, mnemonic, expr) {mnemonic, OpcodeFamily::Binary, (uint8_t)BinaryOperation::name, 2, {ArgKind::Reg, ArgKind::Reg}},
+    BINARY_OPERATIONS(X)
+#undef X
+
+    /* arithmetic opcodes with constants */
+#define X(name, mnemonic, expr) {mnemonic "i", OpcodeFamily::Binary, (uint8_t)BinaryOperation::name, 2, {ArgKind::Reg, ArgKind::Int}},
+    BINARY_OPERATIONS(X)
+#undef X
+
+    /* bit magic opcodes */
+#define X(name, mnemonic, expr) {mnemonic, OpcodeFamily::Unary, (uint8_t)UnaryOperation::name, 1, {ArgKind::Reg}},
+    UNARY_OPERATIONS(X)
+#undef X
+
+    /* io opcodes */
+    {"printc", OpcodeFamily::Io, (uint8_t)IoOperation::PrintChar, 1, {ArgKind::Reg}},
+    {"print", OpcodeFamily::Io, (uint8_t)IoOperation::Print, 1, {ArgKind::Reg}},
+    {"readc", OpcodeFamily::Io, (uint8_t)IoOperation::ReadChar, 1, {ArgKind::Reg}},
+    {"read", OpcodeFamily::Io, (uint8_t)IoOperation::Read, 1, {ArgKind::Reg}},
+
+    /* jumps */
+    {"jz", OpcodeFamily::Jump, (uint8_t)JumpCondition::Zero, 2, {ArgKind::Int, ArgKind::Reg}},
+    {"jnz", OpcodeFamily::Jump, (uint8_t)JumpCondition::NonZero, 2, {ArgKind::Int, ArgKind::Reg}},
+    {"jmp", OpcodeFamily::Jump, (uint8_t)JumpCondition::Always, 1, {ArgKind::Int}},
+
+    /* memory opcodes */
+    {"ldr", OpcodeFamily::Binary, (uint8_t)BinaryOperation::Mov, 2, {ArgKind::Reg, ArgKind::Address}},
+    {"str", OpcodeFamily::Binary, (uint8_t)BinaryOperation::Mov, 2, {ArgKind::Address, ArgKind::Reg}},
+
+    /* thread opcodes */
+    {"spawn", OpcodeFamily::Thread, (uint8_t)ThreadOperation::Spawn, 2, {ArgKind::Reg, ArgKind::Int}},
+    {"join", OpcodeFamily::Thread, (uint8_t)ThreadOperation::Join, 1, {ArgKind::Reg}},
+
+    /* atomic opcodes */
+    {"xchg", OpcodeFamily::Atomic, (uint8_t)AtomicOperation::Exchange, 2, {ArgKind::Reg, ArgKind::Reg}},
+    {"cas", OpcodeFamily::Atomic, (uint8_t)AtomicOperation::CompareExchange, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Reg}},
+    {"fetchadd", OpcodeFamily::Atomic, (uint8_t)AtomicOperation::FetchAdd, 2, {ArgKind::Reg, ArgKind::Reg}},
+
+    /* task opcodes */
+    {"go", OpcodeFamily::Task, (uint8_t)TaskOperation::Go, 1, {ArgKind::Int}},
+    {"yield", OpcodeFamily::Task, (uint8_t)TaskOperation::Yield, 0, {}},
+
+    /* bulk memory opcodes */
+    {"mcpy", OpcodeFamily::Bulk, (uint8_t)BulkOperation::Copy, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Reg}},
+    {"mset", OpcodeFamily::Bulk, (uint8_t)BulkOperation::Fill, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Reg}},
+    {"mcmp", OpcodeFamily::Bulk, (uint8_t)BulkOperation::Compare, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Reg}},
+
+    /* vector opcodes */
+    {"vld", OpcodeFamily::Vector, (uint8_t)VectorOperation::Load, 2, {ArgKind::Vec, ArgKind::Reg}},
+    {"vst", OpcodeFamily::Vector, (uint8_t)VectorOperation::Store, 2, {ArgKind::Reg, ArgKind::Vec}},
+    {"vadd", OpcodeFamily::Vector, (uint8_t)VectorOperation::Add, 2, {ArgKind::Vec, ArgKind::Vec}},
+    {"vsub", OpcodeFamily::Vector, (uint8_t)VectorOperation::Sub, 2, {ArgKind::Vec, ArgKind::Vec}},
+    {"vmul", OpcodeFamily::Vector, (uint8_t)VectorOperation::Mul, 2, {ArgKind::Vec, ArgKind::Vec}},
+    {"vand", OpcodeFamily::Vector, (uint8_t)VectorOperation::And, 2, {ArgKind::Vec, ArgKind::Vec}},
+    {"vxor", OpcodeFamily::Vector, (uint8_t)VectorOperation::Xor, 2, {ArgKind::Vec, ArgKind::Vec}},
+    {"vshl", OpcodeFamily::Vector, (uint8_t)VectorOperation::ShiftLeft, 2, {ArgKind::Vec, ArgKind::Int}},
+    {"vsum", OpcodeFamily::Vector, (uint8_t)VectorOperation::Sum, 2, {ArgKind::Reg, ArgKind::Vec}},
+
+    /* compare and branch opcodes, lt and ge compare signed */
+    {"jlt", OpcodeFamily::Jump, (uint8_t)JumpCondition::Less, 3, {ArgKind::Int, ArgKind::Reg, ArgKind::Reg}},
+    {"jge", OpcodeFamily::Jump, (uint8_t)JumpCondition::GreaterEqual, 3, {ArgKind::Int, ArgKind::Reg, ArgKind::Reg}},
+    {"jeq", OpcodeFamily::Jump, (uint8_t)JumpCondition::Equal, 3, {ArgKind::Int, ArgKind::Reg, ArgKind::Reg}},
+    {"jne", OpcodeFamily::Jump, (uint8_t)JumpCondition::NotEqual, 3, {ArgKind::Int, ArgKind::Reg, ArgKind::Reg}},
+    {"jlti", OpcodeFamily::Jump, (uint8_t)JumpCondition::Less, 3, {ArgKind::Int, ArgKind::Reg, ArgKind::Int}},
+    {"jgei", OpcodeFamily::Jump, (uint8_t)JumpCondition::GreaterEqual, 3, {ArgKind::Int, ArgKind::Reg, ArgKind::Int}},
+    {"jeqi", OpcodeFamily::Jump, (uint8_t)JumpCondition::Equal, 3, {ArgKind::Int, ArgKind::Reg, ArgKind::Int}},
+    {"jnei", OpcodeFamily::Jump, (uint8_t)JumpCondition::NotEqual, 3, {ArgKind::Int, ArgKind::Reg, ArgKind::Int}},
+
+    /* three operand forms of the arithmetic opcodes, storing into an additional first register */
+    {"add", OpcodeFamily::ThreeOperand, (uint8_t)BinaryOperation::Add, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Reg}},
+    {"sub", OpcodeFamily::ThreeOperand, (uint8_t)BinaryOperation::Sub, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Reg}},
+    {"xor", OpcodeFamily::ThreeOperand, (uint8_t)BinaryOperation::Xor, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Reg}},
+    {"and", OpcodeFamily::ThreeOperand, (uint8_t)BinaryOperation::And, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Reg}},
+    {"or", OpcodeFamily::ThreeOperand, (uint8_t)BinaryOperation::Or, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Reg}},
+    {"lshift", OpcodeFamily::ThreeOperand, (uint8_t)BinaryOperation::Lshift, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Reg}},
+    {"rshift", OpcodeFamily::ThreeOperand, (uint8_t)BinaryOperation::Rshift, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Reg}},
+    {"mul", OpcodeFamily::ThreeOperand, (uint8_t)BinaryOperation::Mul, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Reg}},
+    {"div", OpcodeFamily::ThreeOperand, (uint8_t)BinaryOperation::Div, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Reg}},
+    {"mod", OpcodeFamily::ThreeOperand, (uint8_t)BinaryOperation::Mod, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Reg}},
+    {"addi", OpcodeFamily::ThreeOperand, (uint8_t)BinaryOperation::Add, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Int}},
+    {"subi", OpcodeFamily::ThreeOperand, (uint8_t)BinaryOperation::Sub, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Int}},
+    {"xori", OpcodeFamily::ThreeOperand, (uint8_t)BinaryOperation::Xor, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Int}},
+    {"andi", OpcodeFamily::ThreeOperand, (uint8_t)BinaryOperation::And, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Int}},
+    {"ori", OpcodeFamily::ThreeOperand, (uint8_t)BinaryOperation::Or, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Int}},
+    {"lshifti", OpcodeFamily::ThreeOperand, (uint8_t)BinaryOperation::Lshift, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Int}},
+    {"rshifti", OpcodeFamily::ThreeOperand, (uint8_t)BinaryOperation::Rshift, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Int}},
+    {"muli", OpcodeFamily::ThreeOperand, (uint8_t)BinaryOperation::Mul, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Int}},
+    {"divi", OpcodeFamily::ThreeOperand, (uint8_t)BinaryOperation::Div, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Int}},
+    {"modi", OpcodeFamily::ThreeOperand, (uint8_t)BinaryOperation::Mod, 3, {ArgKind::Reg, ArgKind::Reg, ArgKind::Int}},
+};
+
+const size_t OpcodeSpecCount = sizeof(OpcodeSpecs) / sizeof(OpcodeSpecs[0]);
+const uint8_t ExitOpcodeNumber = 255;
+static_assert(OpcodeSpecCount <= ExitOpcodeNumber, "opcode numbers collide with exit");
+
+std::shared_ptr<Opcode> make_opcode(size_t number);
+InstructionHandler opcode_handler(size_t number);
@@ -0,0 +1,689 @@
+#include "optimizer.h"
+#include "cfg.h"
+#include "guestthreads.h"
+#include "simd.h"
+#include "tasks.h"
+
+/* opcodes whose first operand is only written */
+static const std::set<std::string> MoveOpcodes = {"mov", "movi", "ldr"};
+/* opcodes trapping on a zero second operand */
+static const std::set<std::string> DivisionOpcodes = {"div", "mod", "divi", "modi"};
+/* immediate opcodes doing nothing for the given immediate */
+static const std::map<std::string, uint32_t> IdentityOpcodes = {
+    {"addi", 0}, {"subi", 0}, {"xori", 0}, {"ori", 0}, {"lshifti", 0}, {"rshifti", 0}, {"muli", 1}, {"divi", 1},
+};
+/* conditional jumps taken exactly when the other one isn't */
+static const std::map<std::string, std::string> InverseJumps = {
+    {"jz", "jnz"}, {"jnz", "jz"}, {"jlt", "jge"}, {"jge", "jlt"}, {"jeq", "jne"}, {"jne", "jeq"},
+    {"jlti", "jgei"}, {"jgei", "jlti"}, {"jeqi", "jnei"}, {"jnei", "jeqi"},
+};
+
+static bool is_arithmetic(const Opcode &opcode) {
+    return dynamic_cast<const BinaryOperationOpcode *>(&opcode) != NULL
+        || dynamic_cast<const ThreeOperandOpcode *>(&opcode) != NULL
+        || dynamic_cast<const UnaryOperationOpcode *>(&opcode) != NULL;
+}
+
+/**
+ * Return whether the first operand of the opcode is only written, like the destination of a three-operand form.
+ * @param[in] opcode
+ */
+static bool is_move(const Opcode &opcode) {
+    return MoveOpcodes.count(opcode.get_name()) != 0 || dynamic_cast<const ThreeOperandOpcode *>(&opcode) != NULL;
+}
+
+/**
+ * Return the label operand of the argument, or an empty string if it is a number.
+ * @param[in] arg
+ */
+static std::string arg_label(const OpcodeArg &arg) {
+    auto int_arg = dynamic_cast<const IntArg *>(&arg);
+    if (int_arg == NULL || !int_arg->has_label()) {
+        return "";
+    }
+    return int_arg->get_label();
+}
+
+/**
+ * Return whether the arithmetic opcode may be removed when its result is not used.
+ * Divisions by a register or by zero are kept, they may trap.
+ * @param[in] opcode
+ */
+static bool is_removable(const Opcode &opcode) {
+    auto &args = opcode.get_args();
+    if (!is_arithmetic(opcode) || args[0]->kind() != ArgKind::Reg) {
+        return false;
+    }
+    if (DivisionOpcodes.count(opcode.get_name())) {
+        return args.back()->kind() == ArgKind::Int && args.back()->get_raw_value() != 0;
+    }
+    return true;
+}
+
+void Optimizer::RegState::set(uint8_t reg, uint32_t value) {
+    values[reg] = value;
+    known.set(reg);
+}
+
+void Optimizer::RegState::forget(uint8_t reg) {
+    known.reset(reg);
+}
+
+/**
+ * Keep only the values known in both states.
+ * @param[in] other
+ * @param[out] changed
+ */
+bool Optimizer::RegState::merge(const RegState &other) {
+    bool changed = false;
+    for(size_t reg = 0; reg < RegisterCount; reg++) {
+        if (known[reg] && (!other.known[reg] || other.values[reg] != values[reg])) {
+            known.reset(reg);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+Optimizer::Optimizer(std::shared_ptr<const OpcodeTable> table) : table(table) {}
+
+/**
+ * Assemble an instruction.
+ * @param[in] name
+ * @param[in] args
+ */
+std::shared_ptr<Opcode> Optimizer::make(std::string name, std::vector<std::string> args) const {
+    return table->opcodes.at(table->lookup(name, args.size()))->assemble(args);
+}
+
+/**
+ * Return whether the opcode reads or writes memory at an address held in a register, or starts code at a
+ * constant address.
+ * The optimizer can't tell where such addresses point to, so it can't move the code or data there.
+ * @param[in] opcode
+ */
+static bool uses_computed_address(const Opcode &opcode) {
+    if (dynamic_cast<const AtomicOpcode *>(&opcode) != NULL || dynamic_cast<const BulkOpcode *>(&opcode) != NULL) {
+        return true;
+    }
+    auto vector = dynamic_cast<const VectorOpcode *>(&opcode);
+    if (vector != NULL) {
+        return vector->get_operation() == VectorOperation::Load || vector->get_operation() == VectorOperation::Store;
+    }
+    return dynamic_cast<const ThreadOpcode *>(&opcode) != NULL || dynamic_cast<const TaskOpcode *>(&opcode) != NULL;
+}
+
+/**
+ * Return whether the program can be laid out differently without changing what it does.
+ * Programs naming rip or registers past the register file, and ones addressing memory through registers,
+ * are left as they are.
+ */
+bool Optimizer::is_safe() const {
+    std::set<std::string> labels;
+    size_t layout_size = 0;
+    for(auto &line: lines) {
+        if (line.opcode == nullptr) {
+            if (line.label != "" && !labels.insert(line.label).second) {
+                return false;
+            }
+            layout_size += line.label_length;
+        } else {
+            layout_size += 1 + line.opcode->len();
+        }
+    }
+    for(auto &line: lines) {
+        if (line.opcode == nullptr) {
+            continue;
+        }
+        if (uses_computed_address(*line.opcode)) {
+            return false;
+        }
+        bool jump = dynamic_cast<const JumpOpcode *>(line.opcode.get()) != NULL;
+        auto &args = line.opcode->get_args();
+        for(size_t i = 0; i < args.size(); i++) {
+            std::string label = arg_label(*args[i]);
+            switch (args[i]->kind()) {
+                case ArgKind::Reg:
+                    if (args[i]->get_raw_value() == RIP || args[i]->get_raw_value() >= RegisterCount) {
+                        return false;
+                    }
+                    break;
+                case ArgKind::Int:
+                    if (jump && i == 0) {
+                        if (label == "" || label_lines.find(label) == label_lines.end()
+                                || lines[label_lines.at(label)].label_length != 0) {
+                            return false;
+                        }
+                    } else if (label != "") {
+                        return false;
+                    }
+                    break;
+                case ArgKind::Address:
+                    if (label == "") {
+                        if (args[i]->get_raw_value() < layout_size) {
+                            return false;
+                        }
+                    } else if (label_lines.find(label) == label_lines.end()
+                            || (lines[label_lines.at(label)].label_length == 0 && first_instruction(label) != lines.size())) {
+                        return false;
+                    }
+                    break;
+                case ArgKind::Vec:
+                    break;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Split the lines into basic blocks and find the blocks reachable from the first line.
+ * Data labels get blocks of their own.
+ * @param[out] safe - whether no reachable block falls through into data or off the end.
+ */
+bool Optimizer::build_cfg() {
+    blocks.clear();
+    label_lines.clear();
+    label_blocks.clear();
+    size_t i = 0;
+    while (i < lines.size()) {
+        Block block;
+        block.begin = i;
+        if (lines[i].opcode == nullptr && lines[i].label_length != 0) {
+            block.data = true;
+            i++;
+        } else {
+            while (i < lines.size() && lines[i].opcode == nullptr && lines[i].label_length == 0) {
+                i++;
+            }
+            while (i < lines.size() && lines[i].opcode != nullptr) {
+                i++;
+                if (ends_basic_block(*lines[i - 1].opcode)) {
+                    break;
+                }
+            }
+        }
+        block.end = i;
+        for(size_t j = block.begin; j < block.end; j++) {
+            if (lines[j].opcode == nullptr && lines[j].label != "") {
+                label_lines[lines[j].label] = j;
+                label_blocks[lines[j].label] = blocks.size();
+            }
+        }
+        blocks.push_back(block);
+    }
+
+    for(size_t b = 0; b < blocks.size(); b++) {
+        auto &block = blocks[b];
+        if (block.data) {
+            continue;
+        }
+        const Opcode *last = block.end > block.begin ? lines[block.end - 1].opcode.get() : NULL;
+        uint32_t target;
+        bool conditional = true;
+        if (last != NULL && is_jump(*last, target, conditional)) {
+            std::string label = arg_label(*last->get_args()[0]);
+            if (label_blocks.find(label) == label_blocks.end()) {
+                return false;
+            }
+            block.successors.push_back(label_blocks.at(label));
+        }
+        if (last == NULL || (conditional && dynamic_cast<const ExitOpcode *>(last) == NULL)) {
+            block.successors.push_back(b + 1);
+        }
+    }
+
+    std::vector<size_t> worklist;
+    if (!blocks.empty()) {
+        worklist.push_back(0);
+    }
+    while (!worklist.empty()) {
+        size_t b = worklist.back();
+        worklist.pop_back();
+        if (b == blocks.size() || blocks[b].data) {
+            return false;
+        }
+        if (blocks[b].reachable) {
+            continue;
+        }
+        blocks[b].reachable = true;
+        for(auto successor: blocks[b].successors) {
+            worklist.push_back(successor);
+        }
+    }
+    return true;
+}
+
+/**
+ * Drop removed instructions and empty unnamed labels.
+ */
+void Optimizer::compact() {
+    lines.erase(std::remove_if(lines.begin(), lines.end(), [](const AsmLine &line) {
+                return line.opcode == nullptr && line.label == "" && line.label_length == 0;
+                }), lines.end());
+}
+
+/**
+ * Return the line of the first instruction executed after jumping to the label,
+ * or the number of lines if the label is followed by data or nothing.
+ * @param[in] label
+ */
+size_t Optimizer::first_instruction(std::string label) const {
+    size_t i = label_lines.at(label);
+    while (i < lines.size() && lines[i].opcode == nullptr && lines[i].label_length == 0) {
+        i++;
+    }
+    if (i == lines.size() || lines[i].opcode == nullptr) {
+        return lines.size();
+    }
+    return i;
+}
+
+/**
+ * Return a label placed right before the line, creating a new one if there is none.
+ * @param[in] line
+ * @param[out] new_labels - labels to insert before the lines once all jumps are threaded.
+ */
+std::string Optimizer::label_before(size_t line, std::map<size_t, std::string> &new_labels) {
+    if (lines[line].opcode == nullptr && lines[line].label != "" && lines[line].label_length == 0) {
+        return lines[line].label;
+    }
+    if (new_labels.find(line) == new_labels.end()) {
+        std::string label;
+        do {
+            label = "__opt" + std::to_string(label_counter++);
+        } while (label_lines.find(label) != label_lines.end());
+        new_labels[line] = label;
+    }
+    return new_labels.at(line);
+}
+
+/**
+ * Update the known registers after the instruction, optionally replacing it with a cheaper one.
+ * Jumps on known registers become unconditional or are removed, instructions on known registers are folded
+ * into movi and register operands with a known value become immediates.
+ * @param[in,out] state
+ * @param[in,out] opcode - set to NULL when removed.
+ * @param[in] rewrite
+ * @param[out] changed
+ */
+bool Optimizer::transfer(RegState &state, std::shared_ptr<Opcode> &opcode, bool rewrite) const {
+    auto &args = opcode->get_args();
+    std::string name = opcode->get_name();
+    auto jump = dynamic_cast<const JumpOpcode *>(opcode.get());
+    if (jump != NULL) {
+        if (!rewrite || args.size() < 2) {
+            return false;
+        }
+        std::vector<uint32_t> values = {0};
+        for(size_t i = 1; i < args.size(); i++) {
+            if (args[i]->kind() == ArgKind::Int && arg_label(*args[i]) == "") {
+                values.push_back(args[i]->get_raw_value());
+            } else if (args[i]->kind() == ArgKind::Reg && state.known[args[i]->get_raw_value()]) {
+                values.push_back(state.values[args[i]->get_raw_value()]);
+            } else {
+                return false;
+            }
+        }
+        if (jump->holds(values)) {
+            opcode = make("jmp", {args[0]->write_asm()});
+        } else {
+            opcode = NULL;
+        }
+        return true;
+    }
+    auto io = dynamic_cast<const IoOpcode *>(opcode.get());
+    if (io != NULL) {
+        if (io->get_operation() == IoOperation::ReadChar || io->get_operation() == IoOperation::Read) {
+            state.forget(args[0]->get_raw_value());
+        }
+        return false;
+    }
+    if (!is_arithmetic(*opcode)) {
+        /* atomics and thread opcodes may write any of their registers */
+        for(auto &arg: args) {
+            if (arg->kind() == ArgKind::Reg) {
+                state.forget(arg->get_raw_value());
+            }
+        }
+        return false;
+    }
+    if (args[0]->kind() != ArgKind::Reg) {
+        return false;
+    }
+
+    uint8_t dest = args[0]->get_raw_value();
+    bool move = is_move(*opcode);
+    if (rewrite && args.size() == 2 && ((name == "mov" && args[1]->get_raw_value() == dest)
+                || (IdentityOpcodes.count(name) && args[1]->get_raw_value() == IdentityOpcodes.at(name)))) {
+        opcode = NULL;
+        return true;
+    }
+
+    bool all_known = true;
+    for(size_t i = 0; i < args.size(); i++) {
+        if (args[i]->kind() == ArgKind::Address
+                || (args[i]->kind() == ArgKind::Reg && !(i == 0 && move) && !state.known[args[i]->get_raw_value()])) {
+            all_known = false;
+        }
+    }
+    if (all_known && DivisionOpcodes.count(name)) {
+        uint32_t divisor = args.back()->get_raw_value();
+        if (args.back()->kind() == ArgKind::Reg) {
+            divisor = state.values[divisor];
+        }
+        all_known = divisor != 0;
+    }
+    if (all_known) {
+        Registers scratch;
+        Memory scratch_mem, scratch_stack;
+        for(size_t reg = 0; reg < RegisterCount; reg++) {
+            if (state.known[reg]) {
+                scratch.set(reg, state.values[reg]);
+            }
+        }
+        opcode->execute(scratch, scratch_mem, scratch_stack);
+        uint32_t value = scratch.get(dest);
+        state.set(dest, value);
+        if (rewrite && !(name == "movi" && args[1]->get_raw_value() == value)) {
+            opcode = make("movi", {args[0]->write_asm(), std::to_string(value)});
+            return true;
+        }
+        return false;
+    }
+
+    bool changed = false;
+    if (rewrite && args.size() == 2 && args[1]->kind() == ArgKind::Reg && state.known[args[1]->get_raw_value()]
+            && table->opcodes_by_name.count(name + "i")) {
+        opcode = make(name + "i", {args[0]->write_asm(), std::to_string(state.values[args[1]->get_raw_value()])});
+        changed = true;
+    }
+    state.forget(dest);
+    return changed;
+}
+
+/**
+ * Remove the instructions of blocks never reached from the first line, their labels are kept.
+ * @param[out] changed
+ */
+bool Optimizer::remove_unreachable() {
+    bool changed = false;
+    for(auto &block: blocks) {
+        if (block.reachable || block.data) {
+            continue;
+        }
+        for(size_t i = block.begin; i < block.end; i++) {
+            if (lines[i].opcode != nullptr) {
+                lines[i].opcode = NULL;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+/**
+ * Find the registers known at the start of every block and fold the instructions using them.
+ * Nothing is known about the registers at the start of the program.
+ * @param[out] changed
+ */
+bool Optimizer::propagate_constants() {
+    std::vector<RegState> states(blocks.size());
+    std::vector<bool> visited(blocks.size());
+    std::vector<size_t> worklist;
+    if (!blocks.empty()) {
+        visited[0] = true;
+        worklist.push_back(0);
+    }
+    while (!worklist.empty()) {
+        size_t b = worklist.back();
+        worklist.pop_back();
+        RegState state = states[b];
+        for(size_t i = blocks[b].begin; i < blocks[b].end; i++) {
+            if (lines[i].opcode != nullptr) {
+                transfer(state, lines[i].opcode, false);
+            }
+        }
+        for(auto successor: blocks[b].successors) {
+            if (!visited[successor]) {
+                visited[successor] = true;
+                states[successor] = state;
+                worklist.push_back(successor);
+            } else if (states[successor].merge(state)) {
+                worklist.push_back(successor);
+            }
+        }
+    }
+
+    bool changed = false;
+    for(size_t b = 0; b < blocks.size(); b++) {
+        if (!visited[b]) {
+            continue;
+        }
+        RegState state = states[b];
+        for(size_t i = blocks[b].begin; i < blocks[b].end; i++) {
+            if (lines[i].opcode != nullptr) {
+                changed |= transfer(state, lines[i].opcode, true);
+            }
+        }
+    }
+    return changed;
+}
+
+/**
+ * Retarget jumps landing on other jumps, remove jumps to the next instruction
+ * and turn a conditional jump over an unconditional one into a single inverted jump.
+ * A jz landing on a jz of the same register always takes it, and never takes a jnz, same for jnz.
+ * @param[out] changed
+ */
+bool Optimizer::thread_jumps() {
+    bool changed = false;
+    std::map<size_t, std::string> new_labels;
+    for(size_t i = 0; i < lines.size(); i++) {
+        if (lines[i].opcode == nullptr || dynamic_cast<const JumpOpcode *>(lines[i].opcode.get()) == NULL) {
+            continue;
+        }
+        auto &args = lines[i].opcode->get_args();
+        std::string name = lines[i].opcode->get_name();
+        std::string label = arg_label(*args[0]);
+        std::string target = label;
+        std::set<size_t> seen;
+        while (true) {
+            if (label_lines.find(target) == label_lines.end()) {
+                /* a new label of an earlier jump, placed after the loop */
+                break;
+            }
+            size_t next = first_instruction(target);
+            if (next == lines.size() || !seen.insert(next).second) {
+                break;
+            }
+            auto &next_args = lines[next].opcode->get_args();
+            std::string next_name = lines[next].opcode->get_name();
+            if (next_name == "jmp") {
+                target = arg_label(*next_args[0]);
+                continue;
+            }
+            if ((name == "jz" || name == "jnz") && (next_name == "jz" || next_name == "jnz")
+                    && args[1]->get_raw_value() == next_args[1]->get_raw_value()) {
+                if (name == next_name) {
+                    target = arg_label(*next_args[0]);
+                    continue;
+                }
+                if (next + 1 < lines.size() && lines[next + 1].label_length == 0) {
+                    target = label_before(next + 1, new_labels);
+                }
+            }
+            break;
+        }
+        if (target != label) {
+            std::vector<std::string> new_args = {target};
+            for(size_t j = 1; j < args.size(); j++) {
+                new_args.push_back(args[j]->write_asm());
+            }
+            lines[i].opcode = make(name, new_args);
+            changed = true;
+        }
+    }
+
+    for(size_t i = 0; i < lines.size(); i++) {
+        if (lines[i].opcode == nullptr || dynamic_cast<const JumpOpcode *>(lines[i].opcode.get()) == NULL) {
+            continue;
+        }
+        std::string label = arg_label(*lines[i].opcode->get_args()[0]);
+        if (label_lines.find(label) == label_lines.end()) {
+            /* a new label, not placed yet */
+            continue;
+        }
+        size_t label_line = label_lines.at(label);
+        auto only_labels = [&](size_t begin, size_t end) {
+            for(size_t j = begin; j < end; j++) {
+                if (lines[j].opcode != nullptr || lines[j].label_length != 0) {
+                    return false;
+                }
+            }
+            return true;
+        };
+        if (label_line > i && only_labels(i + 1, label_line)) {
+            lines[i].opcode = NULL;
+            changed = true;
+            continue;
+        }
+        std::string name = lines[i].opcode->get_name();
+        if (InverseJumps.count(name) && i + 1 < label_line && lines[i + 1].opcode != nullptr
+                && lines[i + 1].opcode->get_name() == "jmp" && only_labels(i + 2, label_line)) {
+            std::vector<std::string> new_args = {lines[i + 1].opcode->get_args()[0]->write_asm()};
+            for(size_t j = 1; j < lines[i].opcode->get_args().size(); j++) {
+                new_args.push_back(lines[i].opcode->get_args()[j]->write_asm());
+            }
+            lines[i].opcode = make(InverseJumps.at(name), new_args);
+            lines[i + 1].opcode = NULL;
+            changed = true;
+        }
+    }
+
+    for(auto it = new_labels.rbegin(); it != new_labels.rend(); it++) {
+        AsmLine line;
+        line.label = it->second;
+        lines.insert(lines.begin() + it->first, line);
+    }
+    return changed;
+}
+
+/**
+ * Remove arithmetic instructions writing registers which are overwritten before being read.
+ * All registers are live at exit, they are the result of the program.
+ * @param[out] changed
+ */
+bool Optimizer::eliminate_dead_stores() {
+    typedef std::bitset<RegisterCount> Live;
+    auto step = [&](Live &live, std::shared_ptr<Opcode> &opcode, bool rewrite) {
+        auto &args = opcode->get_args();
+        if (dynamic_cast<const ExitOpcode *>(opcode.get()) != NULL) {
+            live.set();
+            return false;
+        }
+        auto io = dynamic_cast<const IoOpcode *>(opcode.get());
+        if (io != NULL && (io->get_operation() == IoOperation::ReadChar || io->get_operation() == IoOperation::Read)) {
+            live.reset(args[0]->get_raw_value());
+            return false;
+        }
+        bool move = is_move(*opcode);
+        if (is_arithmetic(*opcode) && args[0]->kind() == ArgKind::Reg) {
+            uint8_t dest = args[0]->get_raw_value();
+            if (!live[dest] && is_removable(*opcode)) {
+                if (rewrite) {
+                    opcode = NULL;
+                    return true;
+                }
+                return false;
+            }
+            live.reset(dest);
+        }
+        for(size_t i = 0; i < args.size(); i++) {
+            if (args[i]->kind() == ArgKind::Reg && !(i == 0 && move)) {
+                live.set(args[i]->get_raw_value());
+            }
+        }
+        return false;
+    };
+
+    std::vector<Live> live_in(blocks.size());
+    auto live_out = [&](size_t b) {
+        Live live;
+        for(auto successor: blocks[b].successors) {
+            live |= live_in[successor];
+        }
+        return live;
+    };
+    bool updated = true;
+    while (updated) {
+        updated = false;
+        for(size_t b = blocks.size(); b-- > 0;) {
+            if (!blocks[b].reachable) {
+                continue;
+            }
+            Live live = live_out(b);
+            for(size_t i = blocks[b].end; i-- > blocks[b].begin;) {
+                if (lines[i].opcode != nullptr) {
+                    std::shared_ptr<Opcode> opcode = lines[i].opcode;
+                    step(live, opcode, false);
+                }
+            }
+            if (live != live_in[b]) {
+                live_in[b] = live;
+                updated = true;
+            }
+        }
+    }
+
+    bool changed = false;
+    for(size_t b = 0; b < blocks.size(); b++) {
+        if (!blocks[b].reachable) {
+            continue;
+        }
+        Live live = live_out(b);
+        for(size_t i = blocks[b].end; i-- > blocks[b].begin;) {
+            if (lines[i].opcode != nullptr) {
+                changed |= step(live, lines[i].opcode, true);
+            }
+        }
+    }
+    return changed;
+}
+
+/**
+ * Return the optimized program, or the program itself if it can't be optimized safely.
+ * @param[in] program
+ */
+std::vector<AsmLine> Optimizer::optimize(const std::vector<AsmLine> &program) {
+    lines = program;
+    if (!build_cfg() || !is_safe()) {
+        return program;
+    }
+    std::vector<bool (Optimizer::*)()> passes = {
+        &Optimizer::remove_unreachable,
+        &Optimizer::propagate_constants,
+        &Optimizer::thread_jumps,
+        &Optimizer::eliminate_dead_stores,
+    };
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for(auto pass: passes) {
+            changed |= (this->*pass)();
+            compact();
+            if (!build_cfg()) {
+                throw std::logic_error("Optimization made the program fall through into data.");
+            }
+        }
+    }
+    return lines;
+}
+
+/**
+ * Return the number of instructions in the program.
+ * @param[in] program
+ */
+size_t count_instructions(const std::vector<AsmLine> &program) {
+    return std::count_if(program.begin(), program.end(), [](const AsmLine &line) { return line.opcode != nullptr; });
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "opcode.h"
+#include "register.h"
+
+/**
+ * A parsed line of assembly, either a label reserving label_length bytes or an instruction.
+ */
+struct AsmLine {
+    std::string label;
+    size_t label_length = 0;
+    std::shared_ptr<Opcode> opcode;
+};
+
+/**
+ * Optimizes parsed assembly before it is laid out, labels are resolved again by the layout.
+ * Unreachable code removal, constant propagation and folding, jump threading and dead store elimination
+ * run on a control flow graph built from the labels and jumps until none of them changes the program.
+ * Registers are live at exit, memory and I/O are never touched.
+ * Programs which could observe their own code addresses, through numeric jump targets, rip, labels used
+ * as values or into code, numeric addresses inside the program or falling through into data, are left as they are.
+ */
+class Optimizer {
+    struct Block {
+        size_t begin;
+        size_t end;
+        bool data = false;
+        bool reachable = false;
+        /* blocks.size() stands for falling off the end of the program */
+        std::vector<size_t> successors;
+    };
+
+    /**
+     * Registers with a value known at compile time.
+     */
+    struct RegState {
+        uint32_t values[RegisterCount] = {};
+        std::bitset<RegisterCount> known;
+
+        void set(uint8_t reg, uint32_t value);
+        void forget(uint8_t reg);
+        bool merge(const RegState &other);
+    };
+
+    std::shared_ptr<const OpcodeTable> table;
+    std::vector<AsmLine> lines;
+    std::vector<Block> blocks;
+    std::map<std::string, size_t> label_lines;
+    std::map<std::string, size_t> label_blocks;
+    size_t label_counter = 0;
+
+    std::shared_ptr<Opcode> make(std::string name, std::vector<std::string> args) const;
+    bool is_safe() const;
+    bool build_cfg();
+    void compact();
+    size_t first_instruction(std::string label) const;
+    std::string label_before(size_t line, std::map<size_t, std::string> &new_labels);
+    bool transfer(RegState &state, std::shared_ptr<Opcode> &opcode, bool rewrite) const;
+    bool remove_unreachable();
+    bool propagate_constants();
+    bool thread_jumps();
+    bool eliminate_dead_stores();
+    public:
+        Optimizer(std::shared_ptr<const OpcodeTable> table);
+        std::vector<AsmLine> optimize(const std::vector<AsmLine> &program);
+};
+
+size_t count_instructions(const std::vector<AsmLine> &program);
@@ -2,20 +2,43 @@
 #include "memory.h"
 #include "opcode.h"
 #include "error.h"
+#include "threaded.h"
+#include "jit.h"
+#include "aot.h"
+#include "image.h"
+#include "snapshot.h"
+#include "cfg.h"
+#include "fusion.h"
+#include "simd.h"
+#include "assembler.h"
+#include "linker.h"
+#include "optable.h"
 #include <string>
  
 /** 
  * Processor constructor
 */
-Processor::Processor() {
-    init_opcodes();
+Processor::Processor()
+    : opcode_table {get_opcode_table()}
+    , opcodes {opcode_table->opcodes}
+    , opcode_traits {get_opcode_traits()}
+    , icache {opcodes}
+    , tasks {stack, io}
+    , threads {*this}
+{
+    mem.add_observer(&icache);
+    io.set_clock(&executed);
+}
+
+Processor::~Processor() {
+    mem.remove_observer(&icache);
 }
 
 /** 
  * Interactivly allow the user to view, change and assemble parts of the memory and stack.
  * @param[in] opcode - the provided opcode will be displayed allong with other info.
 */
-bool Processor::debug_interact(std::shared_ptr<Opcode> opcode) {
+bool Processor::debug_interact(std::shared_ptr<const Opcode> opcode) {
     std::cerr << "registers:" << std::endl;
     for(size_t i = 0; i < RegisterCount; i++) {
         std::string register_name = "r" + std::to_string(i);
@@ -27,10 +50,59 @@ bool Processor::debug_interact(std::shared_ptr<Opcode> opcode) {
         }
         std::cerr << register_name << " " << regs.get(i) << std::endl;
     }
+    for(size_t i = 0; i < VectorRegisterCount; i++) {
+        std::cerr << "v" << i;
+        for(auto lane: regs.get_vector(i).lanes) {
+            std::cerr << " " << lane;
+        }
+        std::cerr << std::endl;
+    }
     std::cerr << "Instruction:" << std::endl;
     std::cerr << opcode->write_asm() << std::endl;
+    /* trailing word after the numeric arguments, used by w */
+    std::string word;
     std::map<std::string, std::tuple<std::string, std::function<int (std::vector<uint32_t>)>, int> > commands = {
-        {"s", {"s (step)", [](std::vector<uint32_t> args) -> int { return 1; }, 0}},
+        {"s", {"s (step)", [&](std::vector<uint32_t> args) -> int {
+                       debug_state.stepping = true;
+                       return 1;
+                   }, 0}},
+        {"c", {"c (continue until a breakpoint or watchpoint)",
+                   [&](std::vector<uint32_t> args) -> int {
+                       debug_state.stepping = false;
+                       return 1;
+                   }, 0}},
+        {"b", {"b <addr> (break before executing address)",
+                   [&](std::vector<uint32_t> args) -> int {
+                       debug_state.add_breakpoint(args[0]);
+                       debug_state.list(std::cerr);
+                       return 0;
+                   }, 1}},
+        {"w", {"w <addr> <length> <r|w|c> (break after a read, write or change of memory)",
+                   [&](std::vector<uint32_t> args) -> int {
+                       int kinds = 0;
+                       for(auto c: word) {
+                           kinds |= c == 'r' ? WatchRead : c == 'w' ? WatchWrite : c == 'c' ? WatchChange : 0;
+                       }
+                       if (kinds == 0 || args[1] == 0) {
+                           std::cerr << "Need a length and any of r, w and c." << std::endl;
+                           return 0;
+                       }
+                       if (args[1] > MaxWatchLength) {
+                           std::cerr << "Watchpoints cover at most " << MaxWatchLength << " bytes." << std::endl;
+                           return 0;
+                       }
+                       debug_state.add_watchpoint(args[0], args[1], kinds, mem);
+                       debug_state.list(std::cerr);
+                       return 0;
+                   }, 2}},
+        {"d", {"d <n> (delete breakpoint or watchpoint)",
+                   [&](std::vector<uint32_t> args) -> int {
+                       if (!debug_state.remove(args[0])) {
+                           std::cerr << "No such breakpoint or watchpoint." << std::endl;
+                       }
+                       debug_state.list(std::cerr);
+                       return 0;
+                   }, 1}},
         {"h", {"h halt", [](std::vector<uint32_t> args) -> int { return 2; }, 0}},
         {"pm", {"pm <addr> (print uint32_t at address in memory)",
                    [&](std::vector<uint32_t> args) -> int {
@@ -39,7 +111,7 @@ bool Processor::debug_interact(std::shared_ptr<Opcode> opcode) {
                    }, 1}},
         {"ps", {"ps <addr> (print uint32_t at address in stack)",
                    [&](std::vector<uint32_t> args) -> int {
-                       std::cerr << stack.read_type<uint32_t>(args[0]) << std::endl;
+                       std::cerr << tasks.stack().read_type<uint32_t>(args[0]) << std::endl;
                        return 0; 
                    }, 1}},
         {"wm", {"wm <addr> <value> (write uint32_t at address in memory)",
@@ -49,7 +121,7 @@ bool Processor::debug_interact(std::shared_ptr<Opcode> opcode) {
                    }, 2}},
         {"ws", {"ws <addr> <value> (write uint32_t at address in stack)",
                    [&](std::vector<uint32_t> args) -> int {
-                       stack.write_type<uint32_t>(args[0], args[1]);
+                       tasks.stack().write_type<uint32_t>(args[0], args[1]);
                        return 0; 
                    }, 2}},
         {"wr", {"wr <n> <value> (write value to register)",
@@ -60,13 +132,17 @@ bool Processor::debug_interact(std::shared_ptr<Opcode> opcode) {
 
         {"am", {"am <addr> (assemble at address in memory)",
                    [&](std::vector<uint32_t> args) -> int {
+                       size_t address = args[0];
                        for(;;) {
                            std::cout << "assemble: ";
                            std::cout.flush();
                            std::string instr_str;
-                           std::getline(std::cin, instr_str);
+                           if (!std::getline(std::cin, instr_str) || strip(instr_str) == "") {
+                               break;
+                           }
+                           std::shared_ptr<Opcode> opcode;
                            try {
-                               auto opcode = opcode_from_string(instr_str);
+                               opcode = opcode_from_string(instr_str);
                            } catch (const AsmException &e) {
                                std::cerr << e.what() << std::endl;
                                continue;
@@ -75,9 +151,9 @@ bool Processor::debug_interact(std::shared_ptr<Opcode> opcode) {
                                continue;
                            }
 
-                           size_t address = args[0];
+                           size_t length;
                            try {
-                               opcode->write_raw(mem, address + 1);
+                               length = opcode->write_raw(mem, address + 1);
                            } catch (const AsmException &e) {
                                std::cerr << e.what() << std::endl;
                                continue;
@@ -85,7 +161,8 @@ bool Processor::debug_interact(std::shared_ptr<Opcode> opcode) {
                                std::cerr << e.what() << std::endl;
                                continue;
                            } 
-                           mem.write_type<uint8_t>(address, opcodes_by_name[opcode->get_name()]);
+                           mem.write_type<uint8_t>(address, opcode_table->lookup(opcode->get_name(), opcode->get_args().size()));
+                           address += 1 + length;
                        }
                        return 0; 
                    }, 1}},
@@ -99,7 +176,9 @@ bool Processor::debug_interact(std::shared_ptr<Opcode> opcode) {
         std::string cmd;
         std::cout << "> ";
         std::cout.flush();
-        std::cin >> cmd;
+        if (!(std::cin >> cmd)) {
+            return true;
+        }
         if (commands.find(cmd) == commands.end()) {
             continue;
         }
@@ -108,10 +187,12 @@ bool Processor::debug_interact(std::shared_ptr<Opcode> opcode) {
         std::getline(std::cin, arg_line);
         std::stringstream ss(arg_line);
         for(size_t i = 0; i < std::get<2>(commands[cmd]); i++) {
-            uint32_t arg;
+            uint32_t arg = 0;
             ss >> arg;
             args.push_back(arg);
         }
+        word = "";
+        ss >> word;
         if ((res = std::get<1>(commands[cmd])(args))) {
             break;
         }
@@ -122,384 +203,717 @@ bool Processor::debug_interact(std::shared_ptr<Opcode> opcode) {
     return false;
 }
 
+/**
+ * Lexes the lines of a list of strings, like Lexer does with a source buffer.
+ */
+class ListLexer {
+    const std::vector<std::string> &instructions;
+    size_t pos = 0;
+
+    public:
+    ListLexer(const std::vector<std::string> &instructions) : instructions {instructions} {}
+
+    bool next(LexedLine &line) {
+        while (pos < instructions.size()) {
+            if (lex_line(instructions[pos++], line)) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+/**
+ * Assemble a lexed instruction into an Opcode object.
+ * @param[in] line
+ * @param[out] opcode
+ */
+std::shared_ptr<Opcode> Processor::opcode_from_line(const LexedLine &line) {
+    uint8_t opcode_no = opcode_table->lookup(std::string(line.mnemonic), line.operand_count);
+    if (line.operand_count > MaxOperands) {
+        throw AsmException("Wrong number of arguments %zu to %s.", line.operand_count, std::string(line.mnemonic).c_str());
+    }
+    std::vector<std::string> args(line.operands, line.operands + line.operand_count);
+    return opcodes.at(opcode_no)->assemble(args);
+}
+
 /**
  * Parse assembly string into and Opcode object.
  * @param[in] instr_str
  * @param[out] opcode
  */
 std::shared_ptr<Opcode> Processor::opcode_from_string(std::string instr_str) {
-            size_t first_whitespace_index = instr_str.find(" ");
-            std::string opcode_str = filterwhitespace(instr_str.substr(0, first_whitespace_index));
-            if (opcode_str == "") {
-                return NULL;
-            }
-            std::vector<std::string> args;
-            if (first_whitespace_index != std::string::npos) {
-                args = string_split(instr_str.substr(first_whitespace_index), ",");
-            }
-            for(auto &arg: args) {
-                arg = filterwhitespace(arg);
-            }
-            if (opcodes_by_name.find(opcode_str) == opcodes_by_name.end()) {
-                throw AsmException("No such opcode %s.", opcode_str.c_str());
+    LexedLine line;
+    if (!lex_line(instr_str, line)) {
+        return NULL;
+    }
+    if (line.mnemonic.empty()) {
+        throw AsmException("No such opcode %s.", strip(instr_str).c_str());
+    }
+    return opcode_from_line(line);
+}
+
+/**
+ * Parse lexed lines into labels and opcodes.
+ * @param[in] lexer
+ * @param[out] lines
+ */
+template<class L>
+std::vector<AsmLine> Processor::parse_lexed(L &lexer) {
+    std::vector<AsmLine> lines;
+    LexedLine lexed;
+    while (lexer.next(lexed)) {
+        AsmLine line;
+        if (lexed.mnemonic.empty()) {
+            line.label = lexed.label;
+            line.label_length = lexed.label_length;
+        } else {
+            line.opcode = opcode_from_line(lexed);
+        }
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+/**
+ * Parse assembly string instructions into labels and opcodes.
+ * @param[in] instructions
+ * @param[out] lines
+ */
+std::vector<AsmLine> Processor::parse(std::vector<std::string> instructions) {
+    ListLexer lexer(instructions);
+    return parse_lexed(lexer);
+}
+
+/**
+ * Lay out parsed lines and write them into memory.
+ * @param[in] lines
+ */
+void Processor::assemble(const std::vector<AsmLine> &lines) {
+    size_t address = 0;
+    std::vector<std::pair<size_t, std::shared_ptr<Opcode>>> assembled;
+    for(auto &line: lines) {
+        if (line.opcode == NULL) {
+            if (line.label != "") { 
+                mem.add_label(line.label, address);
             }
-            uint8_t opcode_no = opcodes_by_name[opcode_str];
-            std::shared_ptr<Opcode> opcode = opcodes[opcode_no];
-            opcode->parse_asm(args);
-            return opcode;
+            address += line.label_length;
+        } else {
+            assembled.emplace_back(address, line.opcode);
+            address += 1;
+            address += line.opcode->len();
+        }
+    }
+    for(auto op: assembled) {
+        address = op.first;
+        code_end = std::max<uint32_t>(code_end, address + 1 + op.second->len());
+        mem.write_type<uint8_t>(address, opcode_table->lookup(op.second->get_name(), op.second->get_args().size()));
+        address += 1;
+        address += op.second->write_raw(mem, address);
+    }
+}
 
+/**
+ * Assemble the lines of the lexers into memory.
+ * Without optimization the lines are encoded straight from the lexer in two passes,
+ * with it they are parsed into opcodes for the Optimizer first.
+ * @param[in] make_lexer - returns a new lexer over all lines, once per pass.
+ */
+template<class MakeLexer>
+void Processor::assemble_source(MakeLexer make_lexer) {
+    if (optimization) {
+        auto lexer = make_lexer();
+        assemble(Optimizer(opcode_table).optimize(parse_lexed(lexer)));
+    } else {
+        Assembler assembler(*opcode_table);
+        assemble_passes(assembler, make_lexer);
+        assembler.write(mem);
+        code_end = std::max<uint32_t>(code_end, assembler.get_code_end());
+    }
+    if (fusion) {
+        fuse();
+    }
+}
+
+/**
+ * Run both passes of the assembler over the lines of the lexers.
+ * @param[in] assembler
+ * @param[in] make_lexer - returns a new lexer over all lines, once per pass.
+ */
+template<class MakeLexer>
+void Processor::assemble_passes(Assembler &assembler, MakeLexer make_lexer) {
+    LexedLine line;
+    auto first = make_lexer();
+    while (first.next(line)) {
+        assembler.layout(line);
+    }
+    auto second = make_lexer();
+    while (second.next(line)) {
+        assembler.encode(line, mem);
+    }
 }
 
 /**
  * Compile a list of assembly string instructions into a binary blob.
+ * With optimization enabled the parsed program goes through the Optimizer before it is laid out.
  * @param[in] instructions
  * @param[out] mem.get_memory()
  */
 std::vector<uint8_t> Processor::compile(std::vector<std::string> instructions) {
-    size_t address = 0;
+    assemble_source([&]() { return ListLexer(instructions); });
+    return mem.get_memory();
+}
 
-    std::vector<std::tuple<
-        size_t,
-        uint8_t,
-        std::shared_ptr<Opcode>
-            >> assembled;
-    for(auto instr_str: instructions) {
-        instr_str = strip(instr_str);
-        if (instr_str == "") {
+/**
+ * Compile assembly source text, lines are separated by line breaks.
+ * @param[in] source
+ */
+void Processor::compile_source(std::string_view source) {
+    assemble_source([&]() { return Lexer(source); });
+}
+
+/**
+ * Assemble source text into a relocatable object, the memory of the processor is not touched.
+ * With optimization enabled the optimized program is assembled from its listing.
+ * Numeric addresses in the source stay absolute, only labels are relocated.
+ * @param[in] source
+ * @param[out] object
+ */
+ObjectFile Processor::compile_object(std::string_view source) {
+    Assembler assembler(*opcode_table, true);
+    if (optimization) {
+        Lexer lexer(source);
+        std::vector<std::string> listing;
+        for(auto &line: Optimizer(opcode_table).optimize(parse_lexed(lexer))) {
+            if (line.opcode != nullptr) {
+                listing.push_back(line.opcode->write_asm());
+            } else if (line.label_length != 0) {
+                listing.push_back(line.label + ":" + std::to_string(line.label_length) + ":");
+            } else {
+                listing.push_back(line.label + ":");
+            }
+        }
+        assemble_passes(assembler, [&]() { return ListLexer(listing); });
+    } else {
+        assemble_passes(assembler, [&]() { return Lexer(source); });
+    }
+    return assembler.make_object();
+}
+
+/**
+ * Load the objects of the linker into memory at the addresses it laid them out at.
+ * @param[in] linker
+ */
+void Processor::link(const Linker &linker) {
+    linker.link(mem, code_end);
+    if (fusion) {
+        fuse();
+    }
+}
+
+/**
+ * Compile an assembly source file, it is mapped into memory instead of being read line by line.
+ * @param[in] fname
+ */
+void Processor::compile_file(const char *fname) {
+    SourceFile source(fname);
+    compile_source(source.text());
+}
+
+/** 
+ * Run the vm, potentially in debug mode on prepared ram and registers.
+ * Instructions are executed from the decoded instruction cache.
+ * @param[in] debug
+*/
+void Processor::run(bool debug) {
+    fuel_deadline = UINT64_MAX;
+    if (debug) {
+        /* the debugger reads its commands from std::cin */
+        io.share_stdin();
+        run_loop<false, true, false>(NULL, NULL);
+    } else {
+        run_loop<false, false, false>(NULL, NULL);
+    }
+}
+
+/** 
+ * Run the vm with the interpreter until it exits or has used up the fuel.
+ * A suspended vm continues where it stopped on the next run.
+ * @param[in] fuel - number of instructions, rounded up to the end of a basic block.
+ * @param[out] exited - false if the vm was suspended.
+*/
+bool Processor::run_for(uint64_t fuel) {
+    fuel_deadline = fuel > UINT64_MAX - executed ? UINT64_MAX : executed + fuel;
+    run_loop<false, false, false>(NULL, NULL);
+    return !suspended;
+}
+
+/**
+ * Prepare the registers for a run with any engine. A suspended vm keeps them and continues where it stopped.
+ */
+void Processor::resume() {
+    if (!suspended) {
+        regs.set(0, 3);
+    }
+    suspended = false;
+}
+
+/**
+ * Return whether the vm ran out of fuel and can be resumed.
+ */
+bool Processor::is_suspended() const {
+    return suspended;
+}
+
+/** 
+ * Run the vm with the interpreter and count the executions of every instruction.
+ * @param[out] profile
+*/
+void Processor::run_profiled(Profile &profile) {
+    fuel_deadline = UINT64_MAX;
+    run_loop<true, false, false>(&profile, NULL);
+}
+
+/** 
+ * Run the vm with the interpreter and record the last instructions executed.
+ * @param[out] trace
+*/
+void Processor::run_traced(TraceBuffer &trace) {
+    fuel_deadline = UINT64_MAX;
+    run_loop<false, false, true>(NULL, &trace);
+}
+
+/**
+ * Return how the interpreter has to execute the opcode.
+ * @param[in] opcode
+ */
+static SpecialOpcode special_kind(const Opcode &opcode) {
+    if (dynamic_cast<const ThreadOpcode *>(&opcode) != NULL) {
+        return SpecialOpcode::Thread;
+    }
+    if (dynamic_cast<const TaskOpcode *>(&opcode) != NULL) {
+        return SpecialOpcode::Task;
+    }
+    auto io = dynamic_cast<const IoOpcode *>(&opcode);
+    if (io != NULL && (io->get_operation() == IoOperation::ReadChar || io->get_operation() == IoOperation::Read)) {
+        return SpecialOpcode::Input;
+    }
+    return SpecialOpcode::None;
+}
+
+/**
+ * Execute an opcode which needs the threads or tasks of the processor.
+ * An input opcode parks the running task instead, if it would block while another task could run.
+ * @param[in] opcode
+ * @param[in] kind
+ * @param[in] rip - address of the opcode.
+ * @param[out] exited
+ */
+bool Processor::execute_special(const Opcode &opcode, SpecialOpcode kind, uint32_t rip) {
+    switch (kind) {
+        case SpecialOpcode::Thread:
+            return static_cast<const ThreadOpcode &>(opcode).execute(regs, mem, tasks.stack(), threads);
+        case SpecialOpcode::Task:
+            return static_cast<const TaskOpcode &>(opcode).execute(regs, mem, tasks);
+        case SpecialOpcode::Input:
+            if (tasks.park(regs, rip)) {
+                return false;
+            }
+            return opcode.execute(regs, mem, tasks.stack(), io);
+        default:
+            return opcode.execute(regs, mem, tasks.stack(), io);
+    }
+}
+
+/**
+ * Return a description of the watchpoint hit by the memory operands of the opcode, or an empty string.
+ * The first operand of an arithmetic opcode is written, the others are read.
+ * Bulk and vector opcodes access the ranges given by their registers, atomics read and write the word
+ * at the address held by their first register.
+ * @param[in] debug_state
+ * @param[in] opcode
+ * @param[in] regs
+ */
+static std::string check_watchpoints(const DebugState &debug_state, const Opcode &opcode, const Registers &regs) {
+    auto &args = opcode.get_args();
+    auto bulk = dynamic_cast<const BulkOpcode *>(&opcode);
+    if (bulk != NULL) {
+        uint32_t a = regs.get(args[0]->get_raw_value());
+        uint32_t b = regs.get(args[1]->get_raw_value());
+        uint32_t length = regs.get(args[2]->get_raw_value());
+        std::string hit = debug_state.check_access(a, length, bulk->get_operation() == BulkOperation::Compare ? WatchRead : WatchWrite);
+        if (hit == "" && bulk->get_operation() != BulkOperation::Fill) {
+            hit = debug_state.check_access(b, length, WatchRead);
+        }
+        return hit;
+    }
+    auto vector = dynamic_cast<const VectorOpcode *>(&opcode);
+    if (vector != NULL && vector->get_operation() == VectorOperation::Load) {
+        return debug_state.check_access(regs.get(args[1]->get_raw_value()), sizeof(Vector), WatchRead);
+    }
+    if (vector != NULL && vector->get_operation() == VectorOperation::Store) {
+        return debug_state.check_access(regs.get(args[0]->get_raw_value()), sizeof(Vector), WatchWrite);
+    }
+    if (dynamic_cast<const AtomicOpcode *>(&opcode) != NULL) {
+        uint32_t address = regs.get(args[0]->get_raw_value());
+        std::string hit = debug_state.check_access(address, sizeof(uint32_t), WatchWrite);
+        if (hit == "") {
+            hit = debug_state.check_access(address, sizeof(uint32_t), WatchRead);
+        }
+        return hit;
+    }
+    bool arithmetic = dynamic_cast<const BinaryOperationOpcode *>(&opcode) != NULL
+        || dynamic_cast<const UnaryOperationOpcode *>(&opcode) != NULL;
+    for(size_t i = 0; i < args.size(); i++) {
+        if (args[i]->kind() != ArgKind::Address) {
             continue;
         }
+        int kind = arithmetic && i == 0 ? WatchWrite : WatchRead;
+        std::string hit = debug_state.check_access(args[i]->get_raw_value(), sizeof(uint32_t), kind);
+        if (hit != "") {
+            return hit;
+        }
+    }
+    return "";
+}
 
-        if (instr_str[instr_str.size() - 1] == ':') {
-            /* label */
-            auto label_parts = string_split(instr_str, ":");
-            if (label_parts.size() > 3) {
-                throw AsmException("Ill formated label %s.", instr_str.c_str());
+/**
+ * Return the traits of every opcode of the shared opcode table, they are computed on first use.
+ */
+const std::array<OpcodeTraits, 256> &Processor::get_opcode_traits() {
+    static const std::array<OpcodeTraits, 256> traits = [] {
+        std::array<OpcodeTraits, 256> traits;
+        for(auto &opcode: get_opcode_table()->opcodes) {
+            OpcodeTraits &entry = traits[opcode.first];
+            entry.special = special_kind(*opcode.second);
+            entry.traced = trace_operands(*opcode.second);
+            uint32_t target;
+            is_jump(*opcode.second, target, entry.conditional_jump);
+            for(auto &arg: opcode.second->get_args()) {
+                entry.touches_memory |= arg->kind() == ArgKind::Address;
             }
+            entry.touches_memory |= dynamic_cast<const AtomicOpcode *>(opcode.second.get()) != NULL;
+            entry.touches_memory |= dynamic_cast<const BulkOpcode *>(opcode.second.get()) != NULL;
+            auto vector = dynamic_cast<const VectorOpcode *>(opcode.second.get());
+            entry.touches_memory |= vector != NULL
+                && (vector->get_operation() == VectorOperation::Load || vector->get_operation() == VectorOperation::Store);
+        }
+        return traits;
+    }();
+    return traits;
+}
 
-            std::string label_name = strip(label_parts[0]);
-            size_t label_length = 0;
-            if (label_parts.size() == 3) {
-                auto length_parse_res = string_to_int(label_parts[1]);
-                if (!length_parse_res.second) {
-                    throw AsmException("Couldn't parse number %s.", label_parts[1].c_str());
+/** 
+ * The interpreter loop. Profiling counters, trace records and debugger checks are compiled out of the plain run.
+ * When debugging, the loop only stops at breakpoints, watchpoints or while single-stepping,
+ * watchpoints are only checked for opcodes with memory operands.
+ * The fuel is only checked at the end of basic blocks, so a run stops at the first block end
+ * after the deadline, suspended with rip pointing to the next instruction.
+ * Guest threads keep running while the vm is suspended, an exit waits for all of them.
+ * An exit only ends the running task while there are others left.
+ * A traced instruction is only committed to the trace once it executed.
+ * @param[out] profile
+ * @param[out] trace
+*/
+template<bool Profiling, bool Debugging, bool Tracing>
+void Processor::run_loop(Profile *profile, TraceBuffer *trace) {
+    resume();
+    debug_state.stepping = true;
+    Memory *task_stack = &tasks.stack();
+    while (true) {
+        uint32_t rip = regs.get(RIP);
+        const DecodedInstruction &instr = icache.fetch(mem, rip);
+        dispatched++;
+        /* per instruction counters, records and stops need the unfused instructions */
+        if (!Profiling && !Debugging && !Tracing && instr.fused) {
+            const DecodedObjects &objects = icache.objects(rip);
+            regs.set(RIP, rip + objects.fused_length);
+            executed += objects.fused_count;
+            objects.fused->execute(regs, mem, *task_stack);
+            if (executed >= fuel_deadline) {
+                suspended = true;
+                break;
+            }
+            continue;
+        }
+        regs.set(RIP, rip + instr.length);
+        executed++;
+        if (Profiling) {
+            profile->record(rip, instr.opcode_no);
+        }
+
+        std::string watch_hit;
+        if (Debugging) {
+            if (debug_state.stepping || debug_state.is_breakpoint(rip)) {
+                io.flush();
+                if (!debug_state.stepping) {
+                    std::cerr << "breakpoint at " << rip << std::endl;
+                }
+                if (debug_interact(icache.objects(rip).opcode)) {
+                    break;
                 }
-                label_length = length_parse_res.first;
             }
-            if (label_name != "") { 
-                mem.add_label(label_name, address);
+            if (debug_state.has_watchpoints() && opcode_traits[instr.opcode_no].touches_memory) {
+                watch_hit = check_watchpoints(debug_state, icache.opcode(rip), regs);
             }
-            address += label_length;
+        }
+
+        TraceRecord *record = NULL;
+        if (Tracing) {
+            /* the address is taken before the instruction can overwrite the register holding it */
+            const TraceOperands &operands = opcode_traits[instr.opcode_no].traced;
+            record = &trace->next();
+            record->rip = rip;
+            record->opcode_no = instr.opcode_no;
+            memcpy(record->operands, instr.operands, sizeof(record->operands));
+            record->reg = operands.reg < 0 ? TraceNoRegister : instr.operands[operands.reg];
+            record->flags = operands.address < 0 ? 0 : TraceTouchedMemory;
+            record->address = operands.address < 0 ? 0
+                : operands.indirect ? regs.get(instr.operands[operands.address]) : instr.operands[operands.address];
+        }
+
+        bool conditional = Profiling && opcode_traits[instr.opcode_no].conditional_jump;
+        uint32_t next = rip + instr.length;
+        bool exited;
+        SpecialOpcode special = opcode_traits[instr.opcode_no].special;
+        if (special != SpecialOpcode::None) {
+            exited = execute_special(icache.opcode(rip), special, rip);
+            task_stack = &tasks.stack();
+        } else if (instr.handler != NULL) {
+            exited = instr.handler(instr.operands, regs, mem);
         } else {
-            /* instruction */
-            auto opcode = opcode_from_string(instr_str);
-            if (opcode == NULL) {
-                continue;
+            exited = icache.opcode(rip).execute(regs, mem, *task_stack, io);
+        }
+        if (Tracing) {
+            record->value = record->reg == TraceNoRegister ? 0 : regs.get(record->reg);
+            trace->commit();
+        }
+        if (exited) {
+            if (!tasks.exit(regs)) {
+                break;
             }
-            assembled.emplace_back(
-                    address,
-                    opcodes_by_name[opcode->get_name()],
-                    opcode->clone()
-                    );
-            address += 1;
-            address += opcode->len();
+            task_stack = &tasks.stack();
+        }
+        if (conditional && regs.get(RIP) != next) {
+            profile->record_taken(rip);
+        }
+        if (instr.ends_block && executed >= fuel_deadline) {
+            suspended = true;
+            break;
+        }
+
+        if (Debugging && debug_state.has_watchpoints() && opcode_traits[instr.opcode_no].touches_memory) {
+            std::string changes = debug_state.check_changes(mem);
+            if (watch_hit == "") {
+                watch_hit = changes;
+            }
+        }
+        if (Debugging && watch_hit != "") {
+            std::cerr << watch_hit << " at " << rip << std::endl;
+            debug_state.stepping = true;
         }
     }
-    for(auto op: assembled) {
-        address = std::get<0>(op);
-        mem.write_type<uint8_t>(address, std::get<1>(op));
-        address += 1;
-        address += std::get<2>(op)->write_raw(mem, address);
+    if (!suspended) {
+        threads.join_all();
     }
-    return mem.get_memory();
+    auto lock = io.acquire();
+    io.flush();
 }
 
 /** 
- * Run the vm, potentially in debug mode on prepared ram and registers.
- * @param[in] debug
+ * Print the report of a profiled run, and optionally its folded stacks.
+ * @param[in] profile
+ * @param[in] report
+ * @param[in] folded
 */
-void Processor::run(bool debug) {
-    regs.set(0, 3);
-    while (true) {
+void Processor::write_profile(const Profile &profile, std::ostream &report, std::ostream *folded) {
+    profile.write_report(report, icache, mem, *opcode_table);
+    if (folded != NULL) {
+        profile.write_folded(*folded, icache, mem);
+    }
+}
+
+/** 
+ * Run the vm on prepared ram and registers with the direct-threaded engine.
+*/
+void Processor::run_threaded() {
+    resume();
+    ThreadedEngine engine(regs, mem, stack, icache, io);
+    executed += engine.run();
+    io.flush();
+}
+
+/** 
+ * Run the vm on prepared ram and registers with the JIT.
+*/
+void Processor::run_jit() {
+    resume();
+    JitEngine engine(regs, mem, stack, icache, io);
+    executed += engine.run();
+    io.flush();
+}
+
+/**
+ * Return whether the opcode does I/O and can't be executed twice.
+ * @param[in] opcode
+ */
+static bool is_io_opcode(const Opcode &opcode) {
+    return dynamic_cast<const IoOpcode *>(&opcode) != NULL;
+}
+
+/** 
+ * Run the JIT and the interpreter in lockstep, block by block, and throw if their states ever differ.
+ * I/O is only done by the JIT, the interpreter takes over its registers after it.
+*/
+void Processor::run_differential() {
+    resume();
+    JitEngine engine(regs, mem, stack, icache, io);
+    engine.set_chaining(false);
+
+    Registers shadow_regs = regs;
+    Memory shadow_mem = mem;
+    Memory shadow_stack = stack;
+    InstructionCache shadow_icache(opcodes);
+    shadow_mem.add_observer(&shadow_icache);
+
+    for(;;) {
         uint32_t rip = regs.get(RIP);
-        uint8_t opcode_no = mem.read_type<uint8_t>(rip);
-        rip += 1;
-        if (opcodes.find(opcode_no) == opcodes.end()) {
-            throw std::runtime_error("No such opcode " + std::to_string(opcode_no) + ".");
-        }
-        std::shared_ptr<Opcode> opcode = opcodes[opcode_no];
-        rip += opcode->parse_raw(mem, rip);
-        regs.set(RIP, rip);
+        uint64_t block_executed;
+        bool stop = engine.step(block_executed);
+        executed += block_executed;
 
-        if (debug) {
-            if (debug_interact(opcode)) {
-                break;
+        bool shadow_stop = false;
+        for(uint64_t i = 0; i < block_executed; i++) {
+            uint32_t shadow_rip = shadow_regs.get(RIP);
+            const DecodedInstruction &instr = shadow_icache.fetch(shadow_mem, shadow_rip);
+            const Opcode &opcode = shadow_icache.opcode(shadow_rip);
+            shadow_regs.set(RIP, shadow_rip + instr.length);
+            if (is_io_opcode(opcode)) {
+                shadow_regs = regs;
+                continue;
             }
+            shadow_stop = opcode.execute(shadow_regs, shadow_mem, shadow_stack);
         }
 
-        if (opcode->execute(regs, mem, stack)) {
+        for(size_t i = 0; i < RegisterCount; i++) {
+            if (regs.get(i) != shadow_regs.get(i)) {
+                throw std::runtime_error("JIT diverged in the block at " + std::to_string(rip) + ": r" + std::to_string(i)
+                        + " is " + std::to_string(regs.get(i)) + ", interpreter has " + std::to_string(shadow_regs.get(i)) + ".");
+            }
+        }
+        for(size_t i = 0; i < VectorRegisterCount; i++) {
+            if (memcmp(&regs.get_vector(i), &shadow_regs.get_vector(i), sizeof(Vector)) != 0) {
+                throw std::runtime_error("JIT diverged in the block at " + std::to_string(rip) + ": v" + std::to_string(i) + " differs.");
+            }
+        }
+        if (mem != shadow_mem || stack != shadow_stack || stop != shadow_stop) {
+            throw std::runtime_error("JIT diverged in the block at " + std::to_string(rip) + ".");
+        }
+        if (stop) {
             break;
         }
     }
+    io.flush();
 }
 
 /** 
- * Initiallizes the lexer's opcodes and opcodes_by_name.
+ * Translate the prepared ram and registers into a standalone C++ program.
+ * @param[in] out
 */
-void Processor::init_opcodes() {
-
-    std::vector<std::shared_ptr<Opcode>> opcode_list = {
-        /* arithmetic opcodes */
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "add",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return a + b; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "sub",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return a + b; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "mov",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return b; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "xor",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return a ^ b; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "and",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return a & b; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "or",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return a | b; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "lshift",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return a << b; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "rshift",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return a >> b; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "mul",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return a * b; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "div",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return a / b; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "mod",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return a % b; },
-                    4
-                    )),
-
-
-        /* arithmetic opcodes with consants */
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "addi",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new IntArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return a + b; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "subi",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new IntArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return a + b; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "movi",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new IntArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return b; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "xori",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new IntArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return a ^ b; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "andi",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new IntArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return a & b; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "ori",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new IntArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return a | b; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "lshifti",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new IntArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return a << b; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "rshifti",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new IntArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return a >> b; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "muli",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new IntArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return a * b; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "divi",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new IntArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return a / b; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "modi",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new IntArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return a % b; },
-                    4
-                    )),
-
-        /* bit magic opcodes */
-        std::shared_ptr<Opcode>(new UnaryOperationOpcode(
-                    "bitflip",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    [](uint32_t a) -> uint32_t { return a ^ 0xffffffff; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new UnaryOperationOpcode(
-                    "neg",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    [](uint32_t a) -> uint32_t { return -a; },
-                    4
-                    )),
-
-        /* io opcodes */
-        std::shared_ptr<Opcode>(new UnaryOperationOpcode(
-                    "printc",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    [](uint32_t a) -> uint32_t { std::cout << (char)a; return a; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new UnaryOperationOpcode(
-                    "print",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    [](uint32_t a) -> uint32_t { std::cout << a; return a; },
-                    4
-                    )),
-        std::shared_ptr<Opcode>(new UnaryOperationOpcode(
-                    "readc",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    [](uint32_t a) -> uint32_t { char c; std::cin >> c; return c; },
-                    4
-                    )),
-
-        std::shared_ptr<Opcode>(new UnaryOperationOpcode(
-                    "read",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    [](uint32_t a) -> uint32_t { std::cin >> a; return a; },
-                    4
-                    )),
-
-        /* jumps */
-        std::shared_ptr<Opcode>(new JumpOpcode(
-                    "jz",
-                    std::vector<std::shared_ptr<OpcodeArg>>({
-                        std::shared_ptr<OpcodeArg>(new IntArg()),
-                        std::shared_ptr<OpcodeArg>(new RegArg()),
-                        }),
-                    [](std::vector<uint32_t> values) -> bool { return values[1] == 0; }
-                    )),
-        std::shared_ptr<Opcode>(new JumpOpcode(
-                    "jnz",
-                    std::vector<std::shared_ptr<OpcodeArg>>({
-                        std::shared_ptr<OpcodeArg>(new IntArg()),
-                        std::shared_ptr<OpcodeArg>(new RegArg()),
-                        }),
-                    [](std::vector<uint32_t> values) -> bool { return values[1] != 0; }
-                    )),
-        std::shared_ptr<Opcode>(new JumpOpcode(
-                    "jmp",
-                    std::vector<std::shared_ptr<OpcodeArg>>({
-                        std::shared_ptr<OpcodeArg>(new IntArg()),
-                        }),
-                    [](std::vector<uint32_t> values) -> bool { return true; }
-                    )),
-
-
-        /* memory opcodes */
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "ldr",
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    std::shared_ptr<OpcodeArg>(new AddressArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return b; },
-                    4
-                    )),
-
-        std::shared_ptr<Opcode>(new BinaryOperationOpcode(
-                    "str",
-                    std::shared_ptr<OpcodeArg>(new AddressArg()),
-                    std::shared_ptr<OpcodeArg>(new RegArg()),
-                    [](uint32_t a, uint32_t b) -> uint32_t { return b; },
-                    4
-                    )),
-    };
-    for(size_t i = 0; i < opcode_list.size(); i++) {
-        opcodes[i] = opcode_list[i];
+void Processor::translate_cpp(std::ostream &out) {
+    Registers initial = regs;
+    if (!suspended) {
+        initial.set(0, 3);
+    }
+    write_cpp(out, icache, mem, initial);
+}
+
+/** 
+ * Return the number of instructions executed by all runs so far, including the guest threads which ended.
+*/
+uint64_t Processor::instructions_executed() const {
+    return executed + threads.instructions_executed();
+}
+
+/** 
+ * Return the number of instructions the interpreter dispatched, a superinstruction counts once.
+*/
+uint64_t Processor::instructions_dispatched() const {
+    return dispatched;
+}
+
+/**
+ * Return the number of guest tasks which did not end, 0 before the first go.
+ */
+size_t Processor::task_count() const {
+    return tasks.count();
+}
+
+/** 
+ * Enable or disable optimizing programs when they are compiled.
+ * @param[in] enabled
+*/
+void Processor::set_optimization(bool enabled) {
+    optimization = enabled;
+}
+
+/** 
+ * Enable or disable fusing instructions when code is compiled or loaded.
+ * @param[in] enabled
+*/
+void Processor::set_fusion(bool enabled) {
+    fusion = enabled;
+}
+
+/** 
+ * Fuse the instruction sequences reachable from rip and the labels into superinstructions.
+ * @param[out] fused - number of fused sequences.
+*/
+size_t Processor::fuse() {
+    std::set<uint32_t> entries = {regs.get(RIP)};
+    for(auto &label: mem.get_labels()) {
+        entries.insert(label.second);
     }
+    return fuse_instructions(icache, mem, entries);
+}
+
+/** 
+ * Return the opcode table shared by all processors, it is built on first use.
+*/
+std::shared_ptr<const OpcodeTable> Processor::get_opcode_table() {
+    static const std::shared_ptr<const OpcodeTable> table = init_opcodes();
+    return table;
+}
+
+Registers &Processor::get_regs() {
+    return regs;
+}
+
+Memory &Processor::get_mem() {
+    return mem;
+}
 
+GuestIO &Processor::get_io() {
+    return io;
+}
 
-    opcodes[255] = std::shared_ptr<Opcode>(new ExitOpcode("exit"));
+/** 
+ * Build the lexer's opcodes and opcodes_by_name from OpcodeSpecs.
+*/
+std::shared_ptr<const OpcodeTable> Processor::init_opcodes() {
+    std::shared_ptr<OpcodeTable> table(new OpcodeTable());
+    auto &opcodes = table->opcodes;
+    auto &opcodes_by_name = table->opcodes_by_name;
+
+    for(size_t i = 0; i < OpcodeSpecCount; i++) {
+        opcodes[i] = make_opcode(i);
+    }
+    opcodes[ExitOpcodeNumber] = std::shared_ptr<Opcode>(new ExitOpcode("exit"));
     for(auto opcode: opcodes) {
-        opcodes_by_name[opcode.second->get_name()] = opcode.first;
+        opcodes_by_name.emplace(opcode.second->get_name(), opcode.first);
+        table->opcodes_by_form[{opcode.second->get_name(), opcode.second->get_args().size()}] = opcode.first;
     }
+    return table;
 }
 
 void Processor::dump_regs(FILE *f) {
@@ -508,24 +922,150 @@ void Processor::dump_regs(FILE *f) {
         fwrite(&reg, sizeof(reg), 1, f);
     }
 }
-void Processor::load_regs(FILE *f) {
-    for(size_t i = 0; i < RegisterCount; i++) {
-        uint32_t reg;
-        fread(&reg, sizeof(reg), 1, f);
-        regs.set(i, reg);
-    }
-}
 
 void Processor::dump_mem(FILE *f) {
     for(auto c: mem.get_memory()) {
         fputc(c, f);
     }
 }
-void Processor::load_mem(FILE *f) {
-    size_t address = 0;
-    int c;
-    while((c = fgetc(f)) != EOF) {
-        mem.write_type<uint8_t>(address, c);
-        address += 1;
+
+/**
+ * Write registers, memory and labels in the versioned image format.
+ * @param[in] f
+ */
+void Processor::dump_image(FILE *f) {
+    write_image(f, regs, mem, code_end);
+}
+
+/**
+ * Load an image in the versioned format, its pages are mapped copy on write rather than read.
+ * @param[in] fname
+ */
+void Processor::load_image(const char *fname) {
+    code_end = ::load_image(fname, regs, mem);
+    if (fusion) {
+        fuse();
+    }
+}
+
+/**
+ * Load an image in the headerless raw format, all of its memory counts as code.
+ * @param[in] fname
+ */
+void Processor::load_raw_image(const char *fname) {
+    FILE *f = fopen(fname, "rb");
+    if (f == NULL) {
+        throw std::runtime_error("Could not open file.");
+    }
+    std::unique_ptr<FILE, int (*)(FILE *)> closer(f, fclose);
+    ::load_raw_image(f, regs, mem);
+    code_end = mem.size();
+    if (fusion) {
+        fuse();
+    }
+}
+
+/**
+ * Take a snapshot of registers, memory and counters.
+ * It costs a page table walk over the pages written since the last snapshot, afterwards they are copied on write.
+ */
+std::shared_ptr<const ProcessorSnapshot> Processor::snapshot() {
+    if (threads.active()) {
+        throw std::logic_error("Can't take a snapshot while guest threads run.");
+    }
+    if (tasks.active()) {
+        throw std::logic_error("Can't take a snapshot while there are tasks.");
+    }
+    auto snapshot = std::make_shared<ProcessorSnapshot>();
+    snapshot->regs = regs;
+    snapshot->mem = mem.snapshot();
+    snapshot->stack = stack.snapshot();
+    snapshot->executed = executed;
+    snapshot->code_end = code_end;
+    snapshot->suspended = suspended;
+    return snapshot;
+}
+
+/**
+ * Go back to a snapshot, which may come from another processor.
+ * The decoded instructions are dropped and fused again.
+ * @param[in] snapshot
+ */
+void Processor::restore(const ProcessorSnapshot &snapshot) {
+    if (threads.active()) {
+        throw std::logic_error("Can't restore a snapshot while guest threads run.");
+    }
+    if (tasks.active()) {
+        throw std::logic_error("Can't restore a snapshot while there are tasks.");
+    }
+    regs = snapshot.regs;
+    mem.restore(*snapshot.mem);
+    stack.restore(*snapshot.stack);
+    executed = snapshot.executed;
+    code_end = snapshot.code_end;
+    suspended = snapshot.suspended;
+    icache.clear();
+    if (fusion) {
+        fuse();
+    }
+}
+
+/**
+ * Return a new processor in the current state, both share their pages copy on write.
+ * Takes a snapshot, so the next incremental snapshot starts from here.
+ * The new processor does its I/O on stdin and stdout.
+ */
+std::unique_ptr<Processor> Processor::fork() {
+    std::unique_ptr<Processor> child(new Processor());
+    child->set_fusion(fusion);
+    child->restore(*snapshot());
+    return child;
+}
+
+/**
+ * Write a snapshot in the snapshot file format.
+ * @param[in] f
+ * @param[in] snapshot
+ * @param[in] incremental - only write the pages written since the snapshot before.
+ */
+void Processor::write_snapshot(FILE *f, const ProcessorSnapshot &snapshot, bool incremental) {
+    ::write_snapshot(f, snapshot.regs, *snapshot.mem, snapshot.executed, snapshot.code_end, snapshot.suspended, incremental);
+}
+
+/**
+ * Load a full snapshot file, or apply an incremental one on top of the current state.
+ * @param[in] fname
+ */
+void Processor::load_snapshot(const char *fname) {
+    FILE *f = fopen(fname, "rb");
+    if (f == NULL) {
+        throw std::runtime_error("Could not open file.");
+    }
+    try {
+        ::load_snapshot(f, regs, mem, executed, code_end, suspended);
+    } catch (...) {
+        fclose(f);
+        throw;
+    }
+    fclose(f);
+    icache.clear();
+    if (fusion) {
+        fuse();
+    }
+}
+
+/**
+ * Load an image in either the versioned or the old raw format, or a full snapshot.
+ * @param[in] fname
+ */
+void Processor::load(const char *fname) {
+    if (is_snapshot(fname)) {
+        load_snapshot(fname);
+        return;
+    }
+    if (is_image(fname)) {
+        load_image(fname);
+        return;
     }
+    load_raw_image(fname);
 }
@@ -1,23 +1,137 @@
+#pragma once
 #include "opcode.h"
 #include "memory.h"
+#include "icache.h"
+#include "profile.h"
+#include "debugger.h"
+#include "optimizer.h"
+#include "guestthreads.h"
+#include "tasks.h"
+#include "lexer.h"
+#include "object.h"
+#include "trace.h"
 #include <cstdio>
 
+class Assembler;
+class Linker;
+
+/**
+ * The state of a processor at one point, sharing its pages copy on write with the processor it was taken from.
+ * I/O is not part of it.
+ */
+struct ProcessorSnapshot {
+    Registers regs;
+    std::shared_ptr<const Memory::Snapshot> mem;
+    std::shared_ptr<const Memory::Snapshot> stack;
+    uint64_t executed = 0;
+    uint32_t code_end = 0;
+    bool suspended = false;
+};
+
+/**
+ * How the interpreter executes an opcode, the special ones need more than the registers, memory and I/O.
+ */
+enum class SpecialOpcode : uint8_t {
+    None,
+    Thread,
+    Task,
+    Input,
+};
+
+/**
+ * What the interpreter loop needs to know about an opcode besides its handler, the same for all its instructions.
+ */
+struct OpcodeTraits {
+    SpecialOpcode special = SpecialOpcode::None;
+    /* has memory operands the debugger checks watchpoints for */
+    bool touches_memory = false;
+    bool conditional_jump = false;
+    TraceOperands traced;
+};
+
+/**
+ * A virtual machine with its own memory, stack and registers.
+ * The opcode definitions are immutable and shared by all processors, so processors may run on different threads.
+ * The guest threads spawned by a program share the memory and I/O of their processor.
+ */
 class Processor {
-    std::map<uint8_t, std::shared_ptr<Opcode>> opcodes;
-    std::map<std::string, uint8_t> opcodes_by_name;
+    std::shared_ptr<const OpcodeTable> opcode_table;
+    const std::map<uint8_t, std::shared_ptr<const Opcode>> &opcodes;
+    const std::array<OpcodeTraits, 256> &opcode_traits;
     Memory mem;
     Memory stack;
     Registers regs;
+    InstructionCache icache;
+    uint64_t executed = 0;
+    uint64_t dispatched = 0;
+    bool fusion = true;
+    bool optimization = false;
+    uint32_t code_end = 0;
+    uint64_t fuel_deadline = UINT64_MAX;
+    bool suspended = false;
+    DebugState debug_state;
+    GuestIO io;
+    GuestTasks tasks;
+    /* last, so the threads end before the state they share is destroyed */
+    GuestThreads threads;
 
-    void init_opcodes();
-    bool debug_interact(std::shared_ptr<Opcode>);
+    static std::shared_ptr<const OpcodeTable> init_opcodes();
+    static const std::array<OpcodeTraits, 256> &get_opcode_traits();
+    template<bool Profiling, bool Debugging, bool Tracing>
+    void run_loop(Profile *profile, TraceBuffer *trace);
+    void resume();
+    bool debug_interact(std::shared_ptr<const Opcode>);
+    bool execute_special(const Opcode &opcode, SpecialOpcode kind, uint32_t rip);
     std::shared_ptr<Opcode> opcode_from_string(std::string);
+    std::shared_ptr<Opcode> opcode_from_line(const LexedLine &line);
+    template<class L>
+    std::vector<AsmLine> parse_lexed(L &lexer);
+    void assemble(const std::vector<AsmLine> &lines);
+    template<class MakeLexer>
+    void assemble_source(MakeLexer make_lexer);
+    template<class MakeLexer>
+    void assemble_passes(Assembler &assembler, MakeLexer make_lexer);
+    friend class GuestThreads;
     public:
         void dump_regs(FILE *f);
         void dump_mem(FILE *f);
-        void load_regs(FILE *f);
-        void load_mem(FILE *f);
+        void dump_image(FILE *f);
+        void load_image(const char *fname);
+        void load_raw_image(const char *fname);
+        void load(const char *fname);
+        std::shared_ptr<const ProcessorSnapshot> snapshot();
+        void restore(const ProcessorSnapshot &snapshot);
+        std::unique_ptr<Processor> fork();
+        void write_snapshot(FILE *f, const ProcessorSnapshot &snapshot, bool incremental);
+        void load_snapshot(const char *fname);
         Processor();
+        Processor(const Processor &) = delete;
+        Processor &operator=(const Processor &) = delete;
+        ~Processor();
+        std::vector<AsmLine> parse(std::vector<std::string> instructions);
         std::vector<uint8_t> compile(std::vector<std::string> instructions);
+        void compile_source(std::string_view source);
+        void compile_file(const char *fname);
+        ObjectFile compile_object(std::string_view source);
+        void link(const Linker &linker);
         void run(bool debug=false);
+        bool run_for(uint64_t fuel);
+        bool is_suspended() const;
+        void run_profiled(Profile &profile);
+        void run_traced(TraceBuffer &trace);
+        void write_profile(const Profile &profile, std::ostream &report, std::ostream *folded);
+        void run_threaded();
+        void run_jit();
+        void run_differential();
+        void translate_cpp(std::ostream &out);
+        uint64_t instructions_executed() const;
+        uint64_t instructions_dispatched() const;
+        size_t task_count() const;
+        void set_fusion(bool enabled);
+        void set_optimization(bool enabled);
+        size_t fuse();
+        Registers &get_regs();
+        Memory &get_mem();
+        GuestIO &get_io();
+        static std::shared_ptr<const OpcodeTable> get_opcode_table();
 };
@@ -0,0 +1,164 @@
+#include "profile.h"
+#include "cfg.h"
+
+/**
+ * Return the counts of the page holding the address, or NULL if nothing in it was executed.
+ * @param[in] address
+ */
+const Profile::PageCounts *Profile::find_page(uint32_t address) const {
+    auto page = pages.find(address >> PageBits);
+    return page != pages.end() ? &page->second : nullptr;
+}
+
+uint64_t Profile::get_count(uint32_t address) const {
+    const PageCounts *page = find_page(address);
+    return page != nullptr ? page->counts[address & (PageSize - 1)] : 0;
+}
+
+uint64_t Profile::get_taken(uint32_t address) const {
+    const PageCounts *page = find_page(address);
+    return page != nullptr ? page->taken[address & (PageSize - 1)] : 0;
+}
+
+uint64_t Profile::get_opcode_count(uint8_t opcode_no) const {
+    return opcode_counts[opcode_no];
+}
+
+uint64_t Profile::get_total() const {
+    return total;
+}
+
+/**
+ * Return the executed addresses in ascending order.
+ */
+std::vector<uint32_t> Profile::executed_addresses() const {
+    std::vector<uint32_t> addresses;
+    for(auto &page: pages) {
+        for(size_t i = 0; i < PageSize; i++) {
+            if (page.second.counts[i]) {
+                addresses.push_back(page.first << PageBits | i);
+            }
+        }
+    }
+    return addresses;
+}
+
+/**
+ * Return the executed addresses, most executed first.
+ */
+std::vector<uint32_t> Profile::hot_addresses() const {
+    std::vector<uint32_t> addresses = executed_addresses();
+    std::stable_sort(addresses.begin(), addresses.end(), [&](uint32_t a, uint32_t b) {
+        return get_count(a) > get_count(b);
+    });
+    return addresses;
+}
+
+/**
+ * Return the instruction at the address as assembly, or ?? if it doesn't decode anymore.
+ */
+static std::string disassemble(InstructionCache &icache, const Memory &m, uint32_t address) {
+    try {
+        icache.fetch(m, address);
+        return icache.opcode(address).write_asm();
+    } catch (const std::runtime_error &e) {
+        return "??";
+    }
+}
+
+/**
+ * Return the closest label at or below the address, with the offset from it.
+ */
+static std::string symbolize(const Memory &m, uint32_t address) {
+    const std::string *best = NULL;
+    uint32_t best_address = 0;
+    for(auto &label: m.get_labels()) {
+        if (label.second <= address && (best == NULL || label.second >= best_address)) {
+            best = &label.first;
+            best_address = label.second;
+        }
+    }
+    if (best == NULL) {
+        return "";
+    }
+    if (best_address == address) {
+        return *best;
+    }
+    return *best + "+" + std::to_string(address - best_address);
+}
+
+/**
+ * Print the executions per opcode and an annotated disassembly of the executed instructions, hottest first.
+ * Conditional jumps are annotated with how often they were taken.
+ * @param[in] out
+ * @param[in] icache - used to disassemble.
+ * @param[in] m
+ * @param[in] table - names of the opcodes.
+ */
+void Profile::write_report(std::ostream &out, InstructionCache &icache, const Memory &m, const OpcodeTable &table) const {
+    char line[256];
+    double scale = total ? 100.0 / total : 0;
+
+    out << "opcodes:" << std::endl;
+    std::vector<std::pair<uint64_t, uint8_t>> opcodes;
+    for(size_t i = 0; i < 256; i++) {
+        if (opcode_counts[i]) {
+            opcodes.emplace_back(opcode_counts[i], i);
+        }
+    }
+    std::sort(opcodes.rbegin(), opcodes.rend());
+    for(auto &opcode: opcodes) {
+        auto definition = table.opcodes.find(opcode.second);
+        std::string name = definition != table.opcodes.end() ? definition->second->get_name() : std::to_string(opcode.second);
+        snprintf(line, sizeof(line), "%7.2f%% %14" PRIu64 "  %s", opcode.first * scale, opcode.first, name.c_str());
+        out << line << std::endl;
+    }
+
+    out << std::endl << "instructions:" << std::endl;
+    for(auto address: hot_addresses()) {
+        uint64_t count = get_count(address);
+        snprintf(line, sizeof(line), "%7.2f%% %14" PRIu64 "  %08" PRIx32 "  ", count * scale, count, address);
+        out << line;
+        std::string symbol = symbolize(m, address);
+        if (symbol != "") {
+            out << "<" << symbol << "> ";
+        }
+        out << disassemble(icache, m, address);
+
+        uint32_t target;
+        bool conditional;
+        try {
+            icache.fetch(m, address);
+            if (is_jump(icache.opcode(address), target, conditional) && conditional) {
+                uint64_t jumped = get_taken(address);
+                out << "  [taken " << jumped << ", not taken " << count - jumped << "]";
+            }
+        } catch (const std::runtime_error &e) {
+        }
+        out << std::endl;
+    }
+}
+
+/**
+ * Write the counts as folded stacks for flame graph tools, one "label;instruction count" line per address.
+ * There are no calls, so the closest label stands in for the function.
+ * @param[in] out
+ * @param[in] icache
+ * @param[in] m
+ */
+void Profile::write_folded(std::ostream &out, InstructionCache &icache, const Memory &m) const {
+    for(auto address: executed_addresses()) {
+        std::string symbol = symbolize(m, address);
+        std::string function = symbol.substr(0, symbol.find('+'));
+        if (function == "") {
+            function = "[unknown]";
+        }
+        std::string instruction = disassemble(icache, m, address);
+        /* semicolons and spaces separate frames and counts in the folded format */
+        std::replace(instruction.begin(), instruction.end(), ' ', '_');
+        std::replace(instruction.begin(), instruction.end(), ';', '_');
+        char addr[16];
+        snprintf(addr, sizeof(addr), "%08" PRIx32, address);
+        out << function << ";" << addr << "_" << instruction << " " << get_count(address) << std::endl;
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include "opcode.h"
+#include "memory.h"
+#include "icache.h"
+
+/**
+ * Execution counts gathered by a profiled run, per opcode number and per instruction address.
+ * The counts per address are kept for the executed pages only.
+ */
+class Profile {
+    struct PageCounts {
+        uint64_t counts[PageSize] = {};
+        uint64_t taken[PageSize] = {};
+    };
+
+    /* by page number */
+    std::map<uint32_t, PageCounts> pages;
+    uint64_t opcode_counts[256] = {};
+    uint64_t total = 0;
+
+    const PageCounts *find_page(uint32_t address) const;
+    std::vector<uint32_t> executed_addresses() const;
+    std::vector<uint32_t> hot_addresses() const;
+
+    public:
+    /**
+     * Count one execution of the instruction at the address.
+     * @param[in] address
+     * @param[in] opcode_no
+     */
+    void record(uint32_t address, uint8_t opcode_no) {
+        pages[address >> PageBits].counts[address & (PageSize - 1)]++;
+        opcode_counts[opcode_no]++;
+        total++;
+    }
+
+    /**
+     * Count a conditional jump at the address which was taken.
+     * @param[in] address
+     */
+    void record_taken(uint32_t address) {
+        pages[address >> PageBits].taken[address & (PageSize - 1)]++;
+    }
+
+    uint64_t get_count(uint32_t address) const;
+    uint64_t get_taken(uint32_t address) const;
+    uint64_t get_opcode_count(uint8_t opcode_no) const;
+    uint64_t get_total() const;
+    void write_report(std::ostream &out, InstructionCache &icache, const Memory &m, const OpcodeTable &table) const;
+    void write_folded(std::ostream &out, InstructionCache &icache, const Memory &m) const;
+};
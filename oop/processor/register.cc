@@ -4,6 +4,9 @@ Registers::Registers() {
     for(auto &reg: regs) {
         reg = 0;
     }
+    for(auto &vreg: vregs) {
+        vreg = {};
+    }
 }
 
 uint32_t Registers::get(uint8_t num) const {
@@ -19,3 +22,24 @@ void Registers::set(uint8_t num, uint32_t value){
     }
     regs[num] = value;
 }
+
+const Vector &Registers::get_vector(uint8_t num) const {
+    if (num >= VectorRegisterCount) {
+        throw std::runtime_error("No such vector register.");
+    }
+    return vregs[num];
+}
+
+void Registers::set_vector(uint8_t num, const Vector &value) {
+    if (num >= VectorRegisterCount) {
+        throw std::runtime_error("No such vector register.");
+    }
+    vregs[num] = value;
+}
+
+/**
+ * Return the raw register file, for engines which validate register numbers ahead of time.
+ */
+uint32_t *Registers::data() {
+    return regs;
+}
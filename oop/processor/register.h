@@ -4,10 +4,24 @@
 const size_t RegisterCount = 32;
 const uint8_t RIP = 31;
 const uint8_t RSP = 30;
+const size_t VectorRegisterCount = 8;
+const size_t VectorLanes = 4;
+
+/**
+ * Contents of a vector register, 32-bit lanes stored like consecutive words in memory.
+ */
+struct alignas(16) Vector {
+    uint32_t lanes[VectorLanes];
+};
+
 class Registers {
     uint32_t regs[RegisterCount];
+    Vector vregs[VectorRegisterCount];
     public:
     Registers();
     uint32_t get(uint8_t number) const;
     void set(uint8_t number, uint32_t value);
+    const Vector &get_vector(uint8_t number) const;
+    void set_vector(uint8_t number, const Vector &value);
+    uint32_t *data();
 };
@@ -0,0 +1,122 @@
+#include "scheduler.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/**
+ * Scheduler constructor
+ * @param[in] threads - number of worker threads, 0 for one per core.
+ * @param[in] quantum - fuel of a slice.
+ * @param[in] policy
+ */
+Scheduler::Scheduler(size_t threads, uint64_t quantum, SchedulingPolicy policy)
+    : threads {threads}
+    , quantum {quantum}
+    , policy {policy}
+{
+    if (this->threads == 0) {
+        this->threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (quantum == 0) {
+        throw std::logic_error("A slice needs some fuel.");
+    }
+}
+
+/**
+ * Add a prepared processor as a job and return its number.
+ * @param[in] processor
+ * @param[in] priority - higher runs first with the priority policy.
+ */
+size_t Scheduler::add(std::unique_ptr<Processor> processor, int priority) {
+    jobs.push_back({std::move(processor), priority});
+    return jobs.size() - 1;
+}
+
+Processor &Scheduler::get_processor(size_t job) {
+    return *jobs.at(job).processor;
+}
+
+/**
+ * Run all jobs until they exit and return their reports in job order.
+ * Errors thrown by a job end it and are stored in its report.
+ */
+std::vector<JobReport> Scheduler::run() {
+    typedef std::chrono::steady_clock Clock;
+    struct Ready {
+        int priority;
+        uint64_t sequence;
+        size_t job;
+    };
+    bool by_priority = policy == SchedulingPolicy::Priority;
+    auto later = [by_priority](const Ready &a, const Ready &b) {
+        if (by_priority && a.priority != b.priority) {
+            return a.priority < b.priority;
+        }
+        return a.sequence > b.sequence;
+    };
+    std::priority_queue<Ready, std::vector<Ready>, decltype(later)> ready(later);
+    std::vector<JobReport> reports(jobs.size());
+    std::mutex lock;
+    std::condition_variable wakeup;
+    size_t remaining = jobs.size();
+    uint64_t sequence = 0;
+    for(size_t job = 0; job < jobs.size(); job++) {
+        ready.push({jobs[job].priority, sequence++, job});
+    }
+
+    auto start = Clock::now();
+    auto worker = [&]() {
+        std::unique_lock<std::mutex> guard(lock);
+        while (true) {
+            wakeup.wait(guard, [&]() { return !ready.empty() || remaining == 0; });
+            if (remaining == 0) {
+                return;
+            }
+            Ready slice = ready.top();
+            ready.pop();
+            guard.unlock();
+
+            JobReport &report = reports[slice.job];
+            Processor &p = *jobs[slice.job].processor;
+            auto slice_start = Clock::now();
+            bool done;
+            try {
+                done = p.run_for(quantum);
+                report.ok = done;
+            } catch (const std::exception &e) {
+                report.error = e.what();
+                done = true;
+            }
+            auto slice_end = Clock::now();
+            report.slices++;
+            report.run_seconds += std::chrono::duration<double>(slice_end - slice_start).count();
+            report.executed = p.instructions_executed();
+
+            guard.lock();
+            if (done) {
+                report.wall_seconds = std::chrono::duration<double>(slice_end - start).count();
+                if (--remaining == 0) {
+                    wakeup.notify_all();
+                }
+            } else {
+                ready.push({slice.priority, sequence++, slice.job});
+                wakeup.notify_one();
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for(size_t i = 1; i < std::min(threads, jobs.size()); i++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for(auto &thread: pool) {
+        thread.join();
+    }
+    return reports;
+}
+
+size_t Scheduler::get_threads() const {
+    return threads;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "proc.h"
+
+enum class SchedulingPolicy {
+    /* ready jobs get a slice in turn */
+    RoundRobin,
+    /* the ready job with the highest priority runs, jobs of equal priority take turns */
+    Priority,
+};
+
+/**
+ * What a job of a scheduler run did.
+ */
+struct JobReport {
+    uint64_t executed = 0;
+    size_t slices = 0;
+    /* time spent running the slices of the job */
+    double run_seconds = 0;
+    /* time from the start of the scheduler run until the job exited */
+    double wall_seconds = 0;
+    bool ok = false;
+    std::string error;
+};
+
+/**
+ * Time-slices many processors on a fixed pool of threads.
+ * A slice runs the interpreter of a job with a fixed amount of fuel, jobs which are suspended go back to the ready queue.
+ * A job only ever runs on one thread at a time, but may move between threads from slice to slice.
+ */
+class Scheduler {
+    struct Job {
+        std::unique_ptr<Processor> processor;
+        int priority;
+    };
+
+    size_t threads;
+    uint64_t quantum;
+    SchedulingPolicy policy;
+    std::vector<Job> jobs;
+
+    public:
+    Scheduler(size_t threads=0, uint64_t quantum=10000, SchedulingPolicy policy=SchedulingPolicy::RoundRobin);
+
+    size_t add(std::unique_ptr<Processor> processor, int priority=0);
+    Processor &get_processor(size_t job);
+    std::vector<JobReport> run();
+    size_t get_threads() const;
+};
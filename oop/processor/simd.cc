@@ -0,0 +1,160 @@
+#include "simd.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+
+#ifdef __SSE2__
+static __m128i load(const Vector &v) {
+    return _mm_load_si128((const __m128i *)v.lanes);
+}
+
+static Vector store(__m128i x) {
+    Vector v;
+    _mm_store_si128((__m128i *)v.lanes, x);
+    return v;
+}
+
+/**
+ * Multiply the lanes, SSE2 only multiplies the even ones into 64-bit products.
+ * @param[in] a
+ * @param[in] b
+ */
+static __m128i mul_lanes(__m128i a, __m128i b) {
+#ifdef __SSE4_1__
+    return _mm_mullo_epi32(a, b);
+#else
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+#endif
+}
+#endif
+
+/**
+ * Combine two vectors lane by lane.
+ * @param[in] op
+ * @param[in] a
+ * @param[in] b
+ */
+static Vector combine(VectorOperation op, const Vector &a, const Vector &b) {
+#ifdef __SSE2__
+    __m128i x = load(a);
+    __m128i y = load(b);
+    switch (op) {
+        case VectorOperation::Add:
+            return store(_mm_add_epi32(x, y));
+        case VectorOperation::Sub:
+            return store(_mm_sub_epi32(x, y));
+        case VectorOperation::Mul:
+            return store(mul_lanes(x, y));
+        case VectorOperation::And:
+            return store(_mm_and_si128(x, y));
+        case VectorOperation::Xor:
+            return store(_mm_xor_si128(x, y));
+        default:
+            throw std::logic_error("Not a lane operation.");
+    }
+#else
+    Vector res;
+    for(size_t i = 0; i < VectorLanes; i++) {
+        switch (op) {
+            case VectorOperation::Add:
+                res.lanes[i] = a.lanes[i] + b.lanes[i];
+                break;
+            case VectorOperation::Sub:
+                res.lanes[i] = a.lanes[i] - b.lanes[i];
+                break;
+            case VectorOperation::Mul:
+                res.lanes[i] = a.lanes[i] * b.lanes[i];
+                break;
+            case VectorOperation::And:
+                res.lanes[i] = a.lanes[i] & b.lanes[i];
+                break;
+            case VectorOperation::Xor:
+                res.lanes[i] = a.lanes[i] ^ b.lanes[i];
+                break;
+            default:
+                throw std::logic_error("Not a lane operation.");
+        }
+    }
+    return res;
+#endif
+}
+
+/**
+ * Shift every lane left, counts of 32 or more clear it.
+ * @param[in] a
+ * @param[in] count
+ */
+static Vector shift_left(const Vector &a, uint32_t count) {
+#ifdef __SSE2__
+    return store(_mm_sll_epi32(load(a), _mm_cvtsi32_si128((int)count)));
+#else
+    Vector res;
+    for(size_t i = 0; i < VectorLanes; i++) {
+        res.lanes[i] = count < 32 ? a.lanes[i] << count : 0;
+    }
+    return res;
+#endif
+}
+
+/**
+ * Add up the lanes.
+ * @param[in] a
+ */
+static uint32_t sum(const Vector &a) {
+#ifdef __SSE2__
+    __m128i x = load(a);
+    x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2)));
+    x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(x);
+#else
+    uint32_t res = 0;
+    for(size_t i = 0; i < VectorLanes; i++) {
+        res += a.lanes[i];
+    }
+    return res;
+#endif
+}
+
+VectorOpcode::VectorOpcode(std::string name, std::vector<std::shared_ptr<OpcodeArg>> args, VectorOperation op)
+    : Opcode(name, args)
+    , op_ {op}
+{}
+
+VectorOperation VectorOpcode::get_operation() const {
+    return op_;
+}
+
+std::shared_ptr<Opcode> VectorOpcode::clone() const {
+    auto args = args_;
+    for(auto &arg: args) {
+        arg = arg->clone();
+    }
+    return std::shared_ptr<Opcode>(new VectorOpcode(name_, args, op_));
+}
+
+bool VectorOpcode::execute(Registers &r, Memory &m, Memory &stack) const {
+    switch (op_) {
+        case VectorOperation::Load:
+            r.set_vector(args_[0]->get_raw_value(), m.read_type<Vector>(args_[1]->get_value(r, m)));
+            break;
+        case VectorOperation::Store:
+            m.write_type<Vector>(args_[0]->get_value(r, m), r.get_vector(args_[1]->get_raw_value()));
+            break;
+        case VectorOperation::ShiftLeft:
+            r.set_vector(args_[0]->get_raw_value(), shift_left(r.get_vector(args_[0]->get_raw_value()), args_[1]->get_value(r, m)));
+            break;
+        case VectorOperation::Sum:
+            args_[0]->set_value(r, m, sum(r.get_vector(args_[1]->get_raw_value())));
+            break;
+        default:
+            r.set_vector(args_[0]->get_raw_value(),
+                    combine(op_, r.get_vector(args_[0]->get_raw_value()), r.get_vector(args_[1]->get_raw_value())));
+            break;
+    }
+    return false;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include "opcode.h"
+
+enum class VectorOperation {
+    /* vld v, addr */
+    Load,
+    /* vst addr, v */
+    Store,
+    /* vadd v, v */
+    Add,
+    /* vsub v, v */
+    Sub,
+    /* vmul v, v */
+    Mul,
+    /* vand v, v */
+    And,
+    /* vxor v, v */
+    Xor,
+    /* vshl v, count */
+    ShiftLeft,
+    /* vsum reg, v */
+    Sum,
+};
+
+/**
+ * Works on the four 32-bit lanes of vector registers at once, with SSE2 on hosts which have it.
+ * Loads and stores take the address from a register and need no alignment, lanes wrap around like
+ * the scalar opcodes and shifting by 32 or more clears them. vsum adds up the lanes into a register.
+ */
+class VectorOpcode : public Opcode {
+    VectorOperation op_;
+
+    public:
+    VectorOpcode(std::string name, std::vector<std::shared_ptr<OpcodeArg>> args, VectorOperation op);
+
+    VectorOperation get_operation() const;
+    std::shared_ptr<Opcode> clone() const;
+    bool execute(Registers &r, Memory &m, Memory &stack) const;
+};
@@ -0,0 +1,123 @@
+#include "snapshot.h"
+#include <stdexcept>
+#include <cstring>
+
+static void write_bytes(FILE *f, const void *data, size_t length) {
+    if (length && fwrite(data, 1, length, f) != length) {
+        throw std::runtime_error("Could not write snapshot.");
+    }
+}
+
+static void read_bytes(FILE *f, void *data, size_t length) {
+    if (length && fread(data, 1, length, f) != length) {
+        throw std::runtime_error("Snapshot is truncated.");
+    }
+}
+
+/**
+ * Check whether a file starts with the snapshot magic.
+ * @param[in] fname
+ */
+bool is_snapshot(const char *fname) {
+    FILE *f = fopen(fname, "rb");
+    if (f == NULL) {
+        throw std::runtime_error("Could not open file.");
+    }
+    char magic[sizeof(SnapshotMagic)];
+    bool res = fread(magic, 1, sizeof(magic), f) == sizeof(magic) && memcmp(magic, SnapshotMagic, sizeof(magic)) == 0;
+    fclose(f);
+    return res;
+}
+
+/**
+ * Write a memory snapshot with registers and counters.
+ * @param[in] f
+ * @param[in] regs
+ * @param[in] m
+ * @param[in] executed
+ * @param[in] code_end
+ * @param[in] suspended
+ * @param[in] incremental - only write the pages dirtied since the snapshot before m.
+ */
+void write_snapshot(FILE *f, const Registers &regs, const Memory::Snapshot &m,
+        uint64_t executed, uint32_t code_end, bool suspended, bool incremental) {
+    std::vector<uint32_t> pages = incremental ? m.dirty_pages() : m.page_addresses();
+    SnapshotHeader header = {};
+    memcpy(header.magic, SnapshotMagic, sizeof(header.magic));
+    header.version = SnapshotVersion;
+    header.flags = (incremental ? SnapshotIncremental : 0) | (suspended ? SnapshotSuspended : 0);
+    header.page_count = pages.size();
+    header.label_count = incremental ? 0 : m.get_labels().size();
+    header.code_end = code_end;
+    header.executed = executed;
+    for(size_t i = 0; i < RegisterCount; i++) {
+        header.regs[i] = regs.get(i);
+    }
+    for(size_t i = 0; i < VectorRegisterCount; i++) {
+        memcpy(header.vregs[i], regs.get_vector(i).lanes, sizeof(header.vregs[i]));
+    }
+    write_bytes(f, &header, sizeof(header));
+
+    if (!incremental) {
+        for(auto &label: m.get_labels()) {
+            uint32_t entry[2] = {label.second, (uint32_t)label.first.size()};
+            write_bytes(f, entry, sizeof(entry));
+            write_bytes(f, label.first.data(), label.first.size());
+        }
+    }
+    for(auto addr: pages) {
+        write_bytes(f, &addr, sizeof(addr));
+        write_bytes(f, m.get_page(addr), PageSize);
+    }
+}
+
+/**
+ * Load a full snapshot, replacing the memory, or apply an incremental one to it.
+ * @param[in] f
+ * @param[out] regs
+ * @param[in,out] m
+ * @param[out] executed
+ * @param[out] code_end
+ * @param[out] suspended
+ */
+void load_snapshot(FILE *f, Registers &regs, Memory &m, uint64_t &executed, uint32_t &code_end, bool &suspended) {
+    SnapshotHeader header;
+    read_bytes(f, &header, sizeof(header));
+    if (memcmp(header.magic, SnapshotMagic, sizeof(header.magic)) != 0) {
+        throw std::runtime_error("Not a snapshot.");
+    }
+    if (header.version != SnapshotVersion) {
+        throw std::runtime_error("Unsupported snapshot version " + std::to_string(header.version) + ".");
+    }
+    if (!(header.flags & SnapshotIncremental)) {
+        m = Memory();
+    }
+    for(uint32_t i = 0; i < header.label_count; i++) {
+        uint32_t entry[2];
+        read_bytes(f, entry, sizeof(entry));
+        std::string name(entry[1], '\0');
+        read_bytes(f, &name[0], entry[1]);
+        m.add_label(name, entry[0]);
+    }
+    std::vector<uint8_t> page(PageSize);
+    for(uint32_t i = 0; i < header.page_count; i++) {
+        uint32_t addr;
+        read_bytes(f, &addr, sizeof(addr));
+        if ((addr & (PageSize - 1)) != 0) {
+            throw std::runtime_error("Snapshot page is not aligned.");
+        }
+        read_bytes(f, page.data(), PageSize);
+        m.write_bytes(addr, page.data(), PageSize);
+    }
+    for(size_t i = 0; i < RegisterCount; i++) {
+        regs.set(i, header.regs[i]);
+    }
+    for(size_t i = 0; i < VectorRegisterCount; i++) {
+        Vector vreg;
+        memcpy(vreg.lanes, header.vregs[i], sizeof(vreg.lanes));
+        regs.set_vector(i, vreg);
+    }
+    executed = header.executed;
+    code_end = header.code_end;
+    suspended = header.flags & SnapshotSuspended;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "memory.h"
+#include "register.h"
+#include <cstdio>
+
+/*
+ * Snapshot file layout, all integers little endian:
+ *   SnapshotHeader
+ *   labels: { uint32_t address; uint32_t name_length; char name[name_length]; }[label_count]
+ *   pages: { uint32_t address; uint8_t data[PageSize]; }[page_count]
+ * A full snapshot holds the labels and every allocated page. An incremental one only holds the pages written
+ * since the snapshot before it and is applied on top of the state loaded from that one.
+ */
+const char SnapshotMagic[4] = {'K', 'E', 'K', 'S'};
+const uint32_t SnapshotVersion = 2;
+
+const uint32_t SnapshotIncremental = 1;
+/* taken while the program was suspended, it continues rather than starts when run */
+const uint32_t SnapshotSuspended = 2;
+
+struct SnapshotHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t page_count;
+    uint32_t label_count;
+    uint32_t code_end;
+    uint64_t executed;
+    uint32_t regs[RegisterCount];
+    uint32_t vregs[VectorRegisterCount][VectorLanes];
+};
+
+bool is_snapshot(const char *fname);
+void write_snapshot(FILE *f, const Registers &regs, const Memory::Snapshot &m,
+        uint64_t executed, uint32_t code_end, bool suspended, bool incremental);
+void load_snapshot(FILE *f, Registers &regs, Memory &m, uint64_t &executed, uint32_t &code_end, bool &suspended);
@@ -0,0 +1,172 @@
+#include "tasks.h"
+
+TaskOpcode::TaskOpcode(std::string name, std::vector<std::shared_ptr<OpcodeArg>> args, TaskOperation op)
+    : Opcode(name, args)
+    , op_ {op}
+{}
+
+TaskOperation TaskOpcode::get_operation() const {
+    return op_;
+}
+
+std::shared_ptr<Opcode> TaskOpcode::clone() const {
+    auto args = args_;
+    for(auto &arg: args) {
+        arg = arg->clone();
+    }
+    return std::shared_ptr<Opcode>(new TaskOpcode(name_, args, op_));
+}
+
+bool TaskOpcode::execute(Registers &r, Memory &m, Memory &stack) const {
+    throw std::logic_error("Task opcodes need the interpreter of the main thread.");
+}
+
+/**
+ * Execute with access to the tasks of the processor, a yield leaves the registers of the next task in r.
+ * @param[in,out] r
+ * @param[in] m
+ * @param[in] tasks
+ */
+bool TaskOpcode::execute(Registers &r, Memory &m, GuestTasks &tasks) const {
+    switch (op_) {
+        case TaskOperation::Go:
+            tasks.go(r, args_[0]->get_value(r, m));
+            break;
+        case TaskOperation::Yield:
+            tasks.yield(r);
+            break;
+    }
+    return false;
+}
+
+/**
+ * GuestTasks constructor
+ * @param[in] main_stack - stack of the first task.
+ * @param[in] io - input tasks wait for.
+ */
+GuestTasks::GuestTasks(Memory &main_stack, GuestIO &io)
+    : main_stack {main_stack}
+    , io {io}
+{}
+
+/**
+ * Return the stack of the running task.
+ */
+Memory &GuestTasks::stack() {
+    if (current == nullptr || current->stack == nullptr) {
+        return main_stack;
+    }
+    return *current->stack;
+}
+
+/**
+ * Make the parked tasks ready again, they retry their input instruction.
+ * @param[in] force - also when no input is ready, reading will block then.
+ */
+void GuestTasks::wake(bool force) {
+    if (!force && !io.input_ready()) {
+        return;
+    }
+    while (!waiting.empty()) {
+        ready.push_back(std::move(waiting.front()));
+        waiting.pop_front();
+    }
+}
+
+/**
+ * Load the registers of the first ready task, the current one must have been saved or ended.
+ * @param[out] regs
+ */
+void GuestTasks::switch_to_next(Registers &regs) {
+    current = std::move(ready.front());
+    ready.pop_front();
+    regs = current->regs;
+}
+
+/**
+ * Create a ready task starting at the entry, the running task continues.
+ * @param[in] regs - of the running task, copied into the new one.
+ * @param[in] entry
+ */
+void GuestTasks::go(const Registers &regs, uint32_t entry) {
+    if (current == nullptr) {
+        current.reset(new Task());
+    }
+    std::unique_ptr<Task> task(new Task());
+    task->regs = regs;
+    task->regs.set(RIP, entry);
+    task->regs.set(RSP, 0);
+    if (spare_stacks.empty()) {
+        task->stack.reset(new Memory());
+    } else {
+        task->stack = std::move(spare_stacks.back());
+        spare_stacks.pop_back();
+    }
+    ready.push_back(std::move(task));
+}
+
+/**
+ * Switch to the next ready task, if there is one.
+ * @param[in,out] regs - of the running task, replaced by the ones of the next task.
+ */
+void GuestTasks::yield(Registers &regs) {
+    if (!waiting.empty()) {
+        wake(false);
+    }
+    if (ready.empty()) {
+        return;
+    }
+    current->regs = regs;
+    ready.push_back(std::move(current));
+    switch_to_next(regs);
+}
+
+/**
+ * Park the running task before an input instruction if no input is ready and another task can run.
+ * Otherwise the input instruction blocks, the tasks parked meanwhile are woken by later switches.
+ * @param[in,out] regs - of the running task, replaced by the ones of the next task.
+ * @param[in] rip - address of the input instruction, where the task continues.
+ * @param[out] parked
+ */
+bool GuestTasks::park(Registers &regs, uint32_t rip) {
+    if (current == nullptr || ready.empty() || io.input_ready()) {
+        return false;
+    }
+    regs.set(RIP, rip);
+    current->regs = regs;
+    waiting.push_back(std::move(current));
+    switch_to_next(regs);
+    return true;
+}
+
+/**
+ * End the running task and switch to the next one, waiting for input if all others are parked.
+ * @param[in,out] regs - of the running task, replaced by the ones of the next task.
+ * @param[out] continued - false if no task is left, the registers of the last one stay.
+ */
+bool GuestTasks::exit(Registers &regs) {
+    if (current == nullptr) {
+        return false;
+    }
+    if (current->stack != nullptr) {
+        *current->stack = Memory();
+        spare_stacks.push_back(std::move(current->stack));
+    }
+    current.reset();
+    if (ready.empty() && !waiting.empty()) {
+        io.wait_input();
+        wake(true);
+    }
+    if (ready.empty()) {
+        return false;
+    }
+    switch_to_next(regs);
+    return true;
+}
+
+/**
+ * Return the number of tasks which did not end, including the running one.
+ */
+size_t GuestTasks::count() const {
+    return (current != nullptr) + ready.size() + waiting.size();
+}
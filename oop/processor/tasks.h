@@ -0,0 +1,70 @@
+#pragma once
+#include "opcode.h"
+#include "memory.h"
+#include "guestio.h"
+
+class GuestTasks;
+
+enum class TaskOperation {
+    /* go label */
+    Go,
+    /* yield */
+    Yield,
+};
+
+/**
+ * Creates or switches cooperative tasks, only the interpreter of the main thread can execute it.
+ */
+class TaskOpcode : public Opcode {
+    TaskOperation op_;
+
+    public:
+    TaskOpcode(std::string name, std::vector<std::shared_ptr<OpcodeArg>> args, TaskOperation op);
+
+    TaskOperation get_operation() const;
+    std::shared_ptr<Opcode> clone() const;
+    bool execute(Registers &r, Memory &m, Memory &stack) const;
+    bool execute(Registers &r, Memory &m, GuestTasks &tasks) const;
+};
+
+/**
+ * Cooperative tasks multiplexed on the interpreter of one host thread, without a host stack per task.
+ * The running task owns the registers of the processor, a switch saves them into its record and loads
+ * the next ready task, so it takes constant time. A new task starts with a copy of the registers of its
+ * creator and an empty stack. Tasks waiting for input are parked and woken when input is ready.
+ * Before the first go the processor runs without task records.
+ */
+class GuestTasks {
+    struct Task {
+        Registers regs;
+        /* NULL for the first task, which uses the stack of the processor */
+        std::unique_ptr<Memory> stack;
+    };
+
+    Memory &main_stack;
+    GuestIO &io;
+    std::unique_ptr<Task> current;
+    std::deque<std::unique_ptr<Task>> ready;
+    std::deque<std::unique_ptr<Task>> waiting;
+    /* stacks of ended tasks, cleared for reuse */
+    std::vector<std::unique_ptr<Memory>> spare_stacks;
+
+    void wake(bool force);
+    void switch_to_next(Registers &regs);
+
+    public:
+    GuestTasks(Memory &main_stack, GuestIO &io);
+
+    /**
+     * Return whether tasks were created and not all of them ended.
+     */
+    bool active() const {
+        return current != nullptr;
+    }
+    Memory &stack();
+    void go(const Registers &regs, uint32_t entry);
+    void yield(Registers &regs);
+    bool park(Registers &regs, uint32_t rip);
+    bool exit(Registers &regs);
+    size_t count() const;
+};
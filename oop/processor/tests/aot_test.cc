@@ -0,0 +1,136 @@
+#include "gtest/gtest.h"
+#include "../proc.h"
+
+/**
+ * Translate the program to C++, build it with the host compiler and return what it prints without input.
+ * @param[in] name
+ * @param[in] program
+ */
+static std::string run_aot(std::string name, std::vector<std::string> program) {
+    Processor p;
+    p.compile(program);
+    std::string source = name + ".cc";
+    std::ofstream out(source);
+    p.translate_cpp(out);
+    out.close();
+
+    std::string command = std::string(AOT_TEST_CXX) + " -O1 -o " + name + " " + source;
+    EXPECT_EQ(std::system(command.c_str()), 0);
+    command = "./" + name + " < /dev/null > " + name + ".out";
+    EXPECT_EQ(std::system(command.c_str()), 0);
+
+    std::ifstream in(name + ".out");
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+TEST(AotTestSuite, Labels){
+    Processor p;
+    p.compile({
+            "movi r1, 2",
+            "loop:",
+            "subi r1, 1",
+            "jnz loop, r1",
+            "exit",
+            });
+    std::stringstream ss;
+    p.translate_cpp(ss);
+    EXPECT_NE(ss.str().find("L6:"), std::string::npos);
+    EXPECT_NE(ss.str().find("{ uint32_t b = r1, c = 0u; if (b != 0) goto L6; }"), std::string::npos);
+    EXPECT_NE(ss.str().find("case 6u: goto L6;"), std::string::npos);
+}
+
+TEST(AotTestSuite, Gcd){
+    EXPECT_EQ(run_aot("aot_gcd", {
+            "movi r0, 57827924",
+            "movi r1, 1038849",
+            "gcd:",
+            "jz fin, r1",
+            "mod r0, r1",
+            "mov r2, r0",
+            "mov r0, r1",
+            "mov r1, r2",
+            "jmp gcd",
+            "exit",
+            "fin:",
+            "print r0",
+            "exit",
+            }), "1337");
+}
+
+TEST(AotTestSuite, CompareAndBranch){
+    EXPECT_EQ(run_aot("aot_compare", {
+            "movi r1, -3",
+            "movi r3, 45",
+            "loop:",
+            "mul r2, r1, r1",
+            "print r2",
+            "jgei skip, r1, 0",
+            "printc r3",
+            "skip:",
+            "addi r1, r1, 1",
+            "movi r4, 3",
+            "jlt loop, r1, r4",
+            "exit",
+            }), "9-4-1-014");
+}
+
+TEST(AotTestSuite, MemoryAndIndirectJumps){
+    EXPECT_EQ(run_aot("aot_indirect", {
+            "movi r0, 31337",
+            "str data, r0",
+            "ldr r1, data",
+            "print r1",
+            "mov r2, rip",
+            "addi r2, 10",
+            "mov rip, r2",
+            "exit",
+            "movi r3, 104",
+            "printc r3",
+            "exit",
+            "data:4:",
+            }), "31337h");
+}
+
+TEST(AotTestSuite, FarData){
+    EXPECT_EQ(run_aot("aot_far", {
+            "movi r0, 42",
+            "str far, r0",
+            "ldr r1, far",
+            "print r1",
+            "ldr r2, near",
+            "print r2",
+            "exit",
+            "near:4:",
+            "pad:100000000:",
+            "far:4:",
+            }), "420");
+}
+
+TEST(AotTestSuite, WrappingAccess){
+    /* the last bytes of the address space and the first bytes of the code share the word */
+    EXPECT_EQ(run_aot("aot_wrap", {
+            "movi r0, 16909060",
+            "str 4294967294, r0",
+            "ldr r1, 4294967294",
+            "print r1",
+            "ldr r2, 0",
+            "movi r3, 65535",
+            "and r2, r3",
+            "print r2",
+            "exit",
+            }), "16909060258");
+}
+
+TEST(AotTestSuite, EndOfInput){
+    EXPECT_EQ(run_aot("aot_eof", {
+            "readc r1",
+            "print r1",
+            "movi r2, 32",
+            "printc r2",
+            "read r3",
+            "print r3",
+            "exit",
+            }), "4294967295 0");
+}
@@ -0,0 +1,81 @@
+#include "gtest/gtest.h"
+#include "../batch.h"
+
+/* sums 1..n into r1 */
+static std::vector<std::string> sum_program(uint32_t n) {
+    return {
+        "movi r1, 0",
+        "movi r2, " + std::to_string(n),
+        "loop:",
+        "jz end, r2",
+        "add r1, r2",
+        "subi r2, 1",
+        "jmp loop",
+        "end:",
+        "exit",
+    };
+}
+
+TEST(BatchTestSuite, SharedOpcodeTable){
+    Processor a;
+    Processor b;
+    a.compile({"movi r1, 1"});
+    b.compile({"movi r2, 2"});
+    EXPECT_EQ(a.get_opcode_table(), b.get_opcode_table());
+    EXPECT_EQ(a.get_mem().read_type<uint8_t>(1), 1);
+    EXPECT_EQ(b.get_mem().read_type<uint8_t>(1), 2);
+    for(auto &opcode: Processor::get_opcode_table()->opcodes) {
+        for(auto &arg: opcode.second->get_args()) {
+            EXPECT_EQ(arg->get_raw_value(), 0);
+        }
+    }
+}
+
+TEST(BatchTestSuite, RunsJobsInParallel){
+    for(std::string engine: {"interp", "threaded", "jit"}) {
+        BatchRunner runner(4, engine);
+        const size_t jobs = 200;
+        std::vector<uint32_t> stored(jobs);
+        auto results = runner.run(jobs,
+                [](size_t job, Processor &p) { p.compile(sum_program(job)); },
+                [&](size_t job, Processor &p) { stored[job] = p.get_regs().get(1); });
+        ASSERT_EQ(results.size(), jobs);
+        for(size_t job = 0; job < jobs; job++) {
+            EXPECT_TRUE(results[job].ok) << results[job].error;
+            EXPECT_EQ(results[job].regs.get(1), job * (job + 1) / 2);
+            EXPECT_EQ(stored[job], job * (job + 1) / 2);
+            EXPECT_GT(results[job].executed, 0);
+        }
+    }
+}
+
+TEST(BatchTestSuite, ErrorsStayInTheirJob){
+    BatchRunner runner(2);
+    auto results = runner.run(3, [](size_t job, Processor &p) {
+        if (job == 1) {
+            p.get_mem().write_type<uint8_t>(0, 200);
+            return;
+        }
+        p.compile(sum_program(3));
+    });
+    EXPECT_TRUE(results[0].ok);
+    EXPECT_FALSE(results[1].ok);
+    EXPECT_EQ(results[1].error, "No such opcode 200.");
+    EXPECT_TRUE(results[2].ok);
+    EXPECT_EQ(results[2].regs.get(1), 6);
+}
+
+TEST(BatchTestSuite, ParallelFor){
+    std::vector<std::atomic<int>> runs(100);
+    auto errors = parallel_for(runs.size(), 4, [&](size_t job) {
+        runs[job]++;
+        if (job % 10 == 3) {
+            throw std::runtime_error("job " + std::to_string(job));
+        }
+    });
+    ASSERT_EQ(errors.size(), runs.size());
+    for(size_t job = 0; job < runs.size(); job++) {
+        EXPECT_EQ(runs[job], 1);
+        EXPECT_EQ(errors[job], job % 10 == 3 ? "job " + std::to_string(job) : "");
+    }
+}
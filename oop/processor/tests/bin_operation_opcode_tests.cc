@@ -3,6 +3,7 @@
 #include "../opcode.h"
 #include "../memory"
 #include "../register.h"
+#include "../proc.h"
 
 
 TEST(BinaryOperationOpcodeTestSuite, AsmRegs){
@@ -203,3 +204,26 @@ TEST(BinaryOperationOpcodeTestSuite, SaveAsmRegI){
     opcode->parse_raw(m, 0);
     EXPECT_EQ(opcode->write_asm(), name + " " + "r13, " + std::to_string(some_int));
 }
+
+TEST(BinaryOperationOpcodeTestSuite, Sub){
+    Processor p;
+    p.compile({
+            "movi r0, 100",
+            "movi r1, 7",
+            "sub r0, r1",
+            "print r0",
+            "movi r2, 32",
+            "printc r2",
+            "subi r0, 58",
+            "print r0",
+            "printc r2",
+            "movi r3, 0",
+            "subi r3, 1",
+            "print r3",
+            "exit",
+            });
+    testing::internal::CaptureStdout();
+    p.run();
+    std::cout.flush();
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "93 35 4294967295");
+}
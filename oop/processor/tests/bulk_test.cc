@@ -0,0 +1,82 @@
+#include "gtest/gtest.h"
+#include "../proc.h"
+
+static const std::vector<std::string> buffers = {
+    "movi r1, 8192",
+    "movi r2, 65",
+    "movi r3, 10000",
+    "mset r1, r2, r3",
+    "movi r4, 65536",
+    "mcpy r4, r1, r3",
+    "mov r5, r1",
+    "mcmp r5, r4, r3",
+    "movi r6, 1",
+    "str 70000, r6",
+    "mov r7, r1",
+    "mcmp r7, r4, r3",
+    "mov r8, r4",
+    "mcmp r8, r1, r3",
+    "exit",
+};
+
+TEST(BulkTestSuite, Opcodes){
+    Processor p;
+    p.compile(buffers);
+    p.run();
+    auto &regs = p.get_regs();
+    EXPECT_EQ(regs.get(5), 0);
+    EXPECT_EQ(regs.get(7), 1);
+    EXPECT_EQ(regs.get(8), UINT32_MAX);
+    auto &mem = p.get_mem();
+    EXPECT_EQ(mem.read_type<uint8_t>(8191), 0);
+    EXPECT_EQ(mem.read_type<uint32_t>(8192), 0x41414141);
+    EXPECT_EQ(mem.read_type<uint8_t>(8192 + 9999), 65);
+    EXPECT_EQ(mem.read_type<uint8_t>(8192 + 10000), 0);
+    EXPECT_EQ(mem.read_type<uint8_t>(65536 + 9999), 65);
+    EXPECT_EQ(mem.read_type<uint8_t>(65536 + 10000), 0);
+}
+
+TEST(BulkTestSuite, Engines){
+    Processor interpreted;
+    interpreted.compile(buffers);
+    interpreted.run();
+
+    Processor threaded;
+    threaded.compile(buffers);
+    threaded.run_threaded();
+    Processor jit;
+    jit.compile(buffers);
+    jit.run_jit();
+    for(uint8_t reg = 0; reg < 9; reg++) {
+        EXPECT_EQ(threaded.get_regs().get(reg), interpreted.get_regs().get(reg));
+        EXPECT_EQ(jit.get_regs().get(reg), interpreted.get_regs().get(reg));
+    }
+    EXPECT_TRUE(threaded.get_mem() == interpreted.get_mem());
+    EXPECT_TRUE(jit.get_mem() == interpreted.get_mem());
+}
+
+TEST(BulkTestSuite, CopyOverCode){
+    /* the copied instruction replaces the first exit, the instruction cache has to notice */
+    Processor p;
+    p.compile({
+            "jmp second",
+            "first:",
+            "exit",
+            "exit",
+            "exit",
+            "exit",
+            "exit",
+            "exit",
+            "exit",
+            "second:",
+            "movi r1, first",
+            "movi r2, patch",
+            "movi r3, 6",
+            "mcpy r1, r2, r3",
+            "jmp first",
+            "patch:",
+            "movi r4, 2",
+            });
+    p.run();
+    EXPECT_EQ(p.get_regs().get(4), 2);
+}
@@ -0,0 +1,106 @@
+#include "gtest/gtest.h"
+#include "../proc.h"
+#include "../cache.h"
+#include <sys/stat.h>
+
+static std::string write_source(const std::string &name, const std::string &source) {
+    std::string fname = testing::TempDir() + name;
+    std::ofstream(fname) << source;
+    return fname;
+}
+
+static std::string cache_dir(const std::string &name) {
+    std::string dir = testing::TempDir() + name;
+    std::filesystem::remove_all(dir);
+    return dir;
+}
+
+TEST(CompileCacheTestSuite, Hits){
+    std::string fname = write_source("cache.kekasm", "movi r1, 6\nmuli r1, 7\nprint r1\nexit\n");
+    CompileCache cache(cache_dir("cache_hits"), 1 << 20);
+
+    std::string image = cache.get(fname.c_str(), false);
+    EXPECT_EQ(cache.get_misses(), 1);
+    EXPECT_EQ(cache.get(fname.c_str(), false), image);
+    EXPECT_EQ(cache.get_hits(), 1);
+
+    /* the options are part of the key */
+    EXPECT_NE(cache.get(fname.c_str(), true), image);
+    EXPECT_EQ(cache.get_misses(), 2);
+
+    Processor p;
+    p.load(image.c_str());
+    testing::internal::CaptureStdout();
+    p.run();
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "42");
+
+    /* changing the source misses */
+    write_source("cache.kekasm", "movi r1, 5\nprint r1\nexit\n");
+    EXPECT_NE(cache.get(fname.c_str(), false), image);
+    EXPECT_EQ(cache.get_misses(), 3);
+}
+
+TEST(CompileCacheTestSuite, Keys){
+    EXPECT_EQ(compile_cache_key("exit\n", false), compile_cache_key("exit\n", false));
+    EXPECT_NE(compile_cache_key("exit\n", false), compile_cache_key("exit\n", true));
+    EXPECT_NE(compile_cache_key("exit\n", false), compile_cache_key("exit \n", false));
+}
+
+TEST(CompileCacheTestSuite, Eviction){
+    std::string dir = cache_dir("cache_eviction");
+    std::vector<std::string> fnames;
+    for(int i = 0; i < 3; i++) {
+        fnames.push_back(write_source("evict" + std::to_string(i) + ".kekasm", "movi r1, " + std::to_string(i) + "\nexit\n"));
+    }
+    CompileCache probe(cache_dir("cache_probe"), 1 << 20);
+    uint64_t size = std::filesystem::file_size(probe.get(fnames[0].c_str(), false));
+
+    /* room for two images, the least recently used one goes */
+    CompileCache cache(dir, 2 * size + size / 2);
+    std::string first = cache.get(fnames[0].c_str(), false);
+    std::string second = cache.get(fnames[1].c_str(), false);
+    std::filesystem::last_write_time(second, std::filesystem::last_write_time(first) - std::chrono::seconds(10));
+    std::string third = cache.get(fnames[2].c_str(), false);
+    EXPECT_TRUE(std::filesystem::exists(first));
+    EXPECT_FALSE(std::filesystem::exists(second));
+    EXPECT_TRUE(std::filesystem::exists(third));
+
+    /* files which aren't images are not counted nor removed */
+    std::ofstream(dir + "/notes") << std::string(4 * size, 'x');
+    cache.get(fnames[1].c_str(), false);
+    EXPECT_TRUE(std::filesystem::exists(dir + "/notes"));
+    EXPECT_EQ(cache.get_misses(), 4);
+}
+
+TEST(CompileCacheTestSuite, SharedDirectory){
+    std::string dir = cache_dir("cache_shared");
+    std::string fname = write_source("shared.kekasm", "exit\n");
+    CompileCache cache(dir, 1 << 20);
+
+    /* images get the permissions of any other new file */
+    mode_t mask = umask(0);
+    umask(mask);
+    std::string image = cache.get(fname.c_str(), false);
+    struct stat st;
+    ASSERT_EQ(stat(image.c_str(), &st), 0);
+    EXPECT_EQ(st.st_mode & 0777, 0666 & ~mask);
+
+    /* temporary files of dead compiles are swept, recent ones may still be written */
+    std::string stale = dir + "/tmp.stale1";
+    std::string fresh = dir + "/tmp.fresh1";
+    std::ofstream(stale) << "x";
+    std::ofstream(fresh) << "x";
+    std::filesystem::last_write_time(stale, std::filesystem::file_time_type::clock::now() - std::chrono::hours(2));
+    write_source("shared.kekasm", "movi r1, 1\nexit\n");
+    cache.get(fname.c_str(), false);
+    EXPECT_FALSE(std::filesystem::exists(stale));
+    EXPECT_TRUE(std::filesystem::exists(fresh));
+}
+
+TEST(CompileCacheTestSuite, Errors){
+    CompileCache cache(cache_dir("cache_errors"), 1 << 20);
+    EXPECT_THROW(cache.get((testing::TempDir() + "missing.kekasm").c_str(), false), std::runtime_error);
+    std::string fname = write_source("invalid.kekasm", "jmp nowhere\n");
+    EXPECT_ANY_THROW(cache.get(fname.c_str(), false));
+    EXPECT_TRUE(std::filesystem::is_empty(testing::TempDir() + "cache_errors"));
+}
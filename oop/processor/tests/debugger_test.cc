@@ -0,0 +1,136 @@
+#include "gtest/gtest.h"
+#include "../proc.h"
+#include <unistd.h>
+
+static std::vector<std::string> counter = {
+    "movi r1, 0",
+    "loop:",
+    "addi r1, 1",
+    "str 100, r1",
+    "jmp loop",
+};
+
+/**
+ * Run the program in debug mode with the given debugger input and return the executed instruction count.
+ */
+static uint64_t debug_program(const std::vector<std::string> &program, std::string input, Processor &p) {
+    p.compile(program);
+    std::istringstream in(input);
+    auto cin_buf = std::cin.rdbuf(in.rdbuf());
+    testing::internal::CaptureStdout();
+    testing::internal::CaptureStderr();
+    p.run(true);
+    std::cin.rdbuf(cin_buf);
+    testing::internal::GetCapturedStdout();
+    testing::internal::GetCapturedStderr();
+    return p.instructions_executed();
+}
+
+static uint64_t debug_counter(std::string input, Processor &p) {
+    return debug_program(counter, input, p);
+}
+
+TEST(DebuggerTestSuite, Breakpoint){
+    Processor p;
+    EXPECT_EQ(debug_counter("b 12\nc\nc\nh\n", p), 6);
+    EXPECT_EQ(p.get_regs().get(1), 2);
+}
+
+TEST(DebuggerTestSuite, DeleteBreakpoint){
+    Processor p;
+    EXPECT_EQ(debug_counter("b 12\nb 18\nd 1\nc\nh\n", p), 4);
+}
+
+TEST(DebuggerTestSuite, WriteWatchpoint){
+    Processor p;
+    EXPECT_EQ(debug_counter("w 100 4 w\nc\nh\n", p), 4);
+    EXPECT_EQ(p.get_mem().read_type<uint32_t>(100), 1);
+}
+
+TEST(DebuggerTestSuite, ChangeWatchpoint){
+    Processor p;
+    EXPECT_EQ(debug_counter("w 101 1 c\nc\nh\n", p), 4 + 255 * 3);
+    EXPECT_EQ(p.get_mem().read_type<uint32_t>(100), 256);
+}
+
+TEST(DebuggerTestSuite, AtomicWatchpoint){
+    std::vector<std::string> program = {
+        "movi r1, 100",
+        "movi r2, 1",
+        "fetchadd r1, r2",
+        "fetchadd r1, r2",
+        "exit",
+    };
+    Processor writes;
+    EXPECT_EQ(debug_program(program, "w 100 4 w\nc\nh\n", writes), 4);
+    EXPECT_EQ(writes.get_mem().read_type<uint32_t>(100), 1);
+
+    Processor reads;
+    EXPECT_EQ(debug_program(program, "w 102 1 r\nc\nh\n", reads), 4);
+}
+
+TEST(DebuggerTestSuite, Accesses){
+    DebugState state;
+    Memory m;
+    uint32_t id = state.add_watchpoint(10, 4, WatchRead, m);
+    EXPECT_NE(state.check_access(12, 4, WatchRead), "");
+    EXPECT_EQ(state.check_access(12, 4, WatchWrite), "");
+    EXPECT_EQ(state.check_access(14, 4, WatchRead), "");
+    EXPECT_EQ(state.check_access(6, 4, WatchRead), "");
+    EXPECT_TRUE(state.remove(id));
+    EXPECT_FALSE(state.remove(id));
+    EXPECT_EQ(state.check_access(12, 4, WatchRead), "");
+
+    uint32_t breakpoint = state.add_breakpoint(1000);
+    EXPECT_TRUE(state.is_breakpoint(1000));
+    EXPECT_FALSE(state.is_breakpoint(999));
+    EXPECT_FALSE(state.is_breakpoint(1 << 30));
+    state.remove(breakpoint);
+    EXPECT_FALSE(state.is_breakpoint(1000));
+
+    state.add_breakpoint(0xffffffff);
+    EXPECT_TRUE(state.is_breakpoint(0xffffffff));
+    EXPECT_FALSE(state.is_breakpoint(0xfffffffe));
+    EXPECT_THROW(state.add_watchpoint(0, 0xffffffff, WatchRead, m), std::logic_error);
+}
+
+TEST(DebuggerTestSuite, Changes){
+    /* the range crosses into a page which is only written later */
+    DebugState state;
+    Memory m;
+    m.write_type<uint32_t>(PageSize - 4, 1);
+    state.add_watchpoint(PageSize - 4, 8, WatchChange, m);
+    EXPECT_EQ(state.check_changes(m), "");
+    m.write_type<uint32_t>(PageSize, 2);
+    EXPECT_EQ(state.check_changes(m), "watchpoint 1: 4092 changed");
+    EXPECT_EQ(state.check_changes(m), "");
+    m.write_type<uint32_t>(PageSize - 4, 1);
+    EXPECT_EQ(state.check_changes(m), "");
+}
+
+TEST(DebuggerTestSuite, PipedGuestInput){
+    /* debugger commands and guest input come through the same piped stdin */
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    std::string input = "s\n5\ns\ns\n";
+    ASSERT_EQ(write(fds[1], input.data(), input.size()), (ssize_t)input.size());
+    close(fds[1]);
+    int saved_stdin = dup(STDIN_FILENO);
+    dup2(fds[0], STDIN_FILENO);
+    close(fds[0]);
+
+    Processor p;
+    p.compile({"read r1", "print r1", "exit"});
+    testing::internal::CaptureStdout();
+    testing::internal::CaptureStderr();
+    p.run(true);
+    testing::internal::GetCapturedStdout();
+    testing::internal::GetCapturedStderr();
+
+    dup2(saved_stdin, STDIN_FILENO);
+    close(saved_stdin);
+    clearerr(stdin);
+    std::cin.clear();
+    EXPECT_EQ(p.get_regs().get(1), 5);
+    EXPECT_EQ(p.instructions_executed(), 3);
+}
@@ -0,0 +1,126 @@
+#include "gtest/gtest.h"
+#include "../proc.h"
+#include "../fusion.h"
+
+/**
+ * Run the program with and without fusion, check that both print the same and execute the same number of instructions.
+ * @param[in] program
+ * @param[out] dispatched - by the fused run.
+ * @param[out] output
+ */
+static std::string run_fused(std::vector<std::string> program, uint64_t &dispatched) {
+    std::string outputs[2];
+    uint64_t executed[2];
+    for(int fused = 0; fused < 2; fused++) {
+        Processor p;
+        p.set_fusion(fused);
+        p.compile(program);
+        testing::internal::CaptureStdout();
+        p.run();
+        outputs[fused] = testing::internal::GetCapturedStdout();
+        executed[fused] = p.instructions_executed();
+        if (fused) {
+            dispatched = p.instructions_dispatched();
+        } else {
+            EXPECT_EQ(p.instructions_dispatched(), p.instructions_executed());
+        }
+    }
+    EXPECT_EQ(outputs[0], outputs[1]);
+    EXPECT_EQ(executed[0], executed[1]);
+    return outputs[1];
+}
+
+TEST(FusionTestSuite, Gcd){
+    uint64_t dispatched;
+    EXPECT_EQ(run_fused({
+                "movi r0, 57827924",
+                "movi r1, 1038849",
+                "gcd:",
+                "jz fin, r1",
+                "mod r0, r1",
+                "mov r2, r0",
+                "mov r0, r1",
+                "mov r1, r2",
+                "jmp gcd",
+                "fin:",
+                "print r0",
+                "exit",
+                }, dispatched), "1337");
+    /* 7 iterations of the loop, each fusing 4 instructions into 1 */
+    EXPECT_EQ(dispatched, 47 - 7 * 3);
+}
+
+TEST(FusionTestSuite, Counter){
+    uint64_t dispatched;
+    EXPECT_EQ(run_fused({
+                "movi r1, 10",
+                "movi r3, 0",
+                "loop:",
+                "addi r3, 1",
+                "subi r1, 1",
+                "jnz loop, r1",
+                "print r3",
+                "exit",
+                }, dispatched), "10");
+    EXPECT_EQ(dispatched, 2 + 10 * 2 + 2);
+}
+
+TEST(FusionTestSuite, JumpIntoSequence){
+    uint64_t dispatched;
+    EXPECT_EQ(run_fused({
+                "movi r0, 1",
+                "movi r1, 2",
+                "movi r2, 7",
+                "movi r5, 0",
+                "jz middle, r5",
+                "mov r2, r0",
+                "middle:",
+                "mov r0, r1",
+                "mov r1, r2",
+                "print r0",
+                "print r1",
+                "print r2",
+                "exit",
+                }, dispatched), "277");
+}
+
+TEST(FusionTestSuite, WriteIntoSequence){
+    uint64_t dispatched;
+    /* the immediate of subi is overwritten before the fused subi + jnz runs */
+    EXPECT_EQ(run_fused({
+                "movi r1, 10",
+                "movi r3, 0",
+                "movi r4, 2",
+                "str 32, r4",
+                "loop:",
+                "addi r3, 1",
+                "subi r1, 1",
+                "jnz loop, r1",
+                "print r3",
+                "exit",
+                }, dispatched), "5");
+}
+
+TEST(FusionTestSuite, Disassembly){
+    Processor p;
+    p.set_fusion(false);
+    p.compile({
+            "sub r1, r2",
+            "jz 0, r1",
+            "mov r3, r4",
+            "mov r4, r5",
+            "mov r5, r3",
+            "exit",
+            });
+    InstructionCache icache(Processor::get_opcode_table()->opcodes);
+    EXPECT_EQ(fuse_instructions(icache, p.get_mem(), {0, 9}), 2);
+    ASSERT_TRUE(icache.fetch(p.get_mem(), 0).fused);
+    auto &compare = icache.objects(0);
+    EXPECT_EQ(compare.fused->write_asm(), "sub r1, r2; jz 0, r1");
+    EXPECT_EQ(compare.fused_length, 9);
+    EXPECT_EQ(compare.fused_count, 2);
+    ASSERT_TRUE(icache.fetch(p.get_mem(), 9).fused);
+    auto &swap = icache.objects(9);
+    EXPECT_EQ(swap.fused->write_asm(), "mov r3, r4; mov r4, r5; mov r5, r3");
+    EXPECT_EQ(std::dynamic_pointer_cast<const FusedOpcode>(swap.fused)->get_kind(), FusedKind::Swap);
+}
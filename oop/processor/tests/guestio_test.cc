@@ -0,0 +1,237 @@
+#include "gtest/gtest.h"
+#include "../guestio.h"
+#include "../proc.h"
+#include <unistd.h>
+
+static std::string temp_path(const char *name) {
+    return testing::TempDir() + name;
+}
+
+static void write_file(const std::string &path, const std::string &contents) {
+    std::ofstream out(path, std::ios::binary);
+    out << contents;
+}
+
+static std::string read_file(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+TEST(GuestIOTestSuite, Output){
+    std::string path = temp_path("guest.out");
+    {
+        GuestIO io;
+        io.bind_output(path.c_str());
+        io.put_uint(0);
+        io.put_char(' ');
+        io.put_uint(4294967295u);
+        for(size_t i = 0; i < GuestOutputBufferSize; i++) {
+            io.put_char('x');
+        }
+        EXPECT_EQ(read_file(path).substr(0, 12), "0 4294967295");
+    }
+    std::string out = read_file(path);
+    EXPECT_EQ(out.size(), 12 + GuestOutputBufferSize);
+    EXPECT_EQ(out.back(), 'x');
+}
+
+TEST(GuestIOTestSuite, Input){
+    std::string path = temp_path("guest.in");
+    write_file(path, "  42\n-1 99999999999 a\tb x");
+    GuestIO io;
+    io.bind_input(path.c_str());
+    EXPECT_EQ(io.get_uint(), 42);
+    EXPECT_EQ(io.get_uint(), (uint32_t)-1);
+    EXPECT_EQ(io.get_uint(), UINT32_MAX);
+    EXPECT_EQ(io.get_char(), 'a');
+    EXPECT_EQ(io.get_char(), 'b');
+    EXPECT_EQ(io.get_uint(), 0);
+    EXPECT_EQ(io.get_char(), 'x');
+    EXPECT_EQ(io.get_char(), (uint32_t)-1);
+    EXPECT_EQ(io.get_uint(), 0);
+}
+
+TEST(GuestIOTestSuite, StreamInput){
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    FILE *in = fdopen(fds[0], "r");
+    GuestIO io;
+    io.bind_input(in);
+    EXPECT_FALSE(io.input_ready());
+    ASSERT_EQ(write(fds[1], " 7 8\n", 5), 5);
+    EXPECT_TRUE(io.input_ready());
+    EXPECT_EQ(io.get_uint(), 7);
+    /* the rest was read ahead, the pipe itself is empty now */
+    EXPECT_TRUE(io.input_ready());
+    EXPECT_EQ(io.get_uint(), 8);
+    EXPECT_FALSE(io.input_ready());
+    close(fds[1]);
+    EXPECT_TRUE(io.input_ready());
+    EXPECT_EQ(io.get_char(), (uint32_t)-1);
+    fclose(in);
+}
+
+TEST(GuestIOTestSuite, BoundProcessor){
+    std::vector<std::string> echo = {
+        "loop:",
+        "read r1",
+        "jz end, r1",
+        "mul r1, r1",
+        "print r1",
+        "movi r2, 10",
+        "printc r2",
+        "jmp loop",
+        "end:",
+        "exit",
+    };
+    std::string input = temp_path("echo.in");
+    write_file(input, "1 2 3 4 0");
+    for(int engine = 0; engine < 3; engine++) {
+        std::string output = temp_path("echo.out");
+        Processor p;
+        p.compile(echo);
+        p.get_io().bind_input(input.c_str());
+        p.get_io().bind_output(output.c_str());
+        if (engine == 0) {
+            p.run();
+        } else if (engine == 1) {
+            p.run_threaded();
+        } else {
+            p.run_jit();
+        }
+        EXPECT_EQ(read_file(output), "1\n4\n9\n16\n") << engine;
+    }
+}
+
+TEST(GuestIOTestSuite, RecordReplay){
+    std::vector<std::string> sum = {
+        "loop:",
+        "read r1",
+        "jz end, r1",
+        "add r2, r1",
+        "readc r3",
+        "jmp loop",
+        "end:",
+        "print r2",
+        "exit",
+    };
+    std::string input = temp_path("sum.in");
+    std::string log = temp_path("sum.log");
+    write_file(input, "5 a 7 b 0");
+    {
+        Processor p;
+        p.compile(sum);
+        p.get_io().bind_input(input.c_str());
+        p.get_io().record_input(log.c_str());
+        testing::internal::CaptureStdout();
+        p.run();
+        EXPECT_EQ(testing::internal::GetCapturedStdout(), "12");
+    }
+    EXPECT_EQ(read_file(log), "1 read 5\n4 readc 97\n6 read 7\n9 readc 98\n11 read 0\n");
+
+    /* replay doesn't read the input, changing it changes nothing */
+    write_file(input, "");
+    Processor replayed;
+    replayed.compile(sum);
+    replayed.get_io().bind_input(input.c_str());
+    replayed.get_io().replay_input(log.c_str());
+    testing::internal::CaptureStdout();
+    replayed.run();
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "12");
+
+    /* a snapshot taken during a replay continues it, skipping the values read before */
+    Processor first;
+    first.compile(sum);
+    first.get_io().replay_input(log.c_str());
+    EXPECT_FALSE(first.run_for(5));
+    auto snapshot = first.snapshot();
+    Processor resumed;
+    resumed.restore(*snapshot);
+    resumed.get_io().replay_input(log.c_str());
+    testing::internal::CaptureStdout();
+    resumed.run();
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "12");
+}
+
+TEST(GuestIOTestSuite, RecordReplayTasks){
+    /* the reader parks while the pipe is empty, the printer spins until it read the end */
+    std::vector<std::string> sum = {
+        "go printer",
+        "loop:",
+        "read r1",
+        "ldr r2, 4096",
+        "add r2, r1",
+        "str 4096, r2",
+        "jnz loop, r1",
+        "movi r3, 1",
+        "str 4100, r3",
+        "exit",
+        "printer:",
+        "ldr r2, 4100",
+        "jnz done, r2",
+        "yield",
+        "jmp printer",
+        "done:",
+        "ldr r2, 4096",
+        "print r2",
+        "exit",
+    };
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    FILE *in = fdopen(fds[0], "r");
+    ASSERT_NE(in, nullptr);
+    std::string log = temp_path("tasks.log");
+    {
+        Processor p;
+        p.compile(sum);
+        p.get_io().bind_input(in);
+        p.get_io().record_input(log.c_str());
+        testing::internal::CaptureStdout();
+        EXPECT_FALSE(p.run_for(1000));
+        ASSERT_EQ(write(fds[1], "3\n", 2), 2);
+        EXPECT_FALSE(p.run_for(1000));
+        ASSERT_EQ(write(fds[1], "4 0", 3), 3);
+        close(fds[1]);
+        p.run();
+        EXPECT_EQ(testing::internal::GetCapturedStdout(), "7");
+    }
+    fclose(in);
+    EXPECT_NE(read_file(log).find(" ready 1\n"), std::string::npos);
+
+    /* the tasks park and wake at the recorded instructions, though empty mapped input is always ready */
+    Processor replayed;
+    replayed.compile(sum);
+    std::string input = temp_path("tasks.in");
+    write_file(input, "");
+    replayed.get_io().bind_input(input.c_str());
+    replayed.get_io().replay_input(log.c_str());
+    testing::internal::CaptureStdout();
+    replayed.run();
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "7");
+}
+
+TEST(GuestIOTestSuite, RecordRejectsThreads){
+    std::string log = temp_path("threads.log");
+    Processor p;
+    p.compile({"spawn r1, worker", "exit", "worker:", "exit"});
+    p.get_io().record_input(log.c_str());
+    EXPECT_THROW(p.run(), std::runtime_error);
+}
+
+TEST(GuestIOTestSuite, ReplayDiverges){
+    std::string log = temp_path("diverge.log");
+    write_file(log, "1 read 5\n");
+    Processor p;
+    p.compile({"readc r1", "exit"});
+    p.get_io().replay_input(log.c_str());
+    EXPECT_THROW(p.run(), std::runtime_error);
+
+    Processor ended;
+    ended.compile({"read r1", "read r1", "exit"});
+    ended.get_io().replay_input(log.c_str());
+    EXPECT_THROW(ended.run(), std::runtime_error);
+
+    write_file(log, "1 write 5\n");
+    GuestIO io;
+    EXPECT_THROW(io.replay_input(log.c_str()), std::runtime_error);
+}
@@ -0,0 +1,249 @@
+#include "gtest/gtest.h"
+#include "../proc.h"
+
+TEST(GuestThreadsTestSuite, Atomics){
+    Processor p;
+    p.compile({
+            "movi r1, 4096",
+            "movi r2, 5",
+            "xchg r1, r2",
+            "movi r3, 5",
+            "movi r4, 7",
+            "cas r1, r3, r4",
+            "movi r5, 6",
+            "movi r6, 9",
+            "cas r1, r5, r6",
+            "movi r7, 3",
+            "fetchadd r1, r7",
+            "ldr r8, 4096",
+            "exit",
+            });
+    p.run();
+    auto &regs = p.get_regs();
+    EXPECT_EQ(regs.get(2), 0);
+    /* the first cas succeeds, the second one fails and returns the current value */
+    EXPECT_EQ(regs.get(3), 5);
+    EXPECT_EQ(regs.get(5), 7);
+    EXPECT_EQ(regs.get(7), 7);
+    EXPECT_EQ(regs.get(8), 10);
+}
+
+TEST(GuestThreadsTestSuite, UnalignedAtomic){
+    Processor p;
+    p.compile({
+            "movi r1, 4098",
+            "fetchadd r1, r2",
+            "exit",
+            });
+    EXPECT_THROW(p.run(), std::runtime_error);
+}
+
+TEST(GuestThreadsTestSuite, SpawnJoin){
+    Processor p;
+    p.compile({
+            "movi r1, 20",
+            "spawn r2, square",
+            "movi r1, 30",
+            "spawn r3, square",
+            "join r2",
+            "join r3",
+            "print r2",
+            "movi r4, 32",
+            "printc r4",
+            "print r3",
+            "exit",
+            "square:",
+            "mul r1, r1",
+            "exit",
+            });
+    testing::internal::CaptureStdout();
+    p.run();
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "400 900");
+    EXPECT_EQ(p.instructions_executed(), 11 + 2 * 2);
+}
+
+TEST(GuestThreadsTestSuite, Counters){
+    /* four threads add to one word with fetchadd and to the next one with a cas loop */
+    Processor p;
+    p.compile({
+            "movi r10, 4",
+            "movi r11, 0",
+            "spawn_loop:",
+            "spawn r12, worker",
+            "addi r11, 1",
+            "mov r13, r11",
+            "sub r13, r10",
+            "jnz spawn_loop, r13",
+            "movi r12, 1",
+            "join_loop:",
+            "mov r14, r12",
+            "join r14",
+            "addi r12, 1",
+            "mov r13, r12",
+            "subi r13, 5",
+            "jnz join_loop, r13",
+            "ldr r1, 4096",
+            "ldr r2, 4100",
+            "exit",
+            "worker:",
+            "movi r1, 4096",
+            "movi r2, 4100",
+            "movi r3, 1",
+            "movi r4, 20000",
+            "loop:",
+            "fetchadd r1, r3",
+            "movi r3, 1",
+            "ldr r5, 4100",
+            "retry:",
+            "mov r6, r5",
+            "addi r6, 1",
+            "mov r7, r5",
+            "cas r2, r5, r6",
+            "sub r7, r5",
+            "jnz retry, r7",
+            "subi r4, 1",
+            "jnz loop, r4",
+            "exit",
+            });
+    p.run();
+    EXPECT_EQ(p.get_regs().get(1), 80000);
+    EXPECT_EQ(p.get_regs().get(2), 80000);
+}
+
+TEST(GuestThreadsTestSuite, ExitWaits){
+    Processor p;
+    p.compile({
+            "spawn r1, worker",
+            "exit",
+            "worker:",
+            "movi r2, 100000",
+            "loop:",
+            "subi r2, 1",
+            "jnz loop, r2",
+            "movi r2, 1",
+            "str done, r2",
+            "exit",
+            "done:4:",
+            });
+    p.run();
+    EXPECT_EQ(p.get_mem().read_type<uint32_t>(p.get_mem().resolve_label("done")), 1);
+}
+
+TEST(GuestThreadsTestSuite, Errors){
+    Processor unknown;
+    unknown.compile({
+            "movi r1, 3",
+            "join r1",
+            "exit",
+            });
+    EXPECT_THROW(unknown.run(), std::runtime_error);
+
+    Processor twice;
+    twice.compile({
+            "spawn r1, worker",
+            "mov r2, r1",
+            "join r1",
+            "join r2",
+            "exit",
+            "worker:",
+            "exit",
+            });
+    EXPECT_THROW(twice.run(), std::runtime_error);
+
+    /* the code is read only while threads run, the error is raised by the join */
+    Processor writer;
+    writer.compile({
+            "spawn r1, worker",
+            "join r1",
+            "exit",
+            "worker:",
+            "str 0, r1",
+            "exit",
+            });
+    EXPECT_THROW(writer.run(), std::runtime_error);
+
+    /* a loaded image knows where its code ends as well */
+    Processor compiled;
+    compiled.compile({
+            "spawn r1, worker",
+            "join r1",
+            "exit",
+            "worker:",
+            "str 0, r1",
+            "exit",
+            });
+    std::string path = testing::TempDir() + "writer.img";
+    FILE *f = fopen(path.c_str(), "wb");
+    ASSERT_NE(f, nullptr);
+    compiled.dump_image(f);
+    fclose(f);
+    Processor loaded;
+    loaded.load_image(path.c_str());
+    EXPECT_THROW(loaded.run(), std::runtime_error);
+}
+
+TEST(GuestThreadsTestSuite, PatchAfterJoin){
+    /* code past the compiled code is not guarded, a thread patches print r1 there into print r7 */
+    Processor p;
+    p.compile({
+            "movi r1, 1",
+            "movi r7, 2",
+            "jmp 4096",
+            "back:",
+            "jnz done, r5",
+            "movi r5, 1",
+            "spawn r2, worker",
+            "join r2",
+            "jmp 4096",
+            "done:",
+            "exit",
+            "worker:",
+            "movi r4, 4097",
+            "movi r8, 7",
+            "movi r6, 1",
+            "mset r4, r8, r6",
+            "exit",
+            });
+    auto &table = *Processor::get_opcode_table();
+    Memory &m = p.get_mem();
+    m.write_type<uint8_t>(4096, table.lookup("print", 1));
+    m.write_type<uint8_t>(4097, 1);
+    m.write_type<uint8_t>(4098, table.lookup("jmp", 1));
+    m.write_type<uint32_t>(4099, m.resolve_label("back"));
+
+    testing::internal::CaptureStdout();
+    p.run();
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "12");
+}
+
+TEST(GuestThreadsTestSuite, NeedsInterpreter){
+    Processor p;
+    p.compile({
+            "spawn r1, worker",
+            "join r1",
+            "exit",
+            "worker:",
+            "exit",
+            });
+    EXPECT_THROW(p.run_threaded(), std::logic_error);
+}
+
+TEST(GuestThreadsTestSuite, SnapshotAfterJoin){
+    Processor p;
+    p.compile({
+            "spawn r1, worker",
+            "join r1",
+            "movi r2, 1",
+            "str 8192, r2",
+            "exit",
+            "worker:",
+            "movi r1, 7",
+            "str 4096, r1",
+            "exit",
+            });
+    p.run();
+    auto snapshot = p.snapshot();
+    EXPECT_EQ(p.get_regs().get(1), 7);
+    EXPECT_EQ(snapshot->mem->get_page(4096)[0], 7);
+    EXPECT_EQ(snapshot->mem->get_page(8192)[0], 1);
+}
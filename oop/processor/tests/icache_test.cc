@@ -0,0 +1,96 @@
+#include "gtest/gtest.h"
+#include "../icache.h"
+#include "../proc.h"
+
+static std::string run_program(std::vector<std::string> program) {
+    Processor p;
+    p.compile(program);
+    testing::internal::CaptureStdout();
+    p.run();
+    std::cout.flush();
+    return testing::internal::GetCapturedStdout();
+}
+
+TEST(InstructionCacheTestSuite, Decode){
+    std::map<uint8_t, std::shared_ptr<const Opcode>> opcodes = {
+        {0, std::shared_ptr<Opcode>(new BinaryOperationOpcode(
+                    "movi",
+                    std::shared_ptr<OpcodeArg>(new RegArg()),
+                    std::shared_ptr<OpcodeArg>(new IntArg()),
+                    [](uint32_t a, uint32_t b) -> uint32_t { return b; },
+                    4
+                    ))},
+    };
+    InstructionCache icache(opcodes);
+    Memory m;
+    m.write_type<uint8_t>(10, 0);
+    m.write_type<uint8_t>(11, 7);
+    m.write_type<uint32_t>(12, 1337);
+    m.write_type<uint8_t>(100, 200);
+
+    auto &instr = icache.fetch(m, 10);
+    EXPECT_TRUE(instr.valid);
+    EXPECT_EQ(instr.length, 6);
+    EXPECT_EQ(icache.opcode(10).write_asm(), "movi r7, 1337");
+    EXPECT_THROW(icache.fetch(m, 100), std::runtime_error);
+}
+
+TEST(InstructionCacheTestSuite, InvalidateOnWrite){
+    std::map<uint8_t, std::shared_ptr<const Opcode>> opcodes = {
+        {0, std::shared_ptr<Opcode>(new BinaryOperationOpcode(
+                    "movi",
+                    std::shared_ptr<OpcodeArg>(new RegArg()),
+                    std::shared_ptr<OpcodeArg>(new IntArg()),
+                    [](uint32_t a, uint32_t b) -> uint32_t { return b; },
+                    4
+                    ))},
+    };
+    InstructionCache icache(opcodes);
+    Memory m;
+    m.add_observer(&icache);
+    m.write_type<uint8_t>(0, 0);
+    m.write_type<uint8_t>(1, 1);
+    m.write_type<uint32_t>(2, 1);
+    icache.fetch(m, 0);
+    EXPECT_EQ(icache.opcode(0).write_asm(), "movi r1, 1");
+
+    m.write_type<uint8_t>(5, 2);
+    icache.fetch(m, 0);
+    EXPECT_EQ(icache.opcode(0).write_asm(), "movi r1, 33554433");
+    m.remove_observer(&icache);
+}
+
+TEST(InstructionCacheTestSuite, SelfModifyingCode){
+    /* the second iteration executes "movi r0, 7" written over the cached "movi r0, 1" */
+    std::string out = run_program({
+            "movi r1, 458765",
+            "movi r2, 4294967294",
+            "target:",
+            "movi r0, 1",
+            "print r0",
+            "str target, r1",
+            "addi r2, 1",
+            "jnz target, r2",
+            "exit",
+            });
+    EXPECT_EQ(out, "17");
+}
+
+TEST(InstructionCacheTestSuite, FarCode){
+    /* the gap is never written, neither decoding nor fusing may walk it */
+    Processor p;
+    p.compile_source(
+            "movi r1, 7\n"
+            "jmp far\n"
+            "pad:100000000:\n"
+            "far:\n"
+            "print r1\n"
+            "movi r2, 4095\n"
+            "str page_end, r2\n"
+            "print r2\n"
+            "exit\n"
+            "page_end:4:\n");
+    testing::internal::CaptureStdout();
+    p.run();
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "74095");
+}
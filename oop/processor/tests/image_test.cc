@@ -0,0 +1,139 @@
+#include "gtest/gtest.h"
+#include "../image.h"
+#include "../proc.h"
+
+static std::string temp_path(const char *name) {
+    return testing::TempDir() + name;
+}
+
+static std::vector<uint8_t> read_file(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+TEST(ImageTestSuite, RoundTrip){
+    Registers regs;
+    regs.set(5, 77);
+    Memory m;
+    m.write_type<uint32_t>(0, 0xdeadbeef);
+    m.write_type<uint32_t>(5 * PageSize + 3, 1337);
+    m.write_type<uint8_t>(0x80000000, 42);
+    m.add_label("data", 5 * PageSize);
+
+    std::string path = temp_path("roundtrip.img");
+    FILE *f = fopen(path.c_str(), "wb");
+    ASSERT_NE(f, nullptr);
+    write_image(f, regs, m, 4);
+    fclose(f);
+    EXPECT_TRUE(is_image(path.c_str()));
+
+    Registers loaded_regs;
+    Memory loaded;
+    /* the code ends within the first page, the rest of it is data */
+    EXPECT_EQ(load_image(path.c_str(), loaded_regs, loaded), 4);
+    EXPECT_EQ(loaded_regs.get(5), 77);
+    EXPECT_TRUE(loaded == m);
+    EXPECT_EQ(loaded.size(), m.size());
+    EXPECT_EQ(loaded.pages(), 3);
+    EXPECT_EQ(loaded.resolve_label("data"), 5 * PageSize);
+}
+
+TEST(ImageTestSuite, CopyOnWrite){
+    Registers regs;
+    Memory m;
+    m.write_type<uint32_t>(16, 1);
+
+    std::string path = temp_path("cow.img");
+    FILE *f = fopen(path.c_str(), "wb");
+    ASSERT_NE(f, nullptr);
+    write_image(f, regs, m, 0);
+    fclose(f);
+    auto before = read_file(path);
+
+    Memory loaded;
+    load_image(path.c_str(), regs, loaded);
+    loaded.write_type<uint32_t>(16, 2);
+    EXPECT_EQ(loaded.read_type<uint32_t>(16), 2);
+    EXPECT_EQ(read_file(path), before);
+
+    Memory copy = loaded;
+    copy.write_type<uint32_t>(16, 3);
+    EXPECT_EQ(loaded.read_type<uint32_t>(16), 2);
+}
+
+TEST(ImageTestSuite, RunCompiledImage){
+    std::string path = temp_path("run.img");
+    {
+        Processor p;
+        p.compile({
+                "movi r1, 6",
+                "movi r2, 7",
+                "mul r1, r2",
+                "print r1",
+                "exit",
+                });
+        FILE *f = fopen(path.c_str(), "wb");
+        ASSERT_NE(f, nullptr);
+        p.dump_image(f);
+        fclose(f);
+    }
+    Processor p;
+    p.load_image(path.c_str());
+    EXPECT_EQ(p.snapshot()->code_end, 18);
+    testing::internal::CaptureStdout();
+    p.run();
+    std::cout.flush();
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "42");
+}
+
+TEST(ImageTestSuite, RawFormat){
+    std::string path = temp_path("raw.img");
+    FILE *f = fopen(path.c_str(), "wb");
+    ASSERT_NE(f, nullptr);
+    uint32_t raw_regs[RegisterCount] = {};
+    raw_regs[RIP] = 2;
+    fwrite(raw_regs, sizeof(uint32_t), RegisterCount, f);
+    std::vector<uint8_t> bytes(PageSize + 10, 7);
+    fwrite(bytes.data(), 1, bytes.size(), f);
+    fclose(f);
+    EXPECT_FALSE(is_image(path.c_str()));
+
+    f = fopen(path.c_str(), "rb");
+    ASSERT_NE(f, nullptr);
+    Registers regs;
+    Memory m;
+    load_raw_image(f, regs, m);
+    fclose(f);
+    EXPECT_EQ(regs.get(RIP), 2);
+    EXPECT_EQ(m.size(), PageSize + 10);
+    EXPECT_EQ(m.read_type<uint8_t>(PageSize + 9), 7);
+    EXPECT_EQ(m.read_type<uint8_t>(PageSize + 10), 0);
+}
+
+TEST(ImageTestSuite, LoadRaw){
+    /* movi r1, 42; print r1; exit */
+    std::string path = temp_path("raw_load.img");
+    FILE *f = fopen(path.c_str(), "wb");
+    ASSERT_NE(f, nullptr);
+    uint32_t raw_regs[RegisterCount] = {};
+    fwrite(raw_regs, sizeof(uint32_t), RegisterCount, f);
+    std::vector<uint8_t> code = {13, 1, 42, 0, 0, 0, 25, 1, 255};
+    fwrite(code.data(), 1, code.size(), f);
+    fclose(f);
+
+    Processor p;
+    p.load(path.c_str());
+    EXPECT_EQ(p.snapshot()->code_end, code.size());
+    testing::internal::CaptureStdout();
+    p.run();
+    std::cout.flush();
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "42");
+
+    /* cut off within the registers */
+    f = fopen(path.c_str(), "wb");
+    ASSERT_NE(f, nullptr);
+    fwrite(raw_regs, sizeof(uint32_t), RegisterCount - 1, f);
+    fclose(f);
+    Processor truncated;
+    EXPECT_THROW(truncated.load(path.c_str()), std::runtime_error);
+}
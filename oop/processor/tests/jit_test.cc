@@ -0,0 +1,187 @@
+#include "gtest/gtest.h"
+#include "../proc.h"
+#include "../jit.h"
+#include "../optable.h"
+
+/**
+ * Run the program with the JIT in lockstep with the interpreter and return what it printed.
+ * @param[in] program
+ * @param[out] output
+ */
+static std::string run_differential(std::vector<std::string> program) {
+    Processor p;
+    p.compile(program);
+    testing::internal::CaptureStdout();
+    EXPECT_NO_THROW(p.run_differential());
+    std::cout.flush();
+    return testing::internal::GetCapturedStdout();
+}
+
+static std::string run_jit(std::vector<std::string> program) {
+    Processor p;
+    p.compile(program);
+    testing::internal::CaptureStdout();
+    p.run_jit();
+    std::cout.flush();
+    return testing::internal::GetCapturedStdout();
+}
+
+static const std::vector<std::string> gcd_program = {
+    "movi r0, 57827924",
+    "movi r1, 1038849",
+    "gcd:",
+    "jz fin, r1",
+    "mod r0, r1",
+    "mov r2, r0",
+    "mov r0, r1",
+    "mov r1, r2",
+    "jmp gcd",
+    "exit",
+    "fin:",
+    "print r0",
+    "exit",
+};
+
+TEST(JitTestSuite, Gcd){
+    EXPECT_EQ(run_differential(gcd_program), "1337");
+    EXPECT_EQ(run_jit(gcd_program), "1337");
+}
+
+TEST(JitTestSuite, Lol){
+    std::vector<std::string> program = {
+        "ldr r0, 0",
+        "print r0",
+        "exit",
+    };
+    EXPECT_EQ(run_differential(program), "31");
+    EXPECT_EQ(run_jit(program), "31");
+}
+
+TEST(JitTestSuite, Arithmetic){
+    std::vector<std::string> program = {
+        "movi r0, 100",
+        "movi r1, 7",
+        "sub r0, r1",
+        "print r0",
+        "subi r0, 3",
+        "muli r0, 3",
+        "print r0",
+        "xori r0, 5",
+        "lshifti r0, 2",
+        "print r0",
+        "movi r3, 3",
+        "rshift r0, r3",
+        "print r0",
+        "divi r0, 7",
+        "print r0",
+        "movi r4, 5",
+        "mod r0, r4",
+        "print r0",
+        "mul r4, r4",
+        "ori r4, 64",
+        "andi r4, 72",
+        "print r4",
+        "neg r1",
+        "print r1",
+        "bitflip r1",
+        "print r1",
+        "exit",
+    };
+    EXPECT_EQ(run_differential(program), "9327010681331947242949672896");
+    EXPECT_EQ(run_jit(program), "9327010681331947242949672896");
+}
+
+TEST(JitTestSuite, Loop){
+    std::vector<std::string> program = {
+        "movi r0, 0",
+        "movi r1, 1000",
+        "loop:",
+        "add r0, r1",
+        "subi r1, 1",
+        "jnz loop, r1",
+        "str sum, r0",
+        "ldr r2, sum",
+        "print r2",
+        "exit",
+        "sum:4:",
+    };
+    EXPECT_EQ(run_differential(program), "500500");
+    EXPECT_EQ(run_jit(program), "500500");
+}
+
+TEST(JitTestSuite, SelfModifyingCode){
+    std::vector<std::string> program = {
+        "movi r1, 458765",
+        "movi r2, 4294967294",
+        "target:",
+        "movi r0, 1",
+        "print r0",
+        "str target, r1",
+        "addi r2, 1",
+        "jnz target, r2",
+        "exit",
+    };
+    EXPECT_EQ(run_differential(program), "17");
+    EXPECT_EQ(run_jit(program), "17");
+}
+
+TEST(JitTestSuite, Rip){
+    std::vector<std::string> program = {
+        "mov r0, rip",
+        "print r0",
+        "movi r1, 15",
+        "mov rip, r1",
+        "exit",
+        "movi r2, 5",
+        "print r2",
+        "exit",
+    };
+    EXPECT_EQ(run_differential(program), "35");
+    EXPECT_EQ(run_jit(program), "35");
+}
+
+TEST(JitTestSuite, FarCode){
+    /* the flags of compiled bytes are only allocated for the pages around the code, not for the gap */
+    EXPECT_EQ(run_differential({
+            "movi r1, 7",
+            "jmp far",
+            "pad:10000000:",
+            "far:",
+            "str data, r1",
+            "ldr r2, data",
+            "print r2",
+            "exit",
+            "data:4:",
+            }), "7");
+}
+
+/**
+ * Return whether any mapping of the process is writable and executable at once.
+ */
+static bool has_wx_mapping() {
+    std::ifstream maps("/proc/self/maps");
+    std::string line;
+    while (std::getline(maps, line)) {
+        std::stringstream ss(line);
+        std::string range, perms;
+        ss >> range >> perms;
+        if (perms.find('w') != std::string::npos && perms.find('x') != std::string::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+TEST(JitTestSuite, CodeIsNeverWritableAndExecutable){
+    Registers regs;
+    Memory mem, stack;
+    InstructionCache icache(Processor::get_opcode_table()->opcodes);
+    GuestIO io;
+    mem.write_type<uint8_t>(0, ExitOpcodeNumber);
+    JitEngine engine(regs, mem, stack, icache, io);
+    EXPECT_FALSE(has_wx_mapping());
+    engine.compile_reachable(0);
+    EXPECT_FALSE(has_wx_mapping());
+    engine.run();
+    EXPECT_FALSE(has_wx_mapping());
+}
@@ -0,0 +1,127 @@
+#include "gtest/gtest.h"
+#include "../proc.h"
+#include "../lexer.h"
+#include "../error.h"
+
+TEST(LexerTestSuite, Lines){
+    LexedLine line;
+    EXPECT_FALSE(lex_line(" \t ", line));
+
+    ASSERT_TRUE(lex_line("\tadd  r1 ,\tr2 ", line));
+    EXPECT_EQ(line.mnemonic, "add");
+    EXPECT_EQ(line.operand_count, 2);
+    EXPECT_EQ(line.operands[0], "r1");
+    EXPECT_EQ(line.operands[1], "r2");
+    EXPECT_EQ(line.label, "");
+
+    ASSERT_TRUE(lex_line("exit", line));
+    EXPECT_EQ(line.mnemonic, "exit");
+    EXPECT_EQ(line.operand_count, 0);
+
+    ASSERT_TRUE(lex_line(" loop :", line));
+    EXPECT_EQ(line.label, "loop");
+    EXPECT_EQ(line.label_length, 0);
+    EXPECT_EQ(line.mnemonic, "");
+
+    ASSERT_TRUE(lex_line("buffer:16:", line));
+    EXPECT_EQ(line.label, "buffer");
+    EXPECT_EQ(line.label_length, 16);
+
+    ASSERT_TRUE(lex_line("mov r1, r2, r3, r4, r5", line));
+    EXPECT_EQ(line.operand_count, 5);
+
+    EXPECT_THROW(lex_line("a:b:c:", line), AsmException);
+    EXPECT_THROW(lex_line("buffer:x:", line), AsmException);
+}
+
+TEST(LexerTestSuite, Source){
+    std::string source = "movi r1, 3\r\n\nloop:\n  subi r1, 1\njnz loop, r1\nexit";
+    Lexer lexer(source);
+    LexedLine line;
+    std::vector<std::string> seen;
+    while (lexer.next(line)) {
+        seen.push_back(line.mnemonic.empty() ? std::string(line.label) + ":" : std::string(line.mnemonic));
+    }
+    EXPECT_EQ(seen, std::vector<std::string>({"movi", "loop:", "subi", "jnz", "exit"}));
+}
+
+TEST(LexerTestSuite, Numbers){
+    EXPECT_EQ(string_to_int("42"), std::make_pair(42u, true));
+    EXPECT_EQ(string_to_int("-1"), std::make_pair(4294967295u, true));
+    EXPECT_EQ(string_to_int("+7"), std::make_pair(7u, true));
+    EXPECT_FALSE(string_to_int("").second);
+    EXPECT_FALSE(string_to_int("-").second);
+    EXPECT_FALSE(string_to_int("12a").second);
+    EXPECT_FALSE(string_to_int("loop").second);
+    EXPECT_FALSE(string_to_int("4294967296").second);
+}
+
+TEST(LexerTestSuite, SameCode){
+    /* the two pass assembler writes the same code as assembling parsed opcodes */
+    std::vector<std::string> program = {
+        "movi r1, 10",
+        "movi r2, data",
+        "loop:",
+        "add r3, r3, r1",
+        "subi r1, 1",
+        "jnz loop, r1",
+        "str data, r3",
+        "vld v1, r2",
+        "jmp end",
+        "data:8:",
+        "end:",
+        "ldr r4, data",
+        "print r4",
+        "exit",
+    };
+    Processor parsed;
+    parsed.set_fusion(false);
+    parsed.set_optimization(true);
+    Processor assembled;
+    assembled.set_fusion(false);
+    std::string source;
+    for(auto &line: program) {
+        source += line + "\n";
+    }
+    assembled.compile_source(source);
+    std::map<std::string, uint32_t> labels = {{"loop", 12}, {"data", 42}, {"end", 50}};
+    EXPECT_EQ(assembled.get_mem().get_labels(), labels);
+
+    /* the optimizer keeps the program, it reads its own data */
+    EXPECT_EQ(parsed.compile(program), assembled.get_mem().get_memory());
+
+    testing::internal::CaptureStdout();
+    assembled.run();
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "55");
+}
+
+TEST(LexerTestSuite, File){
+    std::string fname = testing::TempDir() + "lexer.kekasm";
+    std::ofstream out(fname);
+    out << "movi r1, 6\nmuli r1, 7\nprint r1\nexit\n";
+    out.close();
+
+    Processor p;
+    p.compile_file(fname.c_str());
+    testing::internal::CaptureStdout();
+    p.run();
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "42");
+
+    EXPECT_THROW(p.compile_file((fname + ".missing").c_str()), std::runtime_error);
+}
+
+TEST(LexerTestSuite, Errors){
+    std::vector<std::vector<std::string>> programs = {
+        {"nop"},
+        {"add r1"},
+        {"mov r1, r2, r3, r4, r5"},
+        {"jmp nowhere"},
+        {"a:", "a:"},
+        {"movi x1, 3"},
+        {"vld r1, r2"},
+    };
+    for(auto &program: programs) {
+        Processor p;
+        EXPECT_THROW(p.compile(program), AsmException);
+    }
+}
@@ -0,0 +1,130 @@
+#include "gtest/gtest.h"
+#include "../proc.h"
+#include "../linker.h"
+#include "../error.h"
+
+static std::shared_ptr<const ObjectFile> assemble(std::string source, bool optimize=false) {
+    Processor p;
+    p.set_optimization(optimize);
+    return std::make_shared<const ObjectFile>(p.compile_object(source));
+}
+
+static std::string run(Processor &p) {
+    testing::internal::CaptureStdout();
+    p.run();
+    return testing::internal::GetCapturedStdout();
+}
+
+TEST(LinkerTestSuite, SingleObject){
+    /* one object linked alone is the program compiled from its source */
+    std::string source = "movi r1, 10\nloop:\nadd r3, r1\nsubi r1, 1\njnz loop, r1\nstr data, r3\n"
+        "ldr r4, data\nprint r4\nexit\ndata:4:\n";
+    Processor compiled;
+    compiled.set_fusion(false);
+    compiled.compile_source(source);
+
+    auto object = assemble(source);
+    EXPECT_EQ(object->relocations.size(), 3);
+    Processor linked;
+    linked.set_fusion(false);
+    Linker linker(*Processor::get_opcode_table());
+    EXPECT_EQ(linker.update({{"main", object}}), 1);
+    linked.link(linker);
+    EXPECT_EQ(linked.get_mem().get_memory(), compiled.get_mem().get_memory());
+    EXPECT_EQ(linked.get_mem().get_labels(), compiled.get_mem().get_labels());
+    EXPECT_EQ(run(linked), "55");
+}
+
+TEST(LinkerTestSuite, CrossReferences){
+    auto main = assemble("movi r1, 4\njmp square\nback:\nprint r1\nldr r2, counter\nprint r2\nexit\n");
+    auto square = assemble("square:\nmul r1, r1\nldr r2, counter\naddi r2, 1\nstr counter, r2\njmp back\ncounter:4:\n");
+    ASSERT_EQ(main->symbols.size(), 3);
+    EXPECT_FALSE(main->symbols[0].defined);
+    EXPECT_TRUE(main->symbols[2].defined);
+
+    Linker linker(*Processor::get_opcode_table());
+    linker.update({{"main", main}, {"square", square}});
+    Processor p;
+    p.link(linker);
+    EXPECT_EQ(run(p), "161");
+    EXPECT_EQ(p.get_mem().resolve_label("square"), linker.get_base("square"));
+}
+
+TEST(LinkerTestSuite, FallThrough){
+    /* falling off the end of an object continues in the next one */
+    Linker linker(*Processor::get_opcode_table());
+    linker.update({{"a", assemble("movi r1, 3\n")}, {"b", assemble("muli r1, 5\n", true)}, {"c", assemble("print r1\nexit\n")}});
+    Processor p;
+    p.link(linker);
+    EXPECT_EQ(run(p), "15");
+}
+
+TEST(LinkerTestSuite, Errors){
+    Processor p;
+    EXPECT_THROW(p.compile_object("jmp\n"), AsmException);
+    EXPECT_THROW(p.compile_object("a:\na:\n"), AsmException);
+
+    Linker undefined(*Processor::get_opcode_table());
+    undefined.update({{"main", assemble("jmp nowhere\n")}});
+    EXPECT_THROW(p.link(undefined), AsmException);
+
+    Linker duplicate(*Processor::get_opcode_table());
+    duplicate.update({{"a", assemble("start:\nexit\n")}, {"b", assemble("start:\nexit\n")}});
+    EXPECT_THROW(p.link(duplicate), AsmException);
+}
+
+TEST(LinkerTestSuite, Incremental){
+    auto main = assemble("jmp work\nback:\nprint r1\nexit\n");
+    auto work = assemble("work:\nmovi r1, 1\njmp back\n");
+    auto tail = assemble("unused:\nexit\n");
+    Linker linker(*Processor::get_opcode_table());
+    EXPECT_EQ(linker.update({{"main", main}, {"work", work}, {"tail", tail}}), 3);
+    uint32_t work_base = linker.get_base("work");
+    uint32_t tail_base = linker.get_base("tail");
+
+    /* the same objects keep their slots */
+    EXPECT_EQ(linker.update({{"main", main}, {"work", work}, {"tail", tail}}), 0);
+
+    /* a change within the slack keeps the slot, growing beyond it lays out that object and the ones after it */
+    auto grown = assemble("work:\nmovi r1, 1\naddi r1, 1\njmp back\n");
+    EXPECT_EQ(linker.update({{"main", main}, {"work", grown}, {"tail", tail}}), 2);
+    EXPECT_EQ(linker.get_base("work"), work_base);
+    EXPECT_NE(linker.get_base("tail"), tail_base);
+    Processor p;
+    p.link(linker);
+    EXPECT_EQ(run(p), "2");
+
+    /* a saved layout is used again after loading it */
+    std::stringstream layout;
+    linker.save(layout);
+    Linker loaded(*Processor::get_opcode_table());
+    loaded.load(layout);
+    EXPECT_EQ(loaded.update({{"main", main}, {"work", grown}, {"tail", tail}}), 0);
+    EXPECT_EQ(loaded.get_base("tail"), linker.get_base("tail"));
+
+    std::stringstream invalid("0 8 main\n9 8 work\n");
+    EXPECT_THROW(loaded.load(invalid), std::runtime_error);
+}
+
+TEST(LinkerTestSuite, ObjectFile){
+    std::string fname = testing::TempDir() + "linker.o";
+    auto object = assemble("movi r1, 1\njmp done\nbuffer:16:\ndone:\nexit\n");
+    FILE *f = fopen(fname.c_str(), "wb");
+    ASSERT_NE(f, nullptr);
+    object->write(f);
+    fclose(f);
+
+    ObjectFile read = ObjectFile::read(fname.c_str());
+    EXPECT_EQ(read.size, object->size);
+    EXPECT_EQ(read.code, object->code);
+    EXPECT_EQ(read.runs.size(), 2);
+    ASSERT_EQ(read.symbols.size(), 2);
+    EXPECT_EQ(read.symbols[0].name, "done");
+    EXPECT_TRUE(read.symbols[0].defined);
+    EXPECT_EQ(read.symbols[0].address, object->symbols[0].address);
+    EXPECT_EQ(read.relocations.size(), 1);
+
+    std::ofstream(fname) << "KEKO";
+    EXPECT_THROW(ObjectFile::read(fname.c_str()), std::runtime_error);
+    EXPECT_THROW(ObjectFile::read((fname + ".missing").c_str()), std::runtime_error);
+}
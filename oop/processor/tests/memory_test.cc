@@ -0,0 +1,174 @@
+#include "gtest/gtest.h"
+#include "../memory.h"
+#include <thread>
+
+TEST(MemoryTestSuite, Sparse){
+    Memory m;
+    EXPECT_EQ(m.read_type<uint32_t>(0xdeadbeef), 0);
+    EXPECT_EQ(m.pages(), 0);
+
+    m.write_type<uint32_t>(0xfffffff0, 1337);
+    m.write_type<uint8_t>(0, 17);
+    EXPECT_EQ(m.read_type<uint32_t>(0xfffffff0), 1337);
+    EXPECT_EQ(m.read_type<uint8_t>(0), 17);
+    EXPECT_EQ(m.pages(), 2);
+}
+
+TEST(MemoryTestSuite, CrossPage){
+    Memory m;
+    m.write_type<uint32_t>(PageSize - 2, 0x11223344);
+    EXPECT_EQ(m.read_type<uint32_t>(PageSize - 2), 0x11223344);
+    EXPECT_EQ(m.read_type<uint16_t>(PageSize), 0x1122);
+    EXPECT_EQ(m.pages(), 2);
+
+    m.write_type<uint32_t>(0xfffffffe, 0xaabbccdd);
+    EXPECT_EQ(m.read_type<uint32_t>(0xfffffffe), 0xaabbccdd);
+    EXPECT_EQ(m.read_type<uint16_t>(0), 0xaabb);
+}
+
+TEST(MemoryTestSuite, CopyAndCompare){
+    Memory m;
+    m.write_type<uint32_t>(100, 31337);
+    Memory copy = m;
+    EXPECT_TRUE(copy == m);
+
+    copy.write_type<uint32_t>(100, 1);
+    EXPECT_EQ(m.read_type<uint32_t>(100), 31337);
+    EXPECT_TRUE(copy != m);
+
+    Memory zeroed;
+    zeroed.write_type<uint32_t>(1 << 30, 0);
+    EXPECT_TRUE(zeroed == Memory());
+}
+
+TEST(MemoryTestSuite, BulkCopy){
+    Memory m;
+    for(uint32_t i = 0; i < 3 * PageSize; i += 4) {
+        m.write_type<uint32_t>(PageSize - 6 + i, i);
+    }
+    m.copy(5 * PageSize + 1, PageSize - 6, 3 * PageSize);
+    for(uint32_t i = 0; i < 3 * PageSize; i += 4) {
+        ASSERT_EQ(m.read_type<uint32_t>(5 * PageSize + 1 + i), i);
+    }
+
+    /* overlapping both ways, like memmove */
+    m.copy(5 * PageSize + 3, 5 * PageSize + 1, 2 * PageSize);
+    EXPECT_EQ(m.read_type<uint32_t>(5 * PageSize + 3 + PageSize), PageSize);
+    m.copy(5 * PageSize + 1, 5 * PageSize + 3, 2 * PageSize);
+    EXPECT_EQ(m.read_type<uint32_t>(5 * PageSize + 1 + PageSize), PageSize);
+
+    /* never written pages are copied as zeros without allocating the destination */
+    size_t pages = m.pages();
+    m.copy(1 << 30, 1 << 20, 16 * PageSize);
+    EXPECT_EQ(m.pages(), pages);
+    m.copy(5 * PageSize + 1, 1 << 20, 8);
+    EXPECT_EQ(m.read_type<uint64_t>(5 * PageSize + 1), 0);
+}
+
+TEST(MemoryTestSuite, BulkCopySnapshot){
+    Memory m;
+    m.write_type<uint32_t>(0, 1);
+    m.write_type<uint32_t>(PageSize, 2);
+    auto snapshot = m.snapshot();
+    /* the source page gets copied when it is also the destination */
+    m.copy(4, 0, PageSize);
+    EXPECT_EQ(m.read_type<uint32_t>(0), 1);
+    EXPECT_EQ(m.read_type<uint32_t>(4), 1);
+    EXPECT_EQ(m.read_type<uint32_t>(PageSize), 0);
+    EXPECT_EQ(snapshot->get_page(0)[4], 0);
+    EXPECT_EQ(snapshot->get_page(PageSize)[0], 2);
+}
+
+TEST(MemoryTestSuite, BulkFillAndCompare){
+    Memory m;
+    m.fill(PageSize - 10, 0xab, 2 * PageSize);
+    EXPECT_EQ(m.read_type<uint8_t>(PageSize - 11), 0);
+    EXPECT_EQ(m.read_type<uint32_t>(PageSize - 10), 0xabababab);
+    EXPECT_EQ(m.read_type<uint8_t>(3 * PageSize - 11), 0xab);
+    EXPECT_EQ(m.read_type<uint8_t>(3 * PageSize - 10), 0);
+    EXPECT_EQ(m.size(), 3 * PageSize - 10);
+
+    size_t pages = m.pages();
+    m.fill(1 << 30, 0, 64 * PageSize);
+    EXPECT_EQ(m.pages(), pages);
+    EXPECT_EQ(m.size(), 3 * PageSize - 10);
+
+    m.fill(8 * PageSize + 7, 0xab, 2 * PageSize);
+    EXPECT_EQ(m.compare(PageSize - 10, 8 * PageSize + 7, 2 * PageSize), 0);
+    m.write_type<uint8_t>(9 * PageSize + 100, 0xac);
+    EXPECT_EQ(m.compare(PageSize - 10, 8 * PageSize + 7, 2 * PageSize), -1);
+    EXPECT_EQ(m.compare(8 * PageSize + 7, PageSize - 10, 2 * PageSize), 1);
+    EXPECT_EQ(m.compare(1 << 30, 1 << 20, 64 * PageSize), 0);
+    EXPECT_EQ(m.compare(0, PageSize - 10, 0), 0);
+}
+
+TEST(MemoryTestSuite, GetMemory){
+    Memory m;
+    m.write_type<uint16_t>(PageSize + 1, 0x0102);
+    auto bytes = m.get_memory();
+    EXPECT_EQ(bytes.size(), PageSize + 3);
+    EXPECT_EQ(bytes[0], 0);
+    EXPECT_EQ(bytes[PageSize + 1], 2);
+    EXPECT_EQ(bytes[PageSize + 2], 1);
+}
+
+TEST(MemoryTestSuite, Snapshot){
+    Memory m;
+    m.write_type<uint32_t>(0, 1);
+    m.write_type<uint32_t>(PageSize, 2);
+    m.write_type<uint32_t>(1 << 30, 3);
+    auto first = m.snapshot();
+    EXPECT_EQ(first->dirty_pages().size(), 3);
+
+    /* untouched pages stay shared, written ones are copied */
+    m.write_type<uint32_t>(PageSize + 4, 5);
+    m.write_type<uint32_t>(PageSize + 8, 6);
+    EXPECT_EQ(m.get_page(0), first->get_page(0));
+    EXPECT_NE(m.get_page(PageSize), first->get_page(PageSize));
+    EXPECT_EQ(first->get_page(PageSize)[4], 0);
+
+    auto second = m.snapshot();
+    EXPECT_EQ(second->dirty_pages(), std::vector<uint32_t>({PageSize}));
+    EXPECT_EQ(second->page_addresses(), std::vector<uint32_t>({0, PageSize, 1 << 30}));
+
+    m.write_type<uint32_t>(0, 7);
+    m.restore(*first);
+    EXPECT_EQ(m.read_type<uint32_t>(0), 1);
+    EXPECT_EQ(m.read_type<uint32_t>(PageSize + 4), 0);
+    m.write_type<uint32_t>(PageSize + 4, 8);
+    EXPECT_EQ(first->get_page(PageSize)[4], 0);
+    m.restore(*second);
+    EXPECT_EQ(m.read_type<uint32_t>(PageSize + 4), 5);
+    EXPECT_EQ(m.read_type<uint32_t>(PageSize + 8), 6);
+}
+
+TEST(MemoryTestSuite, SnapshotReleased){
+    Memory m;
+    m.write_type<uint32_t>(0, 1);
+    const uint8_t *page = m.get_page(0);
+    m.snapshot();
+    /* nothing references the snapshot anymore, the page is written in place */
+    m.write_type<uint32_t>(0, 2);
+    EXPECT_EQ(m.get_page(0), page);
+}
+
+TEST(MemoryTestSuite, ConcurrentWrites){
+    /* threads allocate pages of the same page tables and add to one word */
+    Memory m;
+    std::vector<std::thread> threads;
+    for(uint32_t t = 0; t < 4; t++) {
+        threads.emplace_back([&m, t]() {
+            for(uint32_t i = 0; i < 256; i++) {
+                m.write_type<uint32_t>((i * 4 + t) * PageSize, i);
+                m.atomic_fetch_add(1 << 30, 1);
+            }
+        });
+    }
+    for(auto &thread: threads) {
+        thread.join();
+    }
+    EXPECT_EQ(m.pages(), 4 * 256 + 1);
+    EXPECT_EQ(m.read_type<uint32_t>(1 << 30), 4 * 256);
+    EXPECT_EQ(m.read_type<uint32_t>((255 * 4 + 3) * PageSize), 255);
+    EXPECT_THROW(m.atomic_exchange(2, 0), std::runtime_error);
+}
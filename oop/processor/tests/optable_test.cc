@@ -0,0 +1,103 @@
+#include "gtest/gtest.h"
+#include "../proc.h"
+#include "../optable.h"
+
+TEST(OpcodeTableTestSuite, BuiltFromSpecs){
+    auto &table = *Processor::get_opcode_table();
+    ASSERT_EQ(table.opcodes.size(), OpcodeSpecCount + 1);
+    for(size_t i = 0; i < OpcodeSpecCount; i++) {
+        auto &opcode = table.opcodes.at(i);
+        EXPECT_EQ(opcode->get_name(), OpcodeSpecs[i].mnemonic);
+        ASSERT_EQ(opcode->get_args().size(), OpcodeSpecs[i].arg_count);
+        for(size_t j = 0; j < OpcodeSpecs[i].arg_count; j++) {
+            EXPECT_EQ(opcode->get_args()[j]->kind(), OpcodeSpecs[i].args[j]);
+        }
+        EXPECT_EQ(opcode->get_handler(), opcode_handler(i));
+    }
+    EXPECT_EQ(table.opcodes.at(ExitOpcodeNumber)->get_name(), "exit");
+
+    /* numbers are part of the image format */
+    EXPECT_EQ(table.lookup("add", 2), 0);
+    EXPECT_EQ(table.lookup("jnei", 3), 59);
+    EXPECT_EQ(table.lookup("add", 3), 60);
+    EXPECT_EQ(table.lookup("modi", 3), 79);
+}
+
+TEST(OpcodeTableTestSuite, HandlersMatchExecute){
+    auto &table = *Processor::get_opcode_table();
+    std::mt19937 random(1337);
+    size_t handled = 0;
+    for(size_t i = 0; i < OpcodeSpecCount; i++) {
+        InstructionHandler handler = opcode_handler(i);
+        if (handler == NULL) {
+            continue;
+        }
+        handled++;
+        for(int round = 0; round < 20; round++) {
+            Registers r;
+            Memory m;
+            for(uint8_t reg = 1; reg < 8; reg++) {
+                r.set(reg, 1 + random() % 1000);
+            }
+            for(uint32_t address = 64; address < 128; address += 4) {
+                m.write_type<uint32_t>(address, 1 + random() % 1000);
+            }
+
+            /* encode random operands, registers r1 to r7 and addresses into the initialized words */
+            m.write_type<uint8_t>(0, i);
+            size_t address = 1;
+            auto &args = table.opcodes.at(i)->get_args();
+            for(auto &arg: args) {
+                if (arg->kind() == ArgKind::Reg) {
+                    m.write_type<uint8_t>(address, 1 + random() % 7);
+                } else if (arg->kind() == ArgKind::Address) {
+                    m.write_type<uint32_t>(address, 64 + random() % 16 * 4);
+                } else {
+                    m.write_type<uint32_t>(address, 1 + random() % 40);
+                }
+                address += arg->len();
+            }
+            size_t length;
+            auto opcode = table.opcodes.at(i)->decode(m, 1, length);
+            uint32_t operands[3] = {};
+            for(size_t j = 0; j < args.size(); j++) {
+                operands[j] = opcode->get_args()[j]->get_raw_value();
+            }
+
+            Registers handled_r = r;
+            Memory handled_m = m;
+            Memory stack;
+            opcode->execute(r, m, stack);
+            handler(operands, handled_r, handled_m);
+            for(uint8_t reg = 0; reg < RegisterCount; reg++) {
+                EXPECT_EQ(handled_r.get(reg), r.get(reg)) << OpcodeSpecs[i].mnemonic << " r" << (int)reg;
+            }
+            for(uint32_t address = 64; address < 128; address += 4) {
+                EXPECT_EQ(handled_m.read_type<uint32_t>(address), m.read_type<uint32_t>(address)) << OpcodeSpecs[i].mnemonic;
+            }
+        }
+    }
+    EXPECT_EQ(handled, 57);
+}
+
+TEST(OpcodeTableTestSuite, Run){
+    Processor p;
+    p.compile({
+        "movi r1, 10",
+        "movi r2, 0",
+        "loop:",
+        "add r3, r2, r1",
+        "mov r2, r3",
+        "subi r1, 1",
+        "jgei loop, r1, 1",
+        "lshifti r2, 33",
+        "str data, r2",
+        "ldr r4, data",
+        "print r4",
+        "exit",
+        "data:4:",
+    });
+    testing::internal::CaptureStdout();
+    p.run();
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "110");
+}
@@ -0,0 +1,304 @@
+#include "gtest/gtest.h"
+#include "../proc.h"
+#include "../optimizer.h"
+
+/**
+ * Optimize the program and return the listing of the result.
+ * @param[in] program
+ */
+static std::vector<std::string> optimize(std::vector<std::string> program) {
+    Processor p;
+    auto lines = Optimizer(Processor::get_opcode_table()).optimize(p.parse(program));
+    std::vector<std::string> listing;
+    for(auto &line: lines) {
+        if (line.opcode != nullptr) {
+            listing.push_back(line.opcode->write_asm());
+        } else if (line.label_length != 0) {
+            listing.push_back(line.label + ":" + std::to_string(line.label_length) + ":");
+        } else {
+            listing.push_back(line.label + ":");
+        }
+    }
+    return listing;
+}
+
+/**
+ * Run the program with and without optimization, check that both print the same and end in the same registers.
+ * @param[in] program
+ * @param[out] executed - by the optimized run.
+ */
+static std::string run_optimized(std::vector<std::string> program, uint64_t &executed) {
+    std::string outputs[2];
+    Registers regs[2];
+    for(int optimized = 0; optimized < 2; optimized++) {
+        Processor p;
+        p.set_optimization(optimized);
+        p.compile(program);
+        testing::internal::CaptureStdout();
+        p.run();
+        outputs[optimized] = testing::internal::GetCapturedStdout();
+        regs[optimized] = p.get_regs();
+        executed = p.instructions_executed();
+    }
+    EXPECT_EQ(outputs[0], outputs[1]);
+    for(size_t i = 0; i < RIP; i++) {
+        EXPECT_EQ(regs[0].get(i), regs[1].get(i));
+    }
+    return outputs[1];
+}
+
+TEST(OptimizerTestSuite, FoldConstants){
+    EXPECT_EQ(optimize({
+                "movi r1, 5",
+                "addi r1, 3",
+                "mov r2, r1",
+                "muli r2, 2",
+                "add r3, r2",
+                "print r2",
+                "exit",
+                }), std::vector<std::string>({
+                "movi r1, 8",
+                "movi r2, 16",
+                "addi r3, 16",
+                "print r2",
+                "exit",
+                }));
+}
+
+TEST(OptimizerTestSuite, DeadStores){
+    EXPECT_EQ(optimize({
+                "read r1",
+                "movi r2, 1",
+                "mov r2, r1",
+                "mov r1, r1",
+                "addi r1, 0",
+                "exit",
+                }), std::vector<std::string>({
+                "read r1",
+                "mov r2, r1",
+                "exit",
+                }));
+}
+
+TEST(OptimizerTestSuite, KeepDivisions){
+    EXPECT_EQ(optimize({
+                "read r1",
+                "movi r2, 0",
+                "div r1, r2",
+                "movi r1, 1",
+                "exit",
+                }), std::vector<std::string>({
+                "read r1",
+                "movi r2, 0",
+                "divi r1, 0",
+                "movi r1, 1",
+                "exit",
+                }));
+}
+
+TEST(OptimizerTestSuite, FoldBranches){
+    EXPECT_EQ(optimize({
+                "movi r1, 0",
+                "jz skip, r1",
+                "movi r2, 7",
+                "print r2",
+                "skip:",
+                "jnz skip, r1",
+                "exit",
+                }), std::vector<std::string>({
+                "movi r1, 0",
+                "skip:",
+                "exit",
+                }));
+}
+
+TEST(OptimizerTestSuite, ThreeOperands){
+    EXPECT_EQ(optimize({
+                "movi r1, 3",
+                "add r2, r1, r1",
+                "jlti skip, r2, 5",
+                "print r2",
+                "skip:",
+                "read r3",
+                "sub r4, r3, r1",
+                "movi r4, 0",
+                "jlt skip, r3, r4",
+                "exit",
+                }), std::vector<std::string>({
+                "movi r1, 3",
+                "movi r2, 6",
+                "print r2",
+                "skip:",
+                "read r3",
+                "movi r4, 0",
+                "jlt skip, r3, r4",
+                "exit",
+                }));
+}
+
+TEST(OptimizerTestSuite, ThreadJumps){
+    EXPECT_EQ(optimize({
+                "read r1",
+                "jz first, r1",
+                "jmp second",
+                "first:",
+                "jmp third",
+                "second:",
+                "print r1",
+                "third:",
+                "jz fourth, r1",
+                "print r1",
+                "fourth:",
+                "jnz third, r1",
+                "printc r1",
+                "exit",
+                }), std::vector<std::string>({
+                "read r1",
+                "jz __opt0, r1",
+                "first:",
+                "second:",
+                "print r1",
+                "third:",
+                "jz __opt0, r1",
+                "__opt1:",
+                "print r1",
+                "fourth:",
+                "jnz __opt1, r1",
+                "__opt0:",
+                "printc r1",
+                "exit",
+                }));
+}
+
+TEST(OptimizerTestSuite, ThreadIntoNewLabels){
+    /* the second jz follows the first into the label made for it */
+    EXPECT_EQ(optimize({
+            "read r0",
+            "X:",
+            "jz A, r0",
+            "print r0",
+            "jz X, r0",
+            "exit",
+            "A:",
+            "jnz B, r0",
+            "print r0",
+            "exit",
+            "B:",
+            "exit",
+            }), std::vector<std::string>({
+            "read r0",
+            "X:",
+            "jz __opt0, r0",
+            "print r0",
+            "jz __opt0, r0",
+            "exit",
+            "A:",
+            "__opt0:",
+            "print r0",
+            "exit",
+            "B:",
+            }));
+}
+
+TEST(OptimizerTestSuite, KeepAddressedCode){
+    std::vector<std::vector<std::string>> programs = {
+        {"movi r1, 0", "jz 12, r1", "exit", "exit"},
+        {"ldr r0, 0", "print r0", "exit"},
+        {"movi r1, loop", "loop:", "print r1", "exit"},
+        {"movi r1, 0", "mov r31, r1"},
+        {"movi r1, 1", "movi r1, 2"},
+    };
+    for(auto &program: programs) {
+        EXPECT_EQ(optimize(program), program);
+    }
+}
+
+TEST(OptimizerTestSuite, KeepMissingRegisters){
+    std::vector<std::string> program = {"movi r40, 5", "addi r40, 1", "print r40", "exit"};
+    EXPECT_EQ(optimize(program), program);
+}
+
+TEST(OptimizerTestSuite, KeepComputedAddresses){
+    /* removing the addi would move buf away from the address fetchadd is given */
+    uint64_t executed;
+    EXPECT_EQ(run_optimized({
+                "movi r0, 0",
+                "addi r0, 0",
+                "movi r2, 7",
+                "str buf, r2",
+                "movi r1, 36",
+                "fetchadd r1, r2",
+                "print r2",
+                "exit",
+                "buf:4:",
+                }, executed), "7");
+    std::vector<std::vector<std::string>> programs = {
+        {"movi r0, 0", "addi r0, 0", "movi r1, 20", "movi r2, 4", "mset r1, r0, r2", "exit"},
+        {"movi r0, 0", "addi r0, 0", "movi r1, 20", "vld v0, r1", "exit"},
+    };
+    for(auto &program: programs) {
+        EXPECT_EQ(optimize(program), program);
+    }
+}
+
+TEST(OptimizerTestSuite, Data){
+    EXPECT_EQ(optimize({
+                "movi r1, 2",
+                "str counter, r1",
+                "ldr r2, counter",
+                "movi r2, 3",
+                "exit",
+                "counter:4:",
+                }), std::vector<std::string>({
+                "movi r1, 2",
+                "str counter, r1",
+                "movi r2, 3",
+                "exit",
+                "counter:4:",
+                }));
+}
+
+TEST(OptimizerTestSuite, Gcd){
+    uint64_t executed;
+    EXPECT_EQ(run_optimized({
+                "movi r0, 57827924",
+                "movi r1, 1038849",
+                "gcd:",
+                "jz fin, r1",
+                "mod r0, r1",
+                "mov r2, r0",
+                "mov r0, r1",
+                "mov r1, r2",
+                "jmp gcd",
+                "fin:",
+                "print r0",
+                "exit",
+                }, executed), "1337");
+}
+
+TEST(OptimizerTestSuite, Loop){
+    uint64_t executed;
+    std::vector<std::string> program = {
+        "movi r1, 10",
+        "movi r2, 4",
+        "movi r3, 0",
+        "mov r4, r2",
+        "muli r4, 3",
+        "loop:",
+        "add r3, r4",
+        "movi r5, 1",
+        "sub r1, r5",
+        "jz done, r1",
+        "jmp next",
+        "next:",
+        "jmp loop",
+        "done:",
+        "print r3",
+        "exit",
+    };
+    EXPECT_EQ(run_optimized(program, executed), "120");
+    Processor p;
+    p.compile(program);
+    p.run();
+    EXPECT_LT(executed, p.instructions_executed());
+}
@@ -0,0 +1,65 @@
+#include "gtest/gtest.h"
+#include "../proc.h"
+
+static std::vector<std::string> countdown = {
+    "movi r1, 5",
+    "loop:",
+    "subi r1, 1",
+    "jnz loop, r1",
+    "exit",
+};
+
+TEST(ProfileTestSuite, Counts){
+    Processor p;
+    p.compile(countdown);
+    Profile profile;
+    p.run_profiled(profile);
+
+    auto &by_name = Processor::get_opcode_table()->opcodes_by_name;
+    EXPECT_EQ(profile.get_total(), 12);
+    EXPECT_EQ(profile.get_total(), p.instructions_executed());
+    EXPECT_EQ(profile.get_opcode_count(by_name.at("subi")), 5);
+    EXPECT_EQ(profile.get_opcode_count(by_name.at("jnz")), 5);
+    EXPECT_EQ(profile.get_count(0), 1);
+    EXPECT_EQ(profile.get_count(6), 5);
+    EXPECT_EQ(profile.get_count(12), 5);
+    EXPECT_EQ(profile.get_taken(12), 4);
+    EXPECT_EQ(profile.get_count(18), 1);
+}
+
+TEST(ProfileTestSuite, Report){
+    Processor p;
+    p.compile(countdown);
+    Profile profile;
+    p.run_profiled(profile);
+
+    std::stringstream report, folded;
+    p.write_profile(profile, report, &folded);
+    std::string text = report.str();
+    EXPECT_NE(text.find("<loop> subi r1, 1"), std::string::npos);
+    EXPECT_NE(text.find("<loop+6> jnz 6, r1  [taken 4, not taken 1]"), std::string::npos);
+    /* hottest instructions come first */
+    EXPECT_LT(text.find("subi r1, 1"), text.find("movi r1, 5"));
+    EXPECT_NE(folded.str().find("loop;00000006_subi_r1,_1 5\n"), std::string::npos);
+    EXPECT_NE(folded.str().find("[unknown];00000000_movi_r1,_5 1\n"), std::string::npos);
+}
+
+TEST(ProfileTestSuite, FarCode){
+    /* only the executed pages are counted, not the gap */
+    Processor p;
+    p.compile({
+        "jmp far",
+        "pad:100000000:",
+        "far:",
+        "exit",
+    });
+    Profile profile;
+    p.run_profiled(profile);
+
+    EXPECT_EQ(profile.get_count(0), 1);
+    EXPECT_EQ(profile.get_count(100000005), 1);
+    EXPECT_EQ(profile.get_count(100000006), 0);
+    std::stringstream report, folded;
+    p.write_profile(profile, report, &folded);
+    EXPECT_NE(folded.str().find("far;05f5e105_exit 1\n"), std::string::npos);
+}
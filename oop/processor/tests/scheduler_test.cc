@@ -0,0 +1,116 @@
+#include "gtest/gtest.h"
+#include "../scheduler.h"
+
+static const std::vector<std::string> gcd = {
+    "movi r0, 57827924",
+    "movi r1, 1038849",
+    "gcd:",
+    "jz fin, r1",
+    "mod r0, r1",
+    "mov r2, r0",
+    "mov r0, r1",
+    "mov r1, r2",
+    "jmp gcd",
+    "fin:",
+    "print r0",
+    "exit",
+};
+
+/**
+ * Return a processor counting r1 down from n, adding r2 to r3 in every iteration.
+ * @param[in] n
+ */
+static std::unique_ptr<Processor> countdown(uint32_t n) {
+    auto p = std::unique_ptr<Processor>(new Processor());
+    p->compile({
+            "movi r1, " + std::to_string(n),
+            "movi r2, 3",
+            "loop:",
+            "add r3, r2",
+            "subi r1, 1",
+            "jnz loop, r1",
+            "exit",
+            });
+    return p;
+}
+
+TEST(SchedulerTestSuite, SuspendAndResume){
+    for(bool fusion: {false, true}) {
+        Processor whole;
+        whole.set_fusion(fusion);
+        whole.compile(gcd);
+        testing::internal::CaptureStdout();
+        whole.run();
+        EXPECT_EQ(testing::internal::GetCapturedStdout(), "1337");
+
+        Processor sliced;
+        sliced.set_fusion(fusion);
+        sliced.compile(gcd);
+        testing::internal::CaptureStdout();
+        size_t slices = 1;
+        while (!sliced.run_for(5)) {
+            EXPECT_TRUE(sliced.is_suspended());
+            slices++;
+        }
+        EXPECT_EQ(testing::internal::GetCapturedStdout(), "1337");
+        EXPECT_FALSE(sliced.is_suspended());
+        EXPECT_GT(slices, 5);
+        EXPECT_EQ(sliced.instructions_executed(), whole.instructions_executed());
+        EXPECT_EQ(sliced.get_regs().get(0), whole.get_regs().get(0));
+    }
+}
+
+TEST(SchedulerTestSuite, FuelStopsAtBlockEnd){
+    Processor p;
+    p.set_fusion(false);
+    p.compile({
+            "loop:",
+            "addi r1, 1",
+            "addi r2, 1",
+            "jmp loop",
+            });
+    EXPECT_FALSE(p.run_for(10));
+    /* blocks of 3 instructions, the tenth ends in the middle of the fourth block */
+    EXPECT_EQ(p.instructions_executed(), 12);
+    EXPECT_EQ(p.get_regs().get(1), 4);
+    EXPECT_EQ(p.get_regs().get(RIP), 0);
+    EXPECT_FALSE(p.run_for(1));
+    EXPECT_EQ(p.instructions_executed(), 15);
+}
+
+TEST(SchedulerTestSuite, RoundRobin){
+    Scheduler scheduler(3, 100);
+    for(uint32_t i = 0; i < 200; i++) {
+        scheduler.add(countdown(i + 1));
+    }
+    auto bad = std::unique_ptr<Processor>(new Processor());
+    bad->get_mem().write_type<uint8_t>(200, 254);
+    bad->compile({"jmp 200"});
+    size_t bad_job = scheduler.add(std::move(bad));
+
+    auto reports = scheduler.run();
+    ASSERT_EQ(reports.size(), 201);
+    for(uint32_t i = 0; i < 200; i++) {
+        EXPECT_TRUE(reports[i].ok);
+        EXPECT_EQ(reports[i].executed, 3 + 3 * (i + 1));
+        EXPECT_EQ(scheduler.get_processor(i).get_regs().get(3), 3 * (i + 1));
+        /* a slice overshoots its fuel by at most one iteration of 3 instructions */
+        EXPECT_LE(reports[i].slices, reports[i].executed / 100 + 1);
+        EXPECT_GE(reports[i].slices, reports[i].executed / 103);
+        EXPECT_GE(reports[i].wall_seconds, reports[i].run_seconds);
+    }
+    EXPECT_FALSE(reports[bad_job].ok);
+    EXPECT_EQ(reports[bad_job].error, "No such opcode 254.");
+}
+
+TEST(SchedulerTestSuite, Priority){
+    Scheduler scheduler(1, 100, SchedulingPolicy::Priority);
+    size_t low = scheduler.add(countdown(10000), 0);
+    size_t high = scheduler.add(countdown(10000), 5);
+    auto reports = scheduler.run();
+    ASSERT_TRUE(reports[low].ok);
+    ASSERT_TRUE(reports[high].ok);
+    /* the high priority job ran all its slices before the low priority one got any */
+    EXPECT_LT(reports[high].wall_seconds, reports[low].wall_seconds);
+    EXPECT_LE(reports[high].wall_seconds, reports[low].wall_seconds - reports[low].run_seconds);
+}
@@ -0,0 +1,129 @@
+#include "gtest/gtest.h"
+#include "../proc.h"
+
+/**
+ * Return the instructions storing the words at the address.
+ * @param[in] address
+ * @param[in] words
+ */
+static std::vector<std::string> store_words(uint32_t address, std::vector<uint32_t> words) {
+    std::vector<std::string> lines;
+    for(size_t i = 0; i < words.size(); i++) {
+        lines.push_back("movi r20, " + std::to_string(words[i]));
+        lines.push_back("str " + std::to_string(address + 4 * i) + ", r20");
+    }
+    return lines;
+}
+
+static std::vector<uint32_t> lanes(const Vector &v) {
+    return std::vector<uint32_t>(v.lanes, v.lanes + VectorLanes);
+}
+
+TEST(SimdTestSuite, Lanes){
+    auto program = store_words(4096, {1, 2, 3, 4});
+    auto more = store_words(4112, {10, 20, 30, 40});
+    program.insert(program.end(), more.begin(), more.end());
+    more = store_words(4128, {65536, 3, 0xffffffff, 7});
+    program.insert(program.end(), more.begin(), more.end());
+    more = {
+        "movi r1, 4096",
+        "movi r2, 4112",
+        "movi r3, 8192",
+        "vld v0, r1",
+        "vld v1, r2",
+        "vadd v0, v1",
+        "vst r3, v0",
+        "vsum r4, v0",
+        "vld v2, r2",
+        "vsub v2, v0",
+        "vld v3, r1",
+        "vmul v3, v1",
+        "vsum r5, v3",
+        "movi r6, 4128",
+        "vld v4, r6",
+        "vmul v4, v4",
+        "vld v5, r1",
+        "vshl v5, 4",
+        "vld v6, r1",
+        "vshl v6, 32",
+        "vld v7, r1",
+        "vand v7, v1",
+        "vld v1, r2",
+        "vxor v1, v0",
+        "exit",
+    };
+    program.insert(program.end(), more.begin(), more.end());
+
+    Processor p;
+    p.compile(program);
+    p.run();
+    auto &regs = p.get_regs();
+    EXPECT_EQ(lanes(regs.get_vector(0)), std::vector<uint32_t>({11, 22, 33, 44}));
+    EXPECT_EQ(p.get_mem().read_type<uint32_t>(8192 + 12), 44);
+    EXPECT_EQ(regs.get(4), 110);
+    EXPECT_EQ(lanes(regs.get_vector(2)), std::vector<uint32_t>({(uint32_t)-1, (uint32_t)-2, (uint32_t)-3, (uint32_t)-4}));
+    EXPECT_EQ(regs.get(5), 300);
+    EXPECT_EQ(lanes(regs.get_vector(4)), std::vector<uint32_t>({0, 9, 1, 49}));
+    EXPECT_EQ(lanes(regs.get_vector(5)), std::vector<uint32_t>({16, 32, 48, 64}));
+    EXPECT_EQ(lanes(regs.get_vector(6)), std::vector<uint32_t>({0, 0, 0, 0}));
+    EXPECT_EQ(lanes(regs.get_vector(7)), std::vector<uint32_t>({0, 0, 2, 0}));
+    EXPECT_EQ(lanes(regs.get_vector(1)), std::vector<uint32_t>({10 ^ 11, 20 ^ 22, 30 ^ 33, 40 ^ 44}));
+}
+
+TEST(SimdTestSuite, UnalignedAndCrossPage){
+    Processor p;
+    p.compile({
+            "movi r1, 4094",
+            "movi r2, 1",
+            "str 4094, r2",
+            "movi r2, 2",
+            "str 4098, r2",
+            "vld v0, r1",
+            "movi r3, 12285",
+            "vst r3, v0",
+            "exit",
+            });
+    p.run();
+    EXPECT_EQ(lanes(p.get_regs().get_vector(0)), std::vector<uint32_t>({1, 2, 0, 0}));
+    EXPECT_EQ(p.get_mem().read_type<uint32_t>(12289), 2);
+}
+
+TEST(SimdTestSuite, Errors){
+    Processor parse;
+    EXPECT_THROW(parse.compile({"vadd v0, r1", "exit"}), AsmException);
+
+    Processor missing;
+    missing.compile({"vadd v8, v0", "exit"});
+    EXPECT_THROW(missing.run(), std::runtime_error);
+}
+
+TEST(SimdTestSuite, Disassemble){
+    Processor p;
+    p.compile({"vshl v3, 5", "vsum r2, v3", "exit"});
+    InstructionCache icache(Processor::get_opcode_table()->opcodes);
+    auto &shift = icache.fetch(p.get_mem(), 0);
+    EXPECT_EQ(icache.opcode(0).write_asm(), "vshl v3, 5");
+    icache.fetch(p.get_mem(), shift.length);
+    EXPECT_EQ(icache.opcode(shift.length).write_asm(), "vsum r2, v3");
+}
+
+TEST(SimdTestSuite, SnapshotFile){
+    Processor p;
+    p.compile({
+            "movi r1, 7",
+            "str 4096, r1",
+            "movi r1, 4096",
+            "vld v2, r1",
+            "exit",
+            });
+    p.run();
+    std::string fname = testing::TempDir() + "simd.keks";
+    FILE *f = fopen(fname.c_str(), "wb");
+    p.write_snapshot(f, *p.snapshot(), false);
+    fclose(f);
+
+    Processor loaded;
+    loaded.load(fname.c_str());
+    EXPECT_EQ(lanes(loaded.get_regs().get_vector(2)), std::vector<uint32_t>({7, 0, 0, 0}));
+    unlink(fname.c_str());
+}
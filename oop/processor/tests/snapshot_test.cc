@@ -0,0 +1,124 @@
+#include "gtest/gtest.h"
+#include "../proc.h"
+#include <unistd.h>
+
+/**
+ * Return a processor whose program fills 16 pages, then counts r1 up to 1000 and prints it.
+ */
+static std::unique_ptr<Processor> warmup() {
+    auto p = std::unique_ptr<Processor>(new Processor());
+    p->set_fusion(false);
+    std::vector<std::string> program = {"movi r2, 7"};
+    for(uint32_t page = 1; page <= 16; page++) {
+        program.push_back("str " + std::to_string(page * PageSize) + ", r2");
+    }
+    program.insert(program.end(), {
+            "movi r1, 0",
+            "loop:",
+            "addi r1, 1",
+            "movi r3, 1000",
+            "sub r3, r1",
+            "jnz loop, r3",
+            "print r1",
+            "exit",
+            });
+    p->compile(program);
+    return p;
+}
+
+TEST(SnapshotTestSuite, RestoreAndFork){
+    auto p = warmup();
+    /* stop inside the loop */
+    EXPECT_FALSE(p->run_for(100));
+    auto warm = p->snapshot();
+    auto child = p->fork();
+    uint32_t r1 = p->get_regs().get(1);
+
+    testing::internal::CaptureStdout();
+    p->run();
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "1000");
+    uint64_t executed = p->instructions_executed();
+
+    p->restore(*warm);
+    EXPECT_EQ(p->get_regs().get(1), r1);
+    EXPECT_EQ(p->get_mem().read_type<uint32_t>(16 * PageSize), 7);
+    testing::internal::CaptureStdout();
+    p->run();
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "1000");
+    EXPECT_EQ(p->instructions_executed(), executed);
+
+    child->get_mem().write_type<uint32_t>(PageSize, 9);
+    EXPECT_EQ(p->get_mem().read_type<uint32_t>(PageSize), 7);
+    testing::internal::CaptureStdout();
+    child->run();
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "1000");
+    EXPECT_EQ(child->instructions_executed(), executed);
+}
+
+TEST(SnapshotTestSuite, IncrementalFiles){
+    auto p = warmup();
+    EXPECT_FALSE(p->run_for(20));
+    std::string base = testing::TempDir() + "base.keks";
+    std::string delta = testing::TempDir() + "delta.keks";
+
+    FILE *f = fopen(base.c_str(), "wb");
+    p->write_snapshot(f, *p->snapshot(), false);
+    fclose(f);
+    p->get_mem().write_type<uint32_t>(3 * PageSize, 11);
+    EXPECT_FALSE(p->run_for(100));
+    auto second = p->snapshot();
+    EXPECT_EQ(second->mem->dirty_pages(), std::vector<uint32_t>({3 * PageSize}));
+    f = fopen(delta.c_str(), "wb");
+    p->write_snapshot(f, *second, true);
+    long delta_size = ftell(f);
+    fclose(f);
+    EXPECT_LT(delta_size, 2 * PageSize);
+
+    Processor loaded;
+    loaded.load(base.c_str());
+    EXPECT_EQ(loaded.get_mem().read_type<uint32_t>(16 * PageSize), 7);
+    EXPECT_EQ(loaded.get_mem().read_type<uint32_t>(3 * PageSize), 7);
+    loaded.load_snapshot(delta.c_str());
+    EXPECT_EQ(loaded.get_mem().read_type<uint32_t>(3 * PageSize), 11);
+    EXPECT_EQ(loaded.get_regs().get(1), p->get_regs().get(1));
+    EXPECT_EQ(loaded.instructions_executed(), p->instructions_executed());
+    EXPECT_TRUE(loaded.is_suspended());
+    testing::internal::CaptureStdout();
+    loaded.run();
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "1000");
+    unlink(base.c_str());
+    unlink(delta.c_str());
+}
+
+TEST(SnapshotTestSuite, ResumeOnEveryEngine){
+    Processor p;
+    p.compile({
+            "movi r0, 57827924",
+            "movi r1, 1038849",
+            "gcd:",
+            "jz fin, r1",
+            "mod r0, r1",
+            "mov r2, r0",
+            "mov r0, r1",
+            "mov r1, r2",
+            "jmp gcd",
+            "fin:",
+            "print r0",
+            "exit",
+            });
+    EXPECT_FALSE(p.run_for(10));
+    auto suspended = p.snapshot();
+    std::vector<std::function<void()>> engines = {
+        [&] { p.run(); },
+        [&] { p.run_threaded(); },
+        [&] { p.run_jit(); },
+        [&] { p.run_differential(); },
+    };
+    for(auto &run: engines) {
+        p.restore(*suspended);
+        testing::internal::CaptureStdout();
+        run();
+        std::cout.flush();
+        EXPECT_EQ(testing::internal::GetCapturedStdout(), "1337");
+    }
+}
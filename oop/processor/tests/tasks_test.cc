@@ -0,0 +1,131 @@
+#include "gtest/gtest.h"
+#include "../proc.h"
+#include <unistd.h>
+
+TEST(TasksTestSuite, Interleave){
+    Processor p;
+    p.compile({
+            "go worker",
+            "movi r1, 3",
+            "movi r2, 97",
+            "main_loop:",
+            "printc r2",
+            "yield",
+            "subi r1, 1",
+            "jnz main_loop, r1",
+            "exit",
+            "worker:",
+            "movi r1, 3",
+            "movi r2, 98",
+            "worker_loop:",
+            "printc r2",
+            "yield",
+            "subi r1, 1",
+            "jnz worker_loop, r1",
+            "exit",
+            });
+    testing::internal::CaptureStdout();
+    p.run();
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "ababab");
+    EXPECT_EQ(p.task_count(), 0);
+}
+
+TEST(TasksTestSuite, YieldAlone){
+    Processor p;
+    p.compile({
+            "movi r1, 5",
+            "yield",
+            "addi r1, 1",
+            "exit",
+            });
+    p.run();
+    EXPECT_EQ(p.get_regs().get(1), 6);
+    EXPECT_EQ(p.task_count(), 0);
+}
+
+TEST(TasksTestSuite, ExitWaits){
+    Processor p;
+    p.compile({
+            "movi r1, 7",
+            "go worker",
+            "exit",
+            "worker:",
+            "str 4096, r1",
+            "exit",
+            });
+    p.run();
+    EXPECT_EQ(p.get_mem().read_type<uint32_t>(4096), 7);
+}
+
+TEST(TasksTestSuite, ManyTasks){
+    /* every task increments the word twice, yielding in between, no update is lost */
+    Processor p;
+    p.compile({
+            "movi r1, 1000",
+            "spawn_loop:",
+            "go worker",
+            "subi r1, 1",
+            "jnz spawn_loop, r1",
+            "exit",
+            "worker:",
+            "ldr r5, 4096",
+            "addi r5, 1",
+            "str 4096, r5",
+            "yield",
+            "ldr r5, 4096",
+            "addi r5, 1",
+            "str 4096, r5",
+            "exit",
+            });
+    p.run();
+    EXPECT_EQ(p.get_mem().read_type<uint32_t>(4096), 2000);
+    EXPECT_EQ(p.task_count(), 0);
+}
+
+TEST(TasksTestSuite, ParkOnInput){
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    FILE *in = fdopen(fds[0], "r");
+    ASSERT_NE(in, nullptr);
+
+    /* the printer spins until the reader stored the number */
+    Processor p;
+    p.compile({
+            "go printer",
+            "read r1",
+            "str 4096, r1",
+            "exit",
+            "printer:",
+            "ldr r2, 4096",
+            "jnz done, r2",
+            "yield",
+            "jmp printer",
+            "done:",
+            "print r2",
+            "exit",
+            });
+    p.get_io().bind_input(in);
+    testing::internal::CaptureStdout();
+    EXPECT_FALSE(p.run_for(1000));
+    EXPECT_TRUE(p.is_suspended());
+    EXPECT_EQ(p.task_count(), 2);
+    EXPECT_THROW(p.snapshot(), std::logic_error);
+
+    ASSERT_EQ(write(fds[1], "42\n", 3), 3);
+    close(fds[1]);
+    p.run();
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "42");
+    EXPECT_EQ(p.task_count(), 0);
+    fclose(in);
+}
+
+TEST(TasksTestSuite, NeedsInterpreter){
+    Processor p;
+    p.compile({
+            "go worker",
+            "exit",
+            "worker:",
+            "exit",
+            });
+    EXPECT_THROW(p.run_threaded(), std::logic_error);
+}
@@ -0,0 +1,139 @@
+#include "gtest/gtest.h"
+#include "../proc.h"
+
+/**
+ * Run the program with both engines and check that they print the same and execute the same number of instructions.
+ * @param[in] program
+ * @param[out] output
+ */
+static std::string run_both(std::vector<std::string> program) {
+    Processor interp;
+    interp.compile(program);
+    testing::internal::CaptureStdout();
+    interp.run();
+    std::cout.flush();
+    std::string interp_out = testing::internal::GetCapturedStdout();
+
+    Processor threaded;
+    threaded.compile(program);
+    testing::internal::CaptureStdout();
+    threaded.run_threaded();
+    std::cout.flush();
+    std::string threaded_out = testing::internal::GetCapturedStdout();
+
+    EXPECT_EQ(interp_out, threaded_out);
+    EXPECT_EQ(interp.instructions_executed(), threaded.instructions_executed());
+    return threaded_out;
+}
+
+TEST(ThreadedEngineTestSuite, Gcd){
+    EXPECT_EQ(run_both({
+            "movi r0, 57827924",
+            "movi r1, 1038849",
+            "gcd:",
+            "jz fin, r1",
+            "mod r0, r1",
+            "mov r2, r0",
+            "mov r0, r1",
+            "mov r1, r2",
+            "jmp gcd",
+            "fin:",
+            "print r0",
+            "exit",
+            }), "1337");
+}
+
+TEST(ThreadedEngineTestSuite, Arithmetic){
+    EXPECT_EQ(run_both({
+            "movi r0, 100",
+            "movi r1, 7",
+            "sub r0, r1",
+            "print r0",
+            "subi r0, 3",
+            "muli r0, 3",
+            "print r0",
+            "xori r0, 5",
+            "lshifti r0, 2",
+            "print r0",
+            "neg r1",
+            "print r1",
+            "bitflip r1",
+            "print r1",
+            "movi r2, 104",
+            "printc r2",
+            "exit",
+            }), "93270106842949672896h");
+}
+
+TEST(ThreadedEngineTestSuite, ThreeOperandsAndBranches){
+    EXPECT_EQ(run_both({
+            "movi r1, 0",
+            "movi r2, 5",
+            "loop:",
+            "add r1, r1, r2",
+            "subi r2, r2, 1",
+            "jgei loop, r2, 1",
+            "print r1",
+            "movi r4, 2",
+            "sub r5, r4, r2",
+            "jlt done, r5, r4",
+            "print r5",
+            "jne done, r5, r4",
+            "print r4",
+            "jeq done, r5, r4",
+            "print r1",
+            "done:",
+            "exit",
+            }), "1522");
+}
+
+TEST(ThreadedEngineTestSuite, Memory){
+    EXPECT_EQ(run_both({
+            "movi r0, 31337",
+            "str data, r0",
+            "ldr r1, data",
+            "print r1",
+            "exit",
+            "data:4:",
+            }), "31337");
+}
+
+TEST(ThreadedEngineTestSuite, Rip){
+    /* opcodes using rip fall back to the generic handler */
+    EXPECT_EQ(run_both({
+            "mov r0, rip",
+            "print r0",
+            "movi r1, 15",
+            "mov rip, r1",
+            "exit",
+            "movi r2, 5",
+            "print r2",
+            "exit",
+            }), "35");
+}
+
+TEST(ThreadedEngineTestSuite, SelfModifyingCode){
+    EXPECT_EQ(run_both({
+            "movi r1, 458765",
+            "movi r2, 4294967294",
+            "target:",
+            "movi r0, 1",
+            "print r0",
+            "str target, r1",
+            "addi r2, 1",
+            "jnz target, r2",
+            "exit",
+            }), "17");
+}
+
+TEST(ThreadedEngineTestSuite, FarCode){
+    /* translations are only allocated for the pages around the code, not for the gap */
+    EXPECT_EQ(run_both({
+            "movi r1, 7",
+            "jmp far",
+            "pad:10000000:",
+            "far:",
+            "print r1",
+            "exit",
+            }), "7");
+}
@@ -0,0 +1,174 @@
+#include "gtest/gtest.h"
+#include "../proc.h"
+#include "../error.h"
+
+/**
+ * Run the program with the interpreter, the threaded engine and the JIT in lockstep with the interpreter,
+ * check that all print the same and return it.
+ * @param[in] program
+ */
+static std::string run_engines(std::vector<std::string> program) {
+    std::string outputs[3];
+    for(int engine = 0; engine < 3; engine++) {
+        Processor p;
+        p.compile(program);
+        testing::internal::CaptureStdout();
+        switch (engine) {
+            case 0:
+                p.run();
+                break;
+            case 1:
+                p.run_threaded();
+                break;
+            case 2:
+                EXPECT_NO_THROW(p.run_differential());
+                break;
+        }
+        std::cout.flush();
+        outputs[engine] = testing::internal::GetCapturedStdout();
+    }
+    EXPECT_EQ(outputs[0], outputs[1]);
+    EXPECT_EQ(outputs[0], outputs[2]);
+    return outputs[0];
+}
+
+TEST(ThreeOperandTestSuite, Arithmetic){
+    Processor p;
+    p.compile({
+            "movi r0, 100",
+            "movi r1, 7",
+            "add r2, r0, r1",
+            "sub r3, r0, r1",
+            "mul r4, r0, r1",
+            "div r5, r0, r1",
+            "mod r6, r0, r1",
+            "addi r7, r0, 5",
+            "lshifti r8, r1, 4",
+            "sub r0, r0, r0",
+            "exit",
+            });
+    p.run();
+    auto &regs = p.get_regs();
+    EXPECT_EQ(regs.get(1), 7);
+    EXPECT_EQ(regs.get(2), 107);
+    EXPECT_EQ(regs.get(3), 93);
+    EXPECT_EQ(regs.get(4), 700);
+    EXPECT_EQ(regs.get(5), 14);
+    EXPECT_EQ(regs.get(6), 2);
+    EXPECT_EQ(regs.get(7), 105);
+    EXPECT_EQ(regs.get(8), 112);
+    EXPECT_EQ(regs.get(0), 0);
+}
+
+TEST(ThreeOperandTestSuite, Assemble){
+    /* the operand count selects the form of a mnemonic */
+    Processor p;
+    p.compile({"add r2, r0, r1", "add r2, r0", "jlti 0, r1, -3", "exit"});
+    InstructionCache icache(Processor::get_opcode_table()->opcodes);
+    size_t pc = 0;
+    std::vector<std::string> listing;
+    for(int i = 0; i < 3; i++) {
+        auto &instr = icache.fetch(p.get_mem(), pc);
+        listing.push_back(icache.opcode(pc).write_asm());
+        pc += instr.length;
+    }
+    EXPECT_EQ(listing, std::vector<std::string>({"add r2, r0, r1", "add r2, r0", "jlti 0, r1, 4294967293"}));
+
+    EXPECT_THROW(p.compile({"mov r2, r0, r1", "exit"}), AsmException);
+    EXPECT_THROW(p.compile({"jeq 0, r1", "exit"}), AsmException);
+    /* memory opcodes have no three operand form */
+    EXPECT_THROW(p.compile({"ldr r0, r1, 100", "exit"}), AsmException);
+    EXPECT_THROW(p.compile({"str r0, 100, r1", "exit"}), AsmException);
+}
+
+TEST(ThreeOperandTestSuite, CompareAndBranch){
+    /* print which of the branches are taken for pairs around zero, lt and ge compare signed */
+    std::vector<std::string> program = {
+        "movi r0, -2",
+        "outer:",
+        "movi r1, -2",
+        "inner:",
+        "movi r2, 0",
+        "jlt lt, r0, r1",
+        "ori r2, 1",
+        "lt:",
+        "jge ge, r0, r1",
+        "ori r2, 2",
+        "ge:",
+        "jeq eq, r0, r1",
+        "ori r2, 4",
+        "eq:",
+        "jne ne, r0, r1",
+        "ori r2, 8",
+        "ne:",
+        "print r2",
+        "addi r1, 1",
+        "jlti inner, r1, 3",
+        "addi r0, 1",
+        "jnei outer, r0, 3",
+        "exit",
+    };
+    std::string expected;
+    for(int a = -2; a < 3; a++) {
+        for(int b = -2; b < 3; b++) {
+            expected += std::to_string((a < b ? 0 : 1) | (a >= b ? 0 : 2) | (a == b ? 0 : 4) | (a != b ? 0 : 8));
+        }
+    }
+    EXPECT_EQ(run_engines(program), expected);
+}
+
+TEST(ThreeOperandTestSuite, ImmediateBranches){
+    EXPECT_EQ(run_engines({
+                "movi r1, 10",
+                "jgei big, r1, 10",
+                "printc r1",
+                "big:",
+                "jeqi ten, r1, 10",
+                "printc r1",
+                "ten:",
+                "movi r2, 0",
+                "count:",
+                "addi r2, 1",
+                "jlti count, r2, 5",
+                "print r2",
+                "exit",
+                }), "5");
+}
+
+TEST(ThreeOperandTestSuite, FewerInstructions){
+    /* the sum of 0..99 with a counter compared against a limit instead of a separate down counter */
+    std::vector<std::string> two_operand = {
+        "movi r0, 0",
+        "movi r1, 0",
+        "movi r2, 100",
+        "loop:",
+        "add r0, r1",
+        "addi r1, 1",
+        "subi r2, 1",
+        "jnz loop, r2",
+        "print r0",
+        "exit",
+    };
+    std::vector<std::string> three_operand = {
+        "movi r0, 0",
+        "movi r1, 0",
+        "loop:",
+        "add r0, r0, r1",
+        "addi r1, r1, 1",
+        "jlti loop, r1, 100",
+        "print r0",
+        "exit",
+    };
+    uint64_t executed[2];
+    int i = 0;
+    for(auto &program: {two_operand, three_operand}) {
+        EXPECT_EQ(run_engines(program), "4950");
+        Processor p;
+        p.compile(program);
+        testing::internal::CaptureStdout();
+        p.run();
+        testing::internal::GetCapturedStdout();
+        executed[i++] = p.instructions_executed();
+    }
+    EXPECT_LT(executed[1], executed[0]);
+}
@@ -0,0 +1,120 @@
+#include "gtest/gtest.h"
+#include "../proc.h"
+#include "../trace.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+static TraceRecord make_record(uint32_t rip) {
+    TraceRecord record = {};
+    record.rip = rip;
+    record.reg = TraceNoRegister;
+    return record;
+}
+
+TEST(TraceTestSuite, Ring){
+    TraceBuffer trace(3);
+    EXPECT_EQ(trace.get_capacity(), 3);
+    EXPECT_TRUE(trace.get_records().empty());
+    for(uint32_t rip = 0; rip < 6; rip++) {
+        trace.next() = make_record(rip);
+        trace.commit();
+    }
+    /* a record which is not committed is not kept, nor does it overwrite a kept one */
+    trace.next() = make_record(100);
+
+    EXPECT_EQ(trace.get_total(), 6);
+    auto records = trace.get_records();
+    ASSERT_EQ(records.size(), 3);
+    for(uint32_t i = 0; i < 3; i++) {
+        EXPECT_EQ(records[i].rip, i + 3);
+    }
+}
+
+TEST(TraceTestSuite, Run){
+    Processor p;
+    p.compile({
+        "movi r1, 2",
+        "loop:",
+        "str data, r1",
+        "subi r1, 1",
+        "jnz loop, r1",
+        "movi r2, data",
+        "fetchadd r2, r1",
+        "exit",
+        "align:2:",
+        "data:4:",
+    });
+    TraceBuffer trace(64);
+    p.run_traced(trace);
+    auto records = trace.get_records();
+    ASSERT_EQ(records.size(), 10);
+    EXPECT_EQ(trace.get_total(), p.instructions_executed());
+
+    uint32_t data = p.get_mem().resolve_label("data");
+    auto &table = *Processor::get_opcode_table();
+    EXPECT_EQ(records[0].rip, 0);
+    EXPECT_EQ(records[0].opcode_no, table.lookup("movi", 2));
+    EXPECT_EQ(records[0].reg, 1);
+    EXPECT_EQ(records[0].value, 2);
+    EXPECT_FALSE(records[0].flags & TraceTouchedMemory);
+
+    EXPECT_EQ(records[1].reg, TraceNoRegister);
+    EXPECT_TRUE(records[1].flags & TraceTouchedMemory);
+    EXPECT_EQ(records[1].address, data);
+    EXPECT_EQ(records[2].reg, 1);
+    EXPECT_EQ(records[2].value, 1);
+    EXPECT_EQ(records[4].rip, records[1].rip);
+
+    /* fetchadd returns the previous value in its second register, the address comes from the first */
+    EXPECT_EQ(records[8].opcode_no, table.lookup("fetchadd", 2));
+    EXPECT_EQ(records[8].reg, 1);
+    EXPECT_EQ(records[8].value, 1);
+    EXPECT_EQ(records[8].address, data);
+}
+
+TEST(TraceTestSuite, DumpAndView){
+    Processor p;
+    p.compile({
+        "movi r1, 3",
+        "loop:",
+        "subi r1, 1",
+        "add r2, r1",
+        "jnz loop, r1",
+        "exit",
+    });
+    TraceBuffer trace(3);
+    p.run_traced(trace);
+
+    std::string fname = testing::TempDir() + "trace.kekt";
+    int fd = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(fd, 0);
+    EXPECT_TRUE(trace.dump(fd));
+    close(fd);
+
+    uint64_t total;
+    auto records = read_trace(fname.c_str(), total);
+    EXPECT_EQ(total, 11);
+    ASSERT_EQ(records.size(), 3);
+    EXPECT_EQ(records.back().rip, trace.get_records().back().rip);
+
+    auto &table = *Processor::get_opcode_table();
+    std::stringstream all;
+    write_trace(all, records, table, TraceFilter());
+    EXPECT_EQ(all.str(), "12: add r2, r1  r2 = 3\n15: jnz 6, r1\n21: exit\n");
+
+    TraceFilter range;
+    range.from = 7;
+    range.to = 15;
+    std::stringstream ranged;
+    write_trace(ranged, records, table, range);
+    EXPECT_EQ(ranged.str(), "12: add r2, r1  r2 = 3\n15: jnz 6, r1\n");
+
+    TraceFilter reg;
+    reg.reg = 2;
+    std::stringstream written;
+    write_trace(written, records, table, reg);
+    EXPECT_EQ(written.str(), "12: add r2, r1  r2 = 3\n");
+
+    std::ofstream(fname) << "KEKI";
+    EXPECT_THROW(read_trace(fname.c_str(), total), std::runtime_error);
+}
@@ -0,0 +1,8 @@
+#include "gtest/gtest.h"
+#include "../util.h"
+
+TEST(UtilTestSuite, StringSplit){
+    EXPECT_EQ(string_split("data:16:", ":"), std::vector<std::string>({"data", "16", ""}));
+    EXPECT_EQ(string_split("a, bc, def", ", "), std::vector<std::string>({"a", "bc", "def"}));
+    EXPECT_EQ(string_split("label", ":"), std::vector<std::string>({"label"}));
+}
@@ -0,0 +1,345 @@
+#include "threaded.h"
+#include "ops.h"
+#include "optable.h"
+
+enum Handler : uint8_t {
+    H_TRANSLATE,
+    H_GENERIC,
+#define X(name, mnemonic, expr) H_##name##_RR, H_##name##_RI, H_##name##_RRR, H_##name##_RRI,
+    BINARY_OPERATIONS(X)
+#undef X
+    H_LDR,
+    H_STR,
+#define X(name, mnemonic, expr) H_##name,
+    UNARY_OPERATIONS(X)
+#undef X
+    H_PRINTC,
+    H_PRINT,
+    H_READC,
+    H_READ,
+    /* the second operand of the condition is a register or a constant, missing ones are the constant 0 */
+#define X(name, expr) H_##name##_JR, H_##name##_JI,
+    JUMP_CONDITIONS(X)
+#undef X
+    H_EXIT,
+};
+
+/**
+ * Return the specialized handler of an opcode of the instruction set, H_GENERIC if it has none.
+ * @param[in] spec
+ */
+static constexpr Handler spec_handler(const OpcodeSpec &spec) {
+    bool immediate = spec.arg_count > 0 && spec.args[spec.arg_count - 1] == ArgKind::Int;
+    if (spec.width != 4) {
+        return H_GENERIC;
+    }
+    switch (spec.family) {
+        case OpcodeFamily::Binary:
+            if (spec.args[0] == ArgKind::Address || spec.args[1] == ArgKind::Address) {
+                if ((BinaryOperation)spec.operation != BinaryOperation::Mov) {
+                    return H_GENERIC;
+                }
+                return spec.args[0] == ArgKind::Address ? H_STR : H_LDR;
+            }
+            switch ((BinaryOperation)spec.operation) {
+#define X(name, mnemonic, expr) case BinaryOperation::name: return immediate ? H_##name##_RI : H_##name##_RR;
+                BINARY_OPERATIONS(X)
+#undef X
+            }
+            break;
+        case OpcodeFamily::ThreeOperand:
+            switch ((BinaryOperation)spec.operation) {
+#define X(name, mnemonic, expr) case BinaryOperation::name: return immediate ? H_##name##_RRI : H_##name##_RRR;
+                BINARY_OPERATIONS(X)
+#undef X
+            }
+            break;
+        case OpcodeFamily::Unary:
+            switch ((UnaryOperation)spec.operation) {
+#define X(name, mnemonic, expr) case UnaryOperation::name: return H_##name;
+                UNARY_OPERATIONS(X)
+#undef X
+            }
+            break;
+        case OpcodeFamily::Io:
+            switch ((IoOperation)spec.operation) {
+                case IoOperation::PrintChar:
+                    return H_PRINTC;
+                case IoOperation::Print:
+                    return H_PRINT;
+                case IoOperation::ReadChar:
+                    return H_READC;
+                case IoOperation::Read:
+                    return H_READ;
+            }
+            break;
+        case OpcodeFamily::Jump:
+            switch ((JumpCondition)spec.operation) {
+#define X(name, expr) case JumpCondition::name: return spec.arg_count == 3 && !immediate ? H_##name##_JR : H_##name##_JI;
+                JUMP_CONDITIONS(X)
+#undef X
+            }
+            break;
+        default:
+            break;
+    }
+    return H_GENERIC;
+}
+
+/**
+ * Return the handlers of all opcode numbers.
+ */
+static constexpr std::array<Handler, 256> make_spec_handlers() {
+    std::array<Handler, 256> handlers {};
+    for(size_t i = 0; i < handlers.size(); i++) {
+        handlers[i] = i < OpcodeSpecCount ? spec_handler(OpcodeSpecs[i]) : H_GENERIC;
+    }
+    handlers[ExitOpcodeNumber] = H_EXIT;
+    return handlers;
+}
+
+static constexpr std::array<Handler, 256> SpecHandlers = make_spec_handlers();
+
+/**
+ * Pick the specialized handler for a decoded opcode and extract its operands.
+ * Opcodes touching rip or invalid registers get the generic handler, which keeps rip in the register file.
+ * @param[in] number - of the opcode.
+ * @param[in] opcode
+ * @param[out] operands - raw values of the first three operands.
+ */
+static Handler select_handler(uint8_t number, const Opcode &opcode, uint32_t operands[3]) {
+    Handler handler = SpecHandlers[number];
+    if (handler == H_GENERIC) {
+        return H_GENERIC;
+    }
+    auto &args = opcode.get_args();
+    for(size_t i = 0; i < args.size(); i++) {
+        if (args[i]->kind() == ArgKind::Reg && (args[i]->get_raw_value() >= RegisterCount || args[i]->get_raw_value() == RIP)) {
+            return H_GENERIC;
+        }
+        if (i < 3) {
+            operands[i] = args[i]->get_raw_value();
+        }
+    }
+    return handler;
+}
+
+/**
+ * ThreadedEngine constructor
+ * @param[in] regs
+ * @param[in] mem
+ * @param[in] stack
+ * @param[in] icache - used to decode instructions before translating them.
+ * @param[in] io - guest input and output.
+ */
+ThreadedEngine::ThreadedEngine(Registers &regs, Memory &mem, Memory &stack, InstructionCache &icache, GuestIO &io)
+    : regs {regs}
+    , mem {mem}
+    , stack {stack}
+    , icache {icache}
+    , io {io}
+{
+    mem.add_observer(this);
+}
+
+ThreadedEngine::~ThreadedEngine() {
+    mem.remove_observer(this);
+}
+
+/**
+ * Return the translations of the page holding the address, allocating the page with all of them untranslated.
+ * @param[in] address
+ */
+ThreadedInstruction *ThreadedEngine::page_code(uint32_t address) {
+    Page *page = pages.find(address);
+    if (page == nullptr) {
+        page = &pages.touch(address);
+        for(auto &instr: page->code) {
+            instr.handler = untranslated;
+        }
+    }
+    return page->code;
+}
+
+/**
+ * Drop the translation of every instruction overlapping the written range.
+ * @param[in] address
+ * @param[in] length
+ */
+void ThreadedEngine::memory_written(size_t address, size_t length) {
+    size_t start = address >= max_instruction_length ? address - max_instruction_length + 1 : 0;
+    size_t end = std::min(address + length, (size_t)1 << 32);
+    for(size_t i = start; i < end; i = (i | (PageSize - 1)) + 1) {
+        Page *page = pages.find(i);
+        if (page == nullptr) {
+            continue;
+        }
+        size_t page_end = std::min(end, (i | (PageSize - 1)) + 1);
+        for(size_t j = i; j < page_end; j++) {
+            page->code[j & (PageSize - 1)].handler = untranslated;
+        }
+    }
+}
+
+/**
+ * Run from the current rip until an exit opcode.
+ * @param[out] executed - number of executed instructions.
+ */
+uint64_t ThreadedEngine::run() {
+    static const void *const labels[] = {
+        &&translate,
+        &&generic,
+#define X(name, mnemonic, expr) &&name##_rr, &&name##_ri, &&name##_rrr, &&name##_rri,
+        BINARY_OPERATIONS(X)
+#undef X
+        &&ldr,
+        &&str,
+#define X(name, mnemonic, expr) &&name,
+        UNARY_OPERATIONS(X)
+#undef X
+        &&printc,
+        &&print,
+        &&readc,
+        &&read,
+#define X(name, expr) &&name##_jr, &&name##_ji,
+        JUMP_CONDITIONS(X)
+#undef X
+        &&exit,
+    };
+
+    uint32_t *r = regs.data();
+    uint64_t executed = 0;
+    size_t pc = r[RIP];
+    ThreadedInstruction *ip;
+    /* translations of the page pc was last in, pages don't move until the next run */
+    size_t page = SIZE_MAX;
+    ThreadedInstruction *code = nullptr;
+
+    untranslated = &&translate;
+    pages.clear();
+
+#define DISPATCH() do { \
+        if ((pc >> PageBits) != page) { page = pc >> PageBits; code = page_code(pc); } \
+        ip = &code[pc & (PageSize - 1)]; \
+        goto *ip->handler; \
+    } while (0)
+#define NEXT() do { executed++; pc = ip->next; DISPATCH(); } while (0)
+
+    DISPATCH();
+
+translate:
+    {
+        const DecodedInstruction &instr = icache.fetch(mem, pc);
+        uint32_t operands[3] = {};
+        const std::shared_ptr<const Opcode> &opcode = icache.objects(pc).opcode;
+        ip->handler = labels[select_handler(instr.opcode_no, *opcode, operands)];
+        ip->a = operands[0];
+        ip->b = operands[1];
+        ip->c = operands[2];
+        ip->next = pc + instr.length;
+        ip->opcode = opcode;
+        max_instruction_length = std::max(max_instruction_length, (size_t)instr.length);
+        goto *ip->handler;
+    }
+
+generic:
+    {
+        r[RIP] = ip->next;
+        executed++;
+        if (ip->opcode->execute(regs, mem, stack, io)) {
+            return executed;
+        }
+        pc = r[RIP];
+        DISPATCH();
+    }
+
+#define X(name, mnemonic, expr) \
+name##_rr: \
+    { \
+        [[maybe_unused]] uint32_t a = r[ip->a]; \
+        uint32_t b = r[ip->b]; \
+        r[ip->a] = expr; \
+        NEXT(); \
+    } \
+name##_ri: \
+    { \
+        [[maybe_unused]] uint32_t a = r[ip->a]; \
+        uint32_t b = ip->b; \
+        r[ip->a] = expr; \
+        NEXT(); \
+    } \
+name##_rrr: \
+    { \
+        [[maybe_unused]] uint32_t a = r[ip->b]; \
+        uint32_t b = r[ip->c]; \
+        r[ip->a] = expr; \
+        NEXT(); \
+    } \
+name##_rri: \
+    { \
+        [[maybe_unused]] uint32_t a = r[ip->b]; \
+        uint32_t b = ip->c; \
+        r[ip->a] = expr; \
+        NEXT(); \
+    }
+    BINARY_OPERATIONS(X)
+#undef X
+
+ldr:
+    r[ip->a] = mem.read_type<uint32_t>(ip->b);
+    NEXT();
+str:
+    mem.write_type<uint32_t>(ip->a, r[ip->b]);
+    NEXT();
+
+#define X(name, mnemonic, expr) \
+name: \
+    { \
+        uint32_t a = r[ip->a]; \
+        r[ip->a] = expr; \
+        NEXT(); \
+    }
+    UNARY_OPERATIONS(X)
+#undef X
+
+printc:
+    io.put_char(r[ip->a]);
+    NEXT();
+print:
+    io.put_uint(r[ip->a]);
+    NEXT();
+readc:
+    r[ip->a] = io.get_char();
+    NEXT();
+read:
+    r[ip->a] = io.get_uint();
+    NEXT();
+
+#define X(name, expr) \
+name##_jr: \
+    { \
+        [[maybe_unused]] uint32_t b = r[ip->b]; \
+        [[maybe_unused]] uint32_t c = r[ip->c]; \
+        executed++; \
+        pc = (expr) ? ip->a : ip->next; \
+        DISPATCH(); \
+    } \
+name##_ji: \
+    { \
+        [[maybe_unused]] uint32_t b = r[ip->b]; \
+        [[maybe_unused]] uint32_t c = ip->c; \
+        executed++; \
+        pc = (expr) ? ip->a : ip->next; \
+        DISPATCH(); \
+    }
+    JUMP_CONDITIONS(X)
+#undef X
+
+exit:
+    r[RIP] = ip->next;
+    executed++;
+    return executed;
+
+#undef NEXT
+#undef DISPATCH
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "opcode.h"
+#include "memory.h"
+#include "icache.h"
+
+/**
+ * An instruction translated for the threaded engine: the address of its handler and pre-resolved operands.
+ */
+struct ThreadedInstruction {
+    const void *handler;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+    uint32_t next;
+    std::shared_ptr<const Opcode> opcode;
+};
+
+/**
+ * Direct-threaded interpreter using computed goto dispatch.
+ * Every arithmetic, I/O and jump opcode has its own handler, picked by opcode number from a table built from
+ * OpcodeSpecs at compile time, anything else runs through Opcode::execute.
+ * Translations are indexed by address, in pages allocated on the first dispatch into them.
+ */
+class ThreadedEngine : public MemoryObserver {
+    struct Page {
+        ThreadedInstruction code[PageSize];
+    };
+
+    Registers &regs;
+    Memory &mem;
+    Memory &stack;
+    InstructionCache &icache;
+    GuestIO &io;
+    PagedTable<Page> pages;
+    const void *untranslated = nullptr;
+    size_t max_instruction_length = 1;
+
+    ThreadedInstruction *page_code(uint32_t address);
+
+    public:
+    ThreadedEngine(Registers &regs, Memory &mem, Memory &stack, InstructionCache &icache, GuestIO &io);
+    ThreadedEngine(const ThreadedEngine &) = delete;
+    ThreadedEngine &operator=(const ThreadedEngine &) = delete;
+    ~ThreadedEngine();
+
+    uint64_t run();
+    void memory_written(size_t address, size_t length);
+};
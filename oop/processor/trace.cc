@@ -0,0 +1,243 @@
+#include "trace.h"
+#include "simd.h"
+#include <csignal>
+#include <unistd.h>
+
+/**
+ * Return which operands of the opcode name the register it writes and the memory it accesses.
+ * Arithmetic and moves write their first operand when it is a register, reads write the register read into,
+ * atomics return the previous value in their second register and mcmp stores its result in the first.
+ * Vector registers and the stack are not traced.
+ * @param[in] opcode
+ */
+TraceOperands trace_operands(const Opcode &opcode) {
+    TraceOperands operands;
+    auto &args = opcode.get_args();
+    for(size_t i = 0; i < args.size(); i++) {
+        if (args[i]->kind() == ArgKind::Address) {
+            operands.address = i;
+            break;
+        }
+    }
+
+    bool arithmetic = dynamic_cast<const UnaryOperationOpcode *>(&opcode) != NULL
+        || dynamic_cast<const BinaryOperationOpcode *>(&opcode) != NULL
+        || dynamic_cast<const ThreeOperandOpcode *>(&opcode) != NULL;
+    auto io = dynamic_cast<const IoOpcode *>(&opcode);
+    auto atomic = dynamic_cast<const AtomicOpcode *>(&opcode);
+    auto bulk = dynamic_cast<const BulkOpcode *>(&opcode);
+    auto vector = dynamic_cast<const VectorOpcode *>(&opcode);
+    if (arithmetic || dynamic_cast<const PopOpcode *>(&opcode) != NULL
+            || (io != NULL && (io->get_operation() == IoOperation::Read || io->get_operation() == IoOperation::ReadChar))
+            || (bulk != NULL && bulk->get_operation() == BulkOperation::Compare)
+            || (vector != NULL && vector->get_operation() == VectorOperation::Sum)) {
+        operands.reg = 0;
+    }
+    if (atomic != NULL) {
+        operands.reg = 1;
+    }
+    if (operands.reg >= 0 && args[operands.reg]->kind() != ArgKind::Reg) {
+        operands.reg = -1;
+    }
+
+    if (atomic != NULL || bulk != NULL || (vector != NULL && vector->get_operation() == VectorOperation::Store)) {
+        operands.address = 0;
+        operands.indirect = true;
+    }
+    if (vector != NULL && vector->get_operation() == VectorOperation::Load) {
+        operands.address = 1;
+        operands.indirect = true;
+    }
+    return operands;
+}
+
+static const TraceBuffer *crash_trace = NULL;
+static int crash_fd = -1;
+
+/**
+ * TraceBuffer constructor
+ * The slot after the last record is the one being filled, so the buffer has one slot more than it keeps records.
+ * @param[in] capacity - number of records kept, rounded up to one less than a power of two.
+ */
+TraceBuffer::TraceBuffer(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity + 1) {
+        size *= 2;
+    }
+    records.resize(size);
+    mask = size - 1;
+}
+
+TraceBuffer::~TraceBuffer() {
+    if (crash_trace == this) {
+        crash_trace = NULL;
+    }
+}
+
+size_t TraceBuffer::get_capacity() const {
+    return records.size() - 1;
+}
+
+/**
+ * Return the number of records committed so far, including the ones overwritten.
+ */
+uint64_t TraceBuffer::get_total() const {
+    return head.load(std::memory_order_acquire);
+}
+
+/**
+ * Return the records kept, oldest first.
+ */
+std::vector<TraceRecord> TraceBuffer::get_records() const {
+    uint64_t total = get_total();
+    uint64_t count = std::min<uint64_t>(total, get_capacity());
+    std::vector<TraceRecord> kept;
+    kept.reserve(count);
+    for(uint64_t i = total - count; i < total; i++) {
+        kept.push_back(records[i & mask]);
+    }
+    return kept;
+}
+
+static bool write_all(int fd, const void *data, size_t length) {
+    const char *bytes = (const char *)data;
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        bytes += written;
+        length -= written;
+    }
+    return true;
+}
+
+/**
+ * Write the records kept in the trace format. Only write is called, so it is safe in a signal handler.
+ * @param[in] fd
+ * @param[out] ok
+ */
+bool TraceBuffer::dump(int fd) const {
+    uint64_t total = get_total();
+    uint64_t count = std::min<uint64_t>(total, get_capacity());
+    TraceHeader header = {};
+    memcpy(header.magic, TraceMagic, sizeof(TraceMagic));
+    header.version = TraceVersion;
+    header.record_size = sizeof(TraceRecord);
+    header.record_count = count;
+    header.total = total;
+    if (!write_all(fd, &header, sizeof(header))) {
+        return false;
+    }
+    /* the kept records wrap around the end of the buffer at most once */
+    uint64_t first = (total - count) & mask;
+    uint64_t tail = std::min<uint64_t>(count, records.size() - first);
+    return write_all(fd, &records[first], tail * sizeof(TraceRecord))
+        && write_all(fd, &records[0], (count - tail) * sizeof(TraceRecord));
+}
+
+static void dump_crash_trace(int signal) {
+    if (crash_trace != NULL) {
+        crash_trace->dump(crash_fd);
+        crash_trace = NULL;
+    }
+    std::signal(signal, SIG_DFL);
+    std::raise(signal);
+}
+
+/**
+ * Dump the trace to the file when the process crashes, on a fatal signal.
+ * @param[in] fd - opened in advance, nothing can be opened safely in a signal handler.
+ */
+void TraceBuffer::dump_on_crash(int fd) const {
+    crash_trace = this;
+    crash_fd = fd;
+    for(int signal: {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT}) {
+        std::signal(signal, dump_crash_trace);
+    }
+}
+
+/**
+ * Read a dumped trace.
+ * @param[in] fname
+ * @param[out] total - number of instructions traced, including those not kept.
+ * @param[out] records
+ */
+std::vector<TraceRecord> read_trace(const char *fname, uint64_t &total) {
+    FILE *f = fopen(fname, "rb");
+    if (f == NULL) {
+        throw std::runtime_error("Could not open file.");
+    }
+    std::unique_ptr<FILE, int (*)(FILE *)> closer(f, fclose);
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, TraceMagic, sizeof(TraceMagic)) != 0) {
+        throw std::runtime_error("Not a trace.");
+    }
+    if (header.version != TraceVersion || header.record_size != sizeof(TraceRecord)) {
+        throw std::runtime_error("Unsupported trace version " + std::to_string(header.version) + ".");
+    }
+    std::vector<TraceRecord> records(header.record_count);
+    if (fread(records.data(), sizeof(TraceRecord), records.size(), f) != records.size()) {
+        throw std::runtime_error("Trace is truncated.");
+    }
+    total = header.total;
+    return records;
+}
+
+/**
+ * Return the instruction of a record, decoded from its operands.
+ * @param[in] record
+ * @param[in] table
+ */
+static std::shared_ptr<Opcode> decode_record(const TraceRecord &record, const OpcodeTable &table) {
+    auto prototype = table.opcodes.find(record.opcode_no);
+    if (prototype == table.opcodes.end()) {
+        throw std::runtime_error("No such opcode " + std::to_string(record.opcode_no) + ".");
+    }
+    Memory m;
+    size_t address = 0;
+    auto &args = prototype->second->get_args();
+    for(size_t i = 0; i < args.size() && i < 3; i++) {
+        m.write_bytes(address, (const uint8_t *)&record.operands[i], args[i]->len());
+        address += args[i]->len();
+    }
+    size_t length;
+    return prototype->second->decode(m, 0, length);
+}
+
+/**
+ * Write the records passing the filter, one line per instruction with its address, its assembly,
+ * the register written and the memory address accessed.
+ * @param[in] out
+ * @param[in] records
+ * @param[in] table
+ * @param[in] filter
+ */
+void write_trace(std::ostream &out, const std::vector<TraceRecord> &records, const OpcodeTable &table, const TraceFilter &filter) {
+    for(auto &record: records) {
+        if (record.rip < filter.from || record.rip > filter.to) {
+            continue;
+        }
+        auto opcode = decode_record(record, table);
+        if (filter.reg >= 0 && record.reg != filter.reg) {
+            bool uses = false;
+            for(auto &arg: opcode->get_args()) {
+                uses |= arg->kind() == ArgKind::Reg && arg->get_raw_value() == (uint32_t)filter.reg;
+            }
+            if (!uses) {
+                continue;
+            }
+        }
+        out << record.rip << ": " << opcode->write_asm();
+        if (record.reg != TraceNoRegister) {
+            out << "  r" << (int)record.reg << " = " << record.value;
+        }
+        if (record.flags & TraceTouchedMemory) {
+            out << "  [" << record.address << "]";
+        }
+        out << "\n";
+    }
+}
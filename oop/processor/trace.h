@@ -0,0 +1,94 @@
+#pragma once
+#include "opcode.h"
+#include <atomic>
+
+/*
+ * Trace layout, all integers little endian:
+ *   TraceHeader
+ *   TraceRecord[record_count], oldest first
+ * Only the last records of a run are kept, total counts all instructions traced.
+ */
+const char TraceMagic[4] = {'K', 'E', 'K', 'T'};
+const uint32_t TraceVersion = 1;
+
+const uint8_t TraceNoRegister = 0xff;
+const uint8_t TraceTouchedMemory = 1;
+
+struct TraceHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t record_count;
+    uint64_t total;
+};
+
+/* one executed instruction */
+struct TraceRecord {
+    uint32_t rip;
+    uint8_t opcode_no;
+    /* register written, TraceNoRegister if none */
+    uint8_t reg;
+    uint8_t flags;
+    uint8_t reserved;
+    /* raw operand values, registers by number */
+    uint32_t operands[3];
+    /* value of the written register after the instruction */
+    uint32_t value;
+    /* memory address accessed, if flags has TraceTouchedMemory */
+    uint32_t address;
+};
+
+/* which operands of an opcode name the written register and the memory accessed, -1 for none */
+struct TraceOperands {
+    int8_t reg = -1;
+    int8_t address = -1;
+    /* the address operand is a register holding the address */
+    bool indirect = false;
+};
+
+TraceOperands trace_operands(const Opcode &opcode);
+
+/**
+ * Fixed size ring buffer of the last instructions of a run, written by the interpreter thread only.
+ * A record is filled in place and published by moving the head, so the buffer can be dumped at any point
+ * without locking, including from a signal handler when the vm crashes.
+ */
+class TraceBuffer {
+    std::vector<TraceRecord> records;
+    uint64_t mask;
+    std::atomic<uint64_t> head {0};
+
+    public:
+    TraceBuffer(size_t capacity);
+    ~TraceBuffer();
+
+    /**
+     * Return the record to fill for the next instruction, it is only kept after commit.
+     */
+    TraceRecord &next() {
+        return records[head.load(std::memory_order_relaxed) & mask];
+    }
+
+    /**
+     * Publish the record returned by next.
+     */
+    void commit() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    size_t get_capacity() const;
+    uint64_t get_total() const;
+    std::vector<TraceRecord> get_records() const;
+    bool dump(int fd) const;
+    void dump_on_crash(int fd) const;
+};
+
+struct TraceFilter {
+    uint32_t from = 0;
+    uint32_t to = UINT32_MAX;
+    /* register written or used as an operand, -1 for all */
+    int reg = -1;
+};
+
+std::vector<TraceRecord> read_trace(const char *fname, uint64_t &total);
+void write_trace(std::ostream &out, const std::vector<TraceRecord> &records, const OpcodeTable &table, const TraceFilter &filter);
@@ -15,21 +15,28 @@ std::string to_lower(std::string s) {
 
 /**
  * Return a go-like pair int, bool, where int is the string converted to int
- * and bool represents if it was successful.
+ * and bool represents if it was successful. Negative numbers wrap around like with %u.
  * @param[in] s
  */
-std::pair<uint32_t, bool> string_to_int(std::string s) {
+std::pair<uint32_t, bool> string_to_int(std::string_view s) {
+    while (!s.empty() && isspace((unsigned char)s.front())) {
+        s.remove_prefix(1);
+    }
+    bool negative = false;
+    if (!s.empty() && (s.front() == '-' || s.front() == '+')) {
+        negative = s.front() == '-';
+        s.remove_prefix(1);
+    }
     uint32_t res;
-    long long read;
-
-    if (sscanf(s.c_str(), "%u%lln", &res, &read) != 1 || read != s.length()) {
+    auto conversion = std::from_chars(s.data(), s.data() + s.size(), res);
+    if (s.empty() || conversion.ec != std::errc() || conversion.ptr != s.data() + s.size()) {
         return std::make_pair(
                 0,
                 false
                 );
     }
     return std::make_pair(
-            res,
+            negative ? 0u - res : res,
             true
             );
 }
@@ -94,8 +101,8 @@ std::vector<std::string> string_split(std::string s, std::string delim) {
     size_t prev_pos = 0;
 
     while ((pos = s.find(delim, prev_pos)) != std::string::npos) {
-        res.push_back(s.substr(prev_pos, pos));
-        prev_pos = pos + 1;
+        res.push_back(s.substr(prev_pos, pos - prev_pos));
+        prev_pos = pos + delim.size();
     }
     res.push_back(s.substr(prev_pos));
 
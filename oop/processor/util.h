@@ -1,10 +1,11 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 std::string to_lower(std::string s);
-std::pair<uint32_t, bool> string_to_int(std::string);
+std::pair<uint32_t, bool> string_to_int(std::string_view s);
 std::string filterwhitespace(std::string s);
 std::vector<std::string> string_split(std::string s, std::string delim);
 std::string lstrip(std::string s);